@@ -0,0 +1,151 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "affinity.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <stdio.h>
+
+int8_t affinity_pin_current_thread(int core)
+{
+    if (core < 0) {
+        fprintf(stderr, "Cannot pin thread to core %d\n", core);
+        return 1;
+    }
+
+#ifdef WIN32
+    if (core >= 64 || SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) == 0) {
+        fprintf(stderr, "Failed pinning thread to core %d\n", core);
+        return 1;
+    }
+    return 0;
+#elif defined(__linux__)
+    if (core >= CPU_SETSIZE) {
+        fprintf(stderr, "Cannot pin thread to core %d\n", core);
+        return 1;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "Failed pinning thread to core %d\n", core);
+        return 1;
+    }
+    return 0;
+#else
+    fprintf(stderr, "Pinning threads is not supported on this platform\n");
+    return 1;
+#endif
+}
+
+#if defined(__linux__) && !defined(WIN32)
+// Parses a sysfs cpu list such as "0-7,16-23"
+static int8_t read_cpulist(const char* path, cpu_set_t* set)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return 1;
+
+    CPU_ZERO(set);
+    int8_t any = 0;
+    int first;
+    while (fscanf(f, "%d", &first) == 1)
+    {
+        int last = first;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &last) != 1)
+                break;
+            c = fgetc(f);
+        }
+
+        for (; first <= last && first < CPU_SETSIZE; first++)
+            CPU_SET(first, set);
+        any = 1;
+
+        if (c != ',')
+            break;
+    }
+
+    fclose(f);
+    return any ? 0 : 1;
+}
+#endif
+
+int affinity_node_cores(int* cores, int max)
+{
+    int count = 0;
+
+#ifdef WIN32
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) == 0)
+        return 0;
+
+    ULONGLONG local = 0;
+    UCHAR node;
+    if (GetNumaProcessorNode((UCHAR)GetCurrentProcessorNumber(), &node))
+        GetNumaNodeProcessorMask(node, &local);
+
+    int pass;
+    int core;
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (core = 0; core < (int)sizeof(DWORD_PTR) * 8 && count < max; core++)
+        {
+            const int allowed = (process_mask >> core) & 1;
+            const int near = (local >> core) & 1;
+            if (allowed && near == (pass == 0))
+                cores[count++] = core;
+        }
+    }
+    return count;
+#elif defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return 0;
+
+    // The node holding the core this thread runs on, none without NUMA in sysfs
+    cpu_set_t local;
+    CPU_ZERO(&local);
+    const int current = sched_getcpu();
+    int node;
+    for (node = 0; current >= 0; node++)
+    {
+        char path[64];
+        cpu_set_t set;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (read_cpulist(path, &set) != 0)
+            break;
+        if (CPU_ISSET(current, &set)) {
+            local = set;
+            break;
+        }
+    }
+
+    int pass;
+    int core;
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (core = 0; core < CPU_SETSIZE && count < max; core++)
+        {
+            const int near = CPU_ISSET(core, &local) != 0;
+            if (CPU_ISSET(core, &allowed) && near == (pass == 0))
+                cores[count++] = core;
+        }
+    }
+    return count;
+#else
+    (void)cores;
+    (void)max;
+    return count;
+#endif
+}
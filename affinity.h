@@ -0,0 +1,16 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stdint.h>
+
+// Restricts the calling thread to one core. Returns 1 where the platform
+// cannot pin threads or the core does not exist, the thread keeps running
+// unpinned either way.
+int8_t affinity_pin_current_thread(int core);
+
+// Up to max cores the calling thread may run on, those sharing its NUMA node
+// first, the rest after. Returns how many were written, 0 where the platform
+// does not say.
+int affinity_node_cores(int* cores, int max);
+
+#endif
@@ -0,0 +1,683 @@
+#include "align.h"
+#include "trace.h"
+
+#include <librealsense2/rsutil.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ALIGN_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// Depth to color skips anything nearer, which no camera measures anyway.
+// It bounds how far a depth row can land from where it lands at infinity.
+#define ALIGN_NEAR_RANGE_M 0.05f
+// Color rows kept between the reach of bands that run at the same time,
+// for rounding and distortion between the sampled depths
+#define ALIGN_BAND_MARGIN 2
+
+#if defined(__GNUC__)
+#define ALIGN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define ALIGN_TARGET_AVX2
+#endif
+
+int8_t align_parse_mode(const char* name, enum AlignMode* mode)
+{
+    if (strcmp(name, "none") == 0) {
+        *mode = ALIGN_NONE;
+    } else if (strcmp(name, "color") == 0) {
+        *mode = ALIGN_DEPTH_TO_COLOR;
+    } else if (strcmp(name, "depth") == 0) {
+        *mode = ALIGN_COLOR_TO_DEPTH;
+    } else {
+        fprintf(stderr, "Unknown alignment %s, expected none, color or depth\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
+const char* align_mode_name(enum AlignMode mode)
+{
+    switch (mode)
+    {
+    case ALIGN_DEPTH_TO_COLOR:
+        return "depth to color";
+    case ALIGN_COLOR_TO_DEPTH:
+        return "color to depth";
+    default:
+        return "none";
+    }
+}
+
+// Distorted color goes through librealsense's own projection, one pixel at a time
+static void project_distorted(const struct Aligner* a, const uint16_t* depth, const float* rx,
+                              const float* ry, const float* rz, float units, float* u, float* v, int count)
+{
+    const float* t = a->depth_to_color.translation;
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        const float z = depth[i] * units;
+        const float point[3] = { z * rx[i] + t[0], z * ry[i] + t[1], z * rz[i] + t[2] };
+        float pixel[2];
+        rs2_project_point_to_pixel(pixel, &a->color_intrin, point);
+        u[i] = pixel[0];
+        v[i] = pixel[1];
+    }
+}
+
+static void project_scalar(const struct Aligner* a, const uint16_t* depth, const float* rx,
+                           const float* ry, const float* rz, float units, float* u, float* v, int count)
+{
+    const float* t = a->depth_to_color.translation;
+    const rs2_intrinsics* c = &a->color_intrin;
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        const float z = depth[i] * units;
+        const float inv = 1.0f / (z * rz[i] + t[2]);
+        u[i] = (z * rx[i] + t[0]) * inv * c->fx + c->ppx;
+        v[i] = (z * ry[i] + t[1]) * inv * c->fy + c->ppy;
+    }
+}
+
+#ifdef ALIGN_X86
+static void project_sse2(const struct Aligner* a, const uint16_t* depth, const float* rx,
+                         const float* ry, const float* rz, float units, float* u, float* v, int count)
+{
+    const float* t = a->depth_to_color.translation;
+    const rs2_intrinsics* c = &a->color_intrin;
+    const __m128 vunits = _mm_set1_ps(units);
+    const __m128 tx = _mm_set1_ps(t[0]);
+    const __m128 ty = _mm_set1_ps(t[1]);
+    const __m128 tz = _mm_set1_ps(t[2]);
+    const __m128 fx = _mm_set1_ps(c->fx);
+    const __m128 fy = _mm_set1_ps(c->fy);
+    const __m128 ppx = _mm_set1_ps(c->ppx);
+    const __m128 ppy = _mm_set1_ps(c->ppy);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i d = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(depth + i)), zero);
+        __m128 z = _mm_mul_ps(_mm_cvtepi32_ps(d), vunits);
+        __m128 x = _mm_add_ps(_mm_mul_ps(z, _mm_loadu_ps(rx + i)), tx);
+        __m128 y = _mm_add_ps(_mm_mul_ps(z, _mm_loadu_ps(ry + i)), ty);
+        __m128 inv = _mm_div_ps(one, _mm_add_ps(_mm_mul_ps(z, _mm_loadu_ps(rz + i)), tz));
+        _mm_storeu_ps(u + i, _mm_add_ps(_mm_mul_ps(_mm_mul_ps(x, inv), fx), ppx));
+        _mm_storeu_ps(v + i, _mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, inv), fy), ppy));
+    }
+
+    project_scalar(a, depth + i, rx + i, ry + i, rz + i, units, u + i, v + i, count - i);
+}
+
+ALIGN_TARGET_AVX2
+static void project_avx2(const struct Aligner* a, const uint16_t* depth, const float* rx,
+                         const float* ry, const float* rz, float units, float* u, float* v, int count)
+{
+    const float* t = a->depth_to_color.translation;
+    const rs2_intrinsics* c = &a->color_intrin;
+    const __m256 vunits = _mm256_set1_ps(units);
+    const __m256 tx = _mm256_set1_ps(t[0]);
+    const __m256 ty = _mm256_set1_ps(t[1]);
+    const __m256 tz = _mm256_set1_ps(t[2]);
+    const __m256 fx = _mm256_set1_ps(c->fx);
+    const __m256 fy = _mm256_set1_ps(c->fy);
+    const __m256 ppx = _mm256_set1_ps(c->ppx);
+    const __m256 ppy = _mm256_set1_ps(c->ppy);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + i)));
+        __m256 z = _mm256_mul_ps(_mm256_cvtepi32_ps(d), vunits);
+        __m256 x = _mm256_add_ps(_mm256_mul_ps(z, _mm256_loadu_ps(rx + i)), tx);
+        __m256 y = _mm256_add_ps(_mm256_mul_ps(z, _mm256_loadu_ps(ry + i)), ty);
+        __m256 inv = _mm256_div_ps(one, _mm256_add_ps(_mm256_mul_ps(z, _mm256_loadu_ps(rz + i)), tz));
+        _mm256_storeu_ps(u + i, _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(x, inv), fx), ppx));
+        _mm256_storeu_ps(v + i, _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(y, inv), fy), ppy));
+    }
+
+    project_scalar(a, depth + i, rx + i, ry + i, rz + i, units, u + i, v + i, count - i);
+}
+#endif
+
+static void free_tables(struct AlignTables* t)
+{
+    if (t == NULL)
+        return;
+
+    free(t->ray_x);
+    free(t->ray_y);
+    free(t->ray_z);
+
+    int i;
+    for (i = 0; i < t->slot_count; i++)
+    {
+        struct AlignSlot* slot = &t->slots[i];
+        free(slot->u0);
+        free(slot->v0);
+        free(slot->u1);
+        free(slot->v1);
+    }
+
+    free(t);
+}
+
+// Color row a ray lands on at depth z, or at infinity for z 0
+static float project_v(const struct Aligner* a, const struct AlignTables* t, int i, float z)
+{
+    const float* tr = a->depth_to_color.translation;
+    const float point[3] = { z > 0.0f ? z * t->ray_x[i] + tr[0] : t->ray_x[i],
+                             z > 0.0f ? z * t->ray_y[i] + tr[1] : t->ray_y[i],
+                             z > 0.0f ? z * t->ray_z[i] + tr[2] : t->ray_z[i] };
+    if (a->color_pinhole)
+        return point[1] / point[2] * a->color_intrin.fy + a->color_intrin.ppy;
+
+    float pixel[2];
+    rs2_project_point_to_pixel(pixel, &a->color_intrin, point);
+    return pixel[1];
+}
+
+// 1 when bands of the same phase reach color rows apart from each other
+static int8_t bands_apart(const int* reach_lo, const int* reach_hi, int height, int band_count)
+{
+    int lo[2 * THREAD_POOL_THREADS_MAX];
+    int hi[2 * THREAD_POOL_THREADS_MAX];
+    int b, j, y;
+    for (b = 0; b < band_count; b++)
+    {
+        lo[b] = 0x7fffffff;
+        hi[b] = -1;
+        for (y = b * height / band_count; y < (b + 1) * height / band_count; y++) {
+            // Rows landing wholly outside the color image write nothing
+            if (reach_lo[y] > reach_hi[y])
+                continue;
+            if (reach_lo[y] < lo[b])
+                lo[b] = reach_lo[y];
+            if (reach_hi[y] > hi[b])
+                hi[b] = reach_hi[y];
+        }
+    }
+
+    for (b = 0; b < band_count; b++)
+    {
+        for (j = b + 2; j < band_count; j += 2) {
+            if (lo[b] <= hi[b] && lo[j] <= hi[j] && hi[b] >= lo[j] - ALIGN_BAND_MARGIN && hi[j] >= lo[b] - ALIGN_BAND_MARGIN)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Every depth row writes color rows from where its pixels land at the near
+// range to where they land at infinity. A pinhole projection moves
+// monotonically between the two, distortion is sampled at doubling depths.
+// Returns the most bands, up to two per thread, whose same phase ones stay apart.
+static int depth_to_color_band_count(const struct Aligner* a, const struct AlignTables* t, int width, int height)
+{
+    const int threads = a->threads != NULL ? a->threads->threads : 1;
+    if (threads <= 1)
+        return 1;
+
+    int* reach_lo = (int*)malloc(height * sizeof(int));
+    int* reach_hi = (int*)malloc(height * sizeof(int));
+    if (reach_lo == NULL || reach_hi == NULL) {
+        // Alignment still works, on one band
+        free(reach_lo);
+        free(reach_hi);
+        return 1;
+    }
+
+    // 0 stands for infinity
+    float depths[16];
+    int depth_count = 0;
+    depths[depth_count++] = 0.0f;
+    depths[depth_count++] = ALIGN_NEAR_RANGE_M;
+    while (a->color_pinhole == 0 && depth_count < 16) {
+        depths[depth_count] = depths[depth_count - 1] * 2.0f;
+        depth_count++;
+    }
+
+    int x, y, d;
+    for (y = 0; y < height; y++)
+    {
+        float lo = 1e30f;
+        float hi = -1e30f;
+        for (x = 0; x < width; x++)
+        {
+            const int top = y * t->ray_stride + x;
+            const int bottom = top + t->ray_stride + 1;
+            for (d = 0; d < depth_count; d++) {
+                const float v0 = project_v(a, t, top, depths[d]);
+                const float v1 = project_v(a, t, bottom, depths[d]);
+                lo = v0 < lo ? v0 : lo;
+                lo = v1 < lo ? v1 : lo;
+                hi = v0 > hi ? v0 : hi;
+                hi = v1 > hi ? v1 : hi;
+            }
+        }
+
+        // Rows outside the color image are never written
+        reach_lo[y] = lo < 0.0f ? 0 : lo > a->color_intrin.height ? a->color_intrin.height : (int)(lo + 0.5f);
+        reach_hi[y] = hi < 0.0f ? -1 : hi >= a->color_intrin.height ? a->color_intrin.height - 1 : (int)(hi + 0.5f);
+    }
+
+    int band_count;
+    for (band_count = 2 * threads; band_count >= 2; band_count -= 2) {
+        if (bands_apart(reach_lo, reach_hi, height, band_count))
+            break;
+    }
+
+    free(reach_lo);
+    free(reach_hi);
+    return band_count >= 2 ? band_count : 1;
+}
+
+// Deprojects every depth pixel once at 1 m and rotates the ray into the color camera
+static struct AlignTables* build_tables(const struct Aligner* a, const rs2_intrinsics* depth_intrin)
+{
+    struct AlignTables* t = (struct AlignTables*)calloc(1, sizeof(struct AlignTables));
+    if (t == NULL) {
+        fprintf(stderr, "Failed allocating alignment tables\n");
+        return NULL;
+    }
+
+    // Depth to color fills the footprint between a pixel's corners, so it needs one more row and column
+    const int corners = a->mode == ALIGN_DEPTH_TO_COLOR ? 1 : 0;
+    const int cols = depth_intrin->width + corners;
+    const int rows = depth_intrin->height + corners;
+    const float offset = corners ? -0.5f : 0.0f;
+
+    t->ray_x = (float*)malloc((size_t)cols * rows * sizeof(float));
+    t->ray_y = (float*)malloc((size_t)cols * rows * sizeof(float));
+    t->ray_z = (float*)malloc((size_t)cols * rows * sizeof(float));
+    if (t->ray_x == NULL || t->ray_y == NULL || t->ray_z == NULL) {
+        fprintf(stderr, "Failed allocating %dx%d alignment table\n", cols, rows);
+        free_tables(t);
+        return NULL;
+    }
+
+    // rs2_extrinsics keeps the rotation column major
+    const float* r = a->depth_to_color.rotation;
+
+    int x, y;
+    for (y = 0; y < rows; y++)
+    {
+        for (x = 0; x < cols; x++)
+        {
+            const float pixel[2] = { x + offset, y + offset };
+            float ray[3];
+            rs2_deproject_pixel_to_point(ray, depth_intrin, pixel, 1.0f);
+
+            const int i = y * cols + x;
+            t->ray_x[i] = r[0] * ray[0] + r[3] * ray[1] + r[6] * ray[2];
+            t->ray_y[i] = r[1] * ray[0] + r[4] * ray[1] + r[7] * ray[2];
+            t->ray_z[i] = r[2] * ray[0] + r[5] * ray[1] + r[8] * ray[2];
+        }
+    }
+
+    t->ray_stride = cols;
+    t->band_count = corners ? depth_to_color_band_count(a, t, depth_intrin->width, depth_intrin->height) : 1;
+
+    t->slot_count = thread_pool_scratch_count(a->threads);
+    int i;
+    for (i = 0; i < t->slot_count; i++)
+    {
+        struct AlignSlot* slot = &t->slots[i];
+        slot->u0 = (float*)malloc(cols * sizeof(float));
+        slot->v0 = (float*)malloc(cols * sizeof(float));
+        slot->u1 = (float*)malloc(cols * sizeof(float));
+        slot->v1 = (float*)malloc(cols * sizeof(float));
+        if (slot->u0 == NULL || slot->v0 == NULL || slot->u1 == NULL || slot->v1 == NULL) {
+            fprintf(stderr, "Failed allocating alignment row buffers\n");
+            free_tables(t);
+            return NULL;
+        }
+    }
+
+    // Only complete tables carry the profile, a failed build is retried on the next frame
+    t->depth_intrin = *depth_intrin;
+    t->refs = 1;
+    return t;
+}
+
+// Drops a reference, the last one frees the tables. Takes a->lock.
+static void release_tables(struct Aligner* a, struct AlignTables* t)
+{
+    SDL_LockMutex(a->lock);
+    const int refs = --t->refs;
+    SDL_UnlockMutex(a->lock);
+
+    if (refs == 0)
+        free_tables(t);
+}
+
+// Replaces the current tables when dep's size differs from their profile. Called with a->lock held.
+static int8_t follow_depth_locked(struct Aligner* a, const struct FrameHandle* dep)
+{
+    if (a->tables != NULL && dep->width == a->tables->depth_intrin.width &&
+        dep->height == a->tables->depth_intrin.height)
+        return 0;
+
+    rs2_intrinsics intrin;
+    if (frame_handle_intrinsics(dep, &intrin) != 0)
+        return 1;
+
+    struct AlignTables* t = build_tables(a, &intrin);
+    if (t == NULL)
+        return 1;
+
+    // Calls still holding the old tables free them when they finish
+    struct AlignTables* old = a->tables;
+    a->tables = t;
+    if (old != NULL && --old->refs == 0)
+        free_tables(old);
+
+    fprintf(stderr, "alignment rebuilt for %dx%d depth\n", intrin.width, intrin.height);
+    return 0;
+}
+
+// Post-processing may hand over decimated depth, whose profile has intrinsics of its own
+int8_t align_follow_depth(struct Aligner* a, const struct FrameHandle* dep)
+{
+    SDL_LockMutex(a->lock);
+    const int8_t ret = follow_depth_locked(a, dep);
+    SDL_UnlockMutex(a->lock);
+    return ret;
+}
+
+static void project_row(const struct Aligner* a, const struct AlignTables* t, const uint16_t* depth, int y,
+                        float units, float* u, float* v, int count)
+{
+    const int row = y * t->ray_stride;
+    a->kernel(a, depth, t->ray_x + row, t->ray_y + row, t->ray_z + row, units, u, v, count);
+}
+
+void align_project_row(const struct Aligner* a, const uint16_t* depth, int y, float units, float* u, float* v, int count)
+{
+    project_row(a, a->tables, depth, y, units, u, v, count);
+}
+
+// What one align_frames call works on, shared by the threads it runs on
+struct AlignCall
+{
+    const struct Aligner* aligner;
+    struct AlignTables* tables;
+    const struct FrameHandle* dep;
+    const struct FrameHandle* col_frame;
+    uint16_t* out_depth;
+    struct RGBA* out_rgba;
+
+    // Depth to color runs every other of band_count bands at a time
+    int band_count;
+    int phase;
+    // Nearer depth is skipped, it could reach past the bands' bounds
+    int depth_min;
+};
+
+static void depth_to_color_row(const struct AlignCall* call, struct AlignSlot* slot, const uint16_t* depth, int y, int w)
+{
+    const struct Aligner* a = call->aligner;
+    const struct AlignTables* t = call->tables;
+    const rs2_intrinsics* c = &a->color_intrin;
+    const float units = call->dep->depth_units;
+    const int top = y * t->ray_stride;
+    const int bottom = top + t->ray_stride + 1;
+
+    a->kernel(a, depth, t->ray_x + top, t->ray_y + top, t->ray_z + top, units, slot->u0, slot->v0, w);
+    a->kernel(a, depth, t->ray_x + bottom, t->ray_y + bottom, t->ray_z + bottom, units, slot->u1, slot->v1, w);
+
+    int x;
+    for (x = 0; x < w; x++)
+    {
+        const uint16_t d = depth[x];
+        if (d < call->depth_min)
+            continue;
+
+        const int x0 = (int)(slot->u0[x] + 0.5f);
+        const int y0 = (int)(slot->v0[x] + 0.5f);
+        const int x1 = (int)(slot->u1[x] + 0.5f);
+        const int y1 = (int)(slot->v1[x] + 0.5f);
+        if (x0 < 0 || y0 < 0 || x1 >= c->width || y1 >= c->height)
+            continue;
+
+        // Where several depth pixels land on one color pixel the nearest wins
+        int cx, cy;
+        for (cy = y0; cy <= y1; cy++)
+        {
+            uint16_t* out = call->out_depth + cy * c->width;
+            for (cx = x0; cx <= x1; cx++) {
+                if (out[cx] == 0 || d < out[cx])
+                    out[cx] = d;
+            }
+        }
+    }
+}
+
+static void color_to_depth_row(const struct AlignCall* call, struct AlignSlot* slot, const uint16_t* depth, int y, int w)
+{
+    const struct Aligner* a = call->aligner;
+    const rs2_intrinsics* c = &a->color_intrin;
+    const struct FrameHandle* col = call->col_frame;
+    const int bytes = col->bpp / 8;
+    const int swap = col->format == RS2_FORMAT_BGRA8;
+    struct RGBA* out = call->out_rgba + y * w;
+
+    project_row(a, call->tables, depth, y, call->dep->depth_units, slot->u0, slot->v0, w);
+
+    int x;
+    for (x = 0; x < w; x++)
+    {
+        const int cx = (int)(slot->u0[x] + 0.5f);
+        const int cy = (int)(slot->v0[x] + 0.5f);
+        if (depth[x] == 0 || cx < 0 || cy < 0 || cx >= c->width || cy >= c->height) {
+            memset(&out[x], 0, sizeof(struct RGBA));
+            continue;
+        }
+
+        const uint8_t* px = (const uint8_t*)col->data + cy * col->stride + cx * bytes;
+        out[x].r = px[swap ? 2 : 0];
+        out[x].g = px[1];
+        out[x].b = px[swap ? 0 : 2];
+        out[x].a = 255;
+    }
+}
+
+// Item k of a phase is band 2k + phase, or the whole frame without phases
+static void depth_to_color_bands(void* ctx, int thread, int begin, int end)
+{
+    const struct AlignCall* call = (const struct AlignCall*)ctx;
+    struct AlignSlot* slot = &call->tables->slots[thread];
+    const struct FrameHandle* dep = call->dep;
+    const int pixel_stride = dep->stride / (int)sizeof(uint16_t);
+    const int phase_count = call->band_count > 1 ? 2 : 1;
+
+    int item;
+    for (item = begin; item < end; item++)
+    {
+        const int band = item * phase_count + call->phase;
+        const int y_end = (band + 1) * dep->height / call->band_count;
+
+        int y;
+        for (y = band * dep->height / call->band_count; y < y_end; y++)
+            depth_to_color_row(call, slot, (const uint16_t*)dep->data + y * pixel_stride, y, dep->width);
+    }
+}
+
+static void color_to_depth_rows(void* ctx, int thread, int y_begin, int y_end)
+{
+    const struct AlignCall* call = (const struct AlignCall*)ctx;
+    struct AlignSlot* slot = &call->tables->slots[thread];
+    const struct FrameHandle* dep = call->dep;
+    const int pixel_stride = dep->stride / (int)sizeof(uint16_t);
+
+    int y;
+    for (y = y_begin; y < y_end; y++)
+        color_to_depth_row(call, slot, (const uint16_t*)dep->data + y * pixel_stride, y, dep->width);
+}
+
+int8_t align_init(struct Aligner* a, enum AlignMode mode, const struct RS_State* rs_state, struct ThreadPool* threads)
+{
+    if (a == NULL || rs_state == NULL) {
+        fprintf(stderr, "Cannot init aligner: given pointer is null\n");
+        return 1;
+    }
+
+    memset(a, 0, sizeof(struct Aligner));
+
+    if (mode == ALIGN_NONE)
+        return 0;
+
+    if (rs_state->has_extrinsics == 0) {
+        fprintf(stderr, "Cannot align without depth to color extrinsics\n");
+        return 1;
+    }
+
+    a->mode = mode;
+    a->color_intrin = rs_state->color.intrinsics;
+    a->depth_to_color = rs_state->depth_to_color;
+    a->threads = threads;
+
+    // Brown-Conrady with all coefficients zero is a pinhole as well
+    int c;
+    a->color_pinhole = a->color_intrin.model != RS2_DISTORTION_FTHETA;
+    for (c = 0; c < 5; c++) {
+        if (a->color_intrin.coeffs[c] != 0.0f)
+            a->color_pinhole = 0;
+    }
+    if (a->color_intrin.model == RS2_DISTORTION_NONE)
+        a->color_pinhole = 1;
+
+    a->kernel = project_scalar;
+    a->kernel_name = "scalar";
+
+    if (a->color_pinhole == 0) {
+        a->kernel = project_distorted;
+        a->kernel_name = "distorted";
+    }
+#ifdef ALIGN_X86
+    else if (SDL_HasAVX2()) {
+        a->kernel = project_avx2;
+        a->kernel_name = "avx2";
+    } else if (SDL_HasSSE2()) {
+        a->kernel = project_sse2;
+        a->kernel_name = "sse2";
+    }
+#endif
+
+    a->lock = SDL_CreateMutex();
+    if (a->lock == NULL) {
+        fprintf(stderr, "Failed creating alignment lock: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    a->tables = build_tables(a, &rs_state->depth.intrinsics);
+    if (a->tables == NULL) {
+        align_free(a);
+        return 1;
+    }
+
+    fprintf(stderr, "aligning %s with %s kernel on %d threads\n", align_mode_name(mode), a->kernel_name,
+            threads != NULL ? threads->threads : 1);
+    return 0;
+}
+
+void align_free(struct Aligner* a)
+{
+    if (a == NULL)
+        return;
+
+    // No call is in flight any more, the current tables hold the last reference
+    free_tables(a->tables);
+    a->tables = NULL;
+
+    if (a->lock) {
+        SDL_DestroyMutex(a->lock);
+        a->lock = NULL;
+    }
+}
+
+void align_output_size(const struct Aligner* a, int depth_w, int depth_h, int* out_w, int* out_h)
+{
+    if (a->mode == ALIGN_DEPTH_TO_COLOR) {
+        *out_w = a->color_intrin.width;
+        *out_h = a->color_intrin.height;
+    } else {
+        *out_w = depth_w;
+        *out_h = depth_h;
+    }
+}
+
+int8_t align_frames(struct Aligner* a, const struct Colorizer* colorizer, const struct FrameHandle* dep,
+                    const struct FrameHandle* col_frame, uint16_t* aligned_depth, struct RGBA* out)
+{
+    if (a->mode == ALIGN_NONE || dep == NULL || dep->data == NULL)
+        return 0;
+
+    Uint64 begin = SDL_GetPerformanceCounter();
+
+    // The lock only covers taking the tables, the rows run unlocked
+    SDL_LockMutex(a->lock);
+    if (follow_depth_locked(a, dep) != 0) {
+        SDL_UnlockMutex(a->lock);
+        return 1;
+    }
+    struct AlignTables* tables = a->tables;
+    tables->refs++;
+    SDL_UnlockMutex(a->lock);
+
+    struct AlignCall call;
+    memset(&call, 0, sizeof(call));
+    call.aligner = a;
+    call.tables = tables;
+    call.dep = dep;
+    call.col_frame = col_frame;
+    call.out_depth = aligned_depth;
+    call.out_rgba = out;
+
+    const int color_pixels = a->color_intrin.width * a->color_intrin.height;
+
+    if (a->mode == ALIGN_DEPTH_TO_COLOR)
+    {
+        memset(aligned_depth, 0, color_pixels * sizeof(uint16_t));
+
+        // Scattered writes from neighbouring bands can meet where the bands
+        // touch, so every other band runs at a time. The tables hold as many
+        // bands as keep those running together from reaching the same rows.
+        call.band_count = tables->band_count;
+        call.depth_min = dep->depth_units > 0.0f ? (int)ceilf(ALIGN_NEAR_RANGE_M / dep->depth_units) : 1;
+        if (call.depth_min < 1)
+            call.depth_min = 1;
+        const int phase_count = call.band_count > 1 ? 2 : 1;
+        const int items = call.band_count / phase_count;
+        for (call.phase = 0; call.phase < phase_count; call.phase++)
+            thread_pool_run(a->threads, items, dep->width * (dep->height / call.band_count), depth_to_color_bands, &call);
+
+        colorize_depth(colorizer, aligned_depth, (uint32_t*)out, color_pixels);
+    }
+    else if (col_frame == NULL || col_frame->data == NULL)
+    {
+        // Nothing to sample from until the first color frame
+        memset(out, 0, dep->width * dep->height * sizeof(struct RGBA));
+    }
+    else
+    {
+        // Every output pixel is written by exactly one band
+        thread_pool_run(a->threads, dep->height, dep->width, color_to_depth_rows, &call);
+    }
+
+    release_tables(a, tables);
+    trace_span(TRACE_ALIGN, TRACE_STREAM_DEPTH, begin, dep->number);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include <librealsense2/rs.h>
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+#include "colorize.h"
+#include "frame_handle.h"
+#include "frames.h"
+#include "rs_state.h"
+#include "thread_pool.h"
+
+enum AlignMode
+{
+    ALIGN_NONE,
+    // Depth reprojected into the color camera, at color resolution
+    ALIGN_DEPTH_TO_COLOR,
+    // Color sampled for every depth pixel, at depth resolution
+    ALIGN_COLOR_TO_DEPTH
+};
+
+struct Aligner;
+
+typedef void (*align_project_kernel)(const struct Aligner* a, const uint16_t* depth, const float* rx,
+                                     const float* ry, const float* rz, float units, float* u, float* v, int count);
+
+// A thread's row buffers for the projected pixel coordinates
+struct AlignSlot
+{
+    float* u0;
+    float* v0;
+    float* u1;
+    float* v1;
+};
+
+// Ray planes and row buffers for one depth profile. A rebuild for another
+// profile replaces them while calls still using the old ones finish.
+struct AlignTables
+{
+    rs2_intrinsics depth_intrin;
+
+    // One entry per pixel corner for depth to color, per pixel center otherwise
+    float* ray_x;
+    float* ray_y;
+    float* ray_z;
+    int ray_stride;
+
+    // Depth to color row bands, as many as keep the color rows that bands
+    // running side by side can write apart, see align.c
+    int band_count;
+
+    // One per thread pool scratch index
+    int slot_count;
+    struct AlignSlot slots[THREAD_POOL_SCRATCH_MAX];
+
+    // Calls using the tables, plus one while the aligner has them current. Guarded by the aligner's lock.
+    int refs;
+};
+
+// Remaps depth and color into each other's camera. Deprojecting a depth pixel
+// only depends on the depth intrinsics and the pixel, so the rays at 1 m are
+// computed once per profile and already rotated into the color camera; per
+// frame a pixel costs a multiply-add per axis and a perspective divide.
+struct Aligner
+{
+    enum AlignMode mode;
+    rs2_intrinsics color_intrin;
+    rs2_extrinsics depth_to_color;
+    // Undistorted color projects with the vectorized pinhole kernel
+    int8_t color_pinhole;
+
+    align_project_kernel kernel;
+    const char* kernel_name;
+
+    // Each call spreads its rows over these, shared with the other conversions
+    struct ThreadPool* threads;
+
+    // Only taken to swap tables, calls from several threads run side by side
+    SDL_mutex* lock;
+    struct AlignTables* tables;
+};
+
+int8_t align_parse_mode(const char* name, enum AlignMode* mode);
+const char* align_mode_name(enum AlignMode mode);
+
+// Builds the ray table for the streams rs_state resolved. threads may be
+// NULL to align on the calling thread.
+int8_t align_init(struct Aligner* a, enum AlignMode mode, const struct RS_State* rs_state, struct ThreadPool* threads);
+void align_free(struct Aligner* a);
+
+// Size of what align_frames produces for a depth frame of the given size
+void align_output_size(const struct Aligner* a, int depth_w, int depth_h, int* out_w, int* out_h);
+
+// Rebuilds the tables when dep's size differs from the profile they were built for
+int8_t align_follow_depth(struct Aligner* a, const struct FrameHandle* dep);
+
+// Color pixel coordinates of one row of depth pixels. Only meaningful for
+// color to depth, whose table holds a ray per pixel center. Reads the current
+// tables unguarded, so only for an aligner nobody else rebuilds meanwhile.
+void align_project_row(const struct Aligner* a, const uint16_t* depth, int y, float units, float* u, float* v, int count);
+
+// Writes the aligned view of dep and col_frame to out as RGBA. Depth to color
+// reprojects into aligned_depth, sized for the color stream, then colorizes it.
+int8_t align_frames(struct Aligner* a, const struct Colorizer* colorizer, const struct FrameHandle* dep,
+                    const struct FrameHandle* col_frame, uint16_t* aligned_depth, struct RGBA* out);
+
+#endif
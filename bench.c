@@ -0,0 +1,201 @@
+#define SDL_MAIN_HANDLED
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "colorize.h"
+#include "rgb_expand.h"
+#include "thread_pool.h"
+
+// Microbenchmark for the per-frame pixel conversions, runs without a camera
+
+const int cBenchDepthW = 1280;
+const int cBenchDepthH = 720;
+const int cBenchColorW = 1920;
+const int cBenchColorH = 1080;
+
+#define BENCH_WARMUP 10
+#define BENCH_ITERATIONS 200
+
+// Row thread counts the scaling runs go through
+static const int cBenchThreads[] = { 1, 2, 4, 8 };
+#define BENCH_THREAD_RUNS (int)(sizeof(cBenchThreads) / sizeof(cBenchThreads[0]))
+
+// The per-byte loop update() used before the SIMD kernels, kept as the baseline
+static void rgb_expand_reference(const uint8_t* src, uint8_t* dst, int w, int h)
+{
+    int x, y;
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            dst[4 * (y * w + x) + 0] = src[3 * (y * w + x) + 0];
+            dst[4 * (y * w + x) + 1] = src[3 * (y * w + x) + 1];
+            dst[4 * (y * w + x) + 2] = src[3 * (y * w + x) + 2];
+            dst[4 * (y * w + x) + 3] = 255;
+        }
+    }
+}
+
+static double ms_since(Uint64 start)
+{
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static void report(const char* name, double total_ms, int pixels)
+{
+    double per_frame = total_ms / BENCH_ITERATIONS;
+    fprintf(stdout, "%-28s %8.3f ms/frame %8.1f Mpix/s\n", name, per_frame,
+            pixels / (per_frame * 1000.0));
+}
+
+// Per-frame colorize and RGB expansion split into row bands, against one thread
+static void bench_scaling(const struct Colorizer* colorizer, const struct Colorizer* adaptive,
+                          const struct RgbExpander* expander, const uint16_t* dep, uint32_t* dep_rgb,
+                          const uint8_t* rgb, uint32_t* col)
+{
+    double dep_base = 0.0;
+    double adaptive_base = 0.0;
+    double col_base = 0.0;
+    int run;
+    for (run = 0; run < BENCH_THREAD_RUNS; run++)
+    {
+        struct ThreadPool pool;
+        if (thread_pool_init(&pool, cBenchThreads[run], 1) != 0)
+            return;
+
+        Uint64 start;
+        int it;
+        char name[64];
+
+        for (it = 0; it < BENCH_WARMUP; it++)
+            colorize_image(colorizer, &pool, dep, cBenchDepthW * 2, dep_rgb, cBenchDepthW * 4, cBenchDepthW, cBenchDepthH);
+        start = SDL_GetPerformanceCounter();
+        for (it = 0; it < BENCH_ITERATIONS; it++)
+            colorize_image(colorizer, &pool, dep, cBenchDepthW * 2, dep_rgb, cBenchDepthW * 4, cBenchDepthW, cBenchDepthH);
+        const double dep_ms = ms_since(start);
+
+        for (it = 0; it < BENCH_WARMUP; it++)
+            colorize_image(adaptive, &pool, dep, cBenchDepthW * 2, dep_rgb, cBenchDepthW * 4, cBenchDepthW, cBenchDepthH);
+        start = SDL_GetPerformanceCounter();
+        for (it = 0; it < BENCH_ITERATIONS; it++)
+            colorize_image(adaptive, &pool, dep, cBenchDepthW * 2, dep_rgb, cBenchDepthW * 4, cBenchDepthW, cBenchDepthH);
+        const double adaptive_ms = ms_since(start);
+
+        for (it = 0; it < BENCH_WARMUP; it++)
+            rgb_expand_image(expander, &pool, rgb, cBenchColorW * 3, col, cBenchColorW * 4, cBenchColorW, cBenchColorH);
+        start = SDL_GetPerformanceCounter();
+        for (it = 0; it < BENCH_ITERATIONS; it++)
+            rgb_expand_image(expander, &pool, rgb, cBenchColorW * 3, col, cBenchColorW * 4, cBenchColorW, cBenchColorH);
+        const double col_ms = ms_since(start);
+
+        if (run == 0) {
+            dep_base = dep_ms;
+            adaptive_base = adaptive_ms;
+            col_base = col_ms;
+        }
+
+        snprintf(name, sizeof(name), "depth colorize x%d", pool.threads);
+        report(name, dep_ms, cBenchDepthW * cBenchDepthH);
+        snprintf(name, sizeof(name), "depth percentile x%d", pool.threads);
+        report(name, adaptive_ms, cBenchDepthW * cBenchDepthH);
+        snprintf(name, sizeof(name), "rgb8 expand x%d", pool.threads);
+        report(name, col_ms, cBenchColorW * cBenchColorH);
+        fprintf(stdout, "%-28s %8.2f depth %8.2f percentile %8.2f color\n", "  speedup", dep_base / dep_ms,
+                adaptive_base / adaptive_ms, col_base / col_ms);
+
+        thread_pool_free(&pool);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    SDL_SetMainReady();
+
+    const int dep_pixels = cBenchDepthW * cBenchDepthH;
+    const int col_pixels = cBenchColorW * cBenchColorH;
+
+    uint16_t* dep = (uint16_t*)malloc(dep_pixels * sizeof(uint16_t));
+    uint32_t* dep_rgb = (uint32_t*)malloc(dep_pixels * sizeof(uint32_t));
+    uint8_t* rgb = (uint8_t*)malloc(col_pixels * 3);
+    uint32_t* rgba_frame = (uint32_t*)malloc(col_pixels * sizeof(uint32_t));
+    uint32_t* col = (uint32_t*)malloc(col_pixels * sizeof(uint32_t));
+
+    if (dep == NULL || dep_rgb == NULL || rgb == NULL || rgba_frame == NULL || col == NULL) {
+        fprintf(stderr, "Failed allocating benchmark buffers\n");
+        return 1;
+    }
+
+    int i;
+    for (i = 0; i < dep_pixels; i++)
+        dep[i] = (uint16_t)((i * 7) % 12000);
+    for (i = 0; i < col_pixels * 3; i++)
+        rgb[i] = (uint8_t)(i * 13);
+
+    struct Colorizer colorizer;
+    struct RgbExpander expander;
+    if (colorize_init(&colorizer, COLORIZE_DEFAULT_MAX_DEPTH) != 0)
+        return 1;
+    if (rgb_expand_init(&expander) != 0)
+        return 1;
+
+    // Same table lookups, plus binning every frame into the running histogram
+    struct Colorizer adaptive;
+    if (colorize_init(&adaptive, COLORIZE_DEFAULT_MAX_DEPTH) != 0 || colorize_set_mode(&adaptive, COLORIZE_PERCENTILE) != 0)
+        return 1;
+
+    // What an RGBA8 stream would deliver, used for the zero-conversion path
+    rgb_expand(&expander, rgb, rgba_frame, col_pixels);
+
+    Uint64 start;
+    int it;
+
+    for (it = 0; it < BENCH_WARMUP; it++)
+        colorize_depth(&colorizer, dep, dep_rgb, dep_pixels);
+    start = SDL_GetPerformanceCounter();
+    for (it = 0; it < BENCH_ITERATIONS; it++)
+        colorize_depth(&colorizer, dep, dep_rgb, dep_pixels);
+    report("depth colorize", ms_since(start), dep_pixels);
+
+    for (it = 0; it < BENCH_WARMUP; it++)
+        rgb_expand_reference(rgb, (uint8_t*)col, cBenchColorW, cBenchColorH);
+    start = SDL_GetPerformanceCounter();
+    for (it = 0; it < BENCH_ITERATIONS; it++)
+        rgb_expand_reference(rgb, (uint8_t*)col, cBenchColorW, cBenchColorH);
+    report("rgb8 expand (reference)", ms_since(start), col_pixels);
+
+    for (it = 0; it < BENCH_WARMUP; it++)
+        rgb_expand(&expander, rgb, col, col_pixels);
+    start = SDL_GetPerformanceCounter();
+    for (it = 0; it < BENCH_ITERATIONS; it++)
+        rgb_expand(&expander, rgb, col, col_pixels);
+    report("rgb8 expand (simd)", ms_since(start), col_pixels);
+
+    for (it = 0; it < BENCH_WARMUP; it++)
+        memcpy(col, rgba_frame, col_pixels * sizeof(uint32_t));
+    start = SDL_GetPerformanceCounter();
+    for (it = 0; it < BENCH_ITERATIONS; it++)
+        memcpy(col, rgba_frame, col_pixels * sizeof(uint32_t));
+    report("rgba8 direct (copy)", ms_since(start), col_pixels);
+
+    bench_scaling(&colorizer, &adaptive, &expander, dep, dep_rgb, rgb, col);
+
+    fprintf(stdout, "depth kernel: %s, rgb kernel: %s\n", colorizer.kernel_name, expander.kernel_name);
+
+    colorize_print_stats(&adaptive);
+    colorize_free(&colorizer);
+    colorize_free(&adaptive);
+    free(dep);
+    free(dep_rgb);
+    free(rgb);
+    free(rgba_frame);
+    free(col);
+    return 0;
+}
@@ -0,0 +1,554 @@
+#include "colorize.h"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define COLORIZE_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// GCC and clang only emit AVX2 instructions in functions that ask for them,
+// MSVC allows the intrinsics anywhere
+#if defined(__GNUC__)
+#define COLORIZE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define COLORIZE_TARGET_AVX2
+#endif
+
+static uint32_t pack_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    // Byte order in memory is r, g, b, a to match struct RGBA
+    uint8_t bytes[4] = { r, g, b, a };
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+static void colorize_scalar(const uint32_t* lut, const uint16_t* src, uint32_t* dst, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        dst[i] = lut[src[i]];
+}
+
+#ifdef COLORIZE_X86
+static void colorize_sse2(const uint32_t* lut, const uint16_t* src, uint32_t* dst, int count)
+{
+    int i = 0;
+
+    // SSE2 has no gather, but the table fits in L2 and the lookups are
+    // independent, so do eight of them per iteration and store 128 bits at a time
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_set_epi32(lut[_mm_extract_epi16(d, 3)], lut[_mm_extract_epi16(d, 2)],
+                                   lut[_mm_extract_epi16(d, 1)], lut[_mm_extract_epi16(d, 0)]);
+        __m128i hi = _mm_set_epi32(lut[_mm_extract_epi16(d, 7)], lut[_mm_extract_epi16(d, 6)],
+                                   lut[_mm_extract_epi16(d, 5)], lut[_mm_extract_epi16(d, 4)]);
+        _mm_storeu_si128((__m128i*)(dst + i), lo);
+        _mm_storeu_si128((__m128i*)(dst + i + 4), hi);
+    }
+
+    colorize_scalar(lut, src + i, dst + i, count - i);
+}
+
+COLORIZE_TARGET_AVX2
+static void colorize_avx2(const uint32_t* lut, const uint16_t* src, uint32_t* dst, int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d));
+        __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)lut, lo, 4));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_i32gather_epi32((const int*)lut, hi, 4));
+    }
+
+    colorize_scalar(lut, src + i, dst + i, count - i);
+}
+#endif
+
+static void hist_scalar(const uint16_t* src, int count, uint32_t* lanes)
+{
+    uint32_t* h0 = lanes;
+    uint32_t* h1 = lanes + COLORIZE_HIST_BINS;
+    uint32_t* h2 = lanes + 2 * COLORIZE_HIST_BINS;
+    uint32_t* h3 = lanes + 3 * COLORIZE_HIST_BINS;
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        h0[src[i] >> COLORIZE_HIST_SHIFT]++;
+        h1[src[i + 1] >> COLORIZE_HIST_SHIFT]++;
+        h2[src[i + 2] >> COLORIZE_HIST_SHIFT]++;
+        h3[src[i + 3] >> COLORIZE_HIST_SHIFT]++;
+    }
+    for (; i < count; i++)
+        h0[src[i] >> COLORIZE_HIST_SHIFT]++;
+}
+
+#ifdef COLORIZE_X86
+// Smooth surfaces put long runs of pixels into one bin, where the lanes would
+// still queue up behind each other's increment. A vector of pixels that all
+// share a bin is counted with one add; anything else is binned by
+// hist_scalar, so on noisy depth these are no faster than it.
+static void hist_runs_sse2(const uint16_t* src, int count, uint32_t* lanes)
+{
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i bins = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(src + i)), COLORIZE_HIST_SHIFT);
+        const int first = src[i] >> COLORIZE_HIST_SHIFT;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(bins, _mm_set1_epi16((short)first))) == 0xFFFF)
+            lanes[first] += 8;
+        else
+            hist_scalar(src + i, 8, lanes);
+    }
+
+    hist_scalar(src + i, count - i, lanes);
+}
+
+COLORIZE_TARGET_AVX2
+static void hist_runs_avx2(const uint16_t* src, int count, uint32_t* lanes)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i bins = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i*)(src + i)), COLORIZE_HIST_SHIFT);
+        const int first = src[i] >> COLORIZE_HIST_SHIFT;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(bins, _mm256_set1_epi16((short)first))) == -1)
+            lanes[first] += 16;
+        else
+            hist_scalar(src + i, 16, lanes);
+    }
+
+    hist_scalar(src + i, count - i, lanes);
+}
+#endif
+
+// Polynomial fit of Google's Turbo colormap, t in [0, 1] from blue to red
+static uint32_t turbo(double t)
+{
+    const double t2 = t * t;
+    const double t3 = t2 * t;
+    const double t4 = t3 * t;
+    const double t5 = t4 * t;
+    double rgb[3] = {
+        0.13572138 + 4.61539260 * t - 42.66032258 * t2 + 132.13108234 * t3 - 152.94239396 * t4 + 59.28637943 * t5,
+        0.09140261 + 2.19418839 * t + 4.84296658 * t2 - 14.18503333 * t3 + 4.27729857 * t4 + 2.82956604 * t5,
+        0.10667330 + 12.64194608 * t - 60.58204836 * t2 + 110.36276771 * t3 - 89.90310912 * t4 + 27.34824973 * t5
+    };
+
+    uint8_t bytes[3];
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        double v = rgb[i] < 0.0 ? 0.0 : rgb[i] > 1.0 ? 1.0 : rgb[i];
+        bytes[i] = (uint8_t)(v * 255.0 + 0.5);
+    }
+
+    return pack_rgba(bytes[0], bytes[1], bytes[2], 255);
+}
+
+// Pins the table published last until release_lut, returns its index or -1 for the fixed ramp
+static int acquire_lut(const struct Colorizer* c, const uint32_t** lut)
+{
+    struct ColorizeAdaptive* a = c->adaptive;
+    if (a == NULL) {
+        *lut = c->lut;
+        return -1;
+    }
+
+    // A table retired before the pin took hold may be rebuilt any moment, so try again
+    for (;;)
+    {
+        const int index = SDL_AtomicGet(&a->active);
+        SDL_AtomicAdd(&a->readers[index], 1);
+        if (SDL_AtomicGet(&a->active) == index) {
+            *lut = a->luts[index];
+            return index;
+        }
+        SDL_AtomicAdd(&a->readers[index], -1);
+    }
+}
+
+static void release_lut(const struct Colorizer* c, int index)
+{
+    if (index >= 0)
+        SDL_AtomicAdd(&c->adaptive->readers[index], -1);
+}
+
+static void build_lut(const struct ColorizeAdaptive* a, uint32_t* lut)
+{
+    // No depth stays black whatever the map says
+    lut[0] = pack_rgba(0, 0, 0, 255);
+
+    uint32_t d;
+    for (d = 1; d < COLORIZE_LUT_SIZE; d++)
+        lut[d] = a->palette[a->map[d >> COLORIZE_HIST_SHIFT]];
+}
+
+// Fills map from the running histogram, whose bin 0 holds no valid depth
+static void adaptive_map(const struct ColorizeAdaptive* a, uint64_t total, uint8_t* map)
+{
+    uint64_t cum = 0;
+    int b;
+
+    map[0] = 0;
+
+    if (a->mode == COLORIZE_EQUALIZE)
+    {
+        for (b = 1; b < COLORIZE_HIST_BINS; b++) {
+            cum += a->running[b];
+            map[b] = (uint8_t)(cum * (COLORIZE_PALETTE_SIZE - 1) / total);
+        }
+        return;
+    }
+
+    const uint64_t low = total * COLORIZE_PERCENTILE_LOW / 100;
+    const uint64_t high = total * COLORIZE_PERCENTILE_HIGH / 100;
+    int lo = 0;
+    int hi = COLORIZE_HIST_BINS - 1;
+    for (b = 1; b < COLORIZE_HIST_BINS; b++)
+    {
+        cum += a->running[b];
+        if (lo == 0 && cum > low)
+            lo = b;
+        if (cum >= high) {
+            hi = b;
+            break;
+        }
+    }
+
+    const int span = hi > lo ? hi - lo : 1;
+    for (b = 1; b < COLORIZE_HIST_BINS; b++)
+    {
+        if (b <= lo)
+            map[b] = 0;
+        else if (b >= hi)
+            map[b] = COLORIZE_PALETTE_SIZE - 1;
+        else
+            map[b] = (uint8_t)((b - lo) * (COLORIZE_PALETTE_SIZE - 1) / span);
+    }
+}
+
+// Folds the sub-histograms of the frame just binned into the running one and
+// republishes the table when the mapping moved far enough to be seen
+static void adaptive_update(struct ColorizeAdaptive* a)
+{
+    int b;
+    for (b = 0; b < COLORIZE_HIST_BINS; b++)
+        a->running[b] -= a->running[b] >> COLORIZE_HIST_DECAY_SHIFT;
+
+    int t;
+    for (t = 0; t < THREAD_POOL_SCRATCH_MAX; t++)
+    {
+        if (a->thread_used[t] == 0)
+            continue;
+
+        uint32_t* lanes = a->sub_hists + (size_t)t * COLORIZE_HIST_LANES * COLORIZE_HIST_BINS;
+        int l;
+        for (l = 0; l < COLORIZE_HIST_LANES; l++) {
+            for (b = 0; b < COLORIZE_HIST_BINS; b++)
+                a->running[b] += lanes[l * COLORIZE_HIST_BINS + b];
+        }
+
+        memset(lanes, 0, COLORIZE_HIST_LANES * COLORIZE_HIST_BINS * sizeof(uint32_t));
+        a->thread_used[t] = 0;
+    }
+
+    a->running[0] = 0;
+
+    uint64_t total = 0;
+    for (b = 1; b < COLORIZE_HIST_BINS; b++)
+        total += a->running[b];
+    if (total == 0)
+        return;
+
+    uint8_t map[COLORIZE_HIST_BINS];
+    adaptive_map(a, total, map);
+
+    int moved = 0;
+    for (b = 0; b < COLORIZE_HIST_BINS; b++)
+    {
+        int diff = map[b] > a->map[b] ? map[b] - a->map[b] : a->map[b] - map[b];
+        if (diff > moved)
+            moved = diff;
+    }
+    if (moved < COLORIZE_REBUILD_STEPS)
+        return;
+
+    // A frame still on the other table keeps it, the next binned frame tries again
+    const int next = 1 - SDL_AtomicGet(&a->active);
+    if (SDL_AtomicGet(&a->readers[next]) != 0) {
+        a->rebuilds_deferred++;
+        return;
+    }
+
+    memcpy(a->map, map, sizeof(map));
+    build_lut(a, a->luts[next]);
+    SDL_AtomicSet(&a->active, next);
+    a->rebuilds++;
+}
+
+static void free_adaptive(struct ColorizeAdaptive* a)
+{
+    if (a == NULL)
+        return;
+
+    if (a->lock)
+        SDL_DestroyMutex(a->lock);
+    free(a->luts[0]);
+    free(a->luts[1]);
+    free(a->sub_hists);
+    free(a->running);
+    free(a);
+}
+
+int8_t colorize_init(struct Colorizer* c, uint16_t max_depth)
+{
+    if (c == NULL) {
+        fprintf(stderr, "Cannot init colorizer: given pointer is null\n");
+        return 1;
+    }
+
+    memset(c, 0, sizeof(struct Colorizer));
+
+    c->lut = (uint32_t*)malloc(COLORIZE_LUT_SIZE * sizeof(uint32_t));
+    if (c->lut == NULL) {
+        fprintf(stderr, "Failed allocating colorizer table\n");
+        return 1;
+    }
+
+    colorize_set_range(c, max_depth);
+
+    c->kernel = colorize_scalar;
+    c->kernel_name = "scalar";
+
+#ifdef COLORIZE_X86
+    if (SDL_HasAVX2()) {
+        c->kernel = colorize_avx2;
+        c->kernel_name = "avx2";
+    } else if (SDL_HasSSE2()) {
+        c->kernel = colorize_sse2;
+        c->kernel_name = "sse2";
+    }
+#endif
+
+    fprintf(stderr, "depth colorizer using %s kernel\n", c->kernel_name);
+
+    return 0;
+}
+
+void colorize_free(struct Colorizer* c)
+{
+    if (c == NULL)
+        return;
+
+    free_adaptive(c->adaptive);
+    free(c->lut);
+    memset(c, 0, sizeof(struct Colorizer));
+}
+
+void colorize_set_range(struct Colorizer* c, uint16_t max_depth)
+{
+    uint32_t d;
+
+    if (max_depth == 0)
+        max_depth = 1;
+
+    for (d = 0; d < COLORIZE_LUT_SIZE; d++)
+    {
+        uint32_t v = d >= max_depth ? 255 : d * 255 / max_depth;
+        c->lut[d] = pack_rgba((uint8_t)v, (uint8_t)v, (uint8_t)v, 255);
+    }
+}
+
+int8_t colorize_parse_mode(const char* name, enum ColorizeMode* mode)
+{
+    if (strcmp(name, "linear") == 0)
+        *mode = COLORIZE_LINEAR;
+    else if (strcmp(name, "percentile") == 0)
+        *mode = COLORIZE_PERCENTILE;
+    else if (strcmp(name, "equalize") == 0)
+        *mode = COLORIZE_EQUALIZE;
+    else {
+        fprintf(stderr, "Unknown colormap %s, expected linear, percentile or equalize\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
+const char* colorize_mode_name(enum ColorizeMode mode)
+{
+    switch (mode)
+    {
+    case COLORIZE_PERCENTILE:
+        return "percentile";
+    case COLORIZE_EQUALIZE:
+        return "equalize";
+    default:
+        return "linear";
+    }
+}
+
+int8_t colorize_set_mode(struct Colorizer* c, enum ColorizeMode mode)
+{
+    if (mode == COLORIZE_LINEAR) {
+        free_adaptive(c->adaptive);
+        c->adaptive = NULL;
+        return 0;
+    }
+
+    if (c->adaptive != NULL) {
+        c->adaptive->mode = mode;
+        return 0;
+    }
+
+    struct ColorizeAdaptive* a = (struct ColorizeAdaptive*)calloc(1, sizeof(struct ColorizeAdaptive));
+    if (a == NULL) {
+        fprintf(stderr, "Failed allocating adaptive colormap\n");
+        return 1;
+    }
+
+    a->mode = mode;
+    a->lock = SDL_CreateMutex();
+    a->luts[0] = (uint32_t*)malloc(COLORIZE_LUT_SIZE * sizeof(uint32_t));
+    a->luts[1] = (uint32_t*)malloc(COLORIZE_LUT_SIZE * sizeof(uint32_t));
+    a->sub_hists = (uint32_t*)calloc((size_t)THREAD_POOL_SCRATCH_MAX * COLORIZE_HIST_LANES * COLORIZE_HIST_BINS,
+                                     sizeof(uint32_t));
+    a->running = (uint32_t*)calloc(COLORIZE_HIST_BINS, sizeof(uint32_t));
+    if (a->lock == NULL || a->luts[0] == NULL || a->luts[1] == NULL || a->sub_hists == NULL || a->running == NULL) {
+        fprintf(stderr, "Failed allocating adaptive colormap\n");
+        free_adaptive(a);
+        return 1;
+    }
+
+    int i;
+    for (i = 0; i < COLORIZE_PALETTE_SIZE; i++)
+        a->palette[i] = turbo((double)i / (COLORIZE_PALETTE_SIZE - 1));
+
+    // Until the first frame is binned, the default range
+    int b;
+    for (b = 0; b < COLORIZE_HIST_BINS; b++)
+    {
+        uint32_t v = (uint32_t)(b << COLORIZE_HIST_SHIFT) * (COLORIZE_PALETTE_SIZE - 1) / COLORIZE_DEFAULT_MAX_DEPTH;
+        a->map[b] = (uint8_t)(v > COLORIZE_PALETTE_SIZE - 1 ? COLORIZE_PALETTE_SIZE - 1 : v);
+    }
+    build_lut(a, a->luts[0]);
+
+    a->hist_kernel = hist_scalar;
+#ifdef COLORIZE_X86
+    if (SDL_HasAVX2())
+        a->hist_kernel = hist_runs_avx2;
+    else if (SDL_HasSSE2())
+        a->hist_kernel = hist_runs_sse2;
+#endif
+
+    c->adaptive = a;
+    return 0;
+}
+
+void colorize_depth(const struct Colorizer* c, const uint16_t* src, uint32_t* dst, int count)
+{
+    const uint32_t* lut;
+    const int index = acquire_lut(c, &lut);
+    c->kernel(lut, src, dst, count);
+    release_lut(c, index);
+}
+
+struct ColorizeImage
+{
+    const struct Colorizer* c;
+    // Pinned once for the whole frame, so every row uses the same table
+    const uint32_t* lut;
+    const uint8_t* src;
+    int src_stride;
+    uint8_t* dst;
+    int dst_pitch;
+    int width;
+    // The histogram this frame is binned into, NULL to only colorize
+    struct ColorizeAdaptive* binning;
+};
+
+static void colorize_band(void* ctx, int thread, int y_begin, int y_end)
+{
+    const struct ColorizeImage* img = (const struct ColorizeImage*)ctx;
+    const uint8_t* src = img->src + (size_t)y_begin * img->src_stride;
+    uint8_t* dst = img->dst + (size_t)y_begin * img->dst_pitch;
+
+    uint32_t* lanes = NULL;
+    if (img->binning != NULL) {
+        lanes = img->binning->sub_hists + (size_t)thread * COLORIZE_HIST_LANES * COLORIZE_HIST_BINS;
+        img->binning->thread_used[thread] = 1;
+    }
+
+    // Packed rows on both sides go in one call
+    if (img->src_stride == img->width * 2 && img->dst_pitch == img->width * 4) {
+        const int count = img->width * (y_end - y_begin);
+        img->c->kernel(img->lut, (const uint16_t*)src, (uint32_t*)dst, count);
+        if (lanes != NULL)
+            img->binning->hist_kernel((const uint16_t*)src, count, lanes);
+        return;
+    }
+
+    int y;
+    for (y = y_begin; y < y_end; y++)
+    {
+        img->c->kernel(img->lut, (const uint16_t*)src, (uint32_t*)dst, img->width);
+        if (lanes != NULL)
+            img->binning->hist_kernel((const uint16_t*)src, img->width, lanes);
+        src += img->src_stride;
+        dst += img->dst_pitch;
+    }
+}
+
+void colorize_image(const struct Colorizer* c, struct ThreadPool* threads, const uint16_t* src, int src_stride,
+                    uint32_t* dst, int dst_pitch, int width, int height)
+{
+    struct ColorizeAdaptive* a = c->adaptive;
+
+    // One frame at a time feeds the histogram, concurrent ones are only colorized
+    struct ColorizeAdaptive* binning = NULL;
+    if (a != NULL && SDL_TryLockMutex(a->lock) == 0)
+        binning = a;
+    else if (a != NULL)
+        SDL_AtomicAdd(&a->frames_skipped, 1);
+
+    struct ColorizeImage img = { c, NULL, (const uint8_t*)src, src_stride, (uint8_t*)dst, dst_pitch, width, binning };
+    const int lut_index = acquire_lut(c, &img.lut);
+    thread_pool_run(threads, height, width, colorize_band, &img);
+    release_lut(c, lut_index);
+
+    if (binning != NULL) {
+        adaptive_update(a);
+        a->frames_binned++;
+        SDL_UnlockMutex(a->lock);
+    }
+}
+
+void colorize_print_stats(const struct Colorizer* c)
+{
+    const struct ColorizeAdaptive* a = c->adaptive;
+    if (a == NULL) {
+        fprintf(stderr, "colormap: linear\n");
+        return;
+    }
+
+    fprintf(stderr, "colormap: %s, %d frames binned, %d colorized while another was binned, %d table rebuilds, "
+            "%d put off while in use\n", colorize_mode_name(a->mode), a->frames_binned,
+            SDL_AtomicGet((SDL_atomic_t*)&a->frames_skipped), a->rebuilds, a->rebuilds_deferred);
+}
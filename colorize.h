@@ -0,0 +1,119 @@
+#ifndef COLORIZE_H
+#define COLORIZE_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+#include "thread_pool.h"
+
+// One entry per possible Z16 value
+#define COLORIZE_LUT_SIZE 65536
+
+// Default upper end of the depth visualization range, in depth units
+#define COLORIZE_DEFAULT_MAX_DEPTH 10000
+
+// The adaptive maps work on bins of 16 depth units
+#define COLORIZE_HIST_SHIFT 4
+#define COLORIZE_HIST_BINS (COLORIZE_LUT_SIZE >> COLORIZE_HIST_SHIFT)
+// Interleaved copies per thread, so neighbouring pixels of equal depth do not
+// wait on each other's increment
+#define COLORIZE_HIST_LANES 4
+// Every frame keeps 1 - 1/2^shift of the running histogram, about 8 frames of memory
+#define COLORIZE_HIST_DECAY_SHIFT 3
+
+// Share of valid pixels clipped at either end of the percentile range
+#define COLORIZE_PERCENTILE_LOW 2
+#define COLORIZE_PERCENTILE_HIGH 98
+
+// Palette steps a bin has to move before the table is rebuilt
+#define COLORIZE_REBUILD_STEPS 2
+
+#define COLORIZE_PALETTE_SIZE 256
+
+enum ColorizeMode
+{
+    // Grayscale ramp over a fixed range, see colorize_set_range
+    COLORIZE_LINEAR,
+    // Turbo over the running 2nd to 98th percentile of valid depth
+    COLORIZE_PERCENTILE,
+    // Turbo through the running cumulative histogram, equal area per color
+    COLORIZE_EQUALIZE
+};
+
+typedef void (*colorize_hist_kernel)(const uint16_t* src, int count, uint32_t* lanes);
+
+// State of the adaptive modes. Each colorize_image call bins its frame into
+// per-thread sub-histograms while colorizing, folds them into a decaying
+// running histogram, and only rebuilds the table when the mapping moved.
+// Tables are double buffered: a frame pins whichever was published last for
+// all of its rows, and a rebuild waits for a later frame while the other
+// table is still pinned.
+struct ColorizeAdaptive
+{
+    enum ColorizeMode mode;
+    colorize_hist_kernel hist_kernel;
+
+    // Held by the call whose frame is being binned, other callers only colorize
+    SDL_mutex* lock;
+    uint32_t* luts[2];
+    SDL_atomic_t active;
+    // Frames colorizing with each table
+    SDL_atomic_t readers[2];
+
+    // THREAD_POOL_SCRATCH_MAX scratch indices of COLORIZE_HIST_LANES lanes of bins
+    uint32_t* sub_hists;
+    int8_t thread_used[THREAD_POOL_SCRATCH_MAX];
+    uint32_t* running;
+    // Palette index per bin the current table was built from
+    uint8_t map[COLORIZE_HIST_BINS];
+    uint32_t palette[COLORIZE_PALETTE_SIZE];
+
+    int frames_binned;
+    int rebuilds;
+    // Rebuilds put off because a frame still used the table to be overwritten
+    int rebuilds_deferred;
+    SDL_atomic_t frames_skipped;
+};
+
+typedef void (*colorize_kernel)(const uint32_t* lut, const uint16_t* src, uint32_t* dst, int count);
+
+// Maps Z16 depth to packed RGBA words through a precomputed table.
+// The output words have the same byte layout as struct RGBA.
+struct Colorizer
+{
+    uint32_t* lut;
+    colorize_kernel kernel;
+    const char* kernel_name;
+    // Set by colorize_set_mode for the adaptive modes, its tables replace lut
+    struct ColorizeAdaptive* adaptive;
+};
+
+int8_t colorize_init(struct Colorizer* c, uint16_t max_depth);
+void colorize_free(struct Colorizer* c);
+
+// Rebuilds the table as a linear grayscale ramp over [0, max_depth]
+void colorize_set_range(struct Colorizer* c, uint16_t max_depth);
+
+int8_t colorize_parse_mode(const char* name, enum ColorizeMode* mode);
+const char* colorize_mode_name(enum ColorizeMode mode);
+
+// Switches between the fixed ramp and the adaptive maps. Call before any
+// frame is colorized; the adaptive maps start out over the default range.
+int8_t colorize_set_mode(struct Colorizer* c, enum ColorizeMode mode);
+
+void colorize_depth(const struct Colorizer* c, const uint16_t* src, uint32_t* dst, int count);
+
+// colorize_depth over a width x height image whose rows are src_stride and
+// dst_pitch bytes apart, split into row bands over threads, which may be NULL.
+// With an adaptive mode the frame also feeds the running histogram.
+void colorize_image(const struct Colorizer* c, struct ThreadPool* threads, const uint16_t* src, int src_stride,
+                    uint32_t* dst, int dst_pitch, int width, int height);
+
+void colorize_print_stats(const struct Colorizer* c);
+
+#endif
@@ -0,0 +1,266 @@
+#include "depth_codec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// LZ4 block rules: a match needs 4 bytes, the last 5 bytes are always
+// literals and no match starts in the last 12
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - DEPTH_CODEC_HASH_BITS);
+}
+
+static uint8_t* write_length(uint8_t* op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t* write_sequence(uint8_t* op, const uint8_t* literals, size_t literal_len, size_t offset, size_t match_len)
+{
+    uint8_t* token = op++;
+    *token = (uint8_t)((literal_len >= 15 ? 15 : literal_len) << 4);
+    if (literal_len >= 15)
+        op = write_length(op, literal_len - 15);
+
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    // The final sequence is literals only
+    if (match_len == 0)
+        return op;
+
+    *op++ = (uint8_t)(offset & 0xFF);
+    *op++ = (uint8_t)(offset >> 8);
+
+    match_len -= LZ_MIN_MATCH;
+    *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+    if (match_len >= 15)
+        op = write_length(op, match_len - 15);
+
+    return op;
+}
+
+static size_t lz_compress(const uint8_t* src, size_t n, uint8_t* dst, uint32_t* table)
+{
+    uint8_t* op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    // Stale positions are harmless, every candidate is compared before use
+    memset(table, 0, ((size_t)1 << DEPTH_CODEC_HASH_BITS) * sizeof(uint32_t));
+
+    if (n > LZ_MATCH_LIMIT)
+    {
+        const size_t match_end = n - LZ_LAST_LITERALS;
+        size_t misses = 0;
+
+        while (ip < n - LZ_MATCH_LIMIT)
+        {
+            const uint32_t seq = read32(src + ip);
+            const uint32_t h = hash4(seq);
+            const size_t ref = table[h];
+            table[h] = (uint32_t)ip;
+
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(src + ref) != seq) {
+                // Incompressible stretches are skipped faster the longer they run
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+
+            size_t len = LZ_MIN_MATCH;
+            while (ip + len < match_end && src[ref + len] == src[ip + len])
+                len++;
+
+            op = write_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+            misses = 0;
+        }
+    }
+
+    return (size_t)(write_sequence(op, src + anchor, n - anchor, 0, 0) - dst);
+}
+
+static int8_t lz_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t n)
+{
+    const uint8_t* ip = src;
+    const uint8_t* end = src + size;
+    size_t op = 0;
+
+    while (ip < end)
+    {
+        const uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= end)
+                    return 1;
+                b = *ip++;
+                literal_len += b;
+            } while (b == 255);
+        }
+
+        if (literal_len > (size_t)(end - ip) || literal_len > n - op)
+            return 1;
+        memcpy(dst + op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return 1;
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t match_len = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15) {
+            uint8_t b;
+            do {
+                if (ip >= end)
+                    return 1;
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+
+        if (offset == 0 || offset > op || match_len > n - op)
+            return 1;
+
+        // Runs of one byte, mostly zero, are the common overlapping case
+        if (offset == 1) {
+            memset(dst + op, dst[op - 1], match_len);
+        } else if (offset >= match_len) {
+            memcpy(dst + op, dst + op - offset, match_len);
+        } else {
+            size_t i;
+            for (i = 0; i < match_len; i++)
+                dst[op + i] = dst[op - offset + i];
+        }
+        op += match_len;
+    }
+
+    return op == n ? 0 : 1;
+}
+
+int8_t depth_codec_init(struct DepthCodec* c, int pixels)
+{
+    if (c == NULL) {
+        fprintf(stderr, "Cannot init depth codec: given pointer is null\n");
+        return 1;
+    }
+
+    memset(c, 0, sizeof(struct DepthCodec));
+
+    c->planes = (uint8_t*)malloc((size_t)pixels * 2);
+    c->table = (uint32_t*)malloc(((size_t)1 << DEPTH_CODEC_HASH_BITS) * sizeof(uint32_t));
+    if (c->planes == NULL || c->table == NULL) {
+        fprintf(stderr, "Failed allocating depth codec for %d pixels\n", pixels);
+        depth_codec_free(c);
+        return 1;
+    }
+
+    c->capacity = pixels;
+    return 0;
+}
+
+void depth_codec_free(struct DepthCodec* c)
+{
+    if (c == NULL)
+        return;
+
+    free(c->planes);
+    free(c->table);
+    c->planes = NULL;
+    c->table = NULL;
+    c->capacity = 0;
+}
+
+size_t depth_codec_bound(int pixels)
+{
+    const size_t n = (size_t)pixels * 2;
+    return n + n / 255 + 16;
+}
+
+size_t depth_codec_encode(struct DepthCodec* c, const uint16_t* src, int width, int height, int stride,
+                          uint8_t* dst, size_t dst_size)
+{
+    const int pixels = width * height;
+    if (pixels > c->capacity || dst_size < depth_codec_bound(pixels))
+        return 0;
+
+    uint8_t* lo = c->planes;
+    uint8_t* hi = c->planes + pixels;
+
+    int x, y;
+    for (y = 0; y < height; y++)
+    {
+        const uint16_t* row = (const uint16_t*)((const uint8_t*)src + (size_t)y * stride);
+        uint16_t prev = y > 0 ? *(const uint16_t*)((const uint8_t*)src + (size_t)(y - 1) * stride) : 0;
+
+        for (x = 0; x < width; x++)
+        {
+            const int16_t delta = (int16_t)(row[x] - prev);
+            const uint16_t zz = (uint16_t)(((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15));
+            lo[y * width + x] = (uint8_t)zz;
+            hi[y * width + x] = (uint8_t)(zz >> 8);
+            prev = row[x];
+        }
+    }
+
+    return lz_compress(c->planes, (size_t)pixels * 2, dst, c->table);
+}
+
+int8_t depth_codec_decode(struct DepthCodec* c, const uint8_t* src, size_t size, uint16_t* dst,
+                          int width, int height)
+{
+    const int pixels = width * height;
+    if (pixels > c->capacity) {
+        fprintf(stderr, "Depth codec sized for %d pixels cannot decode %dx%d\n", c->capacity, width, height);
+        return 1;
+    }
+
+    if (lz_decompress(src, size, c->planes, (size_t)pixels * 2) != 0) {
+        fprintf(stderr, "Corrupt compressed depth frame\n");
+        return 1;
+    }
+
+    const uint8_t* lo = c->planes;
+    const uint8_t* hi = c->planes + pixels;
+
+    int x, y;
+    for (y = 0; y < height; y++)
+    {
+        uint16_t prev = y > 0 ? dst[(y - 1) * width] : 0;
+        for (x = 0; x < width; x++)
+        {
+            const uint16_t zz = (uint16_t)(lo[y * width + x] | (hi[y * width + x] << 8));
+            const uint16_t delta = (uint16_t)((zz >> 1) ^ (uint16_t)-(zz & 1));
+            prev = (uint16_t)(prev + delta);
+            dst[y * width + x] = prev;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef DEPTH_CODEC_H
+#define DEPTH_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEPTH_CODEC_HASH_BITS 16
+
+// Lossless Z16 compression. Each pixel becomes the zigzagged difference to
+// its left neighbour (the first one to the pixel above), the low and high
+// bytes go to separate planes, and both planes are compressed as one LZ4
+// block. Smooth surfaces leave the high plane almost all zero and holes
+// leave runs of zero in both, which is where the size goes away.
+struct DepthCodec
+{
+    uint8_t* planes;
+    uint32_t* table;
+    int capacity;
+};
+
+// Scratch for frames of up to pixels pixels
+int8_t depth_codec_init(struct DepthCodec* c, int pixels);
+void depth_codec_free(struct DepthCodec* c);
+
+// Largest encoded size of a frame of pixels pixels
+size_t depth_codec_bound(int pixels);
+
+// stride is in bytes. Returns the encoded size, 0 when dst is too small.
+size_t depth_codec_encode(struct DepthCodec* c, const uint16_t* src, int width, int height, int stride,
+                          uint8_t* dst, size_t dst_size);
+
+// Decodes into a tightly packed width x height frame
+int8_t depth_codec_decode(struct DepthCodec* c, const uint8_t* src, size_t size, uint16_t* dst,
+                          int width, int height);
+
+#endif
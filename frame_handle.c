@@ -0,0 +1,145 @@
+#include "frame_handle.h"
+#include "rs_error.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int8_t frame_handle_acquire(struct FrameHandle* h, rs2_frame* frame)
+{
+    rs2_error* e = NULL;
+
+    if (h == NULL || frame == NULL) {
+        fprintf(stderr, "Cannot acquire frame handle: given pointer is null\n");
+        return 1;
+    }
+
+    memset(h, 0, sizeof(struct FrameHandle));
+
+    h->data = rs2_get_frame_data(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame data\n");
+        return 1;
+    }
+
+    h->width = rs2_get_frame_width(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame width\n");
+        return 1;
+    }
+
+    h->height = rs2_get_frame_height(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame height\n");
+        return 1;
+    }
+
+    h->stride = rs2_get_frame_stride_in_bytes(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame stride\n");
+        return 1;
+    }
+
+    h->bpp = rs2_get_frame_bits_per_pixel(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame bits per pixel\n");
+        return 1;
+    }
+
+    const rs2_stream_profile* profile = rs2_get_frame_stream_profile(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame stream profile\n");
+        return 1;
+    }
+
+    rs2_stream stream;
+    int index;
+    int id;
+    int fps;
+    rs2_get_stream_profile_data(profile, &stream, &h->format, &index, &id, &fps, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame format\n");
+        return 1;
+    }
+
+    h->number = rs2_get_frame_number(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame number\n");
+        return 1;
+    }
+
+    h->timestamp = rs2_get_frame_timestamp(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame timestamp\n");
+        return 1;
+    }
+
+    h->timestamp_domain = rs2_get_frame_timestamp_domain(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame timestamp domain\n");
+        return 1;
+    }
+
+    rs2_frame_add_ref(frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed adding frame reference\n");
+        return 1;
+    }
+
+    h->frame = frame;
+    return 0;
+}
+
+int8_t frame_handle_share(const struct FrameHandle* src, struct FrameHandle* dst)
+{
+    rs2_error* e = NULL;
+
+    if (src == NULL || dst == NULL || src->frame == NULL) {
+        fprintf(stderr, "Cannot share frame handle: nothing to share\n");
+        return 1;
+    }
+
+    rs2_frame_add_ref(src->frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed adding frame reference\n");
+        return 1;
+    }
+
+    *dst = *src;
+    return 0;
+}
+
+int8_t frame_handle_intrinsics(const struct FrameHandle* h, rs2_intrinsics* intrin)
+{
+    rs2_error* e = NULL;
+
+    // Frames served from a recording have no profile to ask
+    if (h->frame == NULL) {
+        fprintf(stderr, "Cannot get intrinsics of a %dx%d frame without a librealsense frame\n", h->width, h->height);
+        return 1;
+    }
+
+    const rs2_stream_profile* profile = rs2_get_frame_stream_profile(h->frame, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting frame stream profile\n");
+        return 1;
+    }
+
+    rs2_get_video_stream_intrinsics(profile, intrin, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting %dx%d frame intrinsics\n", h->width, h->height);
+        return 1;
+    }
+
+    return 0;
+}
+
+void frame_handle_release(struct FrameHandle* h)
+{
+    if (h == NULL)
+        return;
+
+    if (h->frame)
+        rs2_release_frame(h->frame);
+
+    memset(h, 0, sizeof(struct FrameHandle));
+}
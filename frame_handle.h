@@ -0,0 +1,41 @@
+#ifndef FRAME_HANDLE_H
+#define FRAME_HANDLE_H
+
+#include <librealsense2/rs.h>
+#include <librealsense2/h/rs_frame.h>
+
+#include <stdint.h>
+
+// A counted reference to a librealsense frame. Consumers read the pixels
+// straight from the frame instead of copying them out. Every handle owns one
+// reference; librealsense recycles the frame once the last one is released.
+struct FrameHandle
+{
+    rs2_frame* frame;
+    const void* data;
+    int width;
+    int height;
+    int stride;
+    int bpp;
+    rs2_format format;
+    // Meters per Z16 step, only set for depth frames
+    float depth_units;
+    unsigned long long number;
+    double timestamp;
+    // System and global time are host milliseconds, comparable to the host clock
+    rs2_timestamp_domain timestamp_domain;
+};
+
+// Takes a new reference to frame and fills h from it. The caller keeps its own reference.
+int8_t frame_handle_acquire(struct FrameHandle* h, rs2_frame* frame);
+
+// Gives another consumer its own reference to the same frame
+int8_t frame_handle_share(const struct FrameHandle* src, struct FrameHandle* dst);
+
+// Intrinsics of the profile the frame belongs to, which filters like decimation change
+int8_t frame_handle_intrinsics(const struct FrameHandle* h, rs2_intrinsics* intrin);
+
+// Drops the reference held by h, safe to call on an empty handle
+void frame_handle_release(struct FrameHandle* h);
+
+#endif
@@ -0,0 +1,268 @@
+#include "frame_pool.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sits just before a slab the heap had to provide
+struct FramePoolHeapSlab
+{
+    void* block;
+    SDL_atomic_t refs;
+};
+
+static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+static void* map_block(size_t* size, int8_t hugepages)
+{
+#ifdef WIN32
+    if (hugepages && GetLargePageMinimum() > 0) {
+        // Needs the lock pages privilege, most accounts do not have it
+        size_t large = round_up(*size, GetLargePageMinimum());
+        void* block = VirtualAlloc(NULL, large, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (block != NULL) {
+            *size = large;
+            return block;
+        }
+    }
+
+    *size = round_up(*size, FRAME_POOL_PAGE);
+    return VirtualAlloc(NULL, *size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void* block = MAP_FAILED;
+    if (hugepages && *size >= FRAME_POOL_HUGEPAGE)
+    {
+        size_t huge = round_up(*size, FRAME_POOL_HUGEPAGE);
+#ifdef MAP_HUGETLB
+        // Only works when huge pages were set aside, e.g. vm.nr_hugepages
+        block = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (block == MAP_FAILED) {
+            block = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+            // Otherwise ask for transparent huge pages
+            if (block != MAP_FAILED)
+                madvise(block, huge, MADV_HUGEPAGE);
+#endif
+        }
+        if (block != MAP_FAILED) {
+            *size = huge;
+            return block;
+        }
+    }
+
+    *size = round_up(*size, FRAME_POOL_PAGE);
+    block = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return block == MAP_FAILED ? NULL : block;
+#endif
+}
+
+static void unmap_block(void* block, size_t size)
+{
+#ifdef WIN32
+    VirtualFree(block, 0, MEM_RELEASE);
+#else
+    munmap(block, size);
+#endif
+}
+
+static void free_group(struct FramePoolGroup* g)
+{
+    if (g->base)
+        unmap_block(g->base, g->block_size);
+    free(g->refs);
+    ring_queue_free(&g->free_slabs);
+    memset(g, 0, sizeof(struct FramePoolGroup));
+}
+
+void frame_pool_init(struct FramePool* pool, int8_t hugepages)
+{
+    memset(pool, 0, sizeof(struct FramePool));
+    pool->hugepages = hugepages;
+}
+
+void frame_pool_free(struct FramePool* pool)
+{
+    if (pool == NULL)
+        return;
+
+    if (SDL_AtomicGet(&pool->in_use) != 0)
+        fprintf(stderr, "frame pool freed with %d slabs still in use\n", SDL_AtomicGet(&pool->in_use));
+
+    int i;
+    for (i = 0; i < pool->group_count; i++)
+        free_group(&pool->groups[i]);
+    pool->group_count = 0;
+    pool->reserved_bytes = 0;
+}
+
+int8_t frame_pool_reserve(struct FramePool* pool, size_t size, int count)
+{
+    if (pool == NULL || size == 0 || count < 1) {
+        fprintf(stderr, "Cannot reserve frame pool slabs: bad arguments\n");
+        return 1;
+    }
+
+    if (pool->group_count == FRAME_POOL_GROUPS_MAX) {
+        fprintf(stderr, "Frame pool has no room for more than %d slab sizes\n", FRAME_POOL_GROUPS_MAX);
+        return 1;
+    }
+
+    struct FramePoolGroup g;
+    memset(&g, 0, sizeof(g));
+    g.size = size;
+    g.stride = round_up(size, size >= FRAME_POOL_PAGE ? FRAME_POOL_PAGE : FRAME_POOL_ALIGN);
+    g.count = count;
+    g.block_size = g.stride * count;
+
+    g.base = (uint8_t*)map_block(&g.block_size, pool->hugepages);
+    if (g.base == NULL) {
+        fprintf(stderr, "Failed reserving %d frame slabs of %zu bytes\n", count, size);
+        return 1;
+    }
+
+    g.refs = (SDL_atomic_t*)calloc(count, sizeof(SDL_atomic_t));
+    if (g.refs == NULL || ring_queue_init(&g.free_slabs, count, RING_QUEUE_DROP_NEWEST, NULL, NULL) != 0) {
+        fprintf(stderr, "Failed allocating frame pool bookkeeping\n");
+        free_group(&g);
+        return 1;
+    }
+
+    int i;
+    for (i = 0; i < count; i++)
+        ring_queue_try_push(&g.free_slabs, g.base + (size_t)i * g.stride);
+
+    // Smallest first, so acquire takes the tightest fit
+    int at = pool->group_count;
+    while (at > 0 && pool->groups[at - 1].size > size) {
+        pool->groups[at] = pool->groups[at - 1];
+        at--;
+    }
+    pool->groups[at] = g;
+    pool->group_count++;
+    pool->reserved_bytes += g.block_size;
+    return 0;
+}
+
+static void count_acquired(struct FramePool* pool)
+{
+    int in_use = SDL_AtomicAdd(&pool->in_use, 1) + 1;
+    int peak = SDL_AtomicGet(&pool->peak_in_use);
+    while (in_use > peak && !SDL_AtomicCAS(&pool->peak_in_use, peak, in_use))
+        peak = SDL_AtomicGet(&pool->peak_in_use);
+}
+
+void* frame_pool_acquire(struct FramePool* pool, size_t size)
+{
+    int i;
+    for (i = 0; i < pool->group_count; i++)
+    {
+        struct FramePoolGroup* g = &pool->groups[i];
+        if (g->size < size)
+            continue;
+
+        void* slab = NULL;
+        if (ring_queue_try_pop(&g->free_slabs, &slab) == 0) {
+            SDL_AtomicSet(&g->refs[((uint8_t*)slab - g->base) / g->stride], 1);
+            count_acquired(pool);
+            return slab;
+        }
+    }
+
+    // Nothing reserved fits, the heap it is
+    void* block = malloc(size + 2 * FRAME_POOL_ALIGN);
+    if (block == NULL) {
+        fprintf(stderr, "Failed allocating a %zu byte frame buffer\n", size);
+        return NULL;
+    }
+
+    uint8_t* slab = (uint8_t*)round_up((uintptr_t)block + sizeof(struct FramePoolHeapSlab), FRAME_POOL_ALIGN);
+    struct FramePoolHeapSlab* heap = (struct FramePoolHeapSlab*)slab - 1;
+    heap->block = block;
+    SDL_AtomicSet(&heap->refs, 1);
+
+    SDL_AtomicAdd(&pool->heap_allocs, 1);
+    count_acquired(pool);
+    return slab;
+}
+
+// The group a slab came from, NULL when it came from the heap
+static struct FramePoolGroup* find_group(struct FramePool* pool, const void* slab, int* index)
+{
+    const uint8_t* p = (const uint8_t*)slab;
+    int i;
+    for (i = 0; i < pool->group_count; i++)
+    {
+        struct FramePoolGroup* g = &pool->groups[i];
+        if (p >= g->base && p < g->base + g->stride * g->count) {
+            *index = (int)((p - g->base) / g->stride);
+            return g;
+        }
+    }
+
+    return NULL;
+}
+
+void frame_pool_retain(struct FramePool* pool, void* slab)
+{
+    int index = 0;
+    struct FramePoolGroup* g = find_group(pool, slab, &index);
+    if (g != NULL)
+        SDL_AtomicAdd(&g->refs[index], 1);
+    else
+        SDL_AtomicAdd(&((struct FramePoolHeapSlab*)slab - 1)->refs, 1);
+}
+
+void frame_pool_release(struct FramePool* pool, void* slab)
+{
+    if (slab == NULL)
+        return;
+
+    int index = 0;
+    struct FramePoolGroup* g = find_group(pool, slab, &index);
+    if (g != NULL)
+    {
+        if (SDL_AtomicAdd(&g->refs[index], -1) != 1)
+            return;
+
+        // Every slab of the group fits, this cannot run out of room
+        ring_queue_try_push(&g->free_slabs, slab);
+    }
+    else
+    {
+        struct FramePoolHeapSlab* heap = (struct FramePoolHeapSlab*)slab - 1;
+        if (SDL_AtomicAdd(&heap->refs, -1) != 1)
+            return;
+
+        free(heap->block);
+    }
+
+    SDL_AtomicAdd(&pool->in_use, -1);
+}
+
+int frame_pool_heap_allocs(struct FramePool* pool)
+{
+    return SDL_AtomicGet(&pool->heap_allocs);
+}
+
+void frame_pool_print_stats(struct FramePool* pool)
+{
+    int slabs = 0;
+    int i;
+    for (i = 0; i < pool->group_count; i++)
+        slabs += pool->groups[i].count;
+
+    fprintf(stderr, "frame pool: %d slabs in %d sizes, %.1f MB reserved%s, peak %d in use, %d heap allocations\n",
+            slabs, pool->group_count, pool->reserved_bytes / (1024.0 * 1024.0),
+            pool->hugepages ? " (huge pages requested)" : "",
+            SDL_AtomicGet(&pool->peak_in_use), SDL_AtomicGet(&pool->heap_allocs));
+}
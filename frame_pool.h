@@ -0,0 +1,70 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ring_queue.h"
+
+// Every slab starts on a cache line; slabs of a page or more on a page
+#define FRAME_POOL_ALIGN 64
+#define FRAME_POOL_PAGE 4096
+#define FRAME_POOL_HUGEPAGE (2 << 20)
+
+#define FRAME_POOL_GROUPS_MAX 16
+
+// count slabs of one size, carved from a single block
+struct FramePoolGroup
+{
+    size_t size;
+    size_t stride;
+    int count;
+    uint8_t* base;
+    size_t block_size;
+    SDL_atomic_t* refs;
+    struct RingQueue free_slabs;
+};
+
+// Fixed size slabs reserved while setting up and handed out reference
+// counted while streaming. Acquiring and releasing never allocate; when
+// no reserved slab fits, acquire falls back to the heap and counts it in
+// heap_allocs, so a steady state that reads 0 there allocated nothing.
+// Groups are reserved from one thread before any slab is handed out.
+struct FramePool
+{
+    struct FramePoolGroup groups[FRAME_POOL_GROUPS_MAX];
+    int group_count;
+    // Back large groups with huge pages where the OS has them
+    int8_t hugepages;
+
+    size_t reserved_bytes;
+    SDL_atomic_t in_use;
+    SDL_atomic_t peak_in_use;
+    SDL_atomic_t heap_allocs;
+};
+
+void frame_pool_init(struct FramePool* pool, int8_t hugepages);
+void frame_pool_free(struct FramePool* pool);
+
+// Adds count slabs of at least size bytes. Fresh slabs are zeroed.
+int8_t frame_pool_reserve(struct FramePool* pool, size_t size, int count);
+
+// A slab of at least size bytes with one reference, the smallest that
+// fits. NULL only when the heap fallback fails too.
+void* frame_pool_acquire(struct FramePool* pool, size_t size);
+void frame_pool_retain(struct FramePool* pool, void* slab);
+// Drops a reference, the slab is reused once the last one is gone
+void frame_pool_release(struct FramePool* pool, void* slab);
+
+// Heap allocations made for lack of a slab since the pool was initialized
+int frame_pool_heap_allocs(struct FramePool* pool);
+
+void frame_pool_print_stats(struct FramePool* pool);
+
+#endif
@@ -0,0 +1,149 @@
+#include "frames.h"
+#include "metrics.h"
+#include "rs_error.h"
+#include "trace.h"
+
+#include <stdio.h>
+
+int8_t extract_frames(rs2_frame* frames, struct FrameHandle* dep, struct FrameHandle* col_frame,
+                      int8_t* got_dep, int8_t* got_col)
+{
+    rs2_error* e = NULL;
+    Uint64 begin = SDL_GetPerformanceCounter();
+
+    int num_frames = rs2_embedded_frames_count(frames, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting framelist size\n");
+        return 1;
+    }
+
+    int f;
+    for (f = 0; f < num_frames; f++)
+    {
+        rs2_frame* fr = rs2_extract_frame(frames, f, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed extracting frame %d / %d\n", f, num_frames);
+            return 1;
+        }
+
+        if (rs2_is_frame_extendable_to(fr, RS2_EXTENSION_DEPTH_FRAME, &e) == 1)
+        {
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed waiting for frame after frame queue\n");
+                rs2_release_frame(fr);
+                return 1;
+            }
+
+            // Keep the frame itself instead of copying its pixels out
+            frame_handle_release(dep);
+            if (frame_handle_acquire(dep, fr) != 0) {
+                fprintf(stderr, "Failed getting depth frame\n");
+                rs2_release_frame(fr);
+                return 1;
+            }
+
+            dep->depth_units = rs2_depth_frame_get_units(fr, &e);
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed getting depth units\n");
+                rs2_release_frame(fr);
+                return 1;
+            }
+
+            *got_dep = 1;
+            trace_frame_arrival(TRACE_STREAM_DEPTH, dep->number, dep->timestamp);
+            metrics_frame_arrival(TRACE_STREAM_DEPTH, dep->timestamp,
+                                  dep->timestamp_domain != RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK);
+        }
+        else
+        {
+            frame_handle_release(col_frame);
+            if (frame_handle_acquire(col_frame, fr) != 0) {
+                fprintf(stderr, "Failed getting color frame\n");
+                rs2_release_frame(fr);
+                return 1;
+            }
+
+            *got_col = 1;
+            trace_frame_arrival(TRACE_STREAM_COLOR, col_frame->number, col_frame->timestamp);
+            metrics_frame_arrival(TRACE_STREAM_COLOR, col_frame->timestamp,
+                                  col_frame->timestamp_domain != RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK);
+        }
+
+        rs2_release_frame(fr);
+    }
+
+    if (*got_dep)
+        trace_span(TRACE_EXTRACT, TRACE_STREAM_DEPTH, begin, dep->number);
+    else if (*got_col)
+        trace_span(TRACE_EXTRACT, TRACE_STREAM_COLOR, begin, col_frame->number);
+
+    return 0;
+}
+
+void convert_frames(const struct Colorizer* colorizer, const struct RgbExpander* expander,
+                    struct ThreadPool* threads, const struct FrameHandle* dep, struct RGBA* dep_rgb,
+                    const struct FrameHandle* col_frame, struct RGBA* col)
+{
+    if (dep != NULL && dep->data != NULL && dep_rgb != NULL)
+        colorize_rows(colorizer, threads, dep, dep_rgb, dep->width * (int)sizeof(struct RGBA));
+
+    // RGBA8 and BGRA8 frames are consumed straight from col_frame
+    if (col_frame != NULL && col_frame->data != NULL && col_frame->format == RS2_FORMAT_RGB8 && col != NULL)
+        rgb_expand_rows(expander, threads, col_frame, col, col_frame->width * (int)sizeof(struct RGBA));
+}
+
+void colorize_rows(const struct Colorizer* colorizer, struct ThreadPool* threads, const struct FrameHandle* dep,
+                   void* dst, int pitch)
+{
+    Uint64 begin = SDL_GetPerformanceCounter();
+    colorize_image(colorizer, threads, (const uint16_t*)dep->data, dep->stride, (uint32_t*)dst, pitch,
+                   dep->width, dep->height);
+    trace_span(TRACE_COLORIZE, TRACE_STREAM_DEPTH, begin, dep->number);
+}
+
+void rgb_expand_rows(const struct RgbExpander* expander, struct ThreadPool* threads,
+                     const struct FrameHandle* col_frame, void* dst, int pitch)
+{
+    Uint64 begin = SDL_GetPerformanceCounter();
+    rgb_expand_image(expander, threads, (const uint8_t*)col_frame->data, col_frame->stride, (uint32_t*)dst, pitch,
+                     col_frame->width, col_frame->height);
+    trace_span(TRACE_EXPAND, TRACE_STREAM_COLOR, begin, col_frame->number);
+}
+
+int8_t update(struct RS_State* rs_state, const struct Colorizer* colorizer,
+              const struct RgbExpander* expander, struct ThreadPool* threads, struct FrameHandle* dep, struct RGBA* dep_rgb,
+              struct FrameHandle* col_frame, struct RGBA* col, int8_t* got_dep, int8_t* got_col)
+{
+    rs2_frame* frames;
+    rs2_error* e = NULL;
+
+    // Queued or post-processed delivery leaves framesets in the frame queue
+    if (rs_state->frame_queue != NULL)
+        frames = rs2_wait_for_frame(rs_state->frame_queue, 5000, &e);
+    else
+        frames = rs2_pipeline_wait_for_frames(rs_state->pipe, 5000, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed waiting for frames\n");
+        return 1;
+    }
+
+    int8_t new_dep = 0;
+    int8_t new_col = 0;
+
+    if (extract_frames(frames, dep, col_frame, &new_dep, &new_col) != 0) {
+        rs2_release_frame(frames);
+        return 1;
+    }
+
+    rs2_release_frame(frames);
+
+    // Only convert what this frameset brought, the rest is already converted
+    convert_frames(colorizer, expander, threads, new_dep ? dep : NULL, dep_rgb, new_col ? col_frame : NULL, col);
+
+    if (new_dep)
+        *got_dep = 1;
+    if (new_col)
+        *got_col = 1;
+
+    return 0;
+}
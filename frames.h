@@ -0,0 +1,45 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include "colorize.h"
+#include "frame_handle.h"
+#include "rgb_expand.h"
+#include "rs_state.h"
+#include "thread_pool.h"
+
+#include <stdint.h>
+
+struct RGBA
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+};
+
+// Splits a frameset into the latest depth and color handles. The handles
+// already holding a frame are released before they are replaced.
+int8_t extract_frames(rs2_frame* frames, struct FrameHandle* dep, struct FrameHandle* col_frame,
+                      int8_t* got_dep, int8_t* got_col);
+
+// Colorizes depth into dep_rgb and expands RGB8 color into col, which are
+// sized for the frames. Either handle may be NULL or empty, a NULL output
+// skips its stream. RGBA8 and BGRA8 color is left in col_frame. The rows
+// are split over threads when given.
+void convert_frames(const struct Colorizer* colorizer, const struct RgbExpander* expander,
+                    struct ThreadPool* threads, const struct FrameHandle* dep, struct RGBA* dep_rgb,
+                    const struct FrameHandle* col_frame, struct RGBA* col);
+
+// The same conversions into rows pitch bytes apart, e.g. a locked texture.
+// The frame must hold data, and RGB8 for rgb_expand_rows.
+void colorize_rows(const struct Colorizer* colorizer, struct ThreadPool* threads, const struct FrameHandle* dep,
+                   void* dst, int pitch);
+void rgb_expand_rows(const struct RgbExpander* expander, struct ThreadPool* threads,
+                     const struct FrameHandle* col_frame, void* dst, int pitch);
+
+// Waits for the next frameset from the pipeline, then extracts and converts it
+int8_t update(struct RS_State* rs_state, const struct Colorizer* colorizer,
+              const struct RgbExpander* expander, struct ThreadPool* threads, struct FrameHandle* dep, struct RGBA* dep_rgb,
+              struct FrameHandle* col_frame, struct RGBA* col, int8_t* got_dep, int8_t* got_col);
+
+#endif
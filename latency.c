@@ -0,0 +1,75 @@
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int8_t latency_init(struct LatencySamples* l, int capacity)
+{
+    memset(l, 0, sizeof(struct LatencySamples));
+
+    l->ms = (double*)malloc(capacity * sizeof(double));
+    if (l->ms == NULL) {
+        fprintf(stderr, "Failed allocating %d latency samples\n", capacity);
+        return 1;
+    }
+
+    l->capacity = capacity;
+    return 0;
+}
+
+void latency_free(struct LatencySamples* l)
+{
+    free(l->ms);
+    memset(l, 0, sizeof(struct LatencySamples));
+}
+
+void latency_add(struct LatencySamples* l, double ms)
+{
+    if (l->count >= l->capacity) {
+        l->overflow++;
+        return;
+    }
+
+    l->ms[l->count++] = ms;
+}
+
+static int compare_ms(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile over sorted samples
+static double percentile(const struct LatencySamples* l, double p)
+{
+    int rank = (int)(p / 100.0 * l->count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > l->count)
+        rank = l->count;
+    return l->ms[rank - 1];
+}
+
+void latency_summarize(struct LatencySamples* l, struct LatencySummary* out)
+{
+    memset(out, 0, sizeof(struct LatencySummary));
+    if (l->count == 0)
+        return;
+
+    qsort(l->ms, l->count, sizeof(double), compare_ms);
+
+    double total = 0.0;
+    int i;
+    for (i = 0; i < l->count; i++)
+        total += l->ms[i];
+
+    out->count = l->count;
+    out->mean_ms = total / l->count;
+    out->min_ms = l->ms[0];
+    out->p50_ms = percentile(l, 50.0);
+    out->p95_ms = percentile(l, 95.0);
+    out->p99_ms = percentile(l, 99.0);
+    out->max_ms = l->ms[l->count - 1];
+}
@@ -0,0 +1,34 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Per-sample latency record for one stage, summarized into percentiles at the end of a run
+struct LatencySamples
+{
+    double* ms;
+    int count;
+    int capacity;
+    // Samples offered after the buffer filled up
+    int overflow;
+};
+
+struct LatencySummary
+{
+    int count;
+    double mean_ms;
+    double min_ms;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double max_ms;
+};
+
+int8_t latency_init(struct LatencySamples* l, int capacity);
+void latency_free(struct LatencySamples* l);
+void latency_add(struct LatencySamples* l, double ms);
+
+// Sorts the samples in place. An empty record summarizes to all zeroes.
+void latency_summarize(struct LatencySamples* l, struct LatencySummary* out);
+
+#endif
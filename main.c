@@ -20,896 +20,1007 @@
 #include <stdlib.h>
 #include <string.h>
 
-int8_t got_sigint = 0;
+#include "align.h"
+#include "colorize.h"
+#include "frame_pool.h"
+#include "frame_handle.h"
+#include "frames.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "pointcloud.h"
+#include "postprocess.h"
+#include "preset_switch.h"
+#include "publisher.h"
+#include "recorder.h"
+#include "renderer.h"
+#include "rgb_expand.h"
+#include "rs_error.h"
+#include "rs_state.h"
+#include "stream_options.h"
+#include "stream_texture.h"
+#include "synthetic.h"
+#include "thread_pool.h"
+#include "trace.h"
 
-const int cDepthW = 1280;
-const int cDepthH = 720;
-const int cColorW = 1920;
-const int cColorH = 1080;
+int8_t got_sigint = 0;
 
 // Disable to render color
 #define RENDER_DEPTH
 
-#define PRESET_COUNT 3
-const char* presets[PRESET_COUNT] = {
-    "High Accuracy",
-    "High Density",
-    "Hand"
-};
+// Disable to capture, convert and render on the main thread
+#define THREADED_PIPELINE
 
-struct RGBA
-{
-    uint8_t r;
-    uint8_t g;
-    uint8_t b;
-    uint8_t a;
-};
-
-#define RS_STATE_SENSORS_MAX 20
-struct RS_State
-{
-    rs2_context* ctx;
-    rs2_device_list* device_list;
-    int32_t dev_count;
-    rs2_device* dev;
-    rs2_sensor_list* sensor_list;
-    int32_t sensor_list_count;
-    rs2_sensor* sensors[RS_STATE_SENSORS_MAX];
-    int32_t sensors_created;
-    int32_t advanced_enabled;
-    rs2_pipeline* pipe;
-    rs2_pipeline_profile* selection;
-    rs2_stream_profile_list* stream_list;
-    int32_t stream_list_count;
-    rs2_config* config;
-    rs2_processing_block* temporal_filter;
-    rs2_frame_queue* frame_queue;
-};
-
-int8_t check_error(rs2_error* e)
-{
-    if (e)
-    {
-        fprintf(stderr, "rs_error was raised when calling %s(%s): \n",
-               rs2_get_failed_function(e), rs2_get_failed_args(e));
-        fprintf(stderr, "%s\n", rs2_get_error_message(e));
-        return 1;
-    }
-    return 0;
-}
+// Enable to capture and convert inside librealsense's frame callback
+// instead of on a capture thread and conversion workers
+//#define CAPTURE_CALLBACK
 
+// Disable to back the frame pool with regular pages only
+#define FRAME_POOL_HUGEPAGES
 
-int8_t create_context(struct RS_State* rs_state)
-{
-    rs2_error* e = NULL;
+// Framesets librealsense may buffer for the capture thread
+#define FRAME_QUEUE_SIZE 2
 
-    fprintf(stderr, "creating context\n");
+// Where SIGUSR1 writes the trace rings when --trace names no file
+#define TRACE_DEFAULT_PATH "minimal_realsense2_trace.json"
 
-    rs_state->ctx = rs2_create_context(RS2_API_VERSION, &e);
-    if (check_error(e) != 0) {
-        rs_state->ctx = NULL;
-        fprintf(stderr, "Failed creating rs context\n");
-        return 1;
-    }
-
-    fprintf(stderr, "context created\n");
+// Frame rate of --synthetic when none is given
+#define SYNTHETIC_DEFAULT_FPS 30
 
-    return 0;
+static double elapsed_ms(Uint64 since)
+{
+    return (double)(SDL_GetPerformanceCounter() - since) * 1000.0 / (double)SDL_GetPerformanceFrequency();
 }
 
-int8_t clear_state(struct RS_State* s)
+static void destroy_display(struct StreamTexture* tex, SDL_Renderer* sdlren, SDL_Window* sdlwin)
 {
-    if (s == NULL) {
-        fprintf(stderr, "Cannot clear state: given pointer is null\n");
-        return 1;
-    }
-
-    if(s->temporal_filter) {
-        rs2_delete_processing_block(s->temporal_filter);
-    }
-
-    if (s->frame_queue) {
-        rs2_delete_frame_queue(s->frame_queue);
-    }
-
-    if (s->dev) {
-        rs2_delete_device(s->dev);
-    }
-
-    int32_t sen;
-    for (sen = 0; sen < s->sensors_created; sen++) {
-        rs2_delete_sensor(s->sensors[sen]);
-    }
-
-    if (s->sensor_list) {
-        rs2_delete_sensor_list(s->sensor_list);
-    }
-
-    if (s->device_list) {
-        rs2_delete_device_list(s->device_list);
-    }
-
-    if (s->config) {
-        rs2_delete_config(s->config);
-    }
-
-    if (s->selection) {
-        rs2_delete_pipeline_profile(s->selection);
-    }
+    stream_texture_destroy(tex);
+    if (sdlren)
+        SDL_DestroyRenderer(sdlren);
+    if (sdlwin)
+        SDL_DestroyWindow(sdlwin);
+}
 
-    if (s->pipe) {
-        rs2_pipeline_stop(s->pipe, NULL);
-        rs2_delete_pipeline(s->pipe);
+#ifdef WIN32
+int8_t sigint_handler(DWORD fdwCtrlType) {
+    if(fdwCtrlType == CTRL_C_EVENT) {
+        fprintf(stderr, "got signal: %d\n", fdwCtrlType);
+        got_sigint = 1;
+        return 0;
     }
 
-    if (s->ctx) {
-        rs2_delete_context(s->ctx);
-    }
+    return 1;
+}
+#else
+void sigint_handler(int sig)
+{
+    fprintf(stderr, "got sigint\n");
+    got_sigint = 1;
+}
 
-    memset(s, 0, sizeof(struct RS_State));
-    return 0;
+// The main loop writes the dump, the handler only asks for it
+void sigusr1_handler(int sig)
+{
+    trace_request_dump();
 }
+#endif
 
-int8_t ensure_device(struct RS_State* s, int rs_dev_index)
+int main(int argc,  char** argv)
 {
-    if (s == NULL) {
-        fprintf(stderr, "Cannot init state: given pointer is null\n");
-        return 1;
-    }
+#ifdef WIN32
+    SetConsoleCtrlHandler( (PHANDLER_ROUTINE) sigint_handler, TRUE );
+#else
+    signal(SIGINT, sigint_handler);
+    signal(SIGUSR1, sigusr1_handler);
+#endif
 
-    rs2_error* e = NULL;
-    if (s->ctx == NULL) {
-        fprintf(stderr, "Cannot ensure device: context is null\n");
-        return 1;
-    }
+    struct StreamConfig stream_config;
+    stream_config_defaults(&stream_config);
 
-    if (s->device_list != NULL) {
-        rs2_delete_device_list(s->device_list);
-        s->device_list = NULL;
-    }
+    struct PostProcessConfig postprocess_config;
+    postprocess_default_config(&postprocess_config);
 
-    s->dev_count = 0;
+    int8_t use_synthetic = 0;
+    int synthetic_fps = SYNTHETIC_DEFAULT_FPS;
 
-    if (s->dev != NULL) {
-        rs2_delete_device(s->dev);
-        s->dev = NULL;
-    }
+    enum AlignMode align_mode = ALIGN_NONE;
 
-    s->device_list = rs2_query_devices(s->ctx, &e);
-    if (check_error(e) != 0) {
-        s->device_list = NULL;
-        return 1;
-    }
+    int8_t use_pointcloud = 0;
+    struct PointCloudConfig pointcloud_config;
+    pointcloud_default_config(&pointcloud_config);
 
-    s->dev_count = rs2_get_device_count(s->device_list, &e);
-    if (check_error(e) != 0) {
-        s->dev_count = 0;
-        return 1;
-    }
+    struct RecorderConfig recorder_config;
+    recorder_default_config(&recorder_config);
 
-    fprintf(stderr, "There are %d connected RealSense devices.\n", s->dev_count);
-    if (0 == s->dev_count)
-        return 1;
+    // Frames also go to shared memory for other processes when set
+    int8_t publish = 0;
+    struct PublisherConfig publisher_config;
+    publisher_default_config(&publisher_config);
 
-    fprintf(stderr, "Creating device\n");
-    s->dev = rs2_create_device(s->device_list, rs_dev_index, &e);
-    if (check_error(e) != 0) {
-        s->dev = NULL;
-        return 1;
-    }
+    // No window, frames are processed as fast as they come
+    int8_t headless = 0;
 
-    return 0;
-}
+    // Threads converting a frame's rows, 0 is one per core and 1 converts inline
+    int convert_threads = 0;
 
-int8_t set_preset(struct RS_State* s, const char* new_preset)
-{
-    int done = 0;
-    int sensor;
-    rs2_error* e = NULL;
+    // The trace rings always record, this only decides whether exit dumps them
+    const char* trace_path = NULL;
 
-    for (sensor = 0; sensor < s->sensor_list_count && sensor < s->sensors_created; sensor++)
-    {
-        rs2_sensor* sen = s->sensors[sensor];
-        int supports = rs2_supports_option((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, &e);
+    // Scraped over a local socket when set, see metrics_parse_endpoint
+    const char* metrics_spec = NULL;
+    struct MetricsServer metrics;
 
-        if (check_error(e) != 0) {
-            fprintf(stderr, "Failed asking if sensor supports RS2_OPTION_VISUAL_PRESET\n");
-            return 1;
-        }
+    // Depth colors use the fixed linear map, --colormap picks one of the adaptive ones
+    enum ColorizeMode colormap = COLORIZE_LINEAR;
 
-        if (supports == 1)
-        {
-            float pres = rs2_get_option((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, &e);
-            if (check_error(e) != 0) {
-                fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET\n");
+    int arg;
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--playback") == 0 && arg + 1 < argc) {
+            stream_config.playback_file = argv[++arg];
+        } else if (strcmp(argv[arg], "--fast") == 0) {
+            stream_config.playback_realtime = 0;
+        } else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            trace_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--metrics") == 0 && arg + 1 < argc) {
+            metrics_spec = argv[++arg];
+            if (metrics_parse_endpoint(&metrics, metrics_spec) != 0)
                 return 1;
-            }
-
-            const char* preset_desc = rs2_get_option_value_description((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, pres, &e);
-            if (check_error(e) != 0) {
-                fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET description\n");
+        } else if (strcmp(argv[arg], "--colormap") == 0 && arg + 1 < argc) {
+            if (colorize_parse_mode(argv[++arg], &colormap) != 0)
                 return 1;
-            }
-
-            if (strcmp(preset_desc, new_preset) == 0)
-            {
-                fprintf(stderr, "already using preset: %s\n", preset_desc);
-                done = 1;
-                continue;
-            }
-
-            float min, max, step, def;
-            rs2_get_option_range((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, &min, &max, &step, &def, &e);
-            if (check_error(e) != 0) {
-                fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET ranges\n");
+        } else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+            convert_threads = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--headless") == 0) {
+            headless = 1;
+        } else if (strcmp(argv[arg], "--synthetic") == 0) {
+            use_synthetic = 1;
+            if (arg + 1 < argc && argv[arg + 1][0] >= '0' && argv[arg + 1][0] <= '9')
+                synthetic_fps = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--filters") == 0 && arg + 1 < argc) {
+            if (postprocess_parse_filters(&postprocess_config, argv[++arg]) != 0)
+                return 1;
+        } else if (strcmp(argv[arg], "--decimation") == 0 && arg + 1 < argc) {
+            postprocess_config.decimation = atoi(argv[++arg]);
+            postprocess_config.enabled[POSTPROCESS_DECIMATION] = 1;
+        } else if (strcmp(argv[arg], "--align") == 0 && arg + 1 < argc) {
+            if (align_parse_mode(argv[++arg], &align_mode) != 0)
+                return 1;
+        } else if (strcmp(argv[arg], "--pointcloud") == 0 && arg + 1 < argc) {
+            use_pointcloud = 1;
+            arg++;
+            if (strcmp(argv[arg], "compact") == 0) {
+                pointcloud_config.compact = 1;
+            } else if (strcmp(argv[arg], "dense") != 0) {
+                fprintf(stderr, "Unknown point cloud layout %s, expected dense or compact\n", argv[arg]);
                 return 1;
             }
-
-            int r;
-            for (r = (int)min; r < (int)max; r++)
-            {
-                if (done == 1)
-                    break;
-
-                preset_desc = rs2_get_option_value_description((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, r, &e);
-                if (check_error(e) != 0) {
-                    fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET description\n");
-                    rs2_delete_sensor(sen);
-                    return 1;
-                }
-
-                if (strcmp(preset_desc, new_preset) == 0)
-                {
-                    fprintf(stderr, "Changing preset to %s\n", preset_desc);
-                    rs2_set_option((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, r, &e);
-                    if (check_error(e) != 0) {
-                        fprintf(stderr, "Failed setting RS2_OPTION_VISUAL_PRESET\n");
-                        return 1;
-                    }
-
-                    pres = rs2_get_option((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, &e);
-                    if (check_error(e) != 0) {
-                        fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET\n");
-                        rs2_delete_sensor(sen);
-                        return 1;
-                    }
-
-                    if ((int)pres != (int)r) {
-                        fprintf(stderr, "Setting RS2_OPTION_VISUAL_PRESET did not change preset\n");
-                        return 1;
-                    }
-
-                    done = 1;
-                }
-            }
+        } else if (strcmp(argv[arg], "--uv") == 0) {
+            pointcloud_config.uv = 1;
+        } else if (strcmp(argv[arg], "--record") == 0 && arg + 1 < argc) {
+            recorder_config.path = argv[++arg];
+        } else if (strcmp(argv[arg], "--publish") == 0) {
+            publish = 1;
+            if (arg + 1 < argc && argv[arg + 1][0] == '/')
+                publisher_config.name = argv[++arg];
+        } else if (strcmp(argv[arg], "--publish-slots") == 0 && arg + 1 < argc) {
+            publisher_config.slots = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--compress") == 0) {
+            recorder_config.compress_depth = 1;
+        } else if (strcmp(argv[arg], "--config") == 0 && arg + 1 < argc) {
+            if (stream_options_load(&stream_config, argv[++arg]) != 0)
+                return 1;
+        } else if (strncmp(argv[arg], "--", 2) == 0 && arg + 1 < argc &&
+                   stream_option_set(&stream_config, argv[arg] + 2, argv[arg + 1]) == 0) {
+            arg++;
+        } else {
+            fprintf(stderr, "usage: %s [--playback file.bag [--fast] | --synthetic [fps]] %s "
+                    "[--filters decimation,spatial,temporal,hole-filling] [--decimation n] [--align color|depth] [--pointcloud dense|compact [--uv]] [--record file [--compress]] [--publish [/name] [--publish-slots n]] [--colormap linear|percentile|equalize] [--threads n] [--trace file.json] [--metrics [host:]port|unix:path] [--headless]\n",
+                    argv[0], STREAM_OPTIONS_USAGE);
+            return 1;
         }
     }
 
-    if (done == 0) {
-        fprintf(stderr, "Did not find preset: %s\n", new_preset);
-        return 1;
-    }
-
-    return 0;
-}
-
-int8_t create_streams(struct RS_State* s)
-{
-    if (s == NULL) {
-        fprintf(stderr, "Cannot init streaming: given pointer is null\n");
-        return 1;
-    }
-
-    if (s->pipe != NULL) {
-        rs2_delete_pipeline(s->pipe);
-        s->pipe = NULL;
-    }
-
-    rs2_error* e = NULL;
-    s->pipe = rs2_create_pipeline(s->ctx, &e);
-    if (check_error(e) != 0) {
-        s->pipe = NULL;
-        return 1;
-    }
-
-    s->config = rs2_create_config(&e);
-    if (check_error(e) != 0) {
-        s->config = NULL;
-        return 1;
-    }
-
-    rs2_config_enable_stream(s->config, RS2_STREAM_DEPTH, -1, cDepthW, cDepthH, RS2_FORMAT_Z16, 30, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed initting depth streaming\n");
-        return 1;
-    }
-
-    fprintf(stderr, "Depth stream created\n");
+    SDL_SetMainReady();
 
-    rs2_config_enable_stream(s->config, RS2_STREAM_COLOR, -1, cColorW, cColorH, RS2_FORMAT_RGB8, 30, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed initting color streaming\n");
+    // Threads, atomics and timers need no subsystem, only the window needs video
+    if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "Failed initting SDLL: %s\n", SDL_GetError());
         return 1;
     }
 
-    fprintf(stderr, "Color stream created\n");
+    // Startup is measured from here to the first frame on screen
+    const Uint64 startup_begin = SDL_GetPerformanceCounter();
 
-    return 0;
-}
-
-int8_t start_stream(struct RS_State* s, int preset_index)
-{
-    rs2_error* e = NULL;
+    trace_init();
+    trace_thread_name("main");
 
-    if (s == NULL) {
-        fprintf(stderr, "Cannot star t stream: given pointer is null\n");
-        return 1;
-    }
-
-    if (s->selection) {
-        rs2_delete_pipeline_profile(s->selection);
-        s->selection = NULL;
-    }
-
-    s->selection = rs2_config_resolve(s->config, s->pipe, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed resolving config\n");
-        s->selection = NULL;
-        return 1;
-    }
-
-    if (s->device_list != NULL) {
-        rs2_delete_device_list(s->device_list);
-        s->device_list = 0;
-    }
+    struct RS_State rs_state;
+    memset(&rs_state, 0, sizeof(rs_state));
 
-    s->dev_count = 0;
+    struct SyntheticSource synthetic;
+    memset(&synthetic, 0, sizeof(synthetic));
 
-    if (s->dev) {
-        rs2_delete_device(s->dev);
-        s->dev = NULL;
-    }
+    if (use_synthetic)
+    {
+        // The software device lives in the context the pipeline is created from
+        if (create_context(&rs_state) != 0)
+            return 1;
 
-    s->dev = rs2_pipeline_profile_get_device(s->selection, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed getting device for pipeline profile\n");
-        s->dev = NULL;
-        return 1;
-    }
+        // Both synthetic streams are declared at one rate
+        stream_config.color.fps = stream_config.depth.fps;
 
-    if (s->sensor_list) {
-        rs2_delete_sensor_list(s->sensor_list);
-        s->sensor_list = NULL;
-    }
+        struct SyntheticConfig synthetic_config;
+        synthetic_config.depth_w = stream_config.depth.width;
+        synthetic_config.depth_h = stream_config.depth.height;
+        synthetic_config.color_w = stream_config.color.width;
+        synthetic_config.color_h = stream_config.color.height;
+        synthetic_config.color_format = stream_config.color.format;
+        synthetic_config.profile_fps = stream_config.depth.fps;
+        synthetic_config.fps = synthetic_fps;
 
-    if (s->sensor_list_count > 0) {
-        int sensor;
-        for (sensor = 0; sensor < s->sensor_list_count; sensor++) {
-            rs2_delete_sensor(s->sensors[sensor]);
-            s->sensors[sensor] = NULL;
-        }
-        s->sensor_list_count = 0;
-    }
+        if (synthetic_create(&synthetic, &synthetic_config, rs_state.ctx) != 0)
+            return 1;
 
-    s->sensor_list = rs2_query_sensors(s->dev, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed querying for sensors\n");
-        s->sensor_list = NULL;
-        return 1;
+        stream_config.serial = SYNTHETIC_SERIAL;
     }
 
-    s->sensor_list_count = rs2_get_sensors_count(s->sensor_list, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed getting sensor list count\n");
-        s->sensor_list_count = 0;
-        return 1;
-    }
+    // A recording or a synthetic source needs no device, let alone one in advanced mode
+    if (stream_config.playback_file == NULL && use_synthetic == 0)
+    {
+        fprintf(stderr, "Ensuring advanced mode is enabled\n");
 
-    int sensor;
-    for (sensor = 0; sensor < s->sensor_list_count; sensor++) {
-        s->sensors[sensor] = rs2_create_sensor(s->sensor_list, sensor, &e);
-        if (check_error(e) != 0) {
-            fprintf(stderr, "Failed creating sensor %d / %d\n", sensor, s->sensor_list_count);
-            s->sensors[sensor] = NULL;
+        if (ensure_advanced(&rs_state) != 0)
+        {
+            fprintf(stderr, "Ensuring advanced mode failed\n");
             return 1;
         }
 
-        s->sensors_created++;
+        fprintf(stderr, "startup: advanced mode after %.1f ms\n", elapsed_ms(startup_begin));
     }
 
-    if (set_preset(s, presets[preset_index]) != 0)
-        return 1;
-
-    fprintf(stderr, "Preset changed");
-
-    rs2_pipeline_start_with_config(s->pipe, s->config, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed starting pipeline\n");
+    // Everything below is sized for the profile librealsense resolves
+    if (resolve_streams(&rs_state, &stream_config) != 0)
+    {
+        fprintf(stderr, "Failed resolving streams\n");
         return 1;
     }
 
-    fprintf(stderr, "pipeline started\n");
-
+    const int depth_w = rs_state.depth.intrinsics.width;
+    const int depth_h = rs_state.depth.intrinsics.height;
+    const int color_w = rs_state.color.intrinsics.width;
+    const int color_h = rs_state.color.intrinsics.height;
 
-    s->stream_list = rs2_pipeline_profile_get_streams(s->selection, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed getting pipeline profile streams\n");
-        s->stream_list = NULL;
+#ifndef RENDER_DEPTH
+    if (align_mode != ALIGN_NONE) {
+        fprintf(stderr, "--align replaces the depth view, build with RENDER_DEPTH\n");
         return 1;
     }
+#endif
 
-    s->stream_list_count = rs2_get_stream_profiles_count(s->stream_list, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed getting pipeline profile stream count\n");
-        s->stream_list_count = 0;
+    // Colorize, RGB expansion and alignment split their rows over these
+    struct ThreadPool row_threads;
+    if (thread_pool_init(&row_threads, convert_threads, 1) != 0)
         return 1;
-    }
-
-    fprintf(stderr, "stream list count: %d\n", s->stream_list_count);
-
-    return 0;
-}
 
-int8_t set_advanced(struct RS_State* s, int val)
-{
-    if (s == NULL) {
-        fprintf(stderr, "Cannot set advanced: given pointer is null\n");
+    // The tables are built for the resolved profiles
+    struct Aligner aligner;
+    if (align_init(&aligner, align_mode, &rs_state, &row_threads) != 0)
+    {
+        thread_pool_free(&row_threads);
         return 1;
     }
 
-    rs2_error* e = NULL;
-
-    if (val == 0) {
-        fprintf(stderr, "disabling advanced mode\n");
-    } else {
-        fprintf(stderr, "enabling advanced mode\n");
-    }
-
-    rs2_toggle_advanced_mode(s->dev, val, &e);
-    if (check_error(e) != 0) {
-        // This thing spits out errors if the device is not ready for this mode yet
-        return 0;
-    }
+    int aligned_w = 0;
+    int aligned_h = 0;
+    if (align_mode != ALIGN_NONE)
+        align_output_size(&aligner, depth_w, depth_h, &aligned_w, &aligned_h);
 
-    rs2_is_enabled(s->dev, &s->advanced_enabled, &e);
-    if (check_error(e) != 0) {
-        // This thing spits out errors if the device is not ready for this mode yet
-        return 0;
+    struct PointCloud pointcloud;
+    memset(&pointcloud, 0, sizeof(pointcloud));
+    if (use_pointcloud && pointcloud_init(&pointcloud, &pointcloud_config, &rs_state, &row_threads) != 0)
+    {
+        align_free(&aligner);
+        thread_pool_free(&row_threads);
+        SDL_Quit();
+        return 1;
     }
 
-    return 0;
-}
+#ifdef RENDER_DEPTH
+    // Colorized depth and the aligned views are struct RGBA
+    const Uint32 tex_format = SDL_PIXELFORMAT_RGBA32;
+    const int tex_w = align_mode != ALIGN_NONE ? aligned_w : depth_w;
+    const int tex_h = align_mode != ALIGN_NONE ? aligned_h : depth_h;
+#else
+    const rs2_format color_format = rs_state.color.format;
+    const Uint32 tex_format = color_format == RS2_FORMAT_BGRA8 ? SDL_PIXELFORMAT_BGRA32 : SDL_PIXELFORMAT_RGBA32;
+    const int tex_w = color_w;
+    const int tex_h = color_h;
+#endif
 
-int8_t ensure_advanced(struct RS_State* s)
-{
-    while (s->advanced_enabled == 0)
+    SDL_Window* sdlwin = NULL;
+    if (headless == 0)
     {
-        fprintf(stderr, "Waiting for advanced mode\n");
-        if (clear_state(s) != 0) {
-            fprintf(stderr, "Failed clearing state while waiting for advanced mode\n");
+        sdlwin = SDL_CreateWindow("rs2", 510, 510, tex_w, tex_h, SDL_WINDOW_SHOWN);
+        if (sdlwin == NULL)
+        {
+            fprintf(stderr, "failed creating SDL window\n");
+            SDL_Quit();
             return 1;
         }
+    }
 
-        if (create_context(s) != 0) {
-            fprintf(stderr, "Failed initializing context while waiting for advanced mode\n");
+    // The threaded pipeline shows frames through a renderer with vsync
+    // instead, this path renders inline and leaves vsync off to not wait on it
+    SDL_Renderer* sdlren = NULL;
+    struct StreamTexture tex;
+    memset(&tex, 0, sizeof(tex));
+#ifndef THREADED_PIPELINE
+    if (headless == 0)
+    {
+        sdlren = SDL_CreateRenderer(sdlwin, -1, SDL_RENDERER_ACCELERATED);
+        if (sdlren == NULL)
+        {
+            fprintf(stderr, "Failed creating SDL renderer: %s\n", SDL_GetError());
+            SDL_DestroyWindow(sdlwin);
+            SDL_Quit();
             return 1;
         }
 
-        if (ensure_device(s, 0) != 0) {
-            fprintf(stderr, "Failed creating device when waiting for advanced mode\n");
+        if (stream_texture_create(&tex, sdlren, tex_format, tex_w, tex_h) != 0)
+        {
+            SDL_DestroyRenderer(sdlren);
+            SDL_DestroyWindow(sdlwin);
+            SDL_Quit();
             return 1;
         }
+    }
+#endif
 
-        if (set_advanced(s, 1) != 0) {
-            fprintf(stderr, "failed setting advanced mode\n");
-            return 1;
-        }
+    fprintf(stderr, "format: %s\n", SDL_GetPixelFormatName(tex_format));
 
-#ifdef WIN32
-        Sleep(1000);
-#else
-        usleep(1000 * 1000);
-#endif
-    }
+    struct FrameHandle dep;
+    struct FrameHandle col_frame;
+    struct RGBA* dep_rgb;
+    struct RGBA* col;
 
-    fprintf(stderr, "advanced mode enabled\n");
+    memset(&dep, 0, sizeof(dep));
+    memset(&col_frame, 0, sizeof(col_frame));
 
-    // Once the device is properly in advanced mode, clear everything
-    // The device can then be re-opened with whatever parameters are required
-    if (clear_state(s) != 0)
-        return 1;
+    const int dep_bytes_rgb = depth_w * depth_h * sizeof(struct RGBA);
+    const int col_bytes = color_w * color_h * sizeof(struct RGBA);
 
-    // Apparently the device needs a while between clearing the state and starting devices again
-#ifdef WIN32
-        Sleep(1000);
+    // Every per-frame buffer is reserved here or by the stages below, streaming allocates none
+    struct FramePool frame_pool;
+#ifdef FRAME_POOL_HUGEPAGES
+    frame_pool_init(&frame_pool, 1);
 #else
-        usleep(1000 * 1000);
+    frame_pool_init(&frame_pool, 0);
 #endif
 
-    return 0;
-}
-
-int8_t start_sensor(struct RS_State* rs_state, int dev_index, int preset_index)
-{
-    rs2_error* e = NULL;
-
-    if (rs_state->ctx == NULL) {
-        if (create_context(rs_state) != 0)  {
-            fprintf(stderr, "Failed creating context when starting sensor\n");
-            return 1;
-        }
-    }
-
-    if (create_streams(rs_state) != 0)
-    {
-        fprintf(stderr, "Failed initting streams\n");
+    if (frame_pool_reserve(&frame_pool, dep_bytes_rgb, 1) != 0 || frame_pool_reserve(&frame_pool, col_bytes, 1) != 0)
         return 1;
-    }
 
-    fprintf(stderr, "streams created\n");
-
-    if (start_stream(rs_state, preset_index) != 0)
-    {
-        fprintf(stderr, "Failed starting streams\n");
+    dep_rgb = (struct RGBA*)frame_pool_acquire(&frame_pool, dep_bytes_rgb);
+    col = (struct RGBA*)frame_pool_acquire(&frame_pool, col_bytes);
+    if (dep_rgb == NULL || col == NULL)
         return 1;
-    }
 
-    fprintf(stderr, "streams started\n");
+    memset(dep_rgb, 0, dep_bytes_rgb);
+    memset(col, 0, col_bytes);
 
-    int stream;
-    float fov[2];
-    float rgb_fov[2];
-    for (stream = 0; stream < rs_state->stream_list_count; stream++)
-    {
-        rs2_stream str;
-        rs2_format format;
-        int index;
-        int id;
-        int fps;
-
-        const rs2_stream_profile* prof = rs2_get_stream_profile(rs_state->stream_list, stream, &e);
-        if (check_error(e) != 0) {
-            fprintf(stderr, "Failed getting stream profile: %d / %d\n", stream, rs_state->stream_list_count);
+    // Only the main thread path aligns into these, the pipeline has its own per job
+    uint16_t* aligned_depth = NULL;
+    struct RGBA* aligned = NULL;
+#ifndef THREADED_PIPELINE
+    if (align_mode != ALIGN_NONE) {
+        const size_t aligned_depth_bytes = (size_t)color_w * color_h * sizeof(uint16_t);
+        const size_t aligned_bytes = (size_t)aligned_w * aligned_h * sizeof(struct RGBA);
+        if (frame_pool_reserve(&frame_pool, aligned_depth_bytes, 1) != 0 ||
+            frame_pool_reserve(&frame_pool, aligned_bytes, 1) != 0)
             return 1;
-        }
 
-        rs2_get_stream_profile_data(prof, &str, &format, &index, &id, &fps, &e);
-
-        if (check_error(e) != 0) {
-            fprintf(stderr, "Failed getting stream profile data for stream: %d / %d\n", stream, rs_state->stream_list_count);
+        aligned_depth = (uint16_t*)frame_pool_acquire(&frame_pool, aligned_depth_bytes);
+        aligned = (struct RGBA*)frame_pool_acquire(&frame_pool, aligned_bytes);
+        if (aligned_depth == NULL || aligned == NULL)
             return 1;
-        }
-
-        rs2_intrinsics intrinsics;
-        if (str == RS2_STREAM_DEPTH)
-        {
-            rs2_get_video_stream_intrinsics(prof, &intrinsics, &e);
-            if (check_error(e) != 0) {
-                fprintf(stdout, "Failed getting depth stream intrinsics\n");
-                return 1;
-            }
-
-            rs2_fov(&intrinsics, fov);
-            fprintf(stderr, "Started depth stream, fov %f, %f\n", fov[0], fov[1]);
-        }
-        else if (str == RS2_STREAM_COLOR)
-        {
-            rs2_get_video_stream_intrinsics(prof, &intrinsics, &e);
-            if (check_error(e) != 0) {
-                fprintf(stderr, "Failed getting color stream intrinsics\n");
-                return 1;
-            }
-
-            rs2_fov(&intrinsics, rgb_fov);
-            fprintf(stderr, "Started color stream, fov %f, %f\n", rgb_fov[0], rgb_fov[1]);
-        }
+        memset(aligned_depth, 0, aligned_depth_bytes);
+        memset(aligned, 0, aligned_bytes);
     }
+#endif
 
-    return 0;
-}
-
-uint16_t lerp(uint16_t a, uint16_t b, float alpha)
-{
-    return a * (1.0f - alpha) + alpha * b;
-}
-
-int8_t update(struct RS_State* rs_state, uint16_t* dep, struct RGBA* dep_rgb, struct RGBA* col,
-              int8_t* got_dep, int8_t* got_col)
-{
-    rs2_frame* frames;
-    rs2_error* e = NULL;
-    const int dep_bytes = cDepthW * cDepthH * sizeof(uint16_t);
-    const int col_bytes = cColorW * cColorH * sizeof(struct RGBA);
-
-    frames = rs2_pipeline_wait_for_frames(rs_state->pipe, 5000, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed waiting for frames\n");
+    struct Colorizer colorizer;
+    if (colorize_init(&colorizer, COLORIZE_DEFAULT_MAX_DEPTH) != 0 || colorize_set_mode(&colorizer, colormap) != 0)
+    {
+        colorize_free(&colorizer);
+        destroy_display(&tex, sdlren, sdlwin);
+        SDL_Quit();
         return 1;
     }
 
-    int num_frames = rs2_embedded_frames_count(frames, &e);
-    if (check_error(e) != 0) {
-        fprintf(stderr, "Failed getting framelist size\n");
+    struct RgbExpander expander;
+    if (rgb_expand_init(&expander) != 0)
+    {
+        colorize_free(&colorizer);
+        align_free(&aligner);
+        thread_pool_free(&row_threads);
+        pointcloud_free(&pointcloud);
+        destroy_display(&tex, sdlren, sdlwin);
+        SDL_Quit();
         return 1;
     }
 
-    uint16_t* dbuf = NULL;
-    uint8_t* col_buf;
-
-    int f;
-    for (f = 0; f < num_frames; f++)
+    struct StreamDelivery delivery;
+    memset(&delivery, 0, sizeof(delivery));
+    delivery.mode = STREAM_DELIVERY_WAIT;
+
+    // Filtered framesets reach the pipeline or update() through rs_state.frame_queue
+    const int8_t use_postprocess = postprocess_any_enabled(&postprocess_config);
+    struct PostProcess postprocess;
+    memset(&postprocess, 0, sizeof(postprocess));
+
+    // Started just before the sensor, submitting to it does nothing until then
+    struct Recorder recorder;
+    memset(&recorder, 0, sizeof(recorder));
+    recorder_config.pool = &frame_pool;
+
+    // Likewise started before the sensor, once the slots can be sized
+    struct Publisher publisher;
+    memset(&publisher, 0, sizeof(publisher));
+
+#ifdef THREADED_PIPELINE
+    struct PipelineConfig pipeline_config;
+    pipeline_default_config(&pipeline_config);
+    pipeline_config.pool = &frame_pool;
+    pipeline_config.threads = &row_threads;
+    // A window gets the shown stream converted straight into its texture
+#ifdef RENDER_DEPTH
+    pipeline_config.convert_depth = headless;
+#else
+    pipeline_config.convert_color = headless;
+#endif
+    if (recorder_config.path != NULL)
+        pipeline_config.recorder = &recorder;
+    if (publish)
+        pipeline_config.publisher = &publisher;
+
+    struct Pipeline pipeline;
+#ifdef CAPTURE_CALLBACK
+    if (use_postprocess == 0)
     {
-        rs2_frame* fr = rs2_extract_frame(frames, f, &e);
-        if (check_error(e) != 0) {
-            fprintf(stderr, "Failed extracting frame %d / %d\n", f, num_frames);
-            rs2_release_frame(frames);
-            return 1;
-        }
-
-        if (rs2_is_frame_extendable_to(fr, RS2_EXTENSION_DEPTH_FRAME, &e) == 1)
+        // librealsense starts calling into the pipeline as soon as the sensor starts
+        pipeline_config.source = PIPELINE_SOURCE_CALLBACK;
+        pipeline_config.workers = 0;
+        if (pipeline_start(&pipeline, &pipeline_config, &rs_state, &colorizer, &expander, &aligner) != 0)
         {
-            if (check_error(e) != 0) {
-                fprintf(stderr, "Failed waiting for frame after frame queue\n");
-                rs2_release_frame(fr);
-                rs2_release_frame(frames);
-                return 1;
-            }
-
-            dbuf = (uint16_t*)(rs2_get_frame_data(fr, &e));
-            if (check_error(e) != 0) {
-                fprintf(stderr, "Failed getting depth frame\n");
-                rs2_release_frame(fr);
-                rs2_release_frame(frames);
-                return 1;
-            }
-
-            memcpy(dep, dbuf, dep_bytes);
-
-            int y = 0;
-            int x = 0;
-            uint16_t depval;
-            for (y = 0; y < cDepthH; y++)
-            {
-                for (x = 0; x < cDepthW; x++)
-                {
-                    depval = lerp(0, 255, dep[y * cDepthW + x] / 10000.f);
-
-                    dep_rgb[y * cDepthW + x].r = (uint8_t)depval;
-                    dep_rgb[y * cDepthW + x].g = (uint8_t)depval;
-                    dep_rgb[y * cDepthW + x].b = (uint8_t)depval;
-                    dep_rgb[y * cDepthW + x].a = 255;
-                }
-            }
-            *got_dep = 1;
-        }
-        else
-        {
-            col_buf = (uint8_t*)(rs2_get_frame_data(fr, &e));
-            if (check_error(e) != 0) {
-                fprintf(stderr, "Failed getting color frame\n");
-                return 1;
-            }
-
-            int x, y;
-            for (y = 0; y < cColorH; y++)
-            {
-                for (x = 0; x < cColorW; x++)
-                {
-                    col[y * cColorW + x].r = col_buf[3 * (y * cColorW + x) + 0];
-                    col[y * cColorW + x].g = col_buf[3 * (y * cColorW + x) + 1];
-                    col[y * cColorW + x].b = col_buf[3 * (y * cColorW + x) + 2];
-                    col[y * cColorW + x].a = 255;
-                }
-            }
-
-            *got_col = 1;
+            colorize_free(&colorizer);
+            align_free(&aligner);
+            thread_pool_free(&row_threads);
+            pointcloud_free(&pointcloud);
+            destroy_display(&tex, sdlren, sdlwin);
+            SDL_Quit();
+            return 1;
         }
 
-        rs2_release_frame(fr);
-    }
-
-    rs2_release_frame(frames);
-    return 0;
-}
-
-#ifdef WIN32
-int8_t sigint_handler(DWORD fdwCtrlType) {
-    if(fdwCtrlType == CTRL_C_EVENT) {
-        fprintf(stderr, "got signal: %d\n", fdwCtrlType);
-        got_sigint = 1;
-        return 0;
+        delivery.mode = STREAM_DELIVERY_CALLBACK;
+        delivery.callback = pipeline_frame_callback;
+        delivery.user = &pipeline;
     }
-
-    return 1;
-}
 #else
-void sigint_handler(int sig)
-{
-    fprintf(stderr, "got sigint\n");
-    got_sigint = 1;
-}
+    delivery.mode = STREAM_DELIVERY_QUEUE;
+    delivery.frame_queue_size = FRAME_QUEUE_SIZE;
 #endif
-
-int main(int argc,  char** argv)
-{
-#ifdef WIN32
-    SetConsoleCtrlHandler( (PHANDLER_ROUTINE) sigint_handler, TRUE );
-#else
-    signal(SIGINT, sigint_handler);
 #endif
 
-    SDL_SetMainReady();
+    if (use_postprocess)
+    {
+        postprocess_config.queue_size = FRAME_QUEUE_SIZE;
+        if (postprocess_start(&postprocess, &postprocess_config, &rs_state) != 0)
+        {
+            colorize_free(&colorizer);
+            align_free(&aligner);
+            thread_pool_free(&row_threads);
+            pointcloud_free(&pointcloud);
+            destroy_display(&tex, sdlren, sdlwin);
+            SDL_Quit();
+            return 1;
+        }
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-        fprintf(stderr, "Failed initting SDLL: %s\n", SDL_GetError());
-        return 1;
+        delivery.mode = STREAM_DELIVERY_CALLBACK;
+        delivery.callback = postprocess_frame_callback;
+        delivery.user = &postprocess;
     }
 
-    SDL_Window* sdlwin = SDL_CreateWindow("rs2", 510, 510, cDepthW, cDepthH, SDL_WINDOW_SHOWN);
-    if (sdlwin == NULL)
+    if (recorder_config.path != NULL && recorder_start(&recorder, &recorder_config, &rs_state) != 0)
     {
-        fprintf(stderr, "failed creating SDL window\n");
+        colorize_free(&colorizer);
+        align_free(&aligner);
+        thread_pool_free(&row_threads);
+        pointcloud_free(&pointcloud);
+        destroy_display(&tex, sdlren, sdlwin);
         SDL_Quit();
         return 1;
     }
 
-    SDL_Renderer* sdlren = SDL_CreateRenderer(sdlwin, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (sdlren == NULL)
+    if (publish && publisher_start(&publisher, &publisher_config, &rs_state) != 0)
     {
-        fprintf(stderr, "Failed creating SDL renderer: %s\n", SDL_GetError());
-        SDL_DestroyWindow(sdlwin);
+        recorder_stop(&recorder);
+        colorize_free(&colorizer);
+        align_free(&aligner);
+        thread_pool_free(&row_threads);
+        pointcloud_free(&pointcloud);
+        destroy_display(&tex, sdlren, sdlwin);
         SDL_Quit();
         return 1;
     }
 
-    struct RS_State rs_state;
-    memset(&rs_state, 0, sizeof(rs_state));
-
-    fprintf(stderr, "Ensuring advanced mode is enabled\n");
+    fprintf(stderr, "Starting sensor\n");
 
-    if (ensure_advanced(&rs_state) != 0)
+    if (start_sensor(&rs_state, 0, 0, &stream_config, &delivery) != 0)
     {
-        fprintf(stderr, "Ensuring advanced mode failed\n");
+        clear_state(&rs_state);
+        recorder_stop(&recorder);
+        publisher_stop(&publisher);
+        colorize_free(&colorizer);
+        align_free(&aligner);
+        thread_pool_free(&row_threads);
+        pointcloud_free(&pointcloud);
+        destroy_display(&tex, sdlren, sdlwin);
+        SDL_Quit();
         return 1;
     }
 
-    fprintf(stderr, "Starting sensor\n");
-
-    if (start_sensor(&rs_state, 0, 0) != 0)
-        return 1;
-
     fprintf(stderr, "Sensor started\n");
+    fprintf(stderr, "startup: sensor started after %.1f ms\n", elapsed_ms(startup_begin));
 
-    uint16_t* dep;
-    struct RGBA* dep_rgb;
-    struct RGBA* col;
-
-    const int dep_bytes = cDepthW * cDepthH * sizeof(uint16_t);
-    const int dep_bytes_rgb = cDepthW * cDepthH * sizeof(struct RGBA);
-    const int col_bytes = cColorW * cColorH * sizeof(struct RGBA);
-
-    dep = (uint16_t*)malloc(dep_bytes);
-    dep_rgb = (struct RGBA*)malloc(dep_bytes_rgb);
-    col = (struct RGBA*)malloc(col_bytes);
-
-    memset(dep, 0, dep_bytes);
-    memset(dep_rgb, 0, dep_bytes_rgb);
-    memset(col, 0, col_bytes);
-
-#ifdef RENDER_DEPTH
-    SDL_Surface* surf = SDL_CreateRGBSurfaceFrom((void*)dep_rgb, cDepthW, cDepthH, 32, cDepthW*3,
-                             0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
+#ifdef THREADED_PIPELINE
+#ifdef CAPTURE_CALLBACK
+    // Behind the filters the pipeline reads their output queue instead of being called back
+    const int8_t pipeline_after_sensor = use_postprocess;
 #else
-    SDL_Surface* surf = SDL_CreateRGBSurfaceFrom((void*)col, cColorW, cColorH, 32, cColorW*3,
-                             0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
+    const int8_t pipeline_after_sensor = 1;
 #endif
-
-    if (surf == NULL)
-    {
-        fprintf(stderr, "Failed creating surface: %s\n", SDL_GetError());
-        SDL_DestroyRenderer(sdlren);
-        SDL_DestroyWindow(sdlwin);
-        SDL_Quit();
-        return 1;
-    }
-
-    SDL_Texture* tex = SDL_CreateTextureFromSurface(sdlren, surf);
-
-    if (tex == NULL)
+    if (pipeline_after_sensor &&
+        pipeline_start(&pipeline, &pipeline_config, &rs_state, &colorizer, &expander, &aligner) != 0)
     {
-        fprintf(stderr, "Failed creating sdl texture: %s\n", SDL_GetError());
-        SDL_FreeSurface(surf);
-        SDL_DestroyRenderer(sdlren);
-        SDL_DestroyWindow(sdlwin);
+        clear_state(&rs_state);
+        recorder_stop(&recorder);
+        publisher_stop(&publisher);
+        colorize_free(&colorizer);
+        align_free(&aligner);
+        thread_pool_free(&row_threads);
+        pointcloud_free(&pointcloud);
+        destroy_display(&tex, sdlren, sdlwin);
         SDL_Quit();
         return 1;
     }
+#endif
 
-
-    uint32_t format;
-    int access;
-    int w;
-    int h;
-    if (SDL_QueryTexture(tex, &format, &access, &w, &h) != 0)
+    // Frames sent before the pipeline streams would be dropped
+    if (use_synthetic && synthetic_start(&synthetic) != 0)
     {
-        fprintf(stderr, "query tex failed: %s\n", SDL_GetError());
-        SDL_DestroyTexture(tex);
-        SDL_FreeSurface(surf);
-        SDL_DestroyRenderer(sdlren);
-        SDL_DestroyWindow(sdlwin);
+        stop_stream(&rs_state);
+        if (use_postprocess)
+            postprocess_stop(&postprocess);
+#ifdef THREADED_PIPELINE
+        pipeline_stop(&pipeline);
+#endif
+        clear_state(&rs_state);
+        recorder_stop(&recorder);
+        publisher_stop(&publisher);
+        synthetic_destroy(&synthetic);
+        colorize_free(&colorizer);
+        align_free(&aligner);
+        thread_pool_free(&row_threads);
+        pointcloud_free(&pointcloud);
+        destroy_display(&tex, sdlren, sdlwin);
         SDL_Quit();
         return 1;
     }
 
-    // This should be ARGB
-    fprintf(stderr, "format: %s\n", SDL_GetPixelFormatName(format));
-
     int count = 0;
     int preset_index = 0;
+    // Frame buffers the heap had to provide before streaming settled
+    int startup_heap_allocs = 0;
+    Uint64 first_frame_time = 0;
 
+#ifndef THREADED_PIPELINE
     int8_t got_dep = 0;
     int8_t got_col = 0;
+    // update() keeps the last frame of a stream until a new one arrives
+    unsigned long long recorded_dep = 0;
+    unsigned long long recorded_col = 0;
+    unsigned long long published_dep = 0;
+    unsigned long long published_col = 0;
+    // Last frame converted into the texture, which keeps it until the next
+    unsigned long long shown_number = 0;
+#endif
 
     int8_t running = 1;
 
+#ifdef THREADED_PIPELINE
+    struct Renderer renderer;
+    memset(&renderer, 0, sizeof(renderer));
+    if (headless == 0)
+    {
+        struct RendererConfig renderer_config;
+        memset(&renderer_config, 0, sizeof(renderer_config));
+        renderer_config.window = sdlwin;
+        renderer_config.format = tex_format;
+        renderer_config.width = tex_w;
+        renderer_config.height = tex_h;
+        renderer_config.vsync = 1;
+
+        if (renderer_start(&renderer, &renderer_config) != 0)
+            running = 0;
+    }
+#endif
+
+    if (metrics_spec != NULL)
+    {
+#ifdef THREADED_PIPELINE
+        metrics_add_collector(&metrics, pipeline_write_metrics, &pipeline);
+        if (headless == 0)
+            metrics_add_collector(&metrics, renderer_write_metrics, &renderer);
+#endif
+        if (metrics_start(&metrics) != 0)
+            running = 0;
+    }
+
+    // Only reported here, `make preset_bench` fails on switches that pause frames too long
+    struct PresetSwitch preset_switch;
+    preset_switch_init(&preset_switch, 0.0);
+
     while (running == 1)
     {
-        if (update(&rs_state, dep, dep_rgb, col, &got_dep, &got_col) != 0) {
-            fprintf(stderr, "sensor update failed\n");
+        // What gets shown this iteration
+        struct FrameHandle* frame_dep = &dep;
+#ifdef RENDER_DEPTH
+        struct RGBA* frame_aligned = aligned;
+#else
+        struct FrameHandle* frame_col = &col_frame;
+#endif
+
+        if (trace_dump_pending())
+            trace_dump(trace_path != NULL ? trace_path : TRACE_DEFAULT_PATH);
+
+        if (use_postprocess && postprocess_failed(&postprocess)) {
+            fprintf(stderr, "post-processing failed\n");
+            running = 0;
+            continue;
+        }
+
+#ifdef THREADED_PIPELINE
+        // Behind vsync the present paces the loop, so it only takes a job that is ready
+        const int8_t paced = headless == 0 && renderer.vsync;
+        struct PipelineJob* job = pipeline_next(&pipeline, paced ? 0 : 100);
+        if (pipeline_failed(&pipeline)) {
+            fprintf(stderr, "pipeline failed\n");
             running = 0;
             continue;
         }
 
+        if (job == NULL) {
+            if (playback_finished(&rs_state)) {
+                fprintf(stderr, "playback finished\n");
+                running = 0;
+            }
+
+            if (got_sigint != 0)
+                running = 0;
+
+            // Keeps the window refreshed, and waits out the vblank
+            if (paced && running && renderer_present(&renderer) != 0)
+                running = 0;
+            continue;
+        }
+
+        frame_dep = &job->dep;
+#ifdef RENDER_DEPTH
+        frame_aligned = job->aligned;
+#else
+        frame_col = &job->col_frame;
+#endif
+#else
+        // A window gets the shown stream converted straight into its texture below
+#ifdef RENDER_DEPTH
+        if (update(&rs_state, &colorizer, &expander, &row_threads, &dep, headless ? dep_rgb : NULL,
+                   &col_frame, col, &got_dep, &got_col) != 0) {
+#else
+        if (update(&rs_state, &colorizer, &expander, &row_threads, &dep, dep_rgb,
+                   &col_frame, headless ? col : NULL, &got_dep, &got_col) != 0) {
+#endif
+            if (playback_finished(&rs_state))
+                fprintf(stderr, "playback finished\n");
+            else
+                fprintf(stderr, "sensor update failed\n");
+            running = 0;
+            continue;
+        }
+
+        if (got_dep && align_frames(&aligner, &colorizer, &dep, got_col ? &col_frame : NULL,
+                                    aligned_depth, aligned) != 0) {
+            running = 0;
+            continue;
+        }
+
+        if (recorder_config.path != NULL) {
+            if (got_dep && dep.number != recorded_dep) {
+                recorder_submit(&recorder, &dep, RECORDING_STREAM_DEPTH);
+                recorded_dep = dep.number;
+            }
+            if (got_col && col_frame.number != recorded_col) {
+                recorder_submit(&recorder, &col_frame, RECORDING_STREAM_COLOR);
+                recorded_col = col_frame.number;
+            }
+        }
+
+        if (publish) {
+            if (got_dep && dep.number != published_dep) {
+                publisher_submit(&publisher, &dep, RECORDING_STREAM_DEPTH);
+                published_dep = dep.number;
+            }
+            if (got_col && col_frame.number != published_col) {
+                publisher_submit(&publisher, &col_frame, RECORDING_STREAM_COLOR);
+                published_col = col_frame.number;
+            }
+        }
+#endif
+
+        if (preset_switch_frame(&preset_switch, frame_dep))
+            fprintf(stderr, "preset switch to %s: %.1f ms gap, %llu frames missing, depth frame %llu -> %llu\n",
+                    presets[preset_index], preset_switch.gap_ms, preset_switch.missing, preset_switch.first_number,
+                    frame_dep->number);
+
+        if (use_pointcloud && pointcloud_compute(&pointcloud, frame_dep) != 0) {
+            running = 0;
+            continue;
+        }
+
+        if (recorder_config.path != NULL && recorder_failed(&recorder)) {
+            fprintf(stderr, "recording failed\n");
+            running = 0;
+            continue;
+        }
+
+        if (count == 0) {
+            fprintf(stderr, "startup: first frame after %.1f ms\n", elapsed_ms(startup_begin));
+            startup_heap_allocs = frame_pool_heap_allocs(&frame_pool);
+            first_frame_time = SDL_GetPerformanceCounter();
+        }
+
         count++;
         if (count % 15 == 0)
             fprintf(stderr, "%d\n", count);
 
-        if (count % 100 == 0)
+        if (count % 300 == 0 && use_pointcloud)
+            fprintf(stderr, "point cloud: %d points from %dx%d depth\n", pointcloud.count, pointcloud.width, pointcloud.height);
+
+#ifdef THREADED_PIPELINE
+        if (count % 300 == 0)
+            pipeline_print_stats(&pipeline);
+#endif
+        if (count % 300 == 0 && use_postprocess)
+            postprocess_print_stats(&postprocess);
+
+        if (count % 100 == 0 && rs_state.playback == 0 && rs_state.synthetic == 0)
         {
             preset_index++;
             if (preset_index >= PRESET_COUNT)
                 preset_index = 0;
 
-            if (clear_state(&rs_state)) {
+            if (preset_switch_start(&preset_switch, &rs_state, presets[preset_index], frame_dep) != 0) {
                 running = 0;
                 continue;
             }
+        }
 
-            if (start_sensor(&rs_state, 0, preset_index) != 0) {
-                running = 0;
-                continue;
-            }
+#ifdef THREADED_PIPELINE
+        if (renderer_failed(&renderer)) {
+            fprintf(stderr, "rendering failed\n");
+            pipeline_done(&pipeline, job);
+            running = 0;
+            continue;
         }
 
+        // The workers keep converting while this waits for vblank
+        int8_t show_failed = 0;
 #ifdef RENDER_DEPTH
-        if (SDL_UpdateTexture(tex, NULL, (void*)dep_rgb, cDepthW * 4) != 0)
+        // The aligned view replaces plain depth when aligning, the workers
+        // leave plain depth to be colorized straight into the texture
+        if (headless == 0 && frame_dep->data != NULL && align_mode != ALIGN_NONE)
+        {
+            struct RendererFrame shown;
+            shown.pixels = frame_aligned;
+            align_output_size(&aligner, frame_dep->width, frame_dep->height, &shown.width, &shown.height);
+            shown.pitch = shown.width * 4;
+            shown.stream = TRACE_STREAM_DEPTH;
+            shown.number = frame_dep->number;
+            show_failed = renderer_show(&renderer, &shown);
+        }
+        else if (headless == 0 && frame_dep->data != NULL)
+        {
+            void* pixels;
+            int pitch;
+            show_failed = renderer_lock(&renderer, frame_dep->width, frame_dep->height, &pixels, &pitch);
+            if (show_failed == 0) {
+                colorize_rows(&colorizer, &row_threads, frame_dep, pixels, pitch);
+                show_failed = renderer_unlock(&renderer, TRACE_STREAM_DEPTH, frame_dep->number);
+            }
+        }
 #else
-        if (SDL_UpdateTexture(tex, NULL, (void*)col, cColorW * 4) != 0)
+        // Direct RGBA formats are uploaded from the frame itself, RGB8 is
+        // left by the workers to be expanded straight into the texture
+        if (headless == 0 && frame_col->data != NULL && color_format != RS2_FORMAT_RGB8)
+        {
+            struct RendererFrame shown;
+            shown.pixels = frame_col->data;
+            shown.pitch = frame_col->stride;
+            shown.width = color_w;
+            shown.height = color_h;
+            shown.stream = TRACE_STREAM_COLOR;
+            shown.number = frame_col->number;
+            show_failed = renderer_show(&renderer, &shown);
+        }
+        else if (headless == 0 && frame_col->data != NULL)
+        {
+            void* pixels;
+            int pitch;
+            show_failed = renderer_lock(&renderer, color_w, color_h, &pixels, &pitch);
+            if (show_failed == 0) {
+                rgb_expand_rows(&expander, &row_threads, frame_col, pixels, pitch);
+                show_failed = renderer_unlock(&renderer, TRACE_STREAM_COLOR, frame_col->number);
+            }
+        }
 #endif
+        if (show_failed)
+            running = 0;
+        pipeline_done(&pipeline, job);
+#else
+        int8_t upload_failed = 0;
+#ifdef RENDER_DEPTH
+        // The aligned view replaces plain depth when aligning
+        int show_w = frame_dep->width;
+        int show_h = frame_dep->height;
+        if (align_mode != ALIGN_NONE)
+            align_output_size(&aligner, frame_dep->width, frame_dep->height, &show_w, &show_h);
+
+        // Decimated depth is smaller than the resolved profile, the texture follows the frames
+        if (headless == 0 && frame_dep->data != NULL && stream_texture_resize(&tex, show_w, show_h) != 0) {
+            running = 0;
+            continue;
+        }
+
+        if (headless == 0 && frame_dep->data != NULL && align_mode != ALIGN_NONE)
+            upload_failed = stream_texture_upload(&tex, frame_aligned, show_w * 4);
+        else if (headless == 0 && frame_dep->data != NULL && frame_dep->number != shown_number)
+        {
+            void* pixels;
+            int pitch;
+            upload_failed = stream_texture_lock(&tex, &pixels, &pitch);
+            if (upload_failed == 0) {
+                colorize_rows(&colorizer, &row_threads, frame_dep, pixels, pitch);
+                stream_texture_unlock(&tex);
+                shown_number = frame_dep->number;
+            }
+        }
+#else
+        // Direct RGBA formats are uploaded from the frame itself
+        if (headless == 0 && frame_col->data != NULL && color_format != RS2_FORMAT_RGB8)
+            upload_failed = stream_texture_upload(&tex, frame_col->data, frame_col->stride);
+        else if (headless == 0 && frame_col->data != NULL && frame_col->number != shown_number)
         {
-            fprintf(stderr, "Failed updating texture: %s\n", SDL_GetError());
+            void* pixels;
+            int pitch;
+            upload_failed = stream_texture_lock(&tex, &pixels, &pitch);
+            if (upload_failed == 0) {
+                rgb_expand_rows(&expander, &row_threads, frame_col, pixels, pitch);
+                stream_texture_unlock(&tex);
+                shown_number = frame_col->number;
+            }
+        }
+#endif
+        if (upload_failed) {
             running = 0;
             continue;
         }
 
-        SDL_RenderClear(sdlren);
-        SDL_RenderCopy(sdlren, tex, NULL, NULL);
-        SDL_RenderPresent(sdlren);
+        if (headless == 0) {
+            Uint64 present_begin = SDL_GetPerformanceCounter();
+            SDL_RenderClear(sdlren);
+            SDL_RenderCopy(sdlren, tex.tex, NULL, NULL);
+            SDL_RenderPresent(sdlren);
+#ifdef RENDER_DEPTH
+            trace_span(TRACE_PRESENT, TRACE_STREAM_DEPTH, present_begin, frame_dep->number);
+#else
+            trace_span(TRACE_PRESENT, TRACE_STREAM_COLOR, present_begin, frame_col->number);
+#endif
+        }
+#endif
 
         if (got_sigint != 0)
             running = 0;
     }
 
+    // Headless, this does not depend on the display
+    if (count > 1) {
+        const double seconds = elapsed_ms(first_frame_time) / 1000.0;
+        fprintf(stderr, "processed %d frames in %.1f s, %.1f fps\n", count, seconds, (count - 1) / seconds);
+    }
+
+    if (preset_switch.switches > 0)
+        preset_switch_print_stats(&preset_switch);
+
+    // The collectors read the pipeline and renderer, which are stopped below
+    if (metrics_spec != NULL) {
+        metrics_print_stats(&metrics);
+        metrics_stop(&metrics);
+    }
+
+    synthetic_stop(&synthetic);
+
+    // No more framesets may arrive while the filters and pipeline are torn down
+    stop_stream(&rs_state);
+
+    if (use_postprocess) {
+        postprocess_print_stats(&postprocess);
+        postprocess_stop(&postprocess);
+    }
+
+#ifdef THREADED_PIPELINE
+    if (headless == 0) {
+        renderer_print_stats(&renderer);
+        renderer_stop(&renderer);
+    }
+
+    pipeline_print_stats(&pipeline);
+    pipeline_stop(&pipeline);
+#endif
+
+    // Everything the pipeline submitted is written before the index goes out
+    if (recorder_config.path != NULL) {
+        if (recorder_stop(&recorder) != 0)
+            fprintf(stderr, "Failed finishing recording %s\n", recorder_config.path);
+        recorder_print_stats(&recorder);
+    }
+
+    // The pipeline workers publishing are gone, readers still mapping the segment see it close
+    if (publish) {
+        publisher_print_stats(&publisher);
+        publisher_stop(&publisher);
+    }
+
+    align_free(&aligner);
+    thread_pool_print_stats(&row_threads);
+    thread_pool_free(&row_threads);
+    pointcloud_free(&pointcloud);
+
+    frame_handle_release(&dep);
+    frame_handle_release(&col_frame);
+
     clear_state(&rs_state);
 
-    free(dep);
-    free(dep_rgb);
-    free(col);
+    // Every frame pointing into the synthetic patterns is released by now
+    synthetic_destroy(&synthetic);
+
+    frame_pool_print_stats(&frame_pool);
+    fprintf(stderr, "%d frame buffer heap allocations after the first frame\n",
+            frame_pool_heap_allocs(&frame_pool) - startup_heap_allocs);
+
+    frame_pool_release(&frame_pool, dep_rgb);
+    frame_pool_release(&frame_pool, col);
+    frame_pool_release(&frame_pool, aligned_depth);
+    frame_pool_release(&frame_pool, aligned);
+    frame_pool_free(&frame_pool);
 
-    SDL_DestroyTexture(tex);
-    SDL_FreeSurface(surf);
-    SDL_DestroyRenderer(sdlren);
-    SDL_DestroyWindow(sdlwin);
+    colorize_print_stats(&colorizer);
+
+    trace_print_stats();
+    if (trace_path != NULL)
+        trace_dump(trace_path);
+    colorize_free(&colorizer);
+
+    destroy_display(&tex, sdlren, sdlwin);
     SDL_Quit();
+
     return 0;
 }
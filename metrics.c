@@ -0,0 +1,586 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+typedef SOCKET metrics_socket;
+#define METRICS_INVALID_SOCKET ((intptr_t)INVALID_SOCKET)
+#define close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+typedef int metrics_socket;
+#define METRICS_INVALID_SOCKET ((intptr_t)-1)
+#define close_socket close
+#endif
+
+static const char* stream_names[TRACE_STREAM_COUNT] = {
+    "depth",
+    "color"
+};
+
+static const double bucket_ms[METRICS_LATENCY_BUCKETS] = METRICS_LATENCY_BUCKET_MS;
+
+struct StreamCounters
+{
+    uint64_t frames;
+    Uint64 last_arrival;
+    // Running average of the time between arrivals
+    double interval_s;
+    int8_t host_clock;
+
+    // Lowest host minus hardware timestamp seen, the zero of hardware latencies
+    double min_offset_ms;
+    int8_t has_offset;
+
+    // Per bucket, not cumulative, the last one is +Inf
+    uint64_t latency_buckets[METRICS_LATENCY_BUCKETS + 1];
+    uint64_t latency_count;
+    double latency_sum_ms;
+    uint64_t latency_out_of_range;
+};
+
+struct StreamMetrics
+{
+    SDL_SpinLock lock;
+    struct StreamCounters c;
+};
+
+static struct StreamMetrics streams[TRACE_STREAM_COUNT];
+
+// Host milliseconds since the epoch, the clock of the system and global time domains
+static double wall_clock_ms(void)
+{
+#ifdef WIN32
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    const uint64_t t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    // 100 ns steps since 1601
+    return (double)(t - 116444736000000000ULL) / 10000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+#endif
+}
+
+void metrics_frame_arrival(enum TraceStream stream, double sensor_ms, int8_t host_clock)
+{
+    const Uint64 now = SDL_GetPerformanceCounter();
+    // Any host clock does against a hardware clock, only the differences count
+    const double host_ms = host_clock ? wall_clock_ms() : (double)now * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    const double offset = host_ms - sensor_ms;
+
+    struct StreamCounters* s = &streams[stream].c;
+    SDL_AtomicLock(&streams[stream].lock);
+
+    if (s->last_arrival != 0) {
+        const double interval = (double)(now - s->last_arrival) / (double)SDL_GetPerformanceFrequency();
+        if (s->interval_s == 0.0)
+            s->interval_s = interval;
+        else
+            s->interval_s += (interval - s->interval_s) / (1 << METRICS_FPS_DECAY_SHIFT);
+    }
+    s->last_arrival = now;
+    s->frames++;
+
+    if (s->host_clock != host_clock)
+        s->has_offset = 0;
+    s->host_clock = host_clock;
+
+    double latency = offset;
+    if (host_clock == 0) {
+        // A device clock that wrapped or a camera that restarted moves the offset for good
+        if (s->has_offset == 0 || offset < s->min_offset_ms || offset - s->min_offset_ms > METRICS_LATENCY_VALID_MS) {
+            s->min_offset_ms = offset;
+            s->has_offset = 1;
+        }
+        latency = offset - s->min_offset_ms;
+    }
+
+    if (latency < 0.0 || latency > METRICS_LATENCY_VALID_MS) {
+        s->latency_out_of_range++;
+    }
+    else {
+        int b = 0;
+        while (b < METRICS_LATENCY_BUCKETS && latency > bucket_ms[b])
+            b++;
+        s->latency_buckets[b]++;
+        s->latency_count++;
+        s->latency_sum_ms += latency;
+    }
+
+    SDL_AtomicUnlock(&streams[stream].lock);
+}
+
+void metrics_printf(struct MetricsText* out, const char* format, ...)
+{
+    if (out->failed)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->data + out->len, out->cap - out->len, format, args);
+    va_end(args);
+
+    if (n < 0) {
+        out->failed = 1;
+        return;
+    }
+
+    if ((size_t)n >= out->cap - out->len) {
+        size_t cap = out->cap * 2;
+        while (cap - out->len <= (size_t)n)
+            cap *= 2;
+
+        char* data = (char*)realloc(out->data, cap);
+        if (data == NULL) {
+            out->failed = 1;
+            return;
+        }
+        out->data = data;
+        out->cap = cap;
+
+        va_start(args, format);
+        vsnprintf(out->data + out->len, out->cap - out->len, format, args);
+        va_end(args);
+    }
+
+    out->len += (size_t)n;
+}
+
+void metrics_family(struct MetricsText* out, const char* name, const char* type, const char* help)
+{
+    metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_stages(struct MetricsText* out, const char* prefix, const char* help, const char* const* names,
+                    struct StageStats* const* stats, int count)
+{
+    uint64_t counts[16];
+    uint64_t totals[16];
+    uint64_t maxes[16];
+    char name[96];
+    int i;
+
+    if (count > 16)
+        count = 16;
+    for (i = 0; i < count; i++)
+        stage_stats_get(stats[i], &counts[i], &totals[i], &maxes[i]);
+
+    snprintf(name, sizeof(name), "%s_seconds", prefix);
+    metrics_family(out, name, "summary", help);
+    for (i = 0; i < count; i++) {
+        metrics_printf(out, "%s_sum{stage=\"%s\"} %.6f\n", name, names[i], (double)totals[i] / 1e6);
+        metrics_printf(out, "%s_count{stage=\"%s\"} %llu\n", name, names[i], (unsigned long long)counts[i]);
+    }
+
+    snprintf(name, sizeof(name), "%s_max_seconds", prefix);
+    metrics_family(out, name, "gauge", "Longest duration seen");
+    for (i = 0; i < count; i++)
+        metrics_printf(out, "%s{stage=\"%s\"} %.6f\n", name, names[i], (double)maxes[i] / 1e6);
+}
+
+static void write_streams(struct MetricsText* out)
+{
+    struct StreamCounters copy[TRACE_STREAM_COUNT];
+    int s;
+    int b;
+
+    for (s = 0; s < TRACE_STREAM_COUNT; s++) {
+        SDL_AtomicLock(&streams[s].lock);
+        copy[s] = streams[s].c;
+        SDL_AtomicUnlock(&streams[s].lock);
+    }
+
+    const Uint64 now = SDL_GetPerformanceCounter();
+    const double freq = (double)SDL_GetPerformanceFrequency();
+
+    metrics_family(out, "rs2_frames_total", "counter", "Frames received");
+    for (s = 0; s < TRACE_STREAM_COUNT; s++)
+        metrics_printf(out, "rs2_frames_total{stream=\"%s\"} %llu\n", stream_names[s],
+                       (unsigned long long)copy[s].frames);
+
+    metrics_family(out, "rs2_frames_dropped_total", "counter", "Frames missing from gaps in the frame numbers");
+    for (s = 0; s < TRACE_STREAM_COUNT; s++)
+        metrics_printf(out, "rs2_frames_dropped_total{stream=\"%s\"} %d\n", stream_names[s],
+                       trace_dropped((enum TraceStream)s));
+
+    metrics_family(out, "rs2_fps", "gauge", "Running average of the arrival rate, 0 once the stream stalled");
+    for (s = 0; s < TRACE_STREAM_COUNT; s++) {
+        double fps = 0.0;
+        const double age = (double)(now - copy[s].last_arrival) / freq;
+        if (copy[s].interval_s > 0.0 && age < copy[s].interval_s * 2.0 + 1.0)
+            fps = 1.0 / copy[s].interval_s;
+        metrics_printf(out, "rs2_fps{stream=\"%s\"} %.3f\n", stream_names[s], fps);
+    }
+
+    metrics_family(out, "rs2_last_frame_age_seconds", "gauge", "Time since the last frame arrived");
+    for (s = 0; s < TRACE_STREAM_COUNT; s++) {
+        if (copy[s].last_arrival != 0)
+            metrics_printf(out, "rs2_last_frame_age_seconds{stream=\"%s\"} %.6f\n", stream_names[s],
+                           (double)(now - copy[s].last_arrival) / freq);
+    }
+
+    metrics_family(out, "rs2_sensor_latency_seconds", "histogram",
+                   "Frame timestamp until the frame is processed, above the lowest clock offset for hardware clocks");
+    for (s = 0; s < TRACE_STREAM_COUNT; s++) {
+        uint64_t cumulative = 0;
+        for (b = 0; b < METRICS_LATENCY_BUCKETS; b++) {
+            cumulative += copy[s].latency_buckets[b];
+            metrics_printf(out, "rs2_sensor_latency_seconds_bucket{stream=\"%s\",le=\"%g\"} %llu\n", stream_names[s],
+                           bucket_ms[b] / 1000.0, (unsigned long long)cumulative);
+        }
+        metrics_printf(out, "rs2_sensor_latency_seconds_bucket{stream=\"%s\",le=\"+Inf\"} %llu\n", stream_names[s],
+                       (unsigned long long)copy[s].latency_count);
+        metrics_printf(out, "rs2_sensor_latency_seconds_sum{stream=\"%s\"} %.6f\n", stream_names[s],
+                       copy[s].latency_sum_ms / 1000.0);
+        metrics_printf(out, "rs2_sensor_latency_seconds_count{stream=\"%s\"} %llu\n", stream_names[s],
+                       (unsigned long long)copy[s].latency_count);
+    }
+
+    metrics_family(out, "rs2_sensor_latency_out_of_range_total", "counter",
+                   "Frames whose timestamp was too far from the host clock to count");
+    for (s = 0; s < TRACE_STREAM_COUNT; s++)
+        metrics_printf(out, "rs2_sensor_latency_out_of_range_total{stream=\"%s\"} %llu\n", stream_names[s],
+                       (unsigned long long)copy[s].latency_out_of_range);
+
+    metrics_family(out, "rs2_sensor_host_clock", "gauge", "1 when frame timestamps are on the host clock");
+    for (s = 0; s < TRACE_STREAM_COUNT; s++)
+        metrics_printf(out, "rs2_sensor_host_clock{stream=\"%s\"} %d\n", stream_names[s], copy[s].host_clock);
+}
+
+int8_t metrics_parse_endpoint(struct MetricsServer* m, const char* spec)
+{
+    memset(m, 0, sizeof(struct MetricsServer));
+    m->listener = METRICS_INVALID_SOCKET;
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+#ifdef WIN32
+        fprintf(stderr, "Unix socket metrics endpoints are not supported on Windows\n");
+        return 1;
+#else
+        if (spec[5] == '\0' || strlen(spec + 5) >= sizeof(((struct sockaddr_un*)0)->sun_path)) {
+            fprintf(stderr, "Invalid metrics socket path %s\n", spec + 5);
+            return 1;
+        }
+        m->endpoint = METRICS_ENDPOINT_UNIX;
+        snprintf(m->address, sizeof(m->address), "%s", spec + 5);
+        return 0;
+#endif
+    }
+
+    m->endpoint = METRICS_ENDPOINT_TCP;
+    const char* colon = strrchr(spec, ':');
+    const char* port = spec;
+    // Loopback unless a host is given, the endpoint has no authentication
+    snprintf(m->address, sizeof(m->address), "127.0.0.1");
+    if (colon != NULL) {
+        if ((size_t)(colon - spec) >= sizeof(m->address) || colon == spec) {
+            fprintf(stderr, "Invalid metrics host in %s\n", spec);
+            return 1;
+        }
+        snprintf(m->address, sizeof(m->address), "%.*s", (int)(colon - spec), spec);
+        port = colon + 1;
+    }
+
+    char* end = NULL;
+    long p = strtol(port, &end, 10);
+    if (end == port || *end != '\0' || p <= 0 || p > 65535) {
+        fprintf(stderr, "Invalid metrics port in %s\n", spec);
+        return 1;
+    }
+    m->port = (int)p;
+    return 0;
+}
+
+int8_t metrics_add_collector(struct MetricsServer* m, metrics_collect_fn fn, void* user)
+{
+    if (m->collector_count >= METRICS_COLLECTORS_MAX) {
+        fprintf(stderr, "Too many metrics collectors, max %d\n", METRICS_COLLECTORS_MAX);
+        return 1;
+    }
+
+    m->collectors[m->collector_count] = fn;
+    m->collector_users[m->collector_count] = user;
+    m->collector_count++;
+    return 0;
+}
+
+static int8_t set_nonblocking(metrics_socket s)
+{
+#ifdef WIN32
+    u_long on = 1;
+    return ioctlsocket(s, FIONBIO, &on) != 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) != 0;
+#endif
+}
+
+// Waits up to timeout_ms for s to become readable or writable, 0 when it did
+static int8_t wait_socket(metrics_socket s, int8_t write, int timeout_ms)
+{
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(s, &set);
+
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    int ready = select((int)s + 1, write ? NULL : &set, write ? &set : NULL, NULL, &tv);
+    return ready > 0 ? 0 : 1;
+}
+
+static int8_t send_all(metrics_socket s, const char* data, size_t len, Uint32 deadline)
+{
+    while (len > 0)
+    {
+        const Sint32 left = (Sint32)(deadline - SDL_GetTicks());
+        if (left <= 0 || wait_socket(s, 1, left) != 0)
+            return 1;
+
+        int n = (int)send(s, data, (int)len, 0);
+        if (n <= 0)
+            return 1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void serve_client(struct MetricsServer* m, metrics_socket client)
+{
+    const Uint32 deadline = SDL_GetTicks() + METRICS_REQUEST_TIMEOUT_MS;
+    char request[1024];
+    int len = 0;
+
+    // Only the request line matters, read until the headers end
+    while (len < (int)sizeof(request) - 1)
+    {
+        const Sint32 left = (Sint32)(deadline - SDL_GetTicks());
+        if (left <= 0 || wait_socket(client, 0, left) != 0)
+            break;
+
+        int n = (int)recv(client, request + len, (int)sizeof(request) - 1 - len, 0);
+        if (n <= 0)
+            break;
+        len += n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+            break;
+    }
+    request[len] = '\0';
+
+    const char* status = "200 OK";
+    if (strncmp(request, "GET ", 4) != 0)
+        status = "405 Method Not Allowed";
+    else if (strncmp(request + 4, "/metrics", 8) != 0 && strncmp(request + 4, "/ ", 2) != 0)
+        status = "404 Not Found";
+
+    struct MetricsText body;
+    body.cap = 16384;
+    body.len = 0;
+    body.failed = 0;
+    body.data = (char*)malloc(body.cap);
+    if (body.data == NULL) {
+        SDL_AtomicAdd(&m->failed_scrapes, 1);
+        return;
+    }
+    body.data[0] = '\0';
+
+    if (strcmp(status, "200 OK") == 0) {
+        write_streams(&body);
+
+        int c;
+        for (c = 0; c < m->collector_count; c++)
+            m->collectors[c](&body, m->collector_users[c]);
+
+        metrics_family(&body, "rs2_metrics_scrapes_total", "counter", "Scrapes served before this one");
+        metrics_printf(&body, "rs2_metrics_scrapes_total %d\n", SDL_AtomicGet(&m->scrapes));
+
+        if (body.failed)
+            status = "500 Internal Server Error";
+    }
+
+    if (strcmp(status, "200 OK") != 0) {
+        body.failed = 0;
+        body.len = 0;
+        metrics_printf(&body, "%s\n", status);
+    }
+
+    char header[160];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %lu\r\nConnection: close\r\n\r\n",
+                              status, (unsigned long)body.len);
+
+    if (send_all(client, header, (size_t)header_len, deadline) != 0 ||
+        send_all(client, body.data, body.len, deadline) != 0 || strcmp(status, "200 OK") != 0)
+        SDL_AtomicAdd(&m->failed_scrapes, 1);
+    else
+        SDL_AtomicAdd(&m->scrapes, 1);
+
+    free(body.data);
+}
+
+static int metrics_thread(void* data)
+{
+    struct MetricsServer* m = (struct MetricsServer*)data;
+    const metrics_socket listener = (metrics_socket)m->listener;
+
+    trace_thread_name("metrics");
+
+    while (SDL_AtomicGet(&m->running))
+    {
+        if (wait_socket(listener, 0, METRICS_POLL_MS) != 0)
+            continue;
+
+        metrics_socket client = accept(listener, NULL, NULL);
+        if ((intptr_t)client == METRICS_INVALID_SOCKET)
+            continue;
+
+        // A scraper that stops reading or writing runs into the deadline instead of blocking
+        if (set_nonblocking(client) == 0)
+            serve_client(m, client);
+        close_socket(client);
+    }
+
+    return 0;
+}
+
+static int8_t open_listener(struct MetricsServer* m)
+{
+    metrics_socket s;
+
+#ifndef WIN32
+    if (m->endpoint == METRICS_ENDPOINT_UNIX) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", m->address);
+
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0) {
+            fprintf(stderr, "Failed creating metrics socket: %s\n", strerror(errno));
+            return 1;
+        }
+
+        // A socket left behind by an earlier run
+        unlink(m->address);
+        if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "Failed binding metrics socket %s: %s\n", m->address, strerror(errno));
+            close_socket(s);
+            return 1;
+        }
+    }
+    else
+#endif
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)m->port);
+        if (inet_pton(AF_INET, m->address, &addr.sin_addr) != 1) {
+            fprintf(stderr, "Invalid metrics address %s, expected an IPv4 address\n", m->address);
+            return 1;
+        }
+
+        s = socket(AF_INET, SOCK_STREAM, 0);
+        if ((intptr_t)s == METRICS_INVALID_SOCKET) {
+            fprintf(stderr, "Failed creating metrics socket\n");
+            return 1;
+        }
+
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+        if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "Failed binding metrics endpoint %s:%d\n", m->address, m->port);
+            close_socket(s);
+            return 1;
+        }
+    }
+
+    if (listen(s, 8) != 0 || set_nonblocking(s) != 0) {
+        fprintf(stderr, "Failed listening on metrics endpoint\n");
+        close_socket(s);
+        return 1;
+    }
+
+    m->listener = (intptr_t)s;
+    return 0;
+}
+
+int8_t metrics_start(struct MetricsServer* m)
+{
+#ifdef WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "Failed starting winsock\n");
+        return 1;
+    }
+#endif
+
+    if (open_listener(m) != 0) {
+#ifdef WIN32
+        WSACleanup();
+#endif
+        return 1;
+    }
+
+    SDL_AtomicSet(&m->running, 1);
+    m->thread = SDL_CreateThread(metrics_thread, "rs2 metrics", m);
+    if (m->thread == NULL) {
+        fprintf(stderr, "Failed creating metrics thread: %s\n", SDL_GetError());
+        metrics_stop(m);
+        return 1;
+    }
+
+    if (m->endpoint == METRICS_ENDPOINT_UNIX)
+        fprintf(stderr, "metrics served on unix:%s\n", m->address);
+    else
+        fprintf(stderr, "metrics served on http://%s:%d/metrics\n", m->address, m->port);
+    return 0;
+}
+
+void metrics_stop(struct MetricsServer* m)
+{
+    if (m == NULL || m->listener == METRICS_INVALID_SOCKET)
+        return;
+
+    SDL_AtomicSet(&m->running, 0);
+    if (m->thread) {
+        SDL_WaitThread(m->thread, NULL);
+        m->thread = NULL;
+    }
+
+    close_socket((metrics_socket)m->listener);
+    m->listener = METRICS_INVALID_SOCKET;
+
+#ifdef WIN32
+    WSACleanup();
+#else
+    if (m->endpoint == METRICS_ENDPOINT_UNIX)
+        unlink(m->address);
+#endif
+}
+
+void metrics_print_stats(struct MetricsServer* m)
+{
+    fprintf(stderr, "metrics: %d scrapes served, %d failed\n", SDL_AtomicGet(&m->scrapes),
+            SDL_AtomicGet(&m->failed_scrapes));
+}
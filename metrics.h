@@ -0,0 +1,110 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stage_stats.h"
+#include "trace.h"
+
+// Upper bounds of the latency histogram buckets in milliseconds, +Inf follows
+#define METRICS_LATENCY_BUCKETS 12
+#define METRICS_LATENCY_BUCKET_MS {1, 2, 5, 10, 15, 20, 33, 50, 100, 200, 500, 1000}
+
+// Latencies beyond this are clocks that do not match, e.g. a recording
+// played back, and are counted apart. A hardware clock offset is re-taken.
+#define METRICS_LATENCY_VALID_MS 10000
+
+// Each arrival keeps 1 - 1/2^shift of the frame interval average, about 16 frames of memory
+#define METRICS_FPS_DECAY_SHIFT 4
+
+#define METRICS_COLLECTORS_MAX 8
+
+// How long a scraper gets to send its request, the next one waits meanwhile
+#define METRICS_REQUEST_TIMEOUT_MS 500
+// Poll period of the server thread, bounds how long metrics_stop takes
+#define METRICS_POLL_MS 100
+
+#define METRICS_DEFAULT_PORT 9464
+
+// Exposition text being built for one scrape, only touched by the server thread
+struct MetricsText
+{
+    char* data;
+    size_t len;
+    size_t cap;
+    int8_t failed;
+};
+
+void metrics_printf(struct MetricsText* out, const char* format, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+// Writes a HELP and TYPE line
+void metrics_family(struct MetricsText* out, const char* name, const char* type, const char* help);
+
+// Stage durations as a prefix_seconds summary without quantiles and a
+// prefix_max_seconds gauge, one series per stage label
+void metrics_stages(struct MetricsText* out, const char* prefix, const char* help, const char* const* names,
+                    struct StageStats* const* stats, int count);
+
+// Called on the server thread for every scrape, has to be safe against the
+// threads updating whatever it reads
+typedef void (*metrics_collect_fn)(struct MetricsText* out, void* user);
+
+enum MetricsEndpoint
+{
+    METRICS_ENDPOINT_TCP,
+    METRICS_ENDPOINT_UNIX
+};
+
+// Serves the Prometheus text format over HTTP on a socket of its own thread.
+// Scrapes only read counters and copy stats under their spinlocks, a slow or
+// stuck scraper only ever delays other scrapers, never capture.
+struct MetricsServer
+{
+    enum MetricsEndpoint endpoint;
+    // Host and port for TCP, path for a Unix socket
+    char address[108];
+    int port;
+
+    intptr_t listener;
+    SDL_Thread* thread;
+    SDL_atomic_t running;
+
+    metrics_collect_fn collectors[METRICS_COLLECTORS_MAX];
+    void* collector_users[METRICS_COLLECTORS_MAX];
+    int collector_count;
+
+    SDL_atomic_t scrapes;
+    SDL_atomic_t failed_scrapes;
+};
+
+// Counts a frame out of a frameset. sensor_ms is its timestamp; with
+// host_clock set it is in host milliseconds since the epoch and the latency
+// is measured against the host clock. A hardware clock only gives the
+// latency above the lowest offset between both clocks seen so far.
+void metrics_frame_arrival(enum TraceStream stream, double sensor_ms, int8_t host_clock);
+
+// Clears m and parses "port", "host:port" or "unix:path" into it
+int8_t metrics_parse_endpoint(struct MetricsServer* m, const char* spec);
+
+// Collectors are added before metrics_start and called in order
+int8_t metrics_add_collector(struct MetricsServer* m, metrics_collect_fn fn, void* user);
+
+int8_t metrics_start(struct MetricsServer* m);
+
+// Stops the server thread, call before freeing whatever a collector reads
+void metrics_stop(struct MetricsServer* m);
+
+void metrics_print_stats(struct MetricsServer* m);
+
+#endif
@@ -3,10 +3,66 @@ CONFIG += console c++11
 CONFIG -= app_bundle
 CONFIG -= qt
 SOURCES += \
-    main.c
+    main.c \
+    affinity.c \
+    align.c \
+    colorize.c \
+    depth_codec.c \
+    frame_handle.c \
+    frame_pool.c \
+    frames.c \
+    metrics.c \
+    pipeline.c \
+    pointcloud.c \
+    postprocess.c \
+    preset_switch.c \
+    publisher.c \
+    recorder.c \
+    renderer.c \
+    rgb_expand.c \
+    ring_queue.c \
+    rs_error.c \
+    rs_state.c \
+    stage_stats.c \
+    stream_options.c \
+    stream_texture.c \
+    synthetic.c \
+    thread_pool.c \
+    trace.c
+
+HEADERS += \
+    affinity.h \
+    align.h \
+    colorize.h \
+    depth_codec.h \
+    frame_handle.h \
+    frame_pool.h \
+    frames.h \
+    metrics.h \
+    pipeline.h \
+    pointcloud.h \
+    postprocess.h \
+    preset_switch.h \
+    publisher.h \
+    recorder.h \
+    recording.h \
+    renderer.h \
+    rgb_expand.h \
+    ring_queue.h \
+    rs_error.h \
+    rs_state.h \
+    shm_frames.h \
+    stage_stats.h \
+    stream_options.h \
+    stream_texture.h \
+    synthetic.h \
+    thread_pool.h \
+    trace.h
 
 INCLUDEPATH += "C:\SDL2-2.0.7\include"
 LIBS += -L"C:\SDL2-2.0.7_msvc2017_64\Release" -lsdl2
 
 INCLUDEPATH += "C:\Program Files (x86)\Intel RealSense SDK 2.0\include"
 LIBS += -L"C:\Program Files (x86)\Intel RealSense SDK 2.0\lib\x64" -lrealsense2
+
+LIBS += -lws2_32
@@ -0,0 +1,407 @@
+#include "multicam.h"
+#include "affinity.h"
+#include "frames.h"
+#include "rs_error.h"
+
+#include <librealsense2/h/rs_option.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void multicam_default_config(struct MultiCamConfig* config)
+{
+    memset(config, 0, sizeof(struct MultiCamConfig));
+    config->tolerance_ms = MULTICAM_DEFAULT_TOLERANCE_MS;
+
+    int d;
+    for (d = 0; d < MULTICAM_DEVICES_MAX; d++)
+        config->cores[d] = -1;
+}
+
+int8_t multicam_add_all_devices(struct MultiCamConfig* config, const struct StreamConfig* base)
+{
+    // Serials outlive the query, the stream configs only point at them
+    static char serials[MULTICAM_DEVICES_MAX][RS_SERIAL_LEN];
+    rs2_error* e = NULL;
+
+    rs2_context* ctx = rs2_create_context(RS2_API_VERSION, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed creating rs context\n");
+        return 1;
+    }
+
+    int found = query_device_serials(ctx, serials, MULTICAM_DEVICES_MAX - config->count);
+    rs2_delete_context(ctx);
+    if (found < 0)
+        return 1;
+
+    if (found == 0) {
+        fprintf(stderr, "No RealSense devices connected\n");
+        return 1;
+    }
+
+    int i;
+    for (i = 0; i < found; i++)
+    {
+        struct StreamConfig* stream = &config->streams[config->count++];
+        *stream = *base;
+        stream->playback_file = NULL;
+        stream->serial = serials[i];
+    }
+
+    fprintf(stderr, "found %d devices\n", found);
+    return 0;
+}
+
+static void release_frame(struct MultiCamFrame* f)
+{
+    frame_handle_release(&f->dep);
+    frame_handle_release(&f->col);
+    f->got_dep = 0;
+    f->got_col = 0;
+}
+
+// Hardware timestamps of different devices only compare once librealsense maps them to host time
+static void enable_global_time(struct RS_State* s)
+{
+    int sensor;
+    for (sensor = 0; sensor < s->sensors_created; sensor++)
+    {
+        rs2_error* e = NULL;
+        const rs2_options* options = (const rs2_options*)s->sensors[sensor];
+
+        int supports = rs2_supports_option(options, RS2_OPTION_GLOBAL_TIME_ENABLED, &e);
+        if (check_error(e) != 0 || supports != 1)
+            continue;
+
+        rs2_set_option(options, RS2_OPTION_GLOBAL_TIME_ENABLED, 1.0f, &e);
+        if (check_error(e) != 0)
+            fprintf(stderr, "Failed enabling global time on sensor %d, timestamps may not match across devices\n", sensor);
+    }
+}
+
+static void queue_frame(struct MultiCamDevice* dev, struct MultiCamFrame* f)
+{
+    struct MultiCam* mc = dev->owner;
+
+    SDL_LockMutex(mc->lock);
+
+    if (mc->config.rebase_timestamps) {
+        if (dev->has_first == 0) {
+            dev->first_timestamp = f->timestamp;
+            dev->has_first = 1;
+        }
+        f->timestamp -= dev->first_timestamp;
+    }
+
+    // A consumer that falls behind loses the oldest framesets, as the pipeline does
+    if (dev->queued == MULTICAM_QUEUE_SIZE) {
+        release_frame(&dev->queue[dev->head]);
+        dev->head = (dev->head + 1) % MULTICAM_QUEUE_SIZE;
+        dev->queued--;
+        dev->overflowed++;
+    }
+
+    dev->queue[(dev->head + dev->queued) % MULTICAM_QUEUE_SIZE] = *f;
+    dev->queued++;
+    dev->captured++;
+
+    SDL_CondSignal(mc->arrived);
+    SDL_UnlockMutex(mc->lock);
+}
+
+static int capture_thread(void* data)
+{
+    struct MultiCamDevice* dev = (struct MultiCamDevice*)data;
+    struct MultiCam* mc = dev->owner;
+    rs2_error* e = NULL;
+
+    if (mc->config.cores[dev->index] >= 0)
+        affinity_pin_current_thread(mc->config.cores[dev->index]);
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    while (SDL_AtomicGet(&mc->running))
+    {
+        rs2_frame* frames = NULL;
+        if (rs2_try_wait_for_frame(dev->rs_state.frame_queue, 100, &frames, &e) == 0) {
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed waiting for frames from device %d\n", dev->index);
+                SDL_AtomicSet(&mc->failed, 1);
+                break;
+            }
+
+            if (playback_finished(&dev->rs_state)) {
+                SDL_AtomicSet(&dev->finished, 1);
+                SDL_LockMutex(mc->lock);
+                SDL_CondSignal(mc->arrived);
+                SDL_UnlockMutex(mc->lock);
+            }
+            continue;
+        }
+
+        struct MultiCamFrame f;
+        memset(&f, 0, sizeof(f));
+        if (extract_frames(frames, &f.dep, &f.col, &f.got_dep, &f.got_col) != 0) {
+            rs2_release_frame(frames);
+            SDL_AtomicSet(&mc->failed, 1);
+            break;
+        }
+        rs2_release_frame(frames);
+
+        if (f.got_dep == 0 && f.got_col == 0)
+            continue;
+
+        f.timestamp = f.got_dep ? f.dep.timestamp : f.col.timestamp;
+        queue_frame(dev, &f);
+    }
+
+    return 0;
+}
+
+int8_t multicam_start(struct MultiCam* mc, const struct MultiCamConfig* config)
+{
+    if (mc == NULL || config == NULL) {
+        fprintf(stderr, "Cannot start cameras: given pointer is null\n");
+        return 1;
+    }
+
+    if (config->count < 1 || config->count > MULTICAM_DEVICES_MAX) {
+        fprintf(stderr, "Cannot start %d cameras, 1 to %d are supported\n", config->count, MULTICAM_DEVICES_MAX);
+        return 1;
+    }
+
+    memset(mc, 0, sizeof(struct MultiCam));
+    mc->config = *config;
+    if (mc->config.tolerance_ms <= 0.0)
+        mc->config.tolerance_ms = MULTICAM_DEFAULT_TOLERANCE_MS;
+
+    mc->lock = SDL_CreateMutex();
+    mc->arrived = SDL_CreateCond();
+    if (mc->lock == NULL || mc->arrived == NULL) {
+        fprintf(stderr, "Failed creating merger lock: %s\n", SDL_GetError());
+        multicam_stop(mc);
+        return 1;
+    }
+
+    struct StreamDelivery delivery;
+    memset(&delivery, 0, sizeof(delivery));
+    delivery.mode = STREAM_DELIVERY_QUEUE;
+    delivery.frame_queue_size = MULTICAM_FRAME_QUEUE_SIZE;
+
+    SDL_AtomicSet(&mc->running, 1);
+
+    int d;
+    for (d = 0; d < mc->config.count; d++)
+    {
+        struct MultiCamDevice* dev = &mc->devices[d];
+        const struct StreamConfig* stream = &mc->config.streams[d];
+        dev->owner = mc;
+        dev->index = d;
+
+        // Every device gets a context, pipeline and frame queue of its own
+        if (start_sensor(&dev->rs_state, 0, 0, stream, &delivery) != 0) {
+            fprintf(stderr, "Failed starting device %d (%s)\n", d,
+                    stream->playback_file != NULL ? stream->playback_file : stream->serial != NULL ? stream->serial : "any");
+            multicam_stop(mc);
+            return 1;
+        }
+
+        if (dev->rs_state.playback == 0 && dev->rs_state.synthetic == 0)
+            enable_global_time(&dev->rs_state);
+
+        dev->thread = SDL_CreateThread(capture_thread, "rs2 multicam", dev);
+        if (dev->thread == NULL) {
+            fprintf(stderr, "Failed creating capture thread for device %d: %s\n", d, SDL_GetError());
+            multicam_stop(mc);
+            return 1;
+        }
+
+        const char* name = stream->playback_file != NULL ? stream->playback_file :
+                           stream->serial != NULL ? stream->serial : "any";
+        if (mc->config.cores[d] >= 0)
+            fprintf(stderr, "device %d: %s, capture thread on core %d\n", d, name, mc->config.cores[d]);
+        else
+            fprintf(stderr, "device %d: %s\n", d, name);
+    }
+
+    return 0;
+}
+
+void multicam_stop(struct MultiCam* mc)
+{
+    if (mc == NULL)
+        return;
+
+    SDL_AtomicSet(&mc->running, 0);
+
+    int d;
+    for (d = 0; d < MULTICAM_DEVICES_MAX; d++)
+    {
+        struct MultiCamDevice* dev = &mc->devices[d];
+        if (dev->thread) {
+            SDL_WaitThread(dev->thread, NULL);
+            dev->thread = NULL;
+        }
+
+        while (dev->queued > 0) {
+            release_frame(&dev->queue[dev->head]);
+            dev->head = (dev->head + 1) % MULTICAM_QUEUE_SIZE;
+            dev->queued--;
+        }
+
+        // Stops the pipeline before anything it delivers into goes away
+        clear_state(&dev->rs_state);
+    }
+
+    if (mc->arrived) {
+        SDL_DestroyCond(mc->arrived);
+        mc->arrived = NULL;
+    }
+    if (mc->lock) {
+        SDL_DestroyMutex(mc->lock);
+        mc->lock = NULL;
+    }
+}
+
+static struct MultiCamFrame* head_of(struct MultiCamDevice* dev)
+{
+    return &dev->queue[dev->head];
+}
+
+static void drop_head(struct MultiCamDevice* dev)
+{
+    release_frame(head_of(dev));
+    dev->head = (dev->head + 1) % MULTICAM_QUEUE_SIZE;
+    dev->queued--;
+    dev->unmatched++;
+}
+
+// Called with the lock held. Drops every head too old to ever be matched,
+// and returns 0 once the heads of all devices lie within the tolerance.
+static int8_t try_merge(struct MultiCam* mc, struct MultiCamSet* set)
+{
+    const int count = mc->config.count;
+    int d;
+
+    for (;;)
+    {
+        double newest = 0.0;
+        for (d = 0; d < count; d++)
+        {
+            struct MultiCamDevice* dev = &mc->devices[d];
+            if (dev->queued == 0)
+                return 1;
+            if (d == 0 || head_of(dev)->timestamp > newest)
+                newest = head_of(dev)->timestamp;
+        }
+
+        // Devices only move forward, a frame this far behind the newest head never gets a partner
+        int8_t dropped = 0;
+        double oldest = newest;
+        for (d = 0; d < count; d++)
+        {
+            struct MultiCamDevice* dev = &mc->devices[d];
+            if (head_of(dev)->timestamp < newest - mc->config.tolerance_ms) {
+                drop_head(dev);
+                dropped = 1;
+            } else if (head_of(dev)->timestamp < oldest) {
+                oldest = head_of(dev)->timestamp;
+            }
+        }
+
+        if (dropped)
+            continue;
+
+        set->count = count;
+        set->skew_ms = newest - oldest;
+        for (d = 0; d < count; d++)
+        {
+            struct MultiCamDevice* dev = &mc->devices[d];
+            set->frames[d] = *head_of(dev);
+            memset(head_of(dev), 0, sizeof(struct MultiCamFrame));
+            dev->head = (dev->head + 1) % MULTICAM_QUEUE_SIZE;
+            dev->queued--;
+        }
+
+        mc->sets++;
+        mc->skew_total_ms += set->skew_ms;
+        if (set->skew_ms > mc->skew_max_ms)
+            mc->skew_max_ms = set->skew_ms;
+        return 0;
+    }
+}
+
+int8_t multicam_next(struct MultiCam* mc, struct MultiCamSet* set, uint32_t timeout_ms)
+{
+    const uint32_t start = SDL_GetTicks();
+    int8_t ret;
+
+    memset(set, 0, sizeof(struct MultiCamSet));
+
+    SDL_LockMutex(mc->lock);
+    for (;;)
+    {
+        ret = try_merge(mc, set);
+        if (ret == 0 || SDL_AtomicGet(&mc->failed) != 0)
+            break;
+
+        const uint32_t waited = SDL_GetTicks() - start;
+        if (waited >= timeout_ms)
+            break;
+
+        SDL_CondWaitTimeout(mc->arrived, mc->lock, timeout_ms - waited);
+    }
+    SDL_UnlockMutex(mc->lock);
+
+    return ret;
+}
+
+void multicam_release_set(struct MultiCamSet* set)
+{
+    int d;
+    for (d = 0; d < set->count; d++)
+        release_frame(&set->frames[d]);
+    set->count = 0;
+}
+
+int8_t multicam_failed(struct MultiCam* mc)
+{
+    return SDL_AtomicGet(&mc->failed) != 0;
+}
+
+int8_t multicam_finished(struct MultiCam* mc)
+{
+    int8_t finished = 0;
+    int d;
+
+    SDL_LockMutex(mc->lock);
+    for (d = 0; d < mc->config.count; d++) {
+        if (SDL_AtomicGet(&mc->devices[d].finished) && mc->devices[d].queued == 0)
+            finished = 1;
+    }
+    SDL_UnlockMutex(mc->lock);
+
+    return finished;
+}
+
+void multicam_print_stats(struct MultiCam* mc)
+{
+    SDL_LockMutex(mc->lock);
+
+    fprintf(stderr, "  merged sets: %llu, skew avg %.2f ms max %.2f ms (tolerance %.1f ms)\n",
+            (unsigned long long)mc->sets, mc->sets ? mc->skew_total_ms / mc->sets : 0.0, mc->skew_max_ms,
+            mc->config.tolerance_ms);
+
+    int d;
+    for (d = 0; d < mc->config.count; d++)
+    {
+        const struct MultiCamDevice* dev = &mc->devices[d];
+        fprintf(stderr, "  device %d: captured %llu, unmatched %llu, dropped behind consumer %llu\n", d,
+                (unsigned long long)dev->captured, (unsigned long long)dev->unmatched,
+                (unsigned long long)dev->overflowed);
+    }
+
+    SDL_UnlockMutex(mc->lock);
+}
@@ -0,0 +1,116 @@
+#ifndef MULTICAM_H
+#define MULTICAM_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+#include "frame_handle.h"
+#include "rs_state.h"
+
+#define MULTICAM_DEVICES_MAX 8
+
+// Framesets a device may have waiting for the merger before the oldest is dropped
+#define MULTICAM_QUEUE_SIZE 8
+
+// Framesets librealsense buffers for each capture thread
+#define MULTICAM_FRAME_QUEUE_SIZE 2
+
+// Largest timestamp spread within one merged set, about half a frame at 60 fps
+#define MULTICAM_DEFAULT_TOLERANCE_MS 8.0
+
+struct MultiCamConfig
+{
+    int count;
+    // Per device, selected by serial or standing in with playback_file
+    struct StreamConfig streams[MULTICAM_DEVICES_MAX];
+    // Core each capture thread is pinned to, -1 leaves it to the scheduler
+    int cores[MULTICAM_DEVICES_MAX];
+    double tolerance_ms;
+    // Measure every device's time from its own first frame. For recordings
+    // made at different times; live devices share global time instead.
+    int8_t rebase_timestamps;
+};
+
+// One device's frameset as the merger sees it
+struct MultiCamFrame
+{
+    struct FrameHandle dep;
+    struct FrameHandle col;
+    int8_t got_dep;
+    int8_t got_col;
+    double timestamp;
+};
+
+struct MultiCam;
+
+struct MultiCamDevice
+{
+    struct MultiCam* owner;
+    int index;
+    struct RS_State rs_state;
+    SDL_Thread* thread;
+    SDL_atomic_t finished;
+
+    // Guarded by the owner's lock
+    struct MultiCamFrame queue[MULTICAM_QUEUE_SIZE];
+    int head;
+    int queued;
+    double first_timestamp;
+    int8_t has_first;
+    uint64_t captured;
+    uint64_t overflowed;
+    uint64_t unmatched;
+};
+
+// A frameset from every device, taken within tolerance_ms of each other
+struct MultiCamSet
+{
+    int count;
+    struct MultiCamFrame frames[MULTICAM_DEVICES_MAX];
+    double skew_ms;
+};
+
+// One RS_State, pipeline and capture thread per device. Capture threads
+// queue framesets per device; multicam_next() on the consumer's thread
+// pairs them up by timestamp.
+struct MultiCam
+{
+    struct MultiCamConfig config;
+    struct MultiCamDevice devices[MULTICAM_DEVICES_MAX];
+    SDL_mutex* lock;
+    SDL_cond* arrived;
+    SDL_atomic_t running;
+    SDL_atomic_t failed;
+
+    uint64_t sets;
+    double skew_total_ms;
+    double skew_max_ms;
+};
+
+void multicam_default_config(struct MultiCamConfig* config);
+
+// Adds an entry for every connected device, each a copy of base selected by serial
+int8_t multicam_add_all_devices(struct MultiCamConfig* config, const struct StreamConfig* base);
+
+int8_t multicam_start(struct MultiCam* mc, const struct MultiCamConfig* config);
+void multicam_stop(struct MultiCam* mc);
+
+// Waits up to timeout_ms for a set. Returns 0 with set filled, which then
+// owns the frames until multicam_release_set(), 1 when there is none yet.
+int8_t multicam_next(struct MultiCam* mc, struct MultiCamSet* set, uint32_t timeout_ms);
+void multicam_release_set(struct MultiCamSet* set);
+
+// 1 once a capture thread failed
+int8_t multicam_failed(struct MultiCam* mc);
+
+// 1 once a played back device ran out of frames, no set can be completed after that
+int8_t multicam_finished(struct MultiCam* mc);
+
+void multicam_print_stats(struct MultiCam* mc);
+
+#endif
@@ -0,0 +1,187 @@
+#include <librealsense2/rs.h>
+
+#define SDL_MAIN_HANDLED
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multicam.h"
+#include "stream_options.h"
+
+// Streams from several cameras at once, each on its own capture thread, and
+// reports how well their framesets line up. Recordings stand in for devices
+// with one --playback per device.
+
+#define MULTICAM_BENCH_DEFAULT_SETS 300
+
+// Parses a comma separated list of cores, one per device in order
+static int8_t parse_cores(struct MultiCamConfig* config, const char* list)
+{
+    int d = 0;
+    const char* p = list;
+    while (*p != '\0')
+    {
+        if (d >= MULTICAM_DEVICES_MAX) {
+            fprintf(stderr, "More cores than the %d devices supported in %s\n", MULTICAM_DEVICES_MAX, list);
+            return 1;
+        }
+
+        char* end = NULL;
+        long core = strtol(p, &end, 10);
+        if (end == p || core < 0) {
+            fprintf(stderr, "Bad core list %s, expected e.g. 2,3\n", list);
+            return 1;
+        }
+
+        config->cores[d++] = (int)core;
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            fprintf(stderr, "Bad core list %s, expected e.g. 2,3\n", list);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int8_t add_device(struct MultiCamConfig* config, const struct StreamConfig* base,
+                         const char* playback_file, const char* serial)
+{
+    if (config->count >= MULTICAM_DEVICES_MAX) {
+        fprintf(stderr, "At most %d devices are supported\n", MULTICAM_DEVICES_MAX);
+        return 1;
+    }
+
+    struct StreamConfig* stream = &config->streams[config->count++];
+    *stream = *base;
+    stream->playback_file = playback_file;
+    stream->serial = serial;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct StreamConfig stream_config;
+    stream_config_defaults(&stream_config);
+
+    struct MultiCamConfig config;
+    multicam_default_config(&config);
+
+    // Devices are added once every stream option is known
+    const char* playback_files[MULTICAM_DEVICES_MAX];
+    const char* serials[MULTICAM_DEVICES_MAX];
+    int playback_count = 0;
+    int serial_count = 0;
+    int sets = MULTICAM_BENCH_DEFAULT_SETS;
+    int8_t all_devices = 0;
+
+    int arg;
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--playback") == 0 && arg + 1 < argc && playback_count < MULTICAM_DEVICES_MAX) {
+            playback_files[playback_count++] = argv[++arg];
+        } else if (strcmp(argv[arg], "--serial") == 0 && arg + 1 < argc && serial_count < MULTICAM_DEVICES_MAX) {
+            serials[serial_count++] = argv[++arg];
+        } else if (strcmp(argv[arg], "--all") == 0) {
+            all_devices = 1;
+        } else if (strcmp(argv[arg], "--fast") == 0) {
+            stream_config.playback_realtime = 0;
+        } else if (strcmp(argv[arg], "--cores") == 0 && arg + 1 < argc) {
+            if (parse_cores(&config, argv[++arg]) != 0)
+                return 1;
+        } else if (strcmp(argv[arg], "--tolerance") == 0 && arg + 1 < argc) {
+            config.tolerance_ms = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "--rebase") == 0) {
+            config.rebase_timestamps = 1;
+        } else if (strcmp(argv[arg], "--sets") == 0 && arg + 1 < argc) {
+            sets = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--config") == 0 && arg + 1 < argc) {
+            if (stream_options_load(&stream_config, argv[++arg]) != 0)
+                return 1;
+        } else if (strncmp(argv[arg], "--", 2) == 0 && arg + 1 < argc &&
+                   stream_option_set(&stream_config, argv[arg] + 2, argv[arg + 1]) == 0) {
+            arg++;
+        } else {
+            fprintf(stderr, "usage: %s [--all] [--serial s]... [--playback file.bag [--fast]]... "
+                    "[--cores c0,c1,...] [--tolerance ms] [--rebase] [--sets n] %s\n",
+                    argv[0], STREAM_OPTIONS_USAGE);
+            return 1;
+        }
+    }
+
+    int i;
+    for (i = 0; i < serial_count; i++) {
+        if (add_device(&config, &stream_config, NULL, serials[i]) != 0)
+            return 1;
+    }
+    for (i = 0; i < playback_count; i++) {
+        if (add_device(&config, &stream_config, playback_files[i], NULL) != 0)
+            return 1;
+    }
+
+    // Every connected camera unless told otherwise
+    if (all_devices || config.count == 0) {
+        if (multicam_add_all_devices(&config, &stream_config) != 0)
+            return 1;
+    }
+
+    SDL_SetMainReady();
+    if (SDL_Init(0) != 0) {
+        fprintf(stderr, "Failed initting SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    struct MultiCam mc;
+    if (multicam_start(&mc, &config) != 0) {
+        SDL_Quit();
+        return 1;
+    }
+
+    int merged = 0;
+    int8_t failed = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    while (merged < sets)
+    {
+        struct MultiCamSet set;
+        if (multicam_next(&mc, &set, 100) != 0)
+        {
+            if (multicam_failed(&mc)) {
+                fprintf(stderr, "capture failed\n");
+                failed = 1;
+                break;
+            }
+            if (multicam_finished(&mc)) {
+                fprintf(stderr, "playback finished\n");
+                break;
+            }
+            continue;
+        }
+
+        merged++;
+        if (merged % 30 == 0) {
+            fprintf(stderr, "set %d: t %.1f ms", merged, set.frames[0].timestamp);
+            for (i = 0; i < set.count; i++)
+                fprintf(stderr, ", dev %d #%llu", i, set.frames[i].got_dep ? set.frames[i].dep.number : set.frames[i].col.number);
+            fprintf(stderr, ", skew %.2f ms\n", set.skew_ms);
+        }
+
+        multicam_release_set(&set);
+    }
+
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    fprintf(stderr, "%d devices, %d sets in %.1f s (%.1f sets/s)\n", config.count, merged, seconds,
+            seconds > 0.0 ? merged / seconds : 0.0);
+    multicam_print_stats(&mc);
+
+    multicam_stop(&mc);
+    SDL_Quit();
+    return failed;
+}
@@ -0,0 +1,443 @@
+#include "pipeline.h"
+#include "rs_error.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* stage_names[PIPELINE_STAGE_COUNT] = {
+    "capture",
+    "convert wait",
+    "convert",
+    "render wait",
+    "render",
+    "total"
+};
+
+static void stage_record(struct Pipeline* p, enum PipelineStage stage, Uint64 start, Uint64 end)
+{
+    stage_stats_record(&p->stats[stage], start, end);
+}
+
+static void recycle_job(struct Pipeline* p, struct PipelineJob* job)
+{
+    frame_handle_release(&job->dep);
+    frame_handle_release(&job->col_frame);
+    job->got_dep = 0;
+    job->got_col = 0;
+
+    // The pool holds every job, so this cannot run out of room
+    ring_queue_try_push(&p->free_jobs, job);
+}
+
+static void drop_job(void* item, void* user)
+{
+    recycle_job((struct Pipeline*)user, (struct PipelineJob*)item);
+}
+
+static void convert_job(struct Pipeline* p, struct PipelineJob* job)
+{
+    job->t_convert_start = SDL_GetPerformanceCounter();
+    stage_record(p, PIPELINE_STAGE_CONVERT_WAIT, job->t_queued, job->t_convert_start);
+
+    // Off the capture thread, readers get the raw frames before conversion
+    if (p->config.publisher != NULL) {
+        if (job->got_dep)
+            publisher_submit(p->config.publisher, &job->dep, RECORDING_STREAM_DEPTH);
+        if (job->got_col)
+            publisher_submit(p->config.publisher, &job->col_frame, RECORDING_STREAM_COLOR);
+    }
+
+    convert_frames(p->colorizer, p->expander, p->config.threads,
+                   job->got_dep ? &job->dep : NULL, p->config.convert_depth ? job->dep_rgb : NULL,
+                   job->got_col ? &job->col_frame : NULL, p->config.convert_color ? job->col : NULL);
+
+    if (p->aligner != NULL && job->got_dep &&
+        align_frames(p->aligner, p->colorizer, &job->dep, job->got_col ? &job->col_frame : NULL,
+                     job->aligned_depth, job->aligned) != 0)
+        SDL_AtomicSet(&p->failed, 1);
+
+    job->t_converted = SDL_GetPerformanceCounter();
+    stage_record(p, PIPELINE_STAGE_CONVERT, job->t_convert_start, job->t_converted);
+
+    ring_queue_push(&p->render_queue, job);
+}
+
+// Takes ownership of frames
+static int8_t capture_frameset(struct Pipeline* p, rs2_frame* frames)
+{
+    Uint64 arrival = SDL_GetPerformanceCounter();
+
+    void* item = NULL;
+    if (ring_queue_try_pop(&p->free_jobs, &item) != 0) {
+        // Every job is in flight, nothing to do but drop the frameset
+        SDL_AtomicAdd(&p->starved, 1);
+        rs2_release_frame(frames);
+        return 0;
+    }
+
+    struct PipelineJob* job = (struct PipelineJob*)item;
+    if (extract_frames(frames, &job->dep, &job->col_frame, &job->got_dep, &job->got_col) != 0) {
+        rs2_release_frame(frames);
+        recycle_job(p, job);
+        return 1;
+    }
+
+    rs2_release_frame(frames);
+
+    // Recorded ahead of conversion, so frames the display skips are kept too
+    if (p->config.recorder != NULL) {
+        if (job->got_dep)
+            recorder_submit(p->config.recorder, &job->dep, RECORDING_STREAM_DEPTH);
+        if (job->got_col)
+            recorder_submit(p->config.recorder, &job->col_frame, RECORDING_STREAM_COLOR);
+    }
+
+    job->sequence = ++p->sequence;
+    job->t_arrival = arrival;
+    job->t_queued = SDL_GetPerformanceCounter();
+    stage_record(p, PIPELINE_STAGE_CAPTURE, job->t_arrival, job->t_queued);
+
+    if (p->config.workers == 0)
+        convert_job(p, job);
+    else
+        ring_queue_push(&p->capture_queue, job);
+
+    return 0;
+}
+
+static int capture_thread(void* data)
+{
+    struct Pipeline* p = (struct Pipeline*)data;
+    rs2_error* e = NULL;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    trace_thread_name("capture");
+
+    while (SDL_AtomicGet(&p->running))
+    {
+        rs2_frame* frames = NULL;
+        if (rs2_try_wait_for_frame(p->rs_state->frame_queue, 100, &frames, &e) == 0) {
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed waiting for frames in capture thread\n");
+                SDL_AtomicSet(&p->failed, 1);
+                break;
+            }
+            continue;
+        }
+
+        if (capture_frameset(p, frames) != 0) {
+            SDL_AtomicSet(&p->failed, 1);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void pipeline_frame_callback(rs2_frame* frames, void* user)
+{
+    struct Pipeline* p = (struct Pipeline*)user;
+
+    // librealsense may still deliver while the pipeline is being stopped
+    if (SDL_AtomicGet(&p->running) == 0 || SDL_AtomicGet(&p->failed) != 0) {
+        rs2_release_frame(frames);
+        return;
+    }
+
+    if (capture_frameset(p, frames) != 0)
+        SDL_AtomicSet(&p->failed, 1);
+}
+
+static int convert_thread(void* data)
+{
+    struct Pipeline* p = (struct Pipeline*)data;
+
+    trace_thread_name("convert");
+
+    while (SDL_AtomicGet(&p->running))
+    {
+        struct PipelineJob* job = (struct PipelineJob*)ring_queue_pop_wait(&p->capture_queue, 100);
+        if (job == NULL)
+            continue;
+
+        convert_job(p, job);
+    }
+
+    return 0;
+}
+
+void pipeline_default_config(struct PipelineConfig* config)
+{
+    config->source = PIPELINE_SOURCE_QUEUE;
+    config->workers = 2;
+    config->capture_queue_size = 2;
+    config->render_queue_size = 2;
+    config->capture_policy = RING_QUEUE_DROP_OLDEST;
+    config->render_policy = RING_QUEUE_DROP_OLDEST;
+    config->recorder = NULL;
+    config->publisher = NULL;
+    config->pool = NULL;
+    config->threads = NULL;
+    config->convert_depth = 1;
+    config->convert_color = 1;
+}
+
+int8_t pipeline_start(struct Pipeline* p, const struct PipelineConfig* config, struct RS_State* rs_state,
+                      const struct Colorizer* colorizer, const struct RgbExpander* expander,
+                      struct Aligner* aligner)
+{
+    if (p == NULL || config == NULL || rs_state == NULL) {
+        fprintf(stderr, "Cannot start pipeline: given pointer is null\n");
+        return 1;
+    }
+
+    if (config->source == PIPELINE_SOURCE_QUEUE && rs_state->frame_queue == NULL) {
+        fprintf(stderr, "Cannot start pipeline: sensor was not started with a frame queue\n");
+        return 1;
+    }
+
+    if (config->pool == NULL) {
+        fprintf(stderr, "Cannot start pipeline: no frame pool for the job buffers\n");
+        return 1;
+    }
+
+    memset(p, 0, sizeof(struct Pipeline));
+    p->config = *config;
+    p->rs_state = rs_state;
+    p->colorizer = colorizer;
+    p->expander = expander;
+    p->aligner = aligner != NULL && aligner->mode != ALIGN_NONE ? aligner : NULL;
+
+    // Only the callback source has a thread of its own to convert on
+    if (p->config.workers < 1)
+        p->config.workers = p->config.source == PIPELINE_SOURCE_CALLBACK ? 0 : 1;
+    if (p->config.workers > PIPELINE_WORKERS_MAX)
+        p->config.workers = PIPELINE_WORKERS_MAX;
+
+    if (ring_queue_init(&p->capture_queue, p->config.capture_queue_size, p->config.capture_policy, drop_job, p) != 0 ||
+        ring_queue_init(&p->render_queue, p->config.render_queue_size, p->config.render_policy, drop_job, p) != 0) {
+        pipeline_stop(p);
+        return 1;
+    }
+
+    // Enough jobs to fill every queue, keep every worker busy, and have one
+    // in the capture thread and one on screen, so capture never waits for a job
+    p->job_count = p->capture_queue.capacity + p->render_queue.capacity + p->config.workers + 2;
+
+    if (ring_queue_init(&p->free_jobs, p->job_count, RING_QUEUE_DROP_NEWEST, NULL, NULL) != 0) {
+        pipeline_stop(p);
+        return 1;
+    }
+
+    p->jobs = (struct PipelineJob*)calloc(p->job_count, sizeof(struct PipelineJob));
+    if (p->jobs == NULL) {
+        fprintf(stderr, "Failed allocating %d pipeline jobs\n", p->job_count);
+        pipeline_stop(p);
+        return 1;
+    }
+
+    // Sized for the streams resolve_streams settled on
+    const int dep_pixels = rs_state->depth.intrinsics.width * rs_state->depth.intrinsics.height;
+    const int col_pixels = rs_state->color.intrinsics.width * rs_state->color.intrinsics.height;
+
+    int aligned_w = 0;
+    int aligned_h = 0;
+    if (p->aligner != NULL)
+        align_output_size(p->aligner, rs_state->depth.intrinsics.width, rs_state->depth.intrinsics.height,
+                          &aligned_w, &aligned_h);
+
+    const size_t dep_bytes = (size_t)dep_pixels * sizeof(struct RGBA);
+    const size_t col_bytes = (size_t)col_pixels * sizeof(struct RGBA);
+    const size_t aligned_bytes = (size_t)aligned_w * aligned_h * sizeof(struct RGBA);
+    const size_t aligned_depth_bytes = (size_t)col_pixels * sizeof(uint16_t);
+    const int8_t use_aligned_depth = p->aligner != NULL && p->aligner->mode == ALIGN_DEPTH_TO_COLOR;
+
+    // One slab per job and buffer, fresh slabs start out zeroed
+    struct FramePool* pool = p->config.pool;
+    if (frame_pool_reserve(pool, dep_bytes, p->job_count) != 0 ||
+        frame_pool_reserve(pool, col_bytes, p->job_count) != 0 ||
+        (p->aligner != NULL && frame_pool_reserve(pool, aligned_bytes, p->job_count) != 0) ||
+        (use_aligned_depth && frame_pool_reserve(pool, aligned_depth_bytes, p->job_count) != 0)) {
+        pipeline_stop(p);
+        return 1;
+    }
+
+    int j;
+    for (j = 0; j < p->job_count; j++)
+    {
+        struct PipelineJob* job = &p->jobs[j];
+        job->dep_rgb = (struct RGBA*)frame_pool_acquire(pool, dep_bytes);
+        job->col = (struct RGBA*)frame_pool_acquire(pool, col_bytes);
+        if (job->dep_rgb == NULL || job->col == NULL) {
+            fprintf(stderr, "Failed allocating buffers for pipeline job %d\n", j);
+            pipeline_stop(p);
+            return 1;
+        }
+
+        if (p->aligner != NULL)
+        {
+            job->aligned = (struct RGBA*)frame_pool_acquire(pool, aligned_bytes);
+            if (use_aligned_depth)
+                job->aligned_depth = (uint16_t*)frame_pool_acquire(pool, aligned_depth_bytes);
+            if (job->aligned == NULL || (use_aligned_depth && job->aligned_depth == NULL)) {
+                fprintf(stderr, "Failed allocating aligned buffers for pipeline job %d\n", j);
+                pipeline_stop(p);
+                return 1;
+            }
+        }
+
+        ring_queue_try_push(&p->free_jobs, job);
+    }
+
+    SDL_AtomicSet(&p->running, 1);
+
+    int w;
+    for (w = 0; w < p->config.workers; w++)
+    {
+        p->workers[w] = SDL_CreateThread(convert_thread, "rs2 convert", p);
+        if (p->workers[w] == NULL) {
+            fprintf(stderr, "Failed creating conversion thread: %s\n", SDL_GetError());
+            pipeline_stop(p);
+            return 1;
+        }
+    }
+
+    if (p->config.source == PIPELINE_SOURCE_QUEUE)
+    {
+        p->capture_thread = SDL_CreateThread(capture_thread, "rs2 capture", p);
+        if (p->capture_thread == NULL) {
+            fprintf(stderr, "Failed creating capture thread: %s\n", SDL_GetError());
+            pipeline_stop(p);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "pipeline started: %s source, %d workers, %d jobs\n",
+            p->config.source == PIPELINE_SOURCE_QUEUE ? "queue" : "callback", p->config.workers, p->job_count);
+    return 0;
+}
+
+void pipeline_stop(struct Pipeline* p)
+{
+    if (p == NULL)
+        return;
+
+    SDL_AtomicSet(&p->running, 0);
+
+    if (p->capture_thread) {
+        SDL_WaitThread(p->capture_thread, NULL);
+        p->capture_thread = NULL;
+    }
+
+    int w;
+    for (w = 0; w < PIPELINE_WORKERS_MAX; w++)
+    {
+        if (p->workers[w]) {
+            SDL_WaitThread(p->workers[w], NULL);
+            p->workers[w] = NULL;
+        }
+    }
+
+    int j;
+    if (p->jobs)
+    {
+        for (j = 0; j < p->job_count; j++)
+        {
+            frame_handle_release(&p->jobs[j].dep);
+            frame_handle_release(&p->jobs[j].col_frame);
+            frame_pool_release(p->config.pool, p->jobs[j].dep_rgb);
+            frame_pool_release(p->config.pool, p->jobs[j].col);
+            frame_pool_release(p->config.pool, p->jobs[j].aligned_depth);
+            frame_pool_release(p->config.pool, p->jobs[j].aligned);
+        }
+        free(p->jobs);
+        p->jobs = NULL;
+    }
+
+    ring_queue_free(&p->capture_queue);
+    ring_queue_free(&p->render_queue);
+    ring_queue_free(&p->free_jobs);
+}
+
+struct PipelineJob* pipeline_next(struct Pipeline* p, uint32_t timeout_ms)
+{
+    struct PipelineJob* newest = (struct PipelineJob*)ring_queue_pop_wait(&p->render_queue, timeout_ms);
+    if (newest == NULL)
+        return NULL;
+
+    // Workers finish out of order and the display only wants the latest frame
+    void* item = NULL;
+    while (ring_queue_try_pop(&p->render_queue, &item) == 0)
+    {
+        struct PipelineJob* job = (struct PipelineJob*)item;
+        if (job->sequence > newest->sequence) {
+            recycle_job(p, newest);
+            newest = job;
+        } else {
+            recycle_job(p, job);
+        }
+    }
+
+    if (newest->sequence <= p->last_rendered) {
+        recycle_job(p, newest);
+        return NULL;
+    }
+
+    p->last_rendered = newest->sequence;
+    newest->t_render_start = SDL_GetPerformanceCounter();
+    stage_record(p, PIPELINE_STAGE_RENDER_WAIT, newest->t_converted, newest->t_render_start);
+    return newest;
+}
+
+void pipeline_done(struct Pipeline* p, struct PipelineJob* job)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    stage_record(p, PIPELINE_STAGE_RENDER, job->t_render_start, now);
+    stage_record(p, PIPELINE_STAGE_TOTAL, job->t_arrival, now);
+    recycle_job(p, job);
+}
+
+int8_t pipeline_failed(struct Pipeline* p)
+{
+    return SDL_AtomicGet(&p->failed) != 0;
+}
+
+void pipeline_print_stats(struct Pipeline* p)
+{
+    int s;
+    for (s = 0; s < PIPELINE_STAGE_COUNT; s++)
+        stage_stats_print(&p->stats[s], stage_names[s]);
+
+    fprintf(stderr, "  dropped: capture queue %d, render queue %d, no free job %d\n",
+            SDL_AtomicGet(&p->capture_queue.dropped), SDL_AtomicGet(&p->render_queue.dropped),
+            SDL_AtomicGet(&p->starved));
+}
+
+void pipeline_write_metrics(struct MetricsText* out, void* user)
+{
+    struct Pipeline* p = (struct Pipeline*)user;
+    struct StageStats* stats[PIPELINE_STAGE_COUNT];
+    int s;
+
+    metrics_family(out, "rs2_pipeline_queue_depth", "gauge", "Jobs waiting in a pipeline queue");
+    metrics_printf(out, "rs2_pipeline_queue_depth{queue=\"capture\"} %d\n", ring_queue_size(&p->capture_queue));
+    metrics_printf(out, "rs2_pipeline_queue_depth{queue=\"render\"} %d\n", ring_queue_size(&p->render_queue));
+    metrics_printf(out, "rs2_pipeline_queue_depth{queue=\"free\"} %d\n", ring_queue_size(&p->free_jobs));
+
+    metrics_family(out, "rs2_pipeline_queue_capacity", "gauge", "Slots of a pipeline queue");
+    metrics_printf(out, "rs2_pipeline_queue_capacity{queue=\"capture\"} %d\n", p->capture_queue.capacity);
+    metrics_printf(out, "rs2_pipeline_queue_capacity{queue=\"render\"} %d\n", p->render_queue.capacity);
+    metrics_printf(out, "rs2_pipeline_queue_capacity{queue=\"free\"} %d\n", p->free_jobs.capacity);
+
+    metrics_family(out, "rs2_pipeline_dropped_total", "counter", "Jobs dropped by a full queue or for want of a free job");
+    metrics_printf(out, "rs2_pipeline_dropped_total{queue=\"capture\"} %d\n", SDL_AtomicGet(&p->capture_queue.dropped));
+    metrics_printf(out, "rs2_pipeline_dropped_total{queue=\"render\"} %d\n", SDL_AtomicGet(&p->render_queue.dropped));
+    metrics_printf(out, "rs2_pipeline_dropped_total{queue=\"free\"} %d\n", SDL_AtomicGet(&p->starved));
+
+    for (s = 0; s < PIPELINE_STAGE_COUNT; s++)
+        stats[s] = &p->stats[s];
+    metrics_stages(out, "rs2_pipeline_stage", "Time jobs spent in a pipeline stage", stage_names, stats,
+                   PIPELINE_STAGE_COUNT);
+}
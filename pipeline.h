@@ -0,0 +1,145 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "align.h"
+#include "colorize.h"
+#include "frame_handle.h"
+#include "frame_pool.h"
+#include "frames.h"
+#include "metrics.h"
+#include "publisher.h"
+#include "recorder.h"
+#include "rgb_expand.h"
+#include "ring_queue.h"
+#include "rs_state.h"
+#include "stage_stats.h"
+#include "thread_pool.h"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+#define PIPELINE_WORKERS_MAX 16
+
+enum PipelineStage
+{
+    PIPELINE_STAGE_CAPTURE,       // frameset dequeued until its job is queued for conversion
+    PIPELINE_STAGE_CONVERT_WAIT,  // waiting for a conversion worker
+    PIPELINE_STAGE_CONVERT,       // colorize, RGB expansion and alignment
+    PIPELINE_STAGE_RENDER_WAIT,   // waiting for the render loop
+    PIPELINE_STAGE_RENDER,        // texture upload and present
+    PIPELINE_STAGE_TOTAL,         // frameset dequeued until presented
+    PIPELINE_STAGE_COUNT
+};
+
+// One frameset travelling through the stages, along with its converted pixels
+struct PipelineJob
+{
+    struct FrameHandle dep;
+    struct FrameHandle col_frame;
+    struct RGBA* dep_rgb;
+    struct RGBA* col;
+    // Only drawn from the pool when aligning, aligned_depth only for depth to color
+    uint16_t* aligned_depth;
+    struct RGBA* aligned;
+    int8_t got_dep;
+    int8_t got_col;
+    uint64_t sequence;
+    Uint64 t_arrival;
+    Uint64 t_queued;
+    Uint64 t_convert_start;
+    Uint64 t_converted;
+    Uint64 t_render_start;
+};
+
+// Where the capture stage gets framesets from
+enum PipelineSource
+{
+    PIPELINE_SOURCE_QUEUE,    // a capture thread waits on rs_state->frame_queue
+    PIPELINE_SOURCE_CALLBACK  // librealsense calls pipeline_frame_callback()
+};
+
+struct PipelineConfig
+{
+    enum PipelineSource source;
+    // With the callback source, 0 workers converts inside the callback
+    int workers;
+    int capture_queue_size;
+    int render_queue_size;
+    enum RingQueuePolicy capture_policy;
+    enum RingQueuePolicy render_policy;
+    // Every captured frame is also handed to the recorder when set
+    struct Recorder* recorder;
+    // Every frame a worker picks up is also published to shared memory when set
+    struct Publisher* publisher;
+    // Where the job buffers come from, the pipeline reserves what it needs
+    struct FramePool* pool;
+    // Splits each job's conversion into row bands when set
+    struct ThreadPool* threads;
+    // Cleared for a stream the consumer converts itself, e.g. straight into
+    // a locked texture; the job's dep_rgb or col is then left untouched
+    int8_t convert_depth;
+    int8_t convert_color;
+};
+
+// Capture -> conversion workers -> render loop. With the queue source the
+// sensor has to be started with STREAM_DELIVERY_QUEUE before the pipeline.
+// With the callback source the pipeline is started first, then the sensor
+// with STREAM_DELIVERY_CALLBACK and pipeline_frame_callback as callback.
+// The render loop is whoever calls pipeline_next().
+struct Pipeline
+{
+    struct PipelineConfig config;
+    struct RS_State* rs_state;
+    const struct Colorizer* colorizer;
+    const struct RgbExpander* expander;
+    struct Aligner* aligner;
+
+    struct PipelineJob* jobs;
+    int job_count;
+    struct RingQueue free_jobs;
+    struct RingQueue capture_queue;
+    struct RingQueue render_queue;
+
+    SDL_Thread* capture_thread;
+    SDL_Thread* workers[PIPELINE_WORKERS_MAX];
+    SDL_atomic_t running;
+    SDL_atomic_t failed;
+    SDL_atomic_t starved;
+
+    uint64_t sequence;
+    uint64_t last_rendered;
+
+    struct StageStats stats[PIPELINE_STAGE_COUNT];
+};
+
+void pipeline_default_config(struct PipelineConfig* config);
+
+// aligner may be NULL, otherwise every job also carries the aligned view
+int8_t pipeline_start(struct Pipeline* p, const struct PipelineConfig* config, struct RS_State* rs_state,
+                      const struct Colorizer* colorizer, const struct RgbExpander* expander,
+                      struct Aligner* aligner);
+void pipeline_stop(struct Pipeline* p);
+
+// rs2_frame_callback_ptr for the callback source, user is the pipeline
+void pipeline_frame_callback(rs2_frame* frames, void* user);
+
+// Returns the newest converted job, or NULL after timeout_ms. Older converted
+// jobs are recycled unseen. Hand the job back with pipeline_done(), which
+// may be called from any thread.
+struct PipelineJob* pipeline_next(struct Pipeline* p, uint32_t timeout_ms);
+void pipeline_done(struct Pipeline* p, struct PipelineJob* job);
+
+// 1 once a stage thread hit an error and stopped
+int8_t pipeline_failed(struct Pipeline* p);
+
+void pipeline_print_stats(struct Pipeline* p);
+
+// metrics_collect_fn reporting queue depths, drops and stage times, user is the pipeline
+void pipeline_write_metrics(struct MetricsText* out, void* user);
+
+#endif
@@ -0,0 +1,394 @@
+#include "pointcloud.h"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <librealsense2/rsutil.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define POINTCLOUD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define POINTCLOUD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define POINTCLOUD_TARGET_AVX2
+#endif
+
+static void points_scalar(const uint16_t* depth, const float* rx, const float* ry, float units,
+                          float* x, float* y, float* z, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        // No depth gives z = 0 and with it x = y = 0, no branch needed
+        const float d = depth[i] * units;
+        x[i] = rx[i] * d;
+        y[i] = ry[i] * d;
+        z[i] = d;
+    }
+}
+
+#ifdef POINTCLOUD_X86
+static void points_sse2(const uint16_t* depth, const float* rx, const float* ry, float units,
+                        float* x, float* y, float* z, int count)
+{
+    const __m128 vunits = _mm_set1_ps(units);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i d16 = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(depth + i)), zero);
+        __m128 d = _mm_mul_ps(_mm_cvtepi32_ps(d16), vunits);
+        _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(rx + i), d));
+        _mm_storeu_ps(y + i, _mm_mul_ps(_mm_loadu_ps(ry + i), d));
+        _mm_storeu_ps(z + i, d);
+    }
+
+    points_scalar(depth + i, rx + i, ry + i, units, x + i, y + i, z + i, count - i);
+}
+
+POINTCLOUD_TARGET_AVX2
+static void points_avx2(const uint16_t* depth, const float* rx, const float* ry, float units,
+                        float* x, float* y, float* z, int count)
+{
+    const __m256 vunits = _mm256_set1_ps(units);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i d32 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + i)));
+        __m256 d = _mm256_mul_ps(_mm256_cvtepi32_ps(d32), vunits);
+        _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(rx + i), d));
+        _mm256_storeu_ps(y + i, _mm256_mul_ps(_mm256_loadu_ps(ry + i), d));
+        _mm256_storeu_ps(z + i, d);
+    }
+
+    points_scalar(depth + i, rx + i, ry + i, units, x + i, y + i, z + i, count - i);
+}
+#endif
+
+void pointcloud_default_config(struct PointCloudConfig* config)
+{
+    memset(config, 0, sizeof(struct PointCloudConfig));
+}
+
+static void free_rays(struct PointCloud* pc)
+{
+    free(pc->ray_x);
+    free(pc->ray_y);
+    free(pc->row_start);
+    free(pc->row_u);
+    free(pc->row_v);
+    pc->ray_x = NULL;
+    pc->ray_y = NULL;
+    pc->row_start = NULL;
+    pc->row_u = NULL;
+    pc->row_v = NULL;
+}
+
+static int8_t build_rays(struct PointCloud* pc, const rs2_intrinsics* intrin)
+{
+    // Cleared until every table is in place, so a failed build is retried on the next frame
+    free_rays(pc);
+    memset(&pc->depth_intrin, 0, sizeof(pc->depth_intrin));
+
+    const int pixels = intrin->width * intrin->height;
+    const int scratch = thread_pool_scratch_count(pc->threads);
+    pc->ray_x = (float*)malloc(pixels * sizeof(float));
+    pc->ray_y = (float*)malloc(pixels * sizeof(float));
+    pc->row_start = (int*)malloc((intrin->height + 1) * sizeof(int));
+    pc->row_u = (float*)malloc((size_t)scratch * intrin->width * sizeof(float));
+    pc->row_v = (float*)malloc((size_t)scratch * intrin->width * sizeof(float));
+    if (pc->ray_x == NULL || pc->ray_y == NULL || pc->row_start == NULL || pc->row_u == NULL || pc->row_v == NULL) {
+        fprintf(stderr, "Failed allocating %dx%d point cloud rays\n", intrin->width, intrin->height);
+        free_rays(pc);
+        return 1;
+    }
+
+    int x, y;
+    for (y = 0; y < intrin->height; y++)
+    {
+        for (x = 0; x < intrin->width; x++)
+        {
+            const float pixel[2] = { (float)x, (float)y };
+            float ray[3];
+            rs2_deproject_pixel_to_point(ray, intrin, pixel, 1.0f);
+            pc->ray_x[y * intrin->width + x] = ray[0];
+            pc->ray_y[y * intrin->width + x] = ray[1];
+        }
+    }
+
+    pc->depth_intrin = *intrin;
+    return 0;
+}
+
+// All planes come out of one block, each starting on POINTCLOUD_PLANE_ALIGN
+static int8_t alloc_planes(struct PointCloud* pc, int pixels)
+{
+    free(pc->block);
+    pc->block = NULL;
+    pc->capacity = 0;
+
+    const size_t mask = POINTCLOUD_PLANE_ALIGN - 1;
+    const size_t plane = ((size_t)pixels * sizeof(float) + mask) & ~mask;
+    const int planes = 3 + (pc->config.uv ? 2 : 0) + (pc->config.compact ? 1 : 0);
+
+    pc->block = malloc(plane * planes + mask);
+    if (pc->block == NULL) {
+        fprintf(stderr, "Failed allocating point cloud of %d points\n", pixels);
+        return 1;
+    }
+
+    uint8_t* p = (uint8_t*)(((uintptr_t)pc->block + mask) & ~(uintptr_t)mask);
+    pc->x = (float*)p;
+    pc->y = (float*)(p + plane);
+    pc->z = (float*)(p + 2 * plane);
+    p += 3 * plane;
+
+    pc->u = NULL;
+    pc->v = NULL;
+    if (pc->config.uv) {
+        pc->u = (float*)p;
+        pc->v = (float*)(p + plane);
+        p += 2 * plane;
+    }
+
+    pc->pixel = pc->config.compact ? (uint32_t*)p : NULL;
+    pc->capacity = pixels;
+    return 0;
+}
+
+int8_t pointcloud_init(struct PointCloud* pc, const struct PointCloudConfig* config, const struct RS_State* rs_state,
+                       struct ThreadPool* threads)
+{
+    if (pc == NULL || config == NULL || rs_state == NULL) {
+        fprintf(stderr, "Cannot init point cloud: given pointer is null\n");
+        return 1;
+    }
+
+    memset(pc, 0, sizeof(struct PointCloud));
+    pc->config = *config;
+    pc->threads = threads;
+
+    const rs2_intrinsics* intrin = &rs_state->depth.intrinsics;
+    if (build_rays(pc, intrin) != 0 || alloc_planes(pc, intrin->width * intrin->height) != 0) {
+        pointcloud_free(pc);
+        return 1;
+    }
+
+    // Texture coordinates are color to depth alignment without the sampling, projected a row at a time here
+    if (pc->config.uv)
+    {
+        if (align_init(&pc->aligner, ALIGN_COLOR_TO_DEPTH, rs_state, NULL) != 0) {
+            pointcloud_free(pc);
+            return 1;
+        }
+
+        pc->inv_color_w = 1.0f / rs_state->color.intrinsics.width;
+        pc->inv_color_h = 1.0f / rs_state->color.intrinsics.height;
+    }
+
+    pc->kernel = points_scalar;
+    pc->kernel_name = "scalar";
+
+#ifdef POINTCLOUD_X86
+    if (SDL_HasAVX2()) {
+        pc->kernel = points_avx2;
+        pc->kernel_name = "avx2";
+    } else if (SDL_HasSSE2()) {
+        pc->kernel = points_sse2;
+        pc->kernel_name = "sse2";
+    }
+#endif
+
+    fprintf(stderr, "%s point cloud%s using %s kernel on %d threads\n", pc->config.compact ? "compact" : "dense",
+            pc->config.uv ? " with texture coordinates" : "", pc->kernel_name, threads != NULL ? threads->threads : 1);
+    return 0;
+}
+
+void pointcloud_free(struct PointCloud* pc)
+{
+    if (pc == NULL)
+        return;
+
+    align_free(&pc->aligner);
+    free_rays(pc);
+    free(pc->block);
+    pc->block = NULL;
+    pc->capacity = 0;
+}
+
+// Decimated depth has intrinsics of its own, everything follows the frame size
+static int8_t follow_depth(struct PointCloud* pc, const struct FrameHandle* dep)
+{
+    if (dep->width == pc->depth_intrin.width && dep->height == pc->depth_intrin.height)
+        return 0;
+
+    rs2_intrinsics intrin;
+    if (frame_handle_intrinsics(dep, &intrin) != 0 || build_rays(pc, &intrin) != 0)
+        return 1;
+
+    if (dep->width * dep->height > pc->capacity && alloc_planes(pc, dep->width * dep->height) != 0)
+        return 1;
+
+    if (pc->config.uv && align_follow_depth(&pc->aligner, dep) != 0)
+        return 1;
+
+    return 0;
+}
+
+// What one pointcloud_compute call works on, shared by the threads it runs on
+struct PointCloudCall
+{
+    struct PointCloud* pc;
+    const struct FrameHandle* dep;
+};
+
+static void dense_row(struct PointCloud* pc, const uint16_t* depth, int y, float units, int w)
+{
+    const int row = y * w;
+    pc->kernel(depth, pc->ray_x + row, pc->ray_y + row, units, pc->x + row, pc->y + row, pc->z + row, w);
+
+    if (pc->config.uv == 0)
+        return;
+
+    float* u = pc->u + row;
+    float* v = pc->v + row;
+    align_project_row(&pc->aligner, depth, y, units, u, v, w);
+
+    // Projecting no depth divides by the baseline alone, those points get 0
+    int x;
+    for (x = 0; x < w; x++) {
+        u[x] = depth[x] != 0 ? u[x] * pc->inv_color_w : 0.0f;
+        v[x] = depth[x] != 0 ? v[x] * pc->inv_color_h : 0.0f;
+    }
+}
+
+// Writes the row's points from row_start[y] on
+static void compact_row(struct PointCloud* pc, const uint16_t* depth, int y, float units, int w, int thread)
+{
+    const int row = y * w;
+    float* row_u = pc->row_u + thread * w;
+    float* row_v = pc->row_v + thread * w;
+
+    if (pc->config.uv)
+        align_project_row(&pc->aligner, depth, y, units, row_u, row_v, w);
+
+    int n = pc->row_start[y];
+    int x = 0;
+    while (x < w)
+    {
+        // Holes come in runs, four empty pixels cost one compare
+        uint64_t quad;
+        if (x + 4 <= w) {
+            memcpy(&quad, depth + x, sizeof(quad));
+            if (quad == 0) {
+                x += 4;
+                continue;
+            }
+        }
+
+        const int end = x + 4 <= w ? x + 4 : w;
+        for (; x < end; x++)
+        {
+            if (depth[x] == 0)
+                continue;
+
+            const float d = depth[x] * units;
+            pc->x[n] = pc->ray_x[row + x] * d;
+            pc->y[n] = pc->ray_y[row + x] * d;
+            pc->z[n] = d;
+            if (pc->config.uv) {
+                pc->u[n] = row_u[x] * pc->inv_color_w;
+                pc->v[n] = row_v[x] * pc->inv_color_h;
+            }
+            pc->pixel[n] = (uint32_t)(row + x);
+            n++;
+        }
+    }
+}
+
+static void dense_rows(void* ctx, int thread, int y_begin, int y_end)
+{
+    const struct PointCloudCall* call = (const struct PointCloudCall*)ctx;
+    const struct FrameHandle* dep = call->dep;
+    const int pixel_stride = dep->stride / (int)sizeof(uint16_t);
+
+    int y;
+    for (y = y_begin; y < y_end; y++)
+        dense_row(call->pc, (const uint16_t*)dep->data + y * pixel_stride, y, dep->depth_units, dep->width);
+}
+
+// Stores each row's valid points in row_start[y + 1], summed into offsets afterwards
+static void count_rows(void* ctx, int thread, int y_begin, int y_end)
+{
+    const struct PointCloudCall* call = (const struct PointCloudCall*)ctx;
+    const struct FrameHandle* dep = call->dep;
+    const int pixel_stride = dep->stride / (int)sizeof(uint16_t);
+
+    int y;
+    for (y = y_begin; y < y_end; y++)
+    {
+        const uint16_t* depth = (const uint16_t*)dep->data + y * pixel_stride;
+        int n = 0;
+        int x;
+        for (x = 0; x < dep->width; x++)
+            n += depth[x] != 0;
+        call->pc->row_start[y + 1] = n;
+    }
+}
+
+static void compact_rows(void* ctx, int thread, int y_begin, int y_end)
+{
+    const struct PointCloudCall* call = (const struct PointCloudCall*)ctx;
+    const struct FrameHandle* dep = call->dep;
+    const int pixel_stride = dep->stride / (int)sizeof(uint16_t);
+
+    int y;
+    for (y = y_begin; y < y_end; y++)
+        compact_row(call->pc, (const uint16_t*)dep->data + y * pixel_stride, y, dep->depth_units, dep->width, thread);
+}
+
+int8_t pointcloud_compute(struct PointCloud* pc, const struct FrameHandle* dep)
+{
+    if (dep == NULL || dep->data == NULL)
+        return 0;
+
+    if (follow_depth(pc, dep) != 0)
+        return 1;
+
+    pc->width = dep->width;
+    pc->height = dep->height;
+
+    struct PointCloudCall call;
+    call.pc = pc;
+    call.dep = dep;
+
+    if (pc->config.compact == 0) {
+        thread_pool_run(pc->threads, dep->height, dep->width, dense_rows, &call);
+        pc->count = dep->width * dep->height;
+        return 0;
+    }
+
+    // Counting first gives every row the place of its points, so the rows fill in parallel
+    thread_pool_run(pc->threads, dep->height, dep->width, count_rows, &call);
+    pc->row_start[0] = 0;
+    int y;
+    for (y = 0; y < dep->height; y++)
+        pc->row_start[y + 1] += pc->row_start[y];
+
+    thread_pool_run(pc->threads, dep->height, dep->width, compact_rows, &call);
+    pc->count = pc->row_start[dep->height];
+    return 0;
+}
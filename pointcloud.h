@@ -0,0 +1,83 @@
+#ifndef POINTCLOUD_H
+#define POINTCLOUD_H
+
+#include <librealsense2/rs.h>
+
+#include <stdint.h>
+
+#include "align.h"
+#include "frame_handle.h"
+#include "rs_state.h"
+#include "thread_pool.h"
+
+// Every plane starts on this boundary, enough for any vector load
+#define POINTCLOUD_PLANE_ALIGN 64
+
+typedef void (*pointcloud_kernel)(const uint16_t* depth, const float* rx, const float* ry, float units,
+                                  float* x, float* y, float* z, int count);
+
+struct PointCloudConfig
+{
+    // Also compute texture coordinates into the color frame
+    int8_t uv;
+    // Only emit points that have depth, along with the pixel each came from
+    int8_t compact;
+};
+
+// Points in meters in depth camera coordinates, one plane per component.
+// A dense cloud has a point per depth pixel, all zero where there is no
+// depth; a compact one only the valid points, pixel[i] being the index of
+// the depth pixel point i came from.
+struct PointCloud
+{
+    struct PointCloudConfig config;
+
+    float* x;
+    float* y;
+    float* z;
+    // Normalized over the color frame, only with config.uv
+    float* u;
+    float* v;
+    // Only with config.compact
+    uint32_t* pixel;
+    int count;
+    // Size of the depth frame the cloud was computed from
+    int width;
+    int height;
+
+    void* block;
+    int capacity;
+
+    // Ray through every depth pixel center at 1 m. The ray's z is always 1,
+    // so a point is (ray_x * z, ray_y * z, z).
+    rs2_intrinsics depth_intrin;
+    float* ray_x;
+    float* ray_y;
+
+    // Rows are spread over these, NULL computes on the calling thread
+    struct ThreadPool* threads;
+    // Compact clouds: index of each row's first point, height + 1 entries
+    int* row_start;
+
+    // Projects the points into color for the texture coordinates, a row of
+    // width per thread pool scratch index
+    struct Aligner aligner;
+    float* row_u;
+    float* row_v;
+    float inv_color_w;
+    float inv_color_h;
+
+    pointcloud_kernel kernel;
+    const char* kernel_name;
+};
+
+void pointcloud_default_config(struct PointCloudConfig* config);
+
+// Builds the ray table for the depth profile rs_state resolved
+int8_t pointcloud_init(struct PointCloud* pc, const struct PointCloudConfig* config, const struct RS_State* rs_state,
+                       struct ThreadPool* threads);
+void pointcloud_free(struct PointCloud* pc);
+
+int8_t pointcloud_compute(struct PointCloud* pc, const struct FrameHandle* dep);
+
+#endif
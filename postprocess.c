@@ -0,0 +1,272 @@
+#include "postprocess.h"
+#include "rs_error.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* filter_names[POSTPROCESS_FILTER_COUNT] = {
+    "decimation",
+    "spatial",
+    "temporal",
+    "hole-filling"
+};
+
+void postprocess_default_config(struct PostProcessConfig* config)
+{
+    memset(config, 0, sizeof(struct PostProcessConfig));
+    config->decimation = 2;
+    config->queue_size = 2;
+}
+
+int8_t postprocess_any_enabled(const struct PostProcessConfig* config)
+{
+    int f;
+    for (f = 0; f < POSTPROCESS_FILTER_COUNT; f++) {
+        if (config->enabled[f])
+            return 1;
+    }
+
+    return 0;
+}
+
+int8_t postprocess_parse_filters(struct PostProcessConfig* config, const char* list)
+{
+    const char* name = list;
+    while (*name != '\0')
+    {
+        size_t len = strcspn(name, ",");
+
+        int f;
+        for (f = 0; f < POSTPROCESS_FILTER_COUNT; f++) {
+            if (strlen(filter_names[f]) == len && strncmp(name, filter_names[f], len) == 0)
+                break;
+        }
+
+        if (f == POSTPROCESS_FILTER_COUNT) {
+            fprintf(stderr, "Unknown filter: %.*s\n", (int)len, name);
+            return 1;
+        }
+
+        config->enabled[f] = 1;
+
+        name += len;
+        if (*name == ',')
+            name++;
+    }
+
+    return 0;
+}
+
+static rs2_processing_block* create_block(const struct PostProcessConfig* config, enum PostProcessFilter filter)
+{
+    rs2_error* e = NULL;
+    rs2_processing_block* block = NULL;
+
+    switch (filter)
+    {
+    case POSTPROCESS_DECIMATION:
+        block = rs2_create_decimation_filter_block(&e);
+        break;
+    case POSTPROCESS_SPATIAL:
+        block = rs2_create_spatial_filter_block(&e);
+        break;
+    case POSTPROCESS_TEMPORAL:
+        block = rs2_create_temporal_filter_block(&e);
+        break;
+    case POSTPROCESS_HOLE_FILLING:
+        block = rs2_create_hole_filling_filter_block(&e);
+        break;
+    default:
+        return NULL;
+    }
+
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed creating %s filter\n", filter_names[filter]);
+        return NULL;
+    }
+
+    if (filter == POSTPROCESS_DECIMATION)
+    {
+        rs2_set_option((rs2_options*)block, RS2_OPTION_FILTER_MAGNITUDE, (float)config->decimation, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed setting decimation to %d\n", config->decimation);
+            rs2_delete_processing_block(block);
+            return NULL;
+        }
+    }
+
+    return block;
+}
+
+static int filter_thread(void* data)
+{
+    struct PostProcessStage* st = (struct PostProcessStage*)data;
+    struct PostProcess* pp = st->chain;
+    rs2_error* e = NULL;
+
+    // The temporal filter relies on seeing framesets in order, one thread per filter keeps them so
+    while (SDL_AtomicGet(&pp->running))
+    {
+        rs2_frame* frames = NULL;
+        if (rs2_try_wait_for_frame(st->input, 100, &frames, &e) == 0) {
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed waiting for frames in %s filter\n", filter_names[st->filter]);
+                SDL_AtomicSet(&pp->failed, 1);
+                break;
+            }
+            continue;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+
+        // Takes ownership of frames and enqueues the result into the next queue
+        rs2_process_frame(st->block, frames, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed applying %s filter\n", filter_names[st->filter]);
+            SDL_AtomicSet(&pp->failed, 1);
+            break;
+        }
+
+        stage_stats_record(&st->stats, start, SDL_GetPerformanceCounter());
+    }
+
+    return 0;
+}
+
+int8_t postprocess_start(struct PostProcess* pp, const struct PostProcessConfig* config, struct RS_State* rs_state)
+{
+    rs2_error* e = NULL;
+
+    if (pp == NULL || config == NULL || rs_state == NULL) {
+        fprintf(stderr, "Cannot start post-processing: given pointer is null\n");
+        return 1;
+    }
+
+    memset(pp, 0, sizeof(struct PostProcess));
+    pp->config = *config;
+
+    if (rs_state->frame_queue == NULL)
+    {
+        rs_state->frame_queue = rs2_create_frame_queue(config->queue_size, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed creating post-processing output queue\n");
+            rs_state->frame_queue = NULL;
+            return 1;
+        }
+    }
+
+    pp->output = rs_state->frame_queue;
+
+    int f;
+    for (f = 0; f < POSTPROCESS_FILTER_COUNT; f++)
+    {
+        if (config->enabled[f] == 0)
+            continue;
+
+        struct PostProcessStage* st = &pp->stages[pp->stage_count++];
+        st->filter = (enum PostProcessFilter)f;
+        st->chain = pp;
+
+        st->block = create_block(config, st->filter);
+        if (st->block == NULL) {
+            postprocess_stop(pp);
+            return 1;
+        }
+
+        st->input = rs2_create_frame_queue(config->queue_size, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed creating queue for %s filter\n", filter_names[f]);
+            st->input = NULL;
+            postprocess_stop(pp);
+            return 1;
+        }
+    }
+
+    // Each filter hands its results to the next one's queue, the last one to the output
+    int s;
+    for (s = 0; s < pp->stage_count; s++)
+    {
+        rs2_frame_queue* next = s + 1 < pp->stage_count ? pp->stages[s + 1].input : pp->output;
+        rs2_start_processing_queue(pp->stages[s].block, next, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed connecting %s filter\n", filter_names[pp->stages[s].filter]);
+            postprocess_stop(pp);
+            return 1;
+        }
+    }
+
+    SDL_AtomicSet(&pp->running, 1);
+
+    for (s = 0; s < pp->stage_count; s++)
+    {
+        pp->stages[s].thread = SDL_CreateThread(filter_thread, "rs2 filter", &pp->stages[s]);
+        if (pp->stages[s].thread == NULL) {
+            fprintf(stderr, "Failed creating filter thread: %s\n", SDL_GetError());
+            postprocess_stop(pp);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "post-processing with %d filters\n", pp->stage_count);
+    return 0;
+}
+
+void postprocess_stop(struct PostProcess* pp)
+{
+    if (pp == NULL)
+        return;
+
+    SDL_AtomicSet(&pp->running, 0);
+
+    int s;
+    for (s = 0; s < pp->stage_count; s++)
+    {
+        struct PostProcessStage* st = &pp->stages[s];
+        if (st->thread) {
+            SDL_WaitThread(st->thread, NULL);
+            st->thread = NULL;
+        }
+    }
+
+    // Deleting a queue releases the framesets still waiting in it
+    for (s = 0; s < pp->stage_count; s++)
+    {
+        struct PostProcessStage* st = &pp->stages[s];
+        if (st->block) {
+            rs2_delete_processing_block(st->block);
+            st->block = NULL;
+        }
+
+        if (st->input) {
+            rs2_delete_frame_queue(st->input);
+            st->input = NULL;
+        }
+    }
+
+    pp->stage_count = 0;
+}
+
+void postprocess_frame_callback(rs2_frame* frames, void* user)
+{
+    struct PostProcess* pp = (struct PostProcess*)user;
+
+    if (SDL_AtomicGet(&pp->running) == 0) {
+        rs2_release_frame(frames);
+        return;
+    }
+
+    // A full queue drops its oldest frameset, the latest one always gets through
+    rs2_enqueue_frame(frames, pp->stage_count > 0 ? pp->stages[0].input : pp->output);
+}
+
+int8_t postprocess_failed(struct PostProcess* pp)
+{
+    return SDL_AtomicGet(&pp->failed) != 0;
+}
+
+void postprocess_print_stats(struct PostProcess* pp)
+{
+    int s;
+    for (s = 0; s < pp->stage_count; s++)
+        stage_stats_print(&pp->stages[s].stats, filter_names[pp->stages[s].filter]);
+}
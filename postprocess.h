@@ -0,0 +1,89 @@
+#ifndef POSTPROCESS_H
+#define POSTPROCESS_H
+
+#include <librealsense2/rs.h>
+#include <librealsense2/h/rs_frame.h>
+
+#include "rs_state.h"
+#include "stage_stats.h"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+// In the order librealsense recommends applying them
+enum PostProcessFilter
+{
+    POSTPROCESS_DECIMATION,
+    POSTPROCESS_SPATIAL,
+    POSTPROCESS_TEMPORAL,
+    POSTPROCESS_HOLE_FILLING,
+    POSTPROCESS_FILTER_COUNT
+};
+
+struct PostProcessConfig
+{
+    int8_t enabled[POSTPROCESS_FILTER_COUNT];
+    // Decimation factor, 2 halves both depth dimensions
+    int decimation;
+    // Framesets each filter may have waiting before the oldest is dropped
+    int queue_size;
+};
+
+struct PostProcess;
+
+// One filter, fed from its own frame queue by its own thread
+struct PostProcessStage
+{
+    enum PostProcessFilter filter;
+    rs2_processing_block* block;
+    rs2_frame_queue* input;
+    SDL_Thread* thread;
+    struct PostProcess* chain;
+    struct StageStats stats;
+};
+
+// Depth post-processing between librealsense and the pipeline. The sensor is
+// started with STREAM_DELIVERY_CALLBACK and postprocess_frame_callback, and
+// each enabled filter runs on its own thread, passing framesets on through
+// frame queues. Filtered framesets land in rs_state->frame_queue, where the
+// pipeline's queue source or update() picks them up, so a 30 fps stream is
+// held up by the slowest filter rather than by all of them.
+struct PostProcess
+{
+    struct PostProcessConfig config;
+    struct PostProcessStage stages[POSTPROCESS_FILTER_COUNT];
+    int stage_count;
+    rs2_frame_queue* output;
+    SDL_atomic_t running;
+    SDL_atomic_t failed;
+};
+
+// Every filter disabled
+void postprocess_default_config(struct PostProcessConfig* config);
+
+int8_t postprocess_any_enabled(const struct PostProcessConfig* config);
+
+// Enables the filters in a comma separated list of decimation, spatial,
+// temporal and hole-filling
+int8_t postprocess_parse_filters(struct PostProcessConfig* config, const char* list);
+
+// Creates rs_state->frame_queue as the output if there is none yet
+int8_t postprocess_start(struct PostProcess* pp, const struct PostProcessConfig* config, struct RS_State* rs_state);
+
+// Call once librealsense no longer delivers, the output queue is left to rs_state
+void postprocess_stop(struct PostProcess* pp);
+
+// rs2_frame_callback_ptr for the sensor, user is the chain
+void postprocess_frame_callback(rs2_frame* frames, void* user);
+
+// 1 once a filter thread hit an error and stopped
+int8_t postprocess_failed(struct PostProcess* pp);
+
+void postprocess_print_stats(struct PostProcess* pp);
+
+#endif
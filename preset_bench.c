@@ -0,0 +1,151 @@
+#include <librealsense2/rs.h>
+#include <librealsense2/h/rs_pipeline.h>
+#include <librealsense2/h/rs_frame.h>
+
+#define SDL_MAIN_HANDLED
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_handle.h"
+#include "frames.h"
+#include "preset_switch.h"
+#include "rs_error.h"
+#include "rs_state.h"
+#include "stream_options.h"
+
+// Cycles the visual preset on a streaming camera and fails when a switch
+// pauses depth frames for longer than the limit. Needs a device, presets
+// cannot be switched on recordings or synthetic frames.
+
+#define PRESET_BENCH_DEFAULT_SWITCHES 9
+#define PRESET_BENCH_DEFAULT_FRAMES_BETWEEN 30
+// Longest acceptable pause in frame delivery while switching presets on a running pipeline
+#define PRESET_BENCH_MAX_GAP_MS 100.0
+
+int main(int argc, char** argv)
+{
+    struct StreamConfig stream_config;
+    stream_config_defaults(&stream_config);
+
+    int switches = PRESET_BENCH_DEFAULT_SWITCHES;
+    int frames_between = PRESET_BENCH_DEFAULT_FRAMES_BETWEEN;
+    double max_gap_ms = PRESET_BENCH_MAX_GAP_MS;
+
+    int arg;
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--switches") == 0 && arg + 1 < argc) {
+            switches = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--between") == 0 && arg + 1 < argc) {
+            frames_between = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--max-gap") == 0 && arg + 1 < argc) {
+            max_gap_ms = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "--config") == 0 && arg + 1 < argc) {
+            if (stream_options_load(&stream_config, argv[++arg]) != 0)
+                return 1;
+        } else if (strncmp(argv[arg], "--", 2) == 0 && arg + 1 < argc &&
+                   stream_option_set(&stream_config, argv[arg] + 2, argv[arg + 1]) == 0) {
+            arg++;
+        } else {
+            fprintf(stderr, "usage: %s [--switches n] [--between frames] [--max-gap ms] %s\n",
+                    argv[0], STREAM_OPTIONS_USAGE);
+            return 1;
+        }
+    }
+
+    if (switches <= 0 || frames_between <= 0 || max_gap_ms <= 0.0) {
+        fprintf(stderr, "Switch and frame counts and the gap limit must be positive\n");
+        return 1;
+    }
+
+    SDL_SetMainReady();
+
+    struct RS_State rs_state;
+    memset(&rs_state, 0, sizeof(rs_state));
+
+    if (create_context(&rs_state) != 0)
+        return 1;
+
+    if (ensure_advanced(&rs_state) != 0 || start_sensor(&rs_state, 0, 0, &stream_config, NULL) != 0) {
+        clear_state(&rs_state);
+        return 1;
+    }
+
+    struct FrameHandle dep;
+    struct FrameHandle col_frame;
+    memset(&dep, 0, sizeof(dep));
+    memset(&col_frame, 0, sizeof(col_frame));
+
+    struct PresetSwitch preset_switch;
+    preset_switch_init(&preset_switch, max_gap_ms);
+
+    int preset_index = 0;
+    int frames = 0;
+    int8_t failed = 0;
+
+    while (preset_switch.switches < switches)
+    {
+        rs2_error* e = NULL;
+        int8_t new_dep = 0;
+        int8_t new_col = 0;
+
+        rs2_frame* frameset = rs2_pipeline_wait_for_frames(rs_state.pipe, 5000, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "No frames for 5 s, %d switches done\n", preset_switch.switches);
+            failed = 1;
+            break;
+        }
+
+        int8_t extract_failed = extract_frames(frameset, &dep, &col_frame, &new_dep, &new_col);
+        rs2_release_frame(frameset);
+        if (extract_failed) {
+            failed = 1;
+            break;
+        }
+
+        if (new_dep == 0)
+            continue;
+
+        if (preset_switch_frame(&preset_switch, &dep)) {
+            fprintf(stderr, "preset switch to %s: %.1f ms gap, %llu frames missing, depth frame %llu -> %llu%s\n",
+                    presets[preset_index], preset_switch.gap_ms, preset_switch.missing, preset_switch.first_number,
+                    dep.number, preset_switch.gap_ms > max_gap_ms ? ", too slow" : "");
+            frames = 0;
+        }
+
+        frames++;
+        if (preset_switch.pending == 0 && frames >= frames_between)
+        {
+            preset_index++;
+            if (preset_index >= PRESET_COUNT)
+                preset_index = 0;
+
+            if (preset_switch_start(&preset_switch, &rs_state, presets[preset_index], &dep) != 0) {
+                failed = 1;
+                break;
+            }
+        }
+    }
+
+    preset_switch_print_stats(&preset_switch);
+
+    frame_handle_release(&dep);
+    frame_handle_release(&col_frame);
+    stop_stream(&rs_state);
+    clear_state(&rs_state);
+
+    if (failed == 0 && preset_switch.over_limit > 0) {
+        fprintf(stderr, "preset switch FAILED: %d of %d switches paused frames for over %.1f ms\n",
+                preset_switch.over_limit, preset_switch.switches, max_gap_ms);
+        return 1;
+    }
+    return failed;
+}
@@ -0,0 +1,102 @@
+#include "preset_switch.h"
+#include "rs_error.h"
+
+#include <librealsense2/h/rs_frame.h>
+
+#include <stdio.h>
+#include <string.h>
+
+void preset_switch_init(struct PresetSwitch* ps, double limit_ms)
+{
+    memset(ps, 0, sizeof(struct PresetSwitch));
+    ps->limit_ms = limit_ms;
+}
+
+// Host time librealsense got the frame at, -1 when it does not say
+static double arrival_time(const struct FrameHandle* h)
+{
+    rs2_error* e = NULL;
+
+    if (h->frame == NULL)
+        return -1.0;
+
+    int supported = rs2_supports_frame_metadata(h->frame, RS2_FRAME_METADATA_TIME_OF_ARRIVAL, &e);
+    if (check_error(e) != 0 || supported == 0)
+        return -1.0;
+
+    rs2_metadata_type arrival = rs2_get_frame_metadata(h->frame, RS2_FRAME_METADATA_TIME_OF_ARRIVAL, &e);
+    if (check_error(e) != 0)
+        return -1.0;
+
+    return (double)arrival;
+}
+
+int8_t preset_switch_start(struct PresetSwitch* ps, struct RS_State* rs_state, const char* preset,
+                           const struct FrameHandle* dep)
+{
+    rs2_error* e = NULL;
+
+    ps->pending = 0;
+    ps->first_number = dep->number;
+    ps->last_number = dep->number;
+    ps->last_timestamp = dep->timestamp;
+    ps->last_arrival = dep->data != NULL ? arrival_time(dep) : -1.0;
+    ps->gap_ms = 0.0;
+    ps->missing = 0;
+
+    // The sensors stay open, only the option changes while frames keep flowing
+    if (set_preset(rs_state, preset) != 0)
+        return 1;
+
+    ps->returned_at = rs2_get_time(&e);
+    if (check_error(e) != 0)
+        ps->returned_at = 0.0;
+
+    // Without a frame before, there is no gap to measure
+    ps->pending = dep->data != NULL;
+    return 0;
+}
+
+int8_t preset_switch_frame(struct PresetSwitch* ps, const struct FrameHandle* dep)
+{
+    if (ps->pending == 0 || dep->data == NULL || dep->number == ps->last_number)
+        return 0;
+
+    // The raw pause between deliveries, however many frames it swallowed
+    const double arrival = arrival_time(dep);
+    const double step = arrival >= 0.0 && ps->last_arrival >= 0.0 ? arrival - ps->last_arrival
+                                                                   : dep->timestamp - ps->last_timestamp;
+    if (step > ps->gap_ms)
+        ps->gap_ms = step;
+
+    // A counter that restarted says nothing about what went missing
+    if (dep->number > ps->last_number + 1)
+        ps->missing += dep->number - ps->last_number - 1;
+
+    ps->last_number = dep->number;
+    ps->last_timestamp = dep->timestamp;
+    ps->last_arrival = arrival;
+
+    // Frames queued before set_preset returned still belong to the switch
+    if (arrival >= 0.0 && arrival < ps->returned_at)
+        return 0;
+
+    ps->pending = 0;
+    ps->switches++;
+    ps->missing_total += ps->missing;
+    if (ps->gap_ms > ps->max_gap_ms)
+        ps->max_gap_ms = ps->gap_ms;
+    if (ps->limit_ms > 0.0 && ps->gap_ms > ps->limit_ms)
+        ps->over_limit++;
+    return 1;
+}
+
+void preset_switch_print_stats(const struct PresetSwitch* ps)
+{
+    if (ps->limit_ms > 0.0)
+        fprintf(stderr, "preset switches: %d, longest gap %.1f ms, %llu frames missing, over %.1f ms: %d\n",
+                ps->switches, ps->max_gap_ms, ps->missing_total, ps->limit_ms, ps->over_limit);
+    else
+        fprintf(stderr, "preset switches: %d, longest gap %.1f ms, %llu frames missing\n", ps->switches,
+                ps->max_gap_ms, ps->missing_total);
+}
@@ -0,0 +1,50 @@
+#ifndef PRESET_SWITCH_H
+#define PRESET_SWITCH_H
+
+#include <stdint.h>
+
+#include "frame_handle.h"
+#include "rs_state.h"
+
+// Switches the visual preset on running sensors and measures the pause in
+// depth frames it causes from the frames themselves. A switch is done at
+// the first frame captured after set_preset returned, going by the time
+// librealsense saw the frame arrive. The gap is the longest time between
+// consecutive depth frames delivered up to there, by arrival time or, where
+// that is missing, device timestamp; frame numbers skipped on the way are
+// counted apart as missing frames.
+struct PresetSwitch
+{
+    int8_t pending;
+    // Host time set_preset returned at, as rs2_get_time() tells it
+    double returned_at;
+    // First and last depth frame seen since the switch began
+    unsigned long long first_number;
+    unsigned long long last_number;
+    double last_timestamp;
+    // -1 when librealsense did not say
+    double last_arrival;
+    double gap_ms;
+    unsigned long long missing;
+
+    int switches;
+    double max_gap_ms;
+    unsigned long long missing_total;
+    // Switches with a gap over limit_ms, 0 for no limit
+    int over_limit;
+    double limit_ms;
+};
+
+void preset_switch_init(struct PresetSwitch* ps, double limit_ms);
+
+// Switches to preset, dep is the last depth frame seen before
+int8_t preset_switch_start(struct PresetSwitch* ps, struct RS_State* rs_state, const char* preset,
+                           const struct FrameHandle* dep);
+
+// Takes every depth frame seen while a switch is pending, in order.
+// Returns 1 when dep finished the switch, with gap_ms and missing set.
+int8_t preset_switch_frame(struct PresetSwitch* ps, const struct FrameHandle* dep);
+
+void preset_switch_print_stats(const struct PresetSwitch* ps);
+
+#endif
@@ -0,0 +1,273 @@
+#include "publisher.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+void publisher_default_config(struct PublisherConfig* config)
+{
+    config->name = SHM_FRAMES_DEFAULT_NAME;
+    config->slots = SHM_FRAMES_DEFAULT_SLOTS;
+}
+
+static void fill_stream_info(struct RecordingStreamInfo* info, const struct StreamInfo* stream)
+{
+    const rs2_intrinsics* intrin = &stream->intrinsics;
+    info->width = intrin->width;
+    info->height = intrin->height;
+    info->format = (int32_t)stream->format;
+    info->fps = stream->fps;
+    info->ppx = intrin->ppx;
+    info->ppy = intrin->ppy;
+    info->fx = intrin->fx;
+    info->fy = intrin->fy;
+    info->model = (int32_t)intrin->model;
+    memcpy(info->coeffs, intrin->coeffs, sizeof(info->coeffs));
+}
+
+static size_t align_up(size_t size)
+{
+    return (size + SHM_FRAMES_ALIGN - 1) & ~(size_t)(SHM_FRAMES_ALIGN - 1);
+}
+
+#ifdef WIN32
+
+int8_t publisher_start(struct Publisher* pub, const struct PublisherConfig* config, const struct RS_State* rs_state)
+{
+    memset(pub, 0, sizeof(struct Publisher));
+    fprintf(stderr, "Publishing frames to shared memory is not supported on Windows\n");
+    return 1;
+}
+
+void publisher_submit(struct Publisher* pub, const struct FrameHandle* frame, enum RecordingStream stream)
+{
+}
+
+void publisher_stop(struct Publisher* pub)
+{
+}
+
+#else
+
+// Readers on systems without futexes poll published instead
+static void wake_readers(struct Publisher* pub)
+{
+#ifdef __linux__
+    // The segment is shared, so no FUTEX_PRIVATE_FLAG. Without waiters this
+    // costs a syscall per frame, which keeps readers' mappings read-only.
+    syscall(SYS_futex, &pub->header->published, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+#endif
+}
+
+static void release_all(struct Publisher* pub)
+{
+    if (pub->base != NULL)
+        munmap(pub->base, pub->size);
+    if (pub->fd >= 0)
+        close(pub->fd);
+    if (pub->lock != NULL)
+        SDL_DestroyMutex(pub->lock);
+    pub->base = NULL;
+    pub->header = NULL;
+    pub->fd = -1;
+    pub->lock = NULL;
+}
+
+// 1 when a publisher that is still running owns the segment under name
+static int8_t segment_in_use(const char* name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+
+    int8_t in_use = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct ShmFramesHeader)) {
+        void* base = mmap(NULL, sizeof(struct ShmFramesHeader), PROT_READ, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED) {
+            const struct ShmFramesHeader* h = (const struct ShmFramesHeader*)base;
+            const pid_t pid = (pid_t)__atomic_load_n(&h->publisher_pid, __ATOMIC_ACQUIRE);
+            // EPERM means the process exists but belongs to someone else
+            if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE) == 0 && pid > 0 &&
+                (kill(pid, 0) == 0 || errno == EPERM))
+                in_use = 1;
+            munmap(base, sizeof(struct ShmFramesHeader));
+        }
+    }
+
+    close(fd);
+    return in_use;
+}
+
+int8_t publisher_start(struct Publisher* pub, const struct PublisherConfig* config, const struct RS_State* rs_state)
+{
+    if (pub == NULL || config == NULL || config->name == NULL || rs_state == NULL) {
+        fprintf(stderr, "Cannot start publisher: given pointer is null\n");
+        return 1;
+    }
+
+    memset(pub, 0, sizeof(struct Publisher));
+    pub->config = *config;
+    pub->fd = -1;
+
+    const int slots = pub->config.slots;
+    if (slots < 2 || (slots & (slots - 1)) != 0) {
+        fprintf(stderr, "Publisher slots have to be a power of two of at least 2, not %d\n", slots);
+        return 1;
+    }
+
+    // Color may come as RGB8, RGBA8 or BGRA8, the slots take the widest
+    const size_t depth_bytes = (size_t)rs_state->depth.intrinsics.width * rs_state->depth.intrinsics.height * 2;
+    const size_t color_bytes = (size_t)rs_state->color.intrinsics.width * rs_state->color.intrinsics.height * 4;
+    const size_t payload = depth_bytes > color_bytes ? depth_bytes : color_bytes;
+    const size_t slot_size = align_up(sizeof(struct ShmFrameSlot) + payload);
+    const size_t slots_offset = align_up(sizeof(struct ShmFramesHeader));
+    pub->size = slots_offset + slot_size * (size_t)slots;
+
+    if (segment_in_use(pub->config.name)) {
+        fprintf(stderr, "Failed creating shared memory %s: %s, a running publisher owns it\n", pub->config.name,
+                strerror(EEXIST));
+        return 1;
+    }
+
+    // A segment left behind by a publisher that did not stop cleanly
+    shm_unlink(pub->config.name);
+    pub->fd = shm_open(pub->config.name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (pub->fd < 0) {
+        fprintf(stderr, "Failed creating shared memory %s: %s\n", pub->config.name, strerror(errno));
+        return 1;
+    }
+
+    pub->lock = SDL_CreateMutex();
+    if (pub->lock == NULL) {
+        fprintf(stderr, "Failed creating publisher lock: %s\n", SDL_GetError());
+        release_all(pub);
+        shm_unlink(pub->config.name);
+        return 1;
+    }
+
+    if (ftruncate(pub->fd, (off_t)pub->size) != 0) {
+        fprintf(stderr, "Failed sizing shared memory %s to %lu bytes: %s\n", pub->config.name,
+                (unsigned long)pub->size, strerror(errno));
+        release_all(pub);
+        shm_unlink(pub->config.name);
+        return 1;
+    }
+
+    void* base = mmap(NULL, pub->size, PROT_READ | PROT_WRITE, MAP_SHARED, pub->fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed mapping shared memory %s: %s\n", pub->config.name, strerror(errno));
+        release_all(pub);
+        shm_unlink(pub->config.name);
+        return 1;
+    }
+    pub->base = (uint8_t*)base;
+    pub->header = (struct ShmFramesHeader*)base;
+
+    // ftruncate zeroed the segment, every slot starts at sequence 0
+    struct ShmFramesHeader* h = pub->header;
+    h->version = SHM_FRAMES_VERSION;
+    h->slot_count = (uint32_t)slots;
+    h->slot_size = slot_size;
+    h->slots_offset = slots_offset;
+    h->total_size = pub->size;
+    fill_stream_info(&h->streams[RECORDING_STREAM_DEPTH], &rs_state->depth);
+    fill_stream_info(&h->streams[RECORDING_STREAM_COLOR], &rs_state->color);
+    h->has_extrinsics = rs_state->has_extrinsics;
+    if (rs_state->has_extrinsics) {
+        memcpy(h->rotation, rs_state->depth_to_color.rotation, sizeof(h->rotation));
+        memcpy(h->translation, rs_state->depth_to_color.translation, sizeof(h->translation));
+    }
+    h->publisher_pid = (uint32_t)getpid();
+
+    // Readers check the magic last, once it is there the rest is too
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(h->magic, SHM_FRAMES_MAGIC, sizeof(h->magic));
+
+    fprintf(stderr, "publishing frames to shared memory %s, %d slots of %lu KB\n", pub->config.name, slots,
+            (unsigned long)(slot_size >> 10));
+    return 0;
+}
+
+void publisher_submit(struct Publisher* pub, const struct FrameHandle* frame, enum RecordingStream stream)
+{
+    if (pub->header == NULL || frame->data == NULL)
+        return;
+
+    const size_t payload_size = (size_t)frame->stride * frame->height;
+    if (sizeof(struct ShmFrameSlot) + payload_size > pub->header->slot_size) {
+        SDL_AtomicAdd(&pub->oversized, 1);
+        return;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    SDL_LockMutex(pub->lock);
+
+    const uint32_t index = pub->published;
+    struct ShmFrameSlot* slot = (struct ShmFrameSlot*)(pub->base + pub->header->slots_offset +
+                                                       (size_t)(index & (pub->header->slot_count - 1)) * pub->header->slot_size);
+
+    // Odd while writing, a reader that saw the slot before or sees it now retries
+    const uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->stream = (uint8_t)stream;
+    slot->width = (uint32_t)frame->width;
+    slot->height = (uint32_t)frame->height;
+    slot->stride = (uint32_t)frame->stride;
+    slot->payload_size = (uint32_t)payload_size;
+    slot->format = (int32_t)frame->format;
+    slot->timestamp_domain = (int32_t)frame->timestamp_domain;
+    slot->frame_number = frame->number;
+    slot->timestamp = frame->timestamp;
+    slot->depth_units = frame->depth_units;
+    slot->index = index;
+    memcpy((uint8_t*)slot + sizeof(struct ShmFrameSlot), frame->data, payload_size);
+
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+    pub->published = index + 1;
+    __atomic_store_n(&pub->header->published, index + 1, __ATOMIC_RELEASE);
+
+    pub->frames[stream]++;
+    pub->bytes += payload_size;
+    SDL_UnlockMutex(pub->lock);
+
+    wake_readers(pub);
+    stage_stats_record(&pub->publish_stats, start, SDL_GetPerformanceCounter());
+}
+
+void publisher_stop(struct Publisher* pub)
+{
+    if (pub == NULL || pub->header == NULL)
+        return;
+
+    // Readers still mapping it see the close, new ones no longer find it
+    __atomic_store_n(&pub->header->closed, 1, __ATOMIC_RELEASE);
+    wake_readers(pub);
+    shm_unlink(pub->config.name);
+    release_all(pub);
+}
+
+#endif
+
+void publisher_print_stats(struct Publisher* pub)
+{
+    fprintf(stderr, "publisher: %llu depth, %llu color frames, %.1f MB, %d too large for the slots\n",
+            (unsigned long long)pub->frames[RECORDING_STREAM_DEPTH], (unsigned long long)pub->frames[RECORDING_STREAM_COLOR],
+            (double)pub->bytes / (1 << 20), SDL_AtomicGet(&pub->oversized));
+    stage_stats_print(&pub->publish_stats, "publish");
+}
@@ -0,0 +1,64 @@
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+#include "frame_handle.h"
+#include "recording.h"
+#include "rs_state.h"
+#include "shm_frames.h"
+#include "stage_stats.h"
+
+struct PublisherConfig
+{
+    // shm_open name of the segment, e.g. "/minimal_realsense2"
+    const char* name;
+    int slots;
+};
+
+// Copies frames into a shared memory segment (see shm_frames.h) that any
+// number of other processes map with shm_reader. Publishing never waits
+// for a reader: slow readers find their slots overwritten and skip ahead.
+// The copy happens on the submitting thread, submits from several threads
+// are serialized on a mutex only publishers take.
+struct Publisher
+{
+    struct PublisherConfig config;
+    int fd;
+    uint8_t* base;
+    size_t size;
+    struct ShmFramesHeader* header;
+
+    // Held across the copy, which takes too long to spin on
+    SDL_mutex* lock;
+    // Guarded by lock
+    uint32_t published;
+
+    SDL_atomic_t oversized;
+    uint64_t frames[RECORDING_STREAM_COUNT];
+    uint64_t bytes;
+    struct StageStats publish_stats;
+};
+
+void publisher_default_config(struct PublisherConfig* config);
+
+// Creates the segment with slots sized for the streams rs_state resolved.
+// A segment of the same name is only replaced once its publisher is gone.
+int8_t publisher_start(struct Publisher* pub, const struct PublisherConfig* config, const struct RS_State* rs_state);
+
+// Copies the frame into the next slot and wakes waiting readers. A frame
+// larger than the slots, e.g. after a resolution change, is counted and skipped.
+void publisher_submit(struct Publisher* pub, const struct FrameHandle* frame, enum RecordingStream stream);
+
+// Marks the segment closed for the readers still mapping it and unlinks it
+void publisher_stop(struct Publisher* pub);
+
+void publisher_print_stats(struct Publisher* pub);
+
+#endif
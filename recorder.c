@@ -0,0 +1,445 @@
+#include "recorder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* stream_names[RECORDING_STREAM_COUNT] = { "depth", "color" };
+
+void recorder_default_config(struct RecorderConfig* config)
+{
+    config->path = NULL;
+    config->compress_depth = 0;
+    config->queue_size = RECORDER_DEFAULT_QUEUE_SIZE;
+    config->pool = NULL;
+}
+
+static void* alloc_scratch(struct Recorder* rec, size_t size)
+{
+    if (rec->config.pool != NULL)
+        return frame_pool_acquire(rec->config.pool, size);
+    return malloc(size);
+}
+
+static void free_scratch(struct Recorder* rec, void* scratch)
+{
+    if (rec->config.pool != NULL)
+        frame_pool_release(rec->config.pool, scratch);
+    else
+        free(scratch);
+}
+
+static int8_t flush_buffer(struct Recorder* rec)
+{
+    if (rec->buffer_used == 0)
+        return 0;
+
+    if (fwrite(rec->buffer, 1, rec->buffer_used, rec->file) != rec->buffer_used) {
+        fprintf(stderr, "Failed writing recording %s\n", rec->config.path);
+        return 1;
+    }
+
+    rec->buffer_used = 0;
+    return 0;
+}
+
+// Small writes gather in the buffer, big payloads go straight to the file
+// once what came before them is out
+static int8_t write_bytes(struct Recorder* rec, const void* data, size_t size)
+{
+    if (rec->buffer_used + size > RECORDER_BUFFER_SIZE && flush_buffer(rec) != 0)
+        return 1;
+
+    if (size >= RECORDER_BUFFER_SIZE / 2)
+    {
+        if (flush_buffer(rec) != 0)
+            return 1;
+        if (fwrite(data, 1, size, rec->file) != size) {
+            fprintf(stderr, "Failed writing recording %s\n", rec->config.path);
+            return 1;
+        }
+    }
+    else
+    {
+        memcpy(rec->buffer + rec->buffer_used, data, size);
+        rec->buffer_used += size;
+    }
+
+    rec->offset += size;
+    return 0;
+}
+
+static int8_t write_padding(struct Recorder* rec)
+{
+    static const uint8_t zeros[RECORDING_ALIGN];
+    const size_t pad = (size_t)(-rec->offset & (RECORDING_ALIGN - 1));
+    return pad ? write_bytes(rec, zeros, pad) : 0;
+}
+
+static int8_t append_index(struct Recorder* rec, const struct RecordingIndexEntry* entry)
+{
+    if (rec->index_count == rec->index_capacity)
+    {
+        uint64_t capacity = rec->index_capacity ? rec->index_capacity * 2 : 4096;
+        struct RecordingIndexEntry* index = (struct RecordingIndexEntry*)realloc(
+            rec->index, capacity * sizeof(struct RecordingIndexEntry));
+        if (index == NULL) {
+            fprintf(stderr, "Failed growing recording index to %llu entries\n", (unsigned long long)capacity);
+            return 1;
+        }
+        rec->index = index;
+        rec->index_capacity = capacity;
+    }
+
+    rec->index[rec->index_count++] = *entry;
+    return 0;
+}
+
+// Decimated depth can differ from the resolved size, the scratch follows it
+static int8_t ensure_codec(struct Recorder* rec, int pixels)
+{
+    if (pixels <= rec->codec.capacity)
+        return 0;
+
+    depth_codec_free(&rec->codec);
+    free_scratch(rec, rec->encoded);
+    rec->encoded_size = depth_codec_bound(pixels);
+    rec->encoded = (uint8_t*)alloc_scratch(rec, rec->encoded_size);
+    if (rec->encoded == NULL) {
+        fprintf(stderr, "Failed allocating %zu bytes for depth compression\n", rec->encoded_size);
+        rec->encoded_size = 0;
+        return 1;
+    }
+
+    return depth_codec_init(&rec->codec, pixels);
+}
+
+static int8_t write_item(struct Recorder* rec, const struct RecorderItem* item)
+{
+    const struct FrameHandle* f = &item->frame;
+    const size_t raw_size = (size_t)f->stride * f->height;
+
+    struct RecordingChunk chunk;
+    memset(&chunk, 0, sizeof(chunk));
+    chunk.magic = RECORDING_CHUNK_MAGIC;
+    chunk.stream = (uint8_t)item->stream;
+    chunk.codec = RECORDING_CODEC_RAW;
+    chunk.width = (uint32_t)f->width;
+    chunk.height = (uint32_t)f->height;
+    chunk.stride = (uint32_t)f->stride;
+    chunk.payload_size = (uint32_t)raw_size;
+    chunk.frame_number = f->number;
+    chunk.timestamp = f->timestamp;
+    chunk.depth_units = f->depth_units;
+
+    const void* payload = f->data;
+
+    if (rec->config.compress_depth && item->stream == RECORDING_STREAM_DEPTH && f->format == RS2_FORMAT_Z16)
+    {
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        if (ensure_codec(rec, f->width * f->height) != 0)
+            return 1;
+
+        size_t size = depth_codec_encode(&rec->codec, (const uint16_t*)f->data, f->width, f->height, f->stride,
+                                         rec->encoded, rec->encoded_size);
+        stage_stats_record(&rec->encode_stats, t0, SDL_GetPerformanceCounter());
+
+        // Noise can make the encoded frame bigger, those stay raw
+        if (size != 0 && size < raw_size) {
+            chunk.codec = RECORDING_CODEC_DEPTH;
+            chunk.payload_size = (uint32_t)size;
+            payload = rec->encoded;
+        }
+    }
+
+    struct RecordingIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = rec->offset;
+    entry.frame_number = chunk.frame_number;
+    entry.timestamp = chunk.timestamp;
+    entry.payload_size = chunk.payload_size;
+    entry.stream = chunk.stream;
+    entry.codec = chunk.codec;
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    if (write_bytes(rec, &chunk, sizeof(chunk)) != 0 ||
+        write_bytes(rec, payload, chunk.payload_size) != 0 ||
+        write_padding(rec) != 0 ||
+        append_index(rec, &entry) != 0)
+        return 1;
+    stage_stats_record(&rec->write_stats, t0, SDL_GetPerformanceCounter());
+
+    rec->frames[item->stream]++;
+    rec->raw_bytes += raw_size;
+    rec->stored_bytes += chunk.payload_size;
+    return 0;
+}
+
+static void recycle_item(struct Recorder* rec, struct RecorderItem* item)
+{
+    frame_handle_release(&item->frame);
+
+    // The pool holds every item, so this cannot run out of room
+    ring_queue_try_push(&rec->free_items, item);
+}
+
+static int writer_thread(void* data)
+{
+    struct Recorder* rec = (struct Recorder*)data;
+
+    // Frames queued before recorder_stop are still written
+    for (;;)
+    {
+        struct RecorderItem* item = (struct RecorderItem*)ring_queue_pop_wait(&rec->pending, 100);
+        if (item == NULL) {
+            if (SDL_AtomicGet(&rec->running) == 0)
+                break;
+            continue;
+        }
+
+        // After a failed write the file is useless, frames are only let go
+        if (SDL_AtomicGet(&rec->failed) == 0 && write_item(rec, item) != 0)
+            SDL_AtomicSet(&rec->failed, 1);
+
+        recycle_item(rec, item);
+    }
+
+    return 0;
+}
+
+static void fill_stream_info(struct RecordingStreamInfo* info, const struct StreamInfo* stream)
+{
+    const rs2_intrinsics* intrin = &stream->intrinsics;
+    info->width = intrin->width;
+    info->height = intrin->height;
+    info->format = (int32_t)stream->format;
+    info->fps = stream->fps;
+    info->ppx = intrin->ppx;
+    info->ppy = intrin->ppy;
+    info->fx = intrin->fx;
+    info->fy = intrin->fy;
+    info->model = (int32_t)intrin->model;
+    memcpy(info->coeffs, intrin->coeffs, sizeof(info->coeffs));
+}
+
+static void release_all(struct Recorder* rec)
+{
+    int i;
+    if (rec->items)
+    {
+        for (i = 0; i < rec->item_count; i++)
+            frame_handle_release(&rec->items[i].frame);
+        free(rec->items);
+        rec->items = NULL;
+    }
+
+    ring_queue_free(&rec->pending);
+    ring_queue_free(&rec->free_items);
+    depth_codec_free(&rec->codec);
+    free_scratch(rec, rec->encoded);
+    free(rec->index);
+    free_scratch(rec, rec->buffer_block);
+    rec->encoded = NULL;
+    rec->index = NULL;
+    rec->buffer_block = NULL;
+    rec->buffer = NULL;
+
+    if (rec->file) {
+        fclose(rec->file);
+        rec->file = NULL;
+    }
+}
+
+int8_t recorder_start(struct Recorder* rec, const struct RecorderConfig* config, const struct RS_State* rs_state)
+{
+    if (rec == NULL || config == NULL || config->path == NULL || rs_state == NULL) {
+        fprintf(stderr, "Cannot start recorder: given pointer is null\n");
+        return 1;
+    }
+
+    memset(rec, 0, sizeof(struct Recorder));
+    rec->config = *config;
+    if (rec->config.queue_size < 1)
+        rec->config.queue_size = RECORDER_DEFAULT_QUEUE_SIZE;
+
+    rec->file = fopen(rec->config.path, "wb");
+    if (rec->file == NULL) {
+        fprintf(stderr, "Failed creating recording %s\n", rec->config.path);
+        return 1;
+    }
+
+    // The writer already hands over whole buffers, stdio would only copy them again
+    setvbuf(rec->file, NULL, _IONBF, 0);
+
+    const size_t buffer_bytes = RECORDER_BUFFER_SIZE + RECORDER_BUFFER_ALIGN - 1;
+    const int depth_pixels = rs_state->depth.intrinsics.width * rs_state->depth.intrinsics.height;
+    if (rec->config.pool != NULL &&
+        (frame_pool_reserve(rec->config.pool, buffer_bytes, 1) != 0 ||
+         (rec->config.compress_depth && frame_pool_reserve(rec->config.pool, depth_codec_bound(depth_pixels), 1) != 0))) {
+        release_all(rec);
+        return 1;
+    }
+
+    rec->buffer_block = alloc_scratch(rec, buffer_bytes);
+    if (rec->buffer_block == NULL) {
+        fprintf(stderr, "Failed allocating recorder buffer\n");
+        release_all(rec);
+        return 1;
+    }
+    rec->buffer = (uint8_t*)(((uintptr_t)rec->buffer_block + RECORDER_BUFFER_ALIGN - 1) &
+                             ~(uintptr_t)(RECORDER_BUFFER_ALIGN - 1));
+
+    if (rec->config.compress_depth && ensure_codec(rec, depth_pixels) != 0) {
+        release_all(rec);
+        return 1;
+    }
+
+    // Growing the index would allocate on the writer while streaming
+    rec->index_capacity = (uint64_t)(rs_state->depth.fps + rs_state->color.fps) * RECORDER_INDEX_RESERVE_SECONDS;
+    if (rec->index_capacity == 0)
+        rec->index_capacity = 4096;
+    rec->index = (struct RecordingIndexEntry*)malloc(rec->index_capacity * sizeof(struct RecordingIndexEntry));
+    if (rec->index == NULL) {
+        fprintf(stderr, "Failed allocating recording index of %llu entries\n", (unsigned long long)rec->index_capacity);
+        release_all(rec);
+        return 1;
+    }
+
+    if (ring_queue_init(&rec->free_items, rec->config.queue_size, RING_QUEUE_DROP_NEWEST, NULL, NULL) != 0 ||
+        ring_queue_init(&rec->pending, rec->config.queue_size, RING_QUEUE_DROP_NEWEST, NULL, NULL) != 0) {
+        release_all(rec);
+        return 1;
+    }
+
+    rec->item_count = rec->config.queue_size;
+    rec->items = (struct RecorderItem*)calloc(rec->item_count, sizeof(struct RecorderItem));
+    if (rec->items == NULL) {
+        fprintf(stderr, "Failed allocating %d recorder items\n", rec->item_count);
+        release_all(rec);
+        return 1;
+    }
+
+    int i;
+    for (i = 0; i < rec->item_count; i++)
+        ring_queue_try_push(&rec->free_items, &rec->items[i]);
+
+    struct RecordingHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RECORDING_VERSION;
+    header.flags = rec->config.compress_depth ? RECORDING_FLAG_DEPTH_COMPRESSED : 0;
+    fill_stream_info(&header.streams[RECORDING_STREAM_DEPTH], &rs_state->depth);
+    fill_stream_info(&header.streams[RECORDING_STREAM_COLOR], &rs_state->color);
+    header.has_extrinsics = rs_state->has_extrinsics;
+    if (rs_state->has_extrinsics) {
+        memcpy(header.rotation, rs_state->depth_to_color.rotation, sizeof(header.rotation));
+        memcpy(header.translation, rs_state->depth_to_color.translation, sizeof(header.translation));
+    }
+
+    if (write_bytes(rec, &header, sizeof(header)) != 0 || write_padding(rec) != 0) {
+        release_all(rec);
+        return 1;
+    }
+
+    rec->t_start = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&rec->running, 1);
+
+    rec->writer = SDL_CreateThread(writer_thread, "rs2 recorder", rec);
+    if (rec->writer == NULL) {
+        fprintf(stderr, "Failed creating recorder thread: %s\n", SDL_GetError());
+        SDL_AtomicSet(&rec->running, 0);
+        release_all(rec);
+        return 1;
+    }
+
+    fprintf(stderr, "recording to %s%s, %d frames queued at most\n", rec->config.path,
+            rec->config.compress_depth ? " with depth compression" : "", rec->item_count);
+    return 0;
+}
+
+void recorder_submit(struct Recorder* rec, const struct FrameHandle* frame, enum RecordingStream stream)
+{
+    if (rec == NULL || rec->writer == NULL || frame == NULL || frame->frame == NULL)
+        return;
+
+    void* slot = NULL;
+    if (ring_queue_try_pop(&rec->free_items, &slot) != 0) {
+        // The disk fell behind, capture must not wait for it
+        SDL_AtomicAdd(&rec->dropped, 1);
+        return;
+    }
+
+    struct RecorderItem* item = (struct RecorderItem*)slot;
+    if (frame_handle_share(frame, &item->frame) != 0) {
+        ring_queue_try_push(&rec->free_items, item);
+        SDL_AtomicSet(&rec->failed, 1);
+        return;
+    }
+
+    item->stream = stream;
+    ring_queue_try_push(&rec->pending, item);
+}
+
+int8_t recorder_stop(struct Recorder* rec)
+{
+    if (rec == NULL || rec->file == NULL)
+        return 0;
+
+    SDL_AtomicSet(&rec->running, 0);
+    if (rec->writer) {
+        SDL_WaitThread(rec->writer, NULL);
+        rec->writer = NULL;
+    }
+
+    int8_t ret = SDL_AtomicGet(&rec->failed) != 0;
+    if (ret == 0)
+    {
+        struct RecordingTrailer trailer;
+        memset(&trailer, 0, sizeof(trailer));
+        trailer.index_offset = rec->offset;
+        trailer.index_count = rec->index_count;
+        trailer.magic = RECORDING_TRAILER_MAGIC;
+
+        if (write_bytes(rec, rec->index, rec->index_count * sizeof(struct RecordingIndexEntry)) != 0 ||
+            write_bytes(rec, &trailer, sizeof(trailer)) != 0 ||
+            flush_buffer(rec) != 0)
+            ret = 1;
+    }
+    else
+    {
+        // Keep what was written, the chunks can still be walked without an index
+        flush_buffer(rec);
+        fprintf(stderr, "Recording %s is incomplete\n", rec->config.path);
+    }
+
+    if (fclose(rec->file) != 0) {
+        fprintf(stderr, "Failed closing recording %s\n", rec->config.path);
+        ret = 1;
+    }
+    rec->file = NULL;
+
+    release_all(rec);
+    return ret;
+}
+
+int8_t recorder_failed(struct Recorder* rec)
+{
+    return SDL_AtomicGet(&rec->failed) != 0;
+}
+
+void recorder_print_stats(struct Recorder* rec)
+{
+    const double seconds = (double)(SDL_GetPerformanceCounter() - rec->t_start) / SDL_GetPerformanceFrequency();
+
+    int s;
+    for (s = 0; s < RECORDING_STREAM_COUNT; s++)
+        fprintf(stderr, "  recorded %s frames: %llu\n", stream_names[s], (unsigned long long)rec->frames[s]);
+
+    fprintf(stderr, "  recorded %.1f MB as %.1f MB (%.2fx), %.1f MB/s, dropped %d\n",
+            rec->raw_bytes / 1e6, rec->stored_bytes / 1e6,
+            rec->stored_bytes ? (double)rec->raw_bytes / rec->stored_bytes : 0.0,
+            seconds > 0 ? rec->stored_bytes / 1e6 / seconds : 0.0, SDL_AtomicGet(&rec->dropped));
+
+    if (rec->config.compress_depth)
+        stage_stats_print(&rec->encode_stats, "encode");
+    stage_stats_print(&rec->write_stats, "write");
+}
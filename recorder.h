@@ -0,0 +1,102 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "depth_codec.h"
+#include "frame_handle.h"
+#include "frame_pool.h"
+#include "recording.h"
+#include "ring_queue.h"
+#include "rs_state.h"
+#include "stage_stats.h"
+
+// Frames that may wait for the writer. Each holds a librealsense frame,
+// which counts against the sensor's own frame pool.
+#define RECORDER_DEFAULT_QUEUE_SIZE 16
+
+// The writer hands the file whole buffers of this size
+#define RECORDER_BUFFER_SIZE (8 << 20)
+#define RECORDER_BUFFER_ALIGN 4096
+
+// The index is sized up front for this much streaming, it only grows past that
+#define RECORDER_INDEX_RESERVE_SECONDS 600
+
+struct RecorderConfig
+{
+    const char* path;
+    // Compress depth with depth_codec, color is always stored raw
+    int8_t compress_depth;
+    int queue_size;
+    // The write buffer and compression scratch come from here when set
+    struct FramePool* pool;
+};
+
+struct RecorderItem
+{
+    struct FrameHandle frame;
+    enum RecordingStream stream;
+};
+
+// Writes frames to a recording (see recording.h) from a writer thread.
+// Submitting only takes another reference to the frame; encoding and
+// disk writes happen on the writer, which batches them into large
+// aligned writes and keeps the index in memory until recorder_stop().
+struct Recorder
+{
+    struct RecorderConfig config;
+    FILE* file;
+    // Logical file size, including what is still buffered
+    uint64_t offset;
+    void* buffer_block;
+    uint8_t* buffer;
+    size_t buffer_used;
+
+    struct RecorderItem* items;
+    int item_count;
+    struct RingQueue free_items;
+    struct RingQueue pending;
+    SDL_Thread* writer;
+    SDL_atomic_t running;
+    SDL_atomic_t failed;
+
+    struct DepthCodec codec;
+    uint8_t* encoded;
+    size_t encoded_size;
+
+    struct RecordingIndexEntry* index;
+    uint64_t index_count;
+    uint64_t index_capacity;
+
+    SDL_atomic_t dropped;
+    uint64_t frames[RECORDING_STREAM_COUNT];
+    uint64_t raw_bytes;
+    uint64_t stored_bytes;
+    Uint64 t_start;
+    struct StageStats encode_stats;
+    struct StageStats write_stats;
+};
+
+void recorder_default_config(struct RecorderConfig* config);
+
+// Creates the file and writes the header for the streams rs_state resolved
+int8_t recorder_start(struct Recorder* rec, const struct RecorderConfig* config, const struct RS_State* rs_state);
+
+// Queues another reference to frame, never blocks. A frame arriving while
+// the queue is full is dropped and counted.
+void recorder_submit(struct Recorder* rec, const struct FrameHandle* frame, enum RecordingStream stream);
+
+// Writes out everything still queued, then the index, and closes the file
+int8_t recorder_stop(struct Recorder* rec);
+
+int8_t recorder_failed(struct Recorder* rec);
+void recorder_print_stats(struct Recorder* rec);
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdint.h>
+
+// On-disk layout of a recording, little endian:
+//
+//   RecordingHeader
+//   RecordingChunk + payload, one per frame, each starting on RECORDING_ALIGN
+//   RecordingIndexEntry[index_count]
+//   RecordingTrailer
+//
+// Raw payloads start on RECORDING_ALIGN as well, so a mapped file can be
+// read in place. A recording cut short has no index or trailer but its
+// chunks can still be walked from the header.
+
+#define RECORDING_MAGIC "RS2REC\r\n"
+#define RECORDING_VERSION 1
+#define RECORDING_ALIGN 64
+
+#define RECORDING_CHUNK_MAGIC 0x4D415246u  // "FRAM"
+#define RECORDING_TRAILER_MAGIC 0x58444E49u  // "INDX"
+
+// Depth chunks are compressed with depth_codec
+#define RECORDING_FLAG_DEPTH_COMPRESSED 1u
+
+enum RecordingStream
+{
+    RECORDING_STREAM_DEPTH,
+    RECORDING_STREAM_COLOR,
+    RECORDING_STREAM_COUNT
+};
+
+enum RecordingCodec
+{
+    RECORDING_CODEC_RAW,
+    RECORDING_CODEC_DEPTH
+};
+
+// rs2_intrinsics with fixed-size fields
+struct RecordingStreamInfo
+{
+    int32_t width;
+    int32_t height;
+    int32_t format;
+    int32_t fps;
+    float ppx;
+    float ppy;
+    float fx;
+    float fy;
+    int32_t model;
+    float coeffs[5];
+};
+
+struct RecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    struct RecordingStreamInfo streams[RECORDING_STREAM_COUNT];
+    int32_t has_extrinsics;
+    float rotation[9];
+    float translation[3];
+    uint8_t reserved[76];
+};
+
+struct RecordingChunk
+{
+    uint32_t magic;
+    uint8_t stream;
+    uint8_t codec;
+    uint16_t reserved0;
+    uint32_t width;
+    uint32_t height;
+    // Bytes per row of the raw frame, payload_size for raw chunks is stride * height
+    uint32_t stride;
+    uint32_t payload_size;
+    uint64_t frame_number;
+    double timestamp;
+    // Meters per Z16 step, depth chunks only
+    float depth_units;
+    uint32_t reserved[5];
+};
+
+struct RecordingIndexEntry
+{
+    // Of the chunk header, the payload follows it
+    uint64_t offset;
+    uint64_t frame_number;
+    double timestamp;
+    uint32_t payload_size;
+    uint8_t stream;
+    uint8_t codec;
+    uint16_t reserved;
+};
+
+struct RecordingTrailer
+{
+    uint64_t index_offset;
+    uint64_t index_count;
+    uint32_t magic;
+    uint32_t reserved[3];
+};
+
+// Fails to compile when a struct's size drifts from the format
+typedef char recording_header_size[sizeof(struct RecordingHeader) == 256 ? 1 : -1];
+typedef char recording_chunk_size[sizeof(struct RecordingChunk) == RECORDING_ALIGN ? 1 : -1];
+typedef char recording_index_size[sizeof(struct RecordingIndexEntry) == 32 ? 1 : -1];
+typedef char recording_trailer_size[sizeof(struct RecordingTrailer) == 32 ? 1 : -1];
+
+#endif
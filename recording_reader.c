@@ -0,0 +1,533 @@
+#include "recording_reader.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int8_t map_file(struct RecordingReader* r, const char* path)
+{
+#ifdef WIN32
+    r->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                          FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (r->file == INVALID_HANDLE_VALUE) {
+        r->file = NULL;
+        fprintf(stderr, "Failed opening recording %s\n", path);
+        return 1;
+    }
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(r->file, &size) == 0 || size.QuadPart == 0) {
+        fprintf(stderr, "Failed getting size of recording %s\n", path);
+        return 1;
+    }
+    r->size = (size_t)size.QuadPart;
+
+    r->mapping = CreateFileMappingA(r->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (r->mapping == NULL) {
+        fprintf(stderr, "Failed mapping recording %s\n", path);
+        return 1;
+    }
+
+    r->map = (const uint8_t*)MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (r->map == NULL) {
+        fprintf(stderr, "Failed mapping recording %s\n", path);
+        return 1;
+    }
+#else
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        fprintf(stderr, "Failed opening recording %s\n", path);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(r->fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Failed getting size of recording %s\n", path);
+        return 1;
+    }
+    r->size = (size_t)st.st_size;
+
+    void* map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed mapping recording %s\n", path);
+        return 1;
+    }
+    r->map = (const uint8_t*)map;
+
+    // Replays mostly run front to back, pages behind the reader can go
+    madvise(map, r->size, MADV_SEQUENTIAL);
+#endif
+
+    return 0;
+}
+
+static void unmap_file(struct RecordingReader* r)
+{
+#ifdef WIN32
+    if (r->map)
+        UnmapViewOfFile(r->map);
+    if (r->mapping)
+        CloseHandle(r->mapping);
+    if (r->file)
+        CloseHandle(r->file);
+    r->mapping = NULL;
+    r->file = NULL;
+#else
+    if (r->map)
+        munmap((void*)r->map, r->size);
+    // A reader that was never opened is zeroed, fd 0 is not ours
+    if (r->fd > 0)
+        close(r->fd);
+    r->fd = -1;
+#endif
+    r->map = NULL;
+    r->size = 0;
+}
+
+static int8_t entry_in_bounds(const struct RecordingReader* r, const struct RecordingIndexEntry* entry)
+{
+    return entry->stream < RECORDING_STREAM_COUNT &&
+           entry->offset % RECORDING_ALIGN == 0 &&
+           entry->offset <= r->size &&
+           r->size - entry->offset >= sizeof(struct RecordingChunk) + (uint64_t)entry->payload_size;
+}
+
+// The recording was cut short, walk the chunks the header is followed by
+static int8_t rebuild_index(struct RecordingReader* r)
+{
+    uint64_t capacity = 4096;
+    uint64_t count = 0;
+    struct RecordingIndexEntry* index = (struct RecordingIndexEntry*)malloc(capacity * sizeof(struct RecordingIndexEntry));
+    if (index == NULL) {
+        fprintf(stderr, "Failed allocating recording index\n");
+        return 1;
+    }
+
+    uint64_t offset = sizeof(struct RecordingHeader);
+    while (r->size - offset >= sizeof(struct RecordingChunk))
+    {
+        struct RecordingChunk chunk;
+        memcpy(&chunk, r->map + offset, sizeof(chunk));
+        if (chunk.magic != RECORDING_CHUNK_MAGIC)
+            break;
+
+        struct RecordingIndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.offset = offset;
+        entry.frame_number = chunk.frame_number;
+        entry.timestamp = chunk.timestamp;
+        entry.payload_size = chunk.payload_size;
+        entry.stream = chunk.stream;
+        entry.codec = chunk.codec;
+
+        // A chunk the writer did not finish ends the recording
+        if (entry_in_bounds(r, &entry) == 0)
+            break;
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            struct RecordingIndexEntry* grown = (struct RecordingIndexEntry*)realloc(
+                index, capacity * sizeof(struct RecordingIndexEntry));
+            if (grown == NULL) {
+                fprintf(stderr, "Failed growing recording index\n");
+                free(index);
+                return 1;
+            }
+            index = grown;
+        }
+
+        index[count++] = entry;
+
+        const uint64_t mask = RECORDING_ALIGN - 1;
+        offset = (offset + sizeof(chunk) + chunk.payload_size + mask) & ~mask;
+        if (offset > r->size)
+            break;
+    }
+
+    r->rebuilt_index = index;
+    r->index = index;
+    r->index_count = count;
+    return 0;
+}
+
+static int8_t load_index(struct RecordingReader* r)
+{
+    struct RecordingTrailer trailer;
+    if (r->size >= sizeof(struct RecordingHeader) + sizeof(trailer))
+    {
+        memcpy(&trailer, r->map + r->size - sizeof(trailer), sizeof(trailer));
+
+        const uint64_t entries_size = r->size - sizeof(trailer) - trailer.index_offset;
+        if (trailer.magic == RECORDING_TRAILER_MAGIC &&
+            trailer.index_offset <= r->size - sizeof(trailer) &&
+            trailer.index_offset % RECORDING_ALIGN == 0 &&
+            entries_size % sizeof(struct RecordingIndexEntry) == 0 &&
+            entries_size / sizeof(struct RecordingIndexEntry) == trailer.index_count)
+        {
+            r->index = (const struct RecordingIndexEntry*)(r->map + trailer.index_offset);
+            r->index_count = trailer.index_count;
+
+            uint64_t i;
+            for (i = 0; i < r->index_count; i++) {
+                if (entry_in_bounds(r, &r->index[i]) == 0) {
+                    fprintf(stderr, "Recording index entry %llu points outside the file\n", (unsigned long long)i);
+                    return 1;
+                }
+            }
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "Recording has no index, recovering it from the chunks\n");
+    return rebuild_index(r);
+}
+
+// The recorder writes the streams of a frameset back to back, a stream
+// showing up twice starts the next one
+static int8_t group_frames(struct RecordingReader* r)
+{
+    r->frames = (struct RecordingFrame*)malloc((r->index_count + 1) * sizeof(struct RecordingFrame));
+    if (r->frames == NULL) {
+        fprintf(stderr, "Failed allocating %llu recorded frames\n", (unsigned long long)r->index_count);
+        return 1;
+    }
+
+    int64_t n = -1;
+    uint64_t i;
+    for (i = 0; i < r->index_count; i++)
+    {
+        const struct RecordingIndexEntry* entry = &r->index[i];
+        if (n < 0 || r->frames[n].entry[entry->stream] >= 0) {
+            n++;
+            r->frames[n].entry[RECORDING_STREAM_DEPTH] = -1;
+            r->frames[n].entry[RECORDING_STREAM_COLOR] = -1;
+            r->frames[n].timestamp = entry->timestamp;
+        }
+        r->frames[n].entry[entry->stream] = (int64_t)i;
+    }
+
+    r->frame_count = n + 1;
+    return 0;
+}
+
+int8_t recording_reader_open(struct RecordingReader* r, const char* path)
+{
+    if (r == NULL || path == NULL) {
+        fprintf(stderr, "Cannot open recording: given pointer is null\n");
+        return 1;
+    }
+
+    memset(r, 0, sizeof(struct RecordingReader));
+#ifndef WIN32
+    r->fd = -1;
+#endif
+    r->prefetch = RECORDING_READER_DEFAULT_PREFETCH;
+
+    if (map_file(r, path) != 0) {
+        recording_reader_close(r);
+        return 1;
+    }
+
+    if (r->size < sizeof(struct RecordingHeader)) {
+        fprintf(stderr, "%s is too small to be a recording\n", path);
+        recording_reader_close(r);
+        return 1;
+    }
+
+    memcpy(&r->header, r->map, sizeof(r->header));
+    if (memcmp(r->header.magic, RECORDING_MAGIC, sizeof(r->header.magic)) != 0) {
+        fprintf(stderr, "%s is not a recording\n", path);
+        recording_reader_close(r);
+        return 1;
+    }
+
+    if (r->header.version != RECORDING_VERSION) {
+        fprintf(stderr, "%s is recording version %u, expected %u\n", path, r->header.version, RECORDING_VERSION);
+        recording_reader_close(r);
+        return 1;
+    }
+
+    if (load_index(r) != 0 || group_frames(r) != 0) {
+        recording_reader_close(r);
+        return 1;
+    }
+
+    const struct RecordingStreamInfo* depth = &r->header.streams[RECORDING_STREAM_DEPTH];
+    const struct RecordingStreamInfo* color = &r->header.streams[RECORDING_STREAM_COLOR];
+    fprintf(stderr, "recording %s: %lld framesets, depth %dx%d, color %dx%d, %.1f MB\n", path,
+            (long long)r->frame_count, depth->width, depth->height, color->width, color->height, r->size / 1e6);
+    return 0;
+}
+
+void recording_reader_close(struct RecordingReader* r)
+{
+    if (r == NULL)
+        return;
+
+    unmap_file(r);
+    free(r->rebuilt_index);
+    free(r->frames);
+    free(r->decoded);
+    depth_codec_free(&r->codec);
+    r->rebuilt_index = NULL;
+    r->index = NULL;
+    r->frames = NULL;
+    r->decoded = NULL;
+    r->index_count = 0;
+    r->frame_count = 0;
+}
+
+static void fill_stream_info(struct StreamInfo* stream, const struct RecordingStreamInfo* info)
+{
+    memset(stream, 0, sizeof(struct StreamInfo));
+    stream->format = (rs2_format)info->format;
+    stream->fps = info->fps;
+    stream->intrinsics.width = info->width;
+    stream->intrinsics.height = info->height;
+    stream->intrinsics.ppx = info->ppx;
+    stream->intrinsics.ppy = info->ppy;
+    stream->intrinsics.fx = info->fx;
+    stream->intrinsics.fy = info->fy;
+    stream->intrinsics.model = (rs2_distortion)info->model;
+    memcpy(stream->intrinsics.coeffs, info->coeffs, sizeof(info->coeffs));
+}
+
+void recording_reader_stream_state(const struct RecordingReader* r, struct RS_State* s)
+{
+    fill_stream_info(&s->depth, &r->header.streams[RECORDING_STREAM_DEPTH]);
+    fill_stream_info(&s->color, &r->header.streams[RECORDING_STREAM_COLOR]);
+
+    s->has_extrinsics = r->header.has_extrinsics != 0;
+    memcpy(s->depth_to_color.rotation, r->header.rotation, sizeof(r->header.rotation));
+    memcpy(s->depth_to_color.translation, r->header.translation, sizeof(r->header.translation));
+}
+
+int8_t recording_reader_seek_frame(struct RecordingReader* r, int64_t frame)
+{
+    if (frame < 0 || frame > r->frame_count) {
+        fprintf(stderr, "Cannot seek to frameset %lld of %lld\n", (long long)frame, (long long)r->frame_count);
+        return 1;
+    }
+
+    r->position = frame;
+    r->prefetched = frame;
+    return 0;
+}
+
+int8_t recording_reader_seek_time(struct RecordingReader* r, double timestamp)
+{
+    // Capture order is timestamp order
+    int64_t lo = 0;
+    int64_t hi = r->frame_count;
+    while (lo < hi)
+    {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (r->frames[mid].timestamp < timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return recording_reader_seek_frame(r, lo);
+}
+
+// Pages the next framesets in while the current one is processed, a
+// window at a time so the syscall is not paid every frame
+static void prefetch(struct RecordingReader* r)
+{
+#ifndef WIN32
+    if (r->prefetch <= 0 || r->prefetched >= r->frame_count || r->prefetched > r->position + r->prefetch / 2)
+        return;
+
+    int64_t first = r->prefetched > r->position ? r->prefetched : r->position;
+    int64_t last = r->position + r->prefetch;
+    if (last > r->frame_count)
+        last = r->frame_count;
+    if (first >= last)
+        return;
+
+    // Chunks are laid out in index order, the window is one range
+    uint64_t start = (uint64_t)-1;
+    uint64_t end = 0;
+    int64_t f;
+    int s;
+    for (f = first; f < last; f++)
+    {
+        for (s = 0; s < RECORDING_STREAM_COUNT; s++)
+        {
+            if (r->frames[f].entry[s] < 0)
+                continue;
+            const struct RecordingIndexEntry* entry = &r->index[r->frames[f].entry[s]];
+            if (entry->offset < start)
+                start = entry->offset;
+            if (entry->offset + sizeof(struct RecordingChunk) + entry->payload_size > end)
+                end = entry->offset + sizeof(struct RecordingChunk) + entry->payload_size;
+        }
+    }
+
+    if (start < end)
+    {
+        const uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        start &= ~(page - 1);
+        madvise((void*)(r->map + start), end - start, MADV_WILLNEED);
+    }
+
+    r->prefetched = last;
+#endif
+}
+
+static int bits_per_pixel(rs2_format format, const struct RecordingChunk* chunk)
+{
+    switch (format)
+    {
+    case RS2_FORMAT_Z16:
+        return 16;
+    case RS2_FORMAT_RGB8:
+    case RS2_FORMAT_BGR8:
+        return 24;
+    case RS2_FORMAT_RGBA8:
+    case RS2_FORMAT_BGRA8:
+        return 32;
+    default:
+        return (int)(chunk->stride * 8 / chunk->width);
+    }
+}
+
+static int8_t read_chunk(struct RecordingReader* r, int64_t entry_index, struct FrameHandle* h)
+{
+    const struct RecordingIndexEntry* entry = &r->index[entry_index];
+    const uint8_t* base = r->map + entry->offset;
+
+    struct RecordingChunk chunk;
+    memcpy(&chunk, base, sizeof(chunk));
+    if (chunk.magic != RECORDING_CHUNK_MAGIC || chunk.payload_size != entry->payload_size || chunk.stream != entry->stream) {
+        fprintf(stderr, "Corrupt recording chunk at offset %llu\n", (unsigned long long)entry->offset);
+        return 1;
+    }
+
+    if (chunk.width == 0 || chunk.height == 0 || chunk.width > 65535 || chunk.height > 65535) {
+        fprintf(stderr, "Recording chunk at offset %llu is %ux%u\n", (unsigned long long)entry->offset,
+                chunk.width, chunk.height);
+        return 1;
+    }
+
+    const rs2_format format = (rs2_format)r->header.streams[chunk.stream].format;
+    const uint8_t* payload = base + sizeof(chunk);
+
+    frame_handle_release(h);
+    h->width = (int)chunk.width;
+    h->height = (int)chunk.height;
+    h->format = format;
+    h->bpp = bits_per_pixel(format, &chunk);
+    h->depth_units = chunk.depth_units;
+    h->number = chunk.frame_number;
+    h->timestamp = chunk.timestamp;
+    // Recorded on another run, never comparable to the host clock now
+    h->timestamp_domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+
+    if (chunk.codec == RECORDING_CODEC_RAW)
+    {
+        if ((uint64_t)chunk.stride * chunk.height != chunk.payload_size || chunk.stride * 8 < chunk.width * (uint32_t)h->bpp) {
+            fprintf(stderr, "Recording chunk at offset %llu has a bad size\n", (unsigned long long)entry->offset);
+            return 1;
+        }
+
+        // Served in place, no copy
+        h->data = payload;
+        h->stride = (int)chunk.stride;
+    }
+    else if (chunk.codec == RECORDING_CODEC_DEPTH)
+    {
+        const int pixels = (int)(chunk.width * chunk.height);
+        if (pixels > r->decoded_pixels)
+        {
+            free(r->decoded);
+            depth_codec_free(&r->codec);
+            r->decoded_pixels = 0;
+            r->decoded = (uint16_t*)malloc((size_t)pixels * sizeof(uint16_t));
+            if (r->decoded == NULL || depth_codec_init(&r->codec, pixels) != 0) {
+                fprintf(stderr, "Failed allocating depth decode buffers\n");
+                return 1;
+            }
+            r->decoded_pixels = pixels;
+        }
+
+        if (depth_codec_decode(&r->codec, payload, chunk.payload_size, r->decoded, (int)chunk.width, (int)chunk.height) != 0)
+            return 1;
+
+        h->data = r->decoded;
+        h->stride = (int)chunk.width * (int)sizeof(uint16_t);
+    }
+    else
+    {
+        fprintf(stderr, "Recording chunk at offset %llu has unknown codec %u\n",
+                (unsigned long long)entry->offset, chunk.codec);
+        return 1;
+    }
+
+    r->bytes_read += sizeof(chunk) + chunk.payload_size;
+    return 0;
+}
+
+int8_t recording_reader_next(struct RecordingReader* r, struct FrameHandle* dep, struct FrameHandle* col,
+                             int8_t* got_dep, int8_t* got_col)
+{
+    *got_dep = 0;
+    *got_col = 0;
+
+    if (r->position >= r->frame_count)
+        return 1;
+
+    prefetch(r);
+
+    const struct RecordingFrame* frame = &r->frames[r->position];
+    if (frame->entry[RECORDING_STREAM_DEPTH] >= 0) {
+        if (read_chunk(r, frame->entry[RECORDING_STREAM_DEPTH], dep) != 0)
+            return 1;
+        *got_dep = 1;
+    }
+
+    if (frame->entry[RECORDING_STREAM_COLOR] >= 0) {
+        if (read_chunk(r, frame->entry[RECORDING_STREAM_COLOR], col) != 0)
+            return 1;
+        *got_col = 1;
+    }
+
+    r->position++;
+    return 0;
+}
+
+int8_t recording_reader_update(struct RecordingReader* r, const struct Colorizer* colorizer,
+                               const struct RgbExpander* expander, struct ThreadPool* threads,
+                               struct FrameHandle* dep, struct RGBA* dep_rgb,
+                               struct FrameHandle* col_frame, struct RGBA* col, int8_t* got_dep, int8_t* got_col)
+{
+    int8_t new_dep = 0;
+    int8_t new_col = 0;
+
+    if (recording_reader_next(r, dep, col_frame, &new_dep, &new_col) != 0)
+        return 1;
+
+    // Only convert what this frameset brought, the rest is already converted
+    convert_frames(colorizer, expander, threads, new_dep ? dep : NULL, dep_rgb, new_col ? col_frame : NULL, col);
+
+    if (new_dep)
+        *got_dep = 1;
+    if (new_col)
+        *got_col = 1;
+
+    return 0;
+}
+
+int8_t recording_reader_finished(const struct RecordingReader* r)
+{
+    return r->position >= r->frame_count;
+}
@@ -0,0 +1,88 @@
+#ifndef RECORDING_READER_H
+#define RECORDING_READER_H
+
+#ifdef WIN32
+#include <Windows.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "colorize.h"
+#include "depth_codec.h"
+#include "frame_handle.h"
+#include "frames.h"
+#include "recording.h"
+#include "rgb_expand.h"
+#include "rs_state.h"
+
+// Framesets the reader asks the kernel to page in ahead of the current one
+#define RECORDING_READER_DEFAULT_PREFETCH 8
+
+// The index entries of one frameset, -1 for a stream it does not have
+struct RecordingFrame
+{
+    int64_t entry[RECORDING_STREAM_COUNT];
+    double timestamp;
+};
+
+// Maps a recording written by the recorder and hands out its frames in
+// place. Raw frames point straight into the mapping; compressed depth is
+// decoded into a buffer owned by the reader. Either way a frame stays
+// valid until the next call that returns one of the same stream.
+struct RecordingReader
+{
+    const uint8_t* map;
+    size_t size;
+#ifdef WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+
+    struct RecordingHeader header;
+    // Points into the mapping unless it had to be rebuilt from the chunks
+    const struct RecordingIndexEntry* index;
+    struct RecordingIndexEntry* rebuilt_index;
+    uint64_t index_count;
+
+    struct RecordingFrame* frames;
+    int64_t frame_count;
+    int64_t position;
+    int64_t prefetched;
+    int prefetch;
+
+    struct DepthCodec codec;
+    uint16_t* decoded;
+    int decoded_pixels;
+
+    uint64_t bytes_read;
+};
+
+int8_t recording_reader_open(struct RecordingReader* r, const char* path);
+void recording_reader_close(struct RecordingReader* r);
+
+// Fills s->depth, s->color and the extrinsics from the header, so modules
+// initialized from a resolved RS_State work on the recording unchanged
+void recording_reader_stream_state(const struct RecordingReader* r, struct RS_State* s);
+
+// The next frame returned is frameset frame, or the first at or after timestamp (ms)
+int8_t recording_reader_seek_frame(struct RecordingReader* r, int64_t frame);
+int8_t recording_reader_seek_time(struct RecordingReader* r, double timestamp);
+
+// Replaces dep and col with the streams of the next frameset, like
+// extract_frames. Returns 1 at the end of the recording or on a corrupt chunk.
+int8_t recording_reader_next(struct RecordingReader* r, struct FrameHandle* dep, struct FrameHandle* col,
+                             int8_t* got_dep, int8_t* got_col);
+
+// update() reading from the recording instead of the sensor
+int8_t recording_reader_update(struct RecordingReader* r, const struct Colorizer* colorizer,
+                               const struct RgbExpander* expander, struct ThreadPool* threads,
+                               struct FrameHandle* dep, struct RGBA* dep_rgb,
+                               struct FrameHandle* col_frame, struct RGBA* col, int8_t* got_dep, int8_t* got_col);
+
+// 1 once every frameset has been returned
+int8_t recording_reader_finished(const struct RecordingReader* r);
+
+#endif
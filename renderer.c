@@ -0,0 +1,140 @@
+#include "renderer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int8_t renderer_start(struct Renderer* r, const struct RendererConfig* config)
+{
+    if (r == NULL || config == NULL || config->window == NULL) {
+        fprintf(stderr, "Cannot start renderer: given pointer is null\n");
+        return 1;
+    }
+
+    memset(r, 0, sizeof(struct Renderer));
+    r->config = *config;
+
+    Uint32 flags = SDL_RENDERER_ACCELERATED;
+    if (r->config.vsync)
+        flags |= SDL_RENDERER_PRESENTVSYNC;
+
+    r->sdlren = SDL_CreateRenderer(r->config.window, -1, flags);
+    if (r->sdlren == NULL) {
+        fprintf(stderr, "Failed creating SDL renderer: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    if (stream_texture_create(&r->tex, r->sdlren, r->config.format, r->config.width, r->config.height) != 0) {
+        renderer_stop(r);
+        return 1;
+    }
+
+    // Drivers may ignore the request, without it the render loop has to wait for frames instead
+    SDL_RendererInfo info;
+    if (r->config.vsync && SDL_GetRendererInfo(r->sdlren, &info) == 0)
+        r->vsync = (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
+
+    fprintf(stderr, "renderer started%s\n", r->vsync ? ", vsync" : "");
+    return 0;
+}
+
+void renderer_stop(struct Renderer* r)
+{
+    if (r == NULL)
+        return;
+
+    stream_texture_destroy(&r->tex);
+    if (r->sdlren)
+        SDL_DestroyRenderer(r->sdlren);
+    r->sdlren = NULL;
+}
+
+int8_t renderer_present(struct Renderer* r)
+{
+    if (r->failed)
+        return 1;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    SDL_RenderClear(r->sdlren);
+    SDL_RenderCopy(r->sdlren, r->tex.tex, NULL, NULL);
+    SDL_RenderPresent(r->sdlren);
+
+    stage_stats_record(&r->present_stats, start, SDL_GetPerformanceCounter());
+    trace_span(TRACE_PRESENT, r->stream, start, r->number);
+    SDL_AtomicAdd(&r->frames_presented, 1);
+    return 0;
+}
+
+int8_t renderer_show(struct Renderer* r, const struct RendererFrame* frame)
+{
+    if (r->failed)
+        return 1;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    // Decimated depth is smaller than the resolved profile, the texture follows the frames
+    if (stream_texture_resize(&r->tex, frame->width, frame->height) != 0 ||
+        stream_texture_upload(&r->tex, frame->pixels, frame->pitch) != 0) {
+        r->failed = 1;
+        return 1;
+    }
+
+    stage_stats_record(&r->upload_stats, start, SDL_GetPerformanceCounter());
+    trace_span(TRACE_UPLOAD, frame->stream, start, frame->number);
+
+    r->number = frame->number;
+    r->stream = frame->stream;
+    SDL_AtomicAdd(&r->frames_shown, 1);
+    return renderer_present(r);
+}
+
+int8_t renderer_lock(struct Renderer* r, int width, int height, void** pixels, int* pitch)
+{
+    if (r->failed)
+        return 1;
+
+    r->lock_start = SDL_GetPerformanceCounter();
+    if (stream_texture_resize(&r->tex, width, height) != 0 || stream_texture_lock(&r->tex, pixels, pitch) != 0) {
+        r->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int8_t renderer_unlock(struct Renderer* r, enum TraceStream stream, unsigned long long number)
+{
+    stream_texture_unlock(&r->tex);
+
+    stage_stats_record(&r->upload_stats, r->lock_start, SDL_GetPerformanceCounter());
+    trace_span(TRACE_UPLOAD, stream, r->lock_start, number);
+
+    r->number = number;
+    r->stream = stream;
+    SDL_AtomicAdd(&r->frames_shown, 1);
+    return renderer_present(r);
+}
+
+int8_t renderer_failed(struct Renderer* r)
+{
+    return r->failed != 0;
+}
+
+void renderer_print_stats(struct Renderer* r)
+{
+    fprintf(stderr, "renderer: %d frames shown, %d presents\n",
+            SDL_AtomicGet(&r->frames_shown), SDL_AtomicGet(&r->frames_presented));
+    stage_stats_print(&r->upload_stats, "upload");
+    stage_stats_print(&r->present_stats, "present");
+}
+
+void renderer_write_metrics(struct MetricsText* out, void* user)
+{
+    static const char* names[2] = {"upload", "present"};
+    struct Renderer* r = (struct Renderer*)user;
+    struct StageStats* stats[2] = {&r->upload_stats, &r->present_stats};
+
+    metrics_family(out, "rs2_renderer_frames_total", "counter", "Frames uploaded to the display and presents, repeats included");
+    metrics_printf(out, "rs2_renderer_frames_total{state=\"shown\"} %d\n", SDL_AtomicGet(&r->frames_shown));
+    metrics_printf(out, "rs2_renderer_frames_total{state=\"presented\"} %d\n", SDL_AtomicGet(&r->frames_presented));
+
+    metrics_stages(out, "rs2_renderer_stage", "Time the render loop spent per frame", names, stats, 2);
+}
@@ -0,0 +1,88 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+#include "metrics.h"
+#include "stage_stats.h"
+#include "stream_texture.h"
+#include "trace.h"
+
+struct RendererConfig
+{
+    // Created by the caller on the main thread, as SDL wants for video
+    SDL_Window* window;
+    // SDL_PIXELFORMAT_* of the shown pixels
+    Uint32 format;
+    int width;
+    int height;
+    // Wait for vblank when presenting
+    int8_t vsync;
+};
+
+struct RendererFrame
+{
+    const void* pixels;
+    int width;
+    int height;
+    int pitch;
+    // Traced with the upload and present
+    enum TraceStream stream;
+    unsigned long long number;
+};
+
+// The SDL renderer and texture the pipeline's frames are shown through.
+// Every call has to come from the thread that created the window, which
+// SDL requires for video on macOS and some Windows backends. The render
+// loop stays off the capture and conversion path by taking only the
+// latest converted job from pipeline_next(), see main.c.
+struct Renderer
+{
+    struct RendererConfig config;
+    SDL_Renderer* sdlren;
+    struct StreamTexture tex;
+    // Presenting waits for vblank, so re-presenting paces the render loop
+    int8_t vsync;
+    int8_t failed;
+    // Last frame uploaded into the texture, shown again by renderer_present
+    unsigned long long number;
+    enum TraceStream stream;
+    Uint64 lock_start;
+
+    // Read by the metrics thread
+    SDL_atomic_t frames_shown;
+    SDL_atomic_t frames_presented;
+    struct StageStats upload_stats;
+    struct StageStats present_stats;
+};
+
+int8_t renderer_start(struct Renderer* r, const struct RendererConfig* config);
+void renderer_stop(struct Renderer* r);
+
+// Uploads frame and presents it. The pixels may be released once this returns.
+int8_t renderer_show(struct Renderer* r, const struct RendererFrame* frame);
+
+// For frames converted straight into the texture: renderer_lock sizes and
+// locks it, renderer_unlock presents what was written. The upload time
+// then covers the conversion.
+int8_t renderer_lock(struct Renderer* r, int width, int height, void** pixels, int* pitch);
+int8_t renderer_unlock(struct Renderer* r, enum TraceStream stream, unsigned long long number);
+
+// Presents the last shown frame again
+int8_t renderer_present(struct Renderer* r);
+
+// 1 once showing a frame failed
+int8_t renderer_failed(struct Renderer* r);
+
+void renderer_print_stats(struct Renderer* r);
+
+// metrics_collect_fn reporting frame counts and upload and present times, user is the renderer
+void renderer_write_metrics(struct MetricsText* out, void* user);
+
+#endif
@@ -0,0 +1,191 @@
+#include "rgb_expand.h"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RGB_EXPAND_X86
+#include <tmmintrin.h>
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RGB_EXPAND_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__)
+#define RGB_EXPAND_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define RGB_EXPAND_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RGB_EXPAND_TARGET_SSSE3
+#define RGB_EXPAND_TARGET_AVX2
+#endif
+
+static void rgb_expand_scalar(const uint8_t* src, uint32_t* dst, int count)
+{
+    uint8_t* out = (uint8_t*)dst;
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        out[0] = src[0];
+        out[1] = src[1];
+        out[2] = src[2];
+        out[3] = 255;
+        src += 3;
+        out += 4;
+    }
+}
+
+#ifdef RGB_EXPAND_X86
+RGB_EXPAND_TARGET_SSSE3
+static void rgb_expand_ssse3(const uint8_t* src, uint32_t* dst, int count)
+{
+    const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    int i = 0;
+
+    // 16 pixels per iteration: three 16 byte loads in, four 16 byte stores out
+    for (; i + 16 <= count; i += 16)
+    {
+        const uint8_t* s = src + 3 * i;
+        __m128i a = _mm_loadu_si128((const __m128i*)(s + 0));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+
+        __m128i p0 = a;
+        __m128i p1 = _mm_alignr_epi8(b, a, 12);
+        __m128i p2 = _mm_alignr_epi8(c, b, 8);
+        __m128i p3 = _mm_srli_si128(c, 4);
+
+        _mm_storeu_si128((__m128i*)(dst + i + 0), _mm_or_si128(_mm_shuffle_epi8(p0, shuf), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_or_si128(_mm_shuffle_epi8(p1, shuf), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_or_si128(_mm_shuffle_epi8(p2, shuf), alpha));
+        _mm_storeu_si128((__m128i*)(dst + i + 12), _mm_or_si128(_mm_shuffle_epi8(p3, shuf), alpha));
+    }
+
+    rgb_expand_scalar(src + 3 * i, dst + i, count - i);
+}
+
+RGB_EXPAND_TARGET_AVX2
+static void rgb_expand_avx2(const uint8_t* src, uint32_t* dst, int count)
+{
+    // Move the 24 source bytes of 8 pixels so each 128 bit lane holds 12 of them,
+    // then the per-lane byte shuffle works exactly like the SSSE3 version
+    const __m256i perm = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+    const __m256i shuf = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                          0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    int i = 0;
+
+    // Each load reads 32 bytes but consumes 24, stop early enough to stay inside src
+    for (; i + 16 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + 3 * i));
+        v = _mm256_permutevar8x32_epi32(v, perm);
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuf), alpha);
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+    }
+
+    rgb_expand_scalar(src + 3 * i, dst + i, count - i);
+}
+#endif
+
+#ifdef RGB_EXPAND_NEON
+static void rgb_expand_neon(const uint8_t* src, uint32_t* dst, int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16x3_t rgb = vld3q_u8(src + 3 * i);
+        uint8x16x4_t rgba;
+        rgba.val[0] = rgb.val[0];
+        rgba.val[1] = rgb.val[1];
+        rgba.val[2] = rgb.val[2];
+        rgba.val[3] = vdupq_n_u8(255);
+        vst4q_u8((uint8_t*)(dst + i), rgba);
+    }
+
+    rgb_expand_scalar(src + 3 * i, dst + i, count - i);
+}
+#endif
+
+int8_t rgb_expand_init(struct RgbExpander* x)
+{
+    if (x == NULL) {
+        fprintf(stderr, "Cannot init rgb expander: given pointer is null\n");
+        return 1;
+    }
+
+    x->kernel = rgb_expand_scalar;
+    x->kernel_name = "scalar";
+
+#ifdef RGB_EXPAND_X86
+    // SDL cannot be asked about SSSE3 directly, but every CPU with SSE4.1 has it
+    if (SDL_HasAVX2()) {
+        x->kernel = rgb_expand_avx2;
+        x->kernel_name = "avx2";
+    } else if (SDL_HasSSE41()) {
+        x->kernel = rgb_expand_ssse3;
+        x->kernel_name = "ssse3";
+    }
+#endif
+
+#ifdef RGB_EXPAND_NEON
+    if (SDL_HasNEON()) {
+        x->kernel = rgb_expand_neon;
+        x->kernel_name = "neon";
+    }
+#endif
+
+    fprintf(stderr, "rgb expansion using %s kernel\n", x->kernel_name);
+
+    return 0;
+}
+
+void rgb_expand(const struct RgbExpander* x, const uint8_t* src, uint32_t* dst, int count)
+{
+    x->kernel(src, dst, count);
+}
+
+struct RgbExpandImage
+{
+    const struct RgbExpander* x;
+    const uint8_t* src;
+    int src_stride;
+    uint8_t* dst;
+    int dst_pitch;
+    int width;
+};
+
+static void rgb_expand_band(void* ctx, int thread, int y_begin, int y_end)
+{
+    const struct RgbExpandImage* img = (const struct RgbExpandImage*)ctx;
+    const uint8_t* src = img->src + (size_t)y_begin * img->src_stride;
+    uint8_t* dst = img->dst + (size_t)y_begin * img->dst_pitch;
+
+    if (img->src_stride == img->width * 3 && img->dst_pitch == img->width * 4) {
+        rgb_expand(img->x, src, (uint32_t*)dst, img->width * (y_end - y_begin));
+        return;
+    }
+
+    int y;
+    for (y = y_begin; y < y_end; y++)
+    {
+        rgb_expand(img->x, src, (uint32_t*)dst, img->width);
+        src += img->src_stride;
+        dst += img->dst_pitch;
+    }
+}
+
+void rgb_expand_image(const struct RgbExpander* x, struct ThreadPool* threads, const uint8_t* src, int src_stride,
+                      uint32_t* dst, int dst_pitch, int width, int height)
+{
+    struct RgbExpandImage img = { x, src, src_stride, (uint8_t*)dst, dst_pitch, width };
+    thread_pool_run(threads, height, width, rgb_expand_band, &img);
+}
@@ -0,0 +1,27 @@
+#ifndef RGB_EXPAND_H
+#define RGB_EXPAND_H
+
+#include <stdint.h>
+
+#include "thread_pool.h"
+
+typedef void (*rgb_expand_kernel)(const uint8_t* src, uint32_t* dst, int count);
+
+// Expands packed 3-byte RGB pixels to 4-byte RGBA words with opaque alpha.
+// The output words have the same byte layout as struct RGBA.
+struct RgbExpander
+{
+    rgb_expand_kernel kernel;
+    const char* kernel_name;
+};
+
+int8_t rgb_expand_init(struct RgbExpander* x);
+
+void rgb_expand(const struct RgbExpander* x, const uint8_t* src, uint32_t* dst, int count);
+
+// rgb_expand over a width x height image whose rows are src_stride and
+// dst_pitch bytes apart, split into row bands over threads, which may be NULL
+void rgb_expand_image(const struct RgbExpander* x, struct ThreadPool* threads, const uint8_t* src, int src_stride,
+                      uint32_t* dst, int dst_pitch, int width, int height);
+
+#endif
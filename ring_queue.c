@@ -0,0 +1,186 @@
+#include "ring_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bounded MPMC queue after Dmitry Vyukov's design. Every cell carries a
+// sequence number telling whether it is ready to be written or read on the
+// current lap, so producers and consumers only contend on head and tail.
+
+int8_t ring_queue_init(struct RingQueue* q, int capacity, enum RingQueuePolicy policy,
+                       ring_queue_drop_fn drop, void* drop_user)
+{
+    if (q == NULL) {
+        fprintf(stderr, "Cannot init ring queue: given pointer is null\n");
+        return 1;
+    }
+
+    memset(q, 0, sizeof(struct RingQueue));
+
+    int cap = 2;
+    while (cap < capacity)
+        cap *= 2;
+
+    q->cells = (struct RingQueueCell*)malloc(cap * sizeof(struct RingQueueCell));
+    if (q->cells == NULL) {
+        fprintf(stderr, "Failed allocating ring queue of %d cells\n", cap);
+        return 1;
+    }
+
+    int i;
+    for (i = 0; i < cap; i++)
+    {
+        SDL_AtomicSet(&q->cells[i].sequence, i);
+        q->cells[i].item = NULL;
+    }
+
+    q->items = SDL_CreateSemaphore(0);
+    if (q->items == NULL) {
+        fprintf(stderr, "Failed creating ring queue semaphore: %s\n", SDL_GetError());
+        free(q->cells);
+        q->cells = NULL;
+        return 1;
+    }
+
+    q->capacity = cap;
+    q->policy = policy;
+    q->drop = drop;
+    q->drop_user = drop_user;
+    return 0;
+}
+
+void ring_queue_free(struct RingQueue* q)
+{
+    if (q == NULL)
+        return;
+
+    if (q->items)
+        SDL_DestroySemaphore(q->items);
+
+    free(q->cells);
+    memset(q, 0, sizeof(struct RingQueue));
+}
+
+int8_t ring_queue_try_push(struct RingQueue* q, void* item)
+{
+    const unsigned int mask = (unsigned int)q->capacity - 1;
+    struct RingQueueCell* cell;
+    unsigned int pos = (unsigned int)SDL_AtomicGet(&q->head);
+
+    for (;;)
+    {
+        cell = &q->cells[pos & mask];
+        int diff = (int)((unsigned int)SDL_AtomicGet(&cell->sequence) - pos);
+
+        if (diff == 0)
+        {
+            if (SDL_AtomicCAS(&q->head, (int)pos, (int)(pos + 1)))
+                break;
+            pos = (unsigned int)SDL_AtomicGet(&q->head);
+        }
+        else if (diff < 0)
+        {
+            // The cell still holds an item from the previous lap
+            return 1;
+        }
+        else
+        {
+            pos = (unsigned int)SDL_AtomicGet(&q->head);
+        }
+    }
+
+    cell->item = item;
+    SDL_AtomicSet(&cell->sequence, (int)(pos + 1));
+    SDL_SemPost(q->items);
+    return 0;
+}
+
+int8_t ring_queue_try_pop(struct RingQueue* q, void** item)
+{
+    const unsigned int mask = (unsigned int)q->capacity - 1;
+    struct RingQueueCell* cell;
+    unsigned int pos = (unsigned int)SDL_AtomicGet(&q->tail);
+
+    for (;;)
+    {
+        cell = &q->cells[pos & mask];
+        int diff = (int)((unsigned int)SDL_AtomicGet(&cell->sequence) - (pos + 1));
+
+        if (diff == 0)
+        {
+            if (SDL_AtomicCAS(&q->tail, (int)pos, (int)(pos + 1)))
+                break;
+            pos = (unsigned int)SDL_AtomicGet(&q->tail);
+        }
+        else if (diff < 0)
+        {
+            return 1;
+        }
+        else
+        {
+            pos = (unsigned int)SDL_AtomicGet(&q->tail);
+        }
+    }
+
+    *item = cell->item;
+    SDL_AtomicSet(&cell->sequence, (int)(pos + q->capacity));
+
+    // Keep the semaphore count close to the number of queued items
+    SDL_SemTryWait(q->items);
+    return 0;
+}
+
+int ring_queue_push(struct RingQueue* q, void* item)
+{
+    int dropped = 0;
+
+    while (ring_queue_try_push(q, item) != 0)
+    {
+        void* victim = item;
+
+        // Evict the oldest item and try again. If a consumer emptied a cell
+        // in the meantime there is nothing to evict and the retry succeeds.
+        if (q->policy == RING_QUEUE_DROP_OLDEST && ring_queue_try_pop(q, &victim) != 0)
+            continue;
+
+        SDL_AtomicAdd(&q->dropped, 1);
+        dropped++;
+        if (q->drop)
+            q->drop(victim, q->drop_user);
+
+        if (victim == item)
+            break;
+    }
+
+    return dropped;
+}
+
+void* ring_queue_pop_wait(struct RingQueue* q, uint32_t timeout_ms)
+{
+    void* item = NULL;
+    uint32_t start = SDL_GetTicks();
+
+    for (;;)
+    {
+        if (ring_queue_try_pop(q, &item) == 0)
+            return item;
+
+        uint32_t waited = SDL_GetTicks() - start;
+        if (waited >= timeout_ms)
+            return NULL;
+
+        // A wakeup only means an item was pushed at some point, try again
+        SDL_SemWaitTimeout(q->items, timeout_ms - waited);
+    }
+}
+
+int ring_queue_size(struct RingQueue* q)
+{
+    int size = (int)((unsigned int)SDL_AtomicGet(&q->head) - (unsigned int)SDL_AtomicGet(&q->tail));
+    if (size < 0)
+        return 0;
+    if (size > q->capacity)
+        return q->capacity;
+    return size;
+}
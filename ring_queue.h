@@ -0,0 +1,70 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+// What a push does when the queue is full
+enum RingQueuePolicy
+{
+    RING_QUEUE_DROP_OLDEST,
+    RING_QUEUE_DROP_NEWEST
+};
+
+// Called for every item a full queue drops
+typedef void (*ring_queue_drop_fn)(void* item, void* user);
+
+struct RingQueueCell
+{
+    SDL_atomic_t sequence;
+    void* item;
+};
+
+// Bounded lock-free multi-producer multi-consumer queue of pointers.
+// Pushing and popping never take a lock; the semaphore only lets
+// consumers sleep while the queue is empty.
+struct RingQueue
+{
+    struct RingQueueCell* cells;
+    int capacity;
+    enum RingQueuePolicy policy;
+    ring_queue_drop_fn drop;
+    void* drop_user;
+    SDL_sem* items;
+    SDL_atomic_t dropped;
+
+    // Producers and consumers each get their own cache line
+    char pad0[64];
+    SDL_atomic_t head;
+    char pad1[64];
+    SDL_atomic_t tail;
+    char pad2[64];
+};
+
+// capacity is rounded up to a power of two
+int8_t ring_queue_init(struct RingQueue* q, int capacity, enum RingQueuePolicy policy,
+                       ring_queue_drop_fn drop, void* drop_user);
+void ring_queue_free(struct RingQueue* q);
+
+// Returns 0 when the item was queued, 1 when the queue is full
+int8_t ring_queue_try_push(struct RingQueue* q, void* item);
+
+// Returns 0 and sets item when one was dequeued, 1 when the queue is empty
+int8_t ring_queue_try_pop(struct RingQueue* q, void** item);
+
+// Queues item, dropping the newest or oldest items per the policy when full.
+// Returns the number of items handed to the drop callback.
+int ring_queue_push(struct RingQueue* q, void* item);
+
+// Waits up to timeout_ms for an item, returns NULL on timeout
+void* ring_queue_pop_wait(struct RingQueue* q, uint32_t timeout_ms);
+
+// Approximate number of queued items
+int ring_queue_size(struct RingQueue* q);
+
+#endif
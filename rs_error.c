@@ -0,0 +1,15 @@
+#include "rs_error.h"
+
+#include <stdio.h>
+
+int8_t check_error(rs2_error* e)
+{
+    if (e)
+    {
+        fprintf(stderr, "rs_error was raised when calling %s(%s): \n",
+               rs2_get_failed_function(e), rs2_get_failed_args(e));
+        fprintf(stderr, "%s\n", rs2_get_error_message(e));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef RS_ERROR_H
+#define RS_ERROR_H
+
+#include <librealsense2/rs.h>
+
+#include <stdint.h>
+
+// Prints the error if there is one. Returns 1 on error, 0 otherwise.
+int8_t check_error(rs2_error* e);
+
+#endif
@@ -0,0 +1,965 @@
+#include <librealsense2/rs.h>
+#include <librealsense2/rs_advanced_mode.h>
+#include <librealsense2/h/rs_pipeline.h>
+#include <librealsense2/h/rs_option.h>
+#include <librealsense2/h/rs_frame.h>
+#include <librealsense2/rsutil.h>
+
+#include "rs_state.h"
+#include "rs_error.h"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+const char* presets[PRESET_COUNT] = {
+    "High Accuracy",
+    "High Density",
+    "Hand"
+};
+
+int8_t create_context(struct RS_State* rs_state)
+{
+    rs2_error* e = NULL;
+
+    fprintf(stderr, "creating context\n");
+
+    rs_state->ctx = rs2_create_context(RS2_API_VERSION, &e);
+    if (check_error(e) != 0) {
+        rs_state->ctx = NULL;
+        fprintf(stderr, "Failed creating rs context\n");
+        return 1;
+    }
+
+    fprintf(stderr, "context created\n");
+
+    return 0;
+}
+
+int8_t clear_state(struct RS_State* s)
+{
+    if (s == NULL) {
+        fprintf(stderr, "Cannot clear state: given pointer is null\n");
+        return 1;
+    }
+
+    // Stop first so librealsense no longer delivers into the frame queue
+    if (s->pipe) {
+        rs2_pipeline_stop(s->pipe, NULL);
+    }
+
+    if (s->frame_queue) {
+        rs2_delete_frame_queue(s->frame_queue);
+    }
+
+    if (s->dev) {
+        rs2_delete_device(s->dev);
+    }
+
+    int32_t sen;
+    for (sen = 0; sen < s->sensors_created; sen++) {
+        rs2_delete_sensor(s->sensors[sen]);
+    }
+
+    if (s->sensor_list) {
+        rs2_delete_sensor_list(s->sensor_list);
+    }
+
+    if (s->device_list) {
+        rs2_delete_device_list(s->device_list);
+    }
+
+    if (s->config) {
+        rs2_delete_config(s->config);
+    }
+
+    if (s->selection) {
+        rs2_delete_pipeline_profile(s->selection);
+    }
+
+    if (s->pipe) {
+        rs2_delete_pipeline(s->pipe);
+    }
+
+    if (s->ctx) {
+        rs2_delete_context(s->ctx);
+    }
+
+    memset(s, 0, sizeof(struct RS_State));
+    return 0;
+}
+
+int8_t ensure_device(struct RS_State* s, int rs_dev_index)
+{
+    if (s == NULL) {
+        fprintf(stderr, "Cannot init state: given pointer is null\n");
+        return 1;
+    }
+
+    rs2_error* e = NULL;
+    if (s->ctx == NULL) {
+        fprintf(stderr, "Cannot ensure device: context is null\n");
+        return 1;
+    }
+
+    if (s->device_list != NULL) {
+        rs2_delete_device_list(s->device_list);
+        s->device_list = NULL;
+    }
+
+    s->dev_count = 0;
+
+    if (s->dev != NULL) {
+        rs2_delete_device(s->dev);
+        s->dev = NULL;
+    }
+
+    s->device_list = rs2_query_devices(s->ctx, &e);
+    if (check_error(e) != 0) {
+        s->device_list = NULL;
+        return 1;
+    }
+
+    s->dev_count = rs2_get_device_count(s->device_list, &e);
+    if (check_error(e) != 0) {
+        s->dev_count = 0;
+        return 1;
+    }
+
+    fprintf(stderr, "There are %d connected RealSense devices.\n", s->dev_count);
+    if (0 == s->dev_count)
+        return 1;
+
+    fprintf(stderr, "Creating device\n");
+    s->dev = rs2_create_device(s->device_list, rs_dev_index, &e);
+    if (check_error(e) != 0) {
+        s->dev = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+int query_device_serials(rs2_context* ctx, char serials[][RS_SERIAL_LEN], int max)
+{
+    rs2_error* e = NULL;
+
+    if (ctx == NULL) {
+        fprintf(stderr, "Cannot query devices: context is null\n");
+        return -1;
+    }
+
+    rs2_device_list* list = rs2_query_devices(ctx, &e);
+    if (check_error(e) != 0)
+        return -1;
+
+    int count = rs2_get_device_count(list, &e);
+    if (check_error(e) != 0) {
+        rs2_delete_device_list(list);
+        return -1;
+    }
+
+    int found = 0;
+    int i;
+    for (i = 0; i < count && found < max; i++)
+    {
+        // librealsense only sets e on failure, a stale one would fail every later device
+        rs2_device* dev = rs2_create_device(list, i, &e);
+        if (check_error(e) != 0) {
+            rs2_free_error(e);
+            e = NULL;
+            continue;
+        }
+
+        const char* serial = rs2_get_device_info(dev, RS2_CAMERA_INFO_SERIAL_NUMBER, &e);
+        if (check_error(e) == 0) {
+            snprintf(serials[found], RS_SERIAL_LEN, "%s", serial);
+            found++;
+        } else {
+            rs2_free_error(e);
+            e = NULL;
+        }
+
+        rs2_delete_device(dev);
+    }
+
+    rs2_delete_device_list(list);
+    return found;
+}
+
+int8_t set_preset(struct RS_State* s, const char* new_preset)
+{
+    int done = 0;
+    int sensor;
+    rs2_error* e = NULL;
+
+    for (sensor = 0; sensor < s->sensor_list_count && sensor < s->sensors_created; sensor++)
+    {
+        rs2_sensor* sen = s->sensors[sensor];
+        int supports = rs2_supports_option((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, &e);
+
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed asking if sensor supports RS2_OPTION_VISUAL_PRESET\n");
+            return 1;
+        }
+
+        if (supports == 1)
+        {
+            float pres = rs2_get_option((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, &e);
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET\n");
+                return 1;
+            }
+
+            const char* preset_desc = rs2_get_option_value_description((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, pres, &e);
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET description\n");
+                return 1;
+            }
+
+            if (strcmp(preset_desc, new_preset) == 0)
+            {
+                fprintf(stderr, "already using preset: %s\n", preset_desc);
+                done = 1;
+                continue;
+            }
+
+            float min, max, step, def;
+            rs2_get_option_range((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, &min, &max, &step, &def, &e);
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET ranges\n");
+                return 1;
+            }
+
+            int r;
+            for (r = (int)min; r < (int)max; r++)
+            {
+                if (done == 1)
+                    break;
+
+                preset_desc = rs2_get_option_value_description((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, r, &e);
+                if (check_error(e) != 0) {
+                    fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET description\n");
+                    return 1;
+                }
+
+                if (strcmp(preset_desc, new_preset) == 0)
+                {
+                    fprintf(stderr, "Changing preset to %s\n", preset_desc);
+                    rs2_set_option((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, r, &e);
+                    if (check_error(e) != 0) {
+                        fprintf(stderr, "Failed setting RS2_OPTION_VISUAL_PRESET\n");
+                        return 1;
+                    }
+
+                    pres = rs2_get_option((const rs2_options*)sen, RS2_OPTION_VISUAL_PRESET, &e);
+                    if (check_error(e) != 0) {
+                        fprintf(stderr, "Failed getting RS2_OPTION_VISUAL_PRESET\n");
+                        return 1;
+                    }
+
+                    if ((int)pres != (int)r) {
+                        fprintf(stderr, "Setting RS2_OPTION_VISUAL_PRESET did not change preset\n");
+                        return 1;
+                    }
+
+                    done = 1;
+                }
+            }
+        }
+    }
+
+    if (done == 0) {
+        fprintf(stderr, "Did not find preset: %s\n", new_preset);
+        return 1;
+    }
+
+    return 0;
+}
+
+void stream_config_defaults(struct StreamConfig* config)
+{
+    memset(config, 0, sizeof(struct StreamConfig));
+    config->playback_realtime = 1;
+
+    config->depth.width = DEFAULT_DEPTH_W;
+    config->depth.height = DEFAULT_DEPTH_H;
+    config->depth.format = RS2_FORMAT_Z16;
+    config->depth.fps = DEFAULT_FPS;
+
+    config->color.width = DEFAULT_COLOR_W;
+    config->color.height = DEFAULT_COLOR_H;
+    config->color.format = DEFAULT_COLOR_FORMAT;
+    config->color.fps = DEFAULT_FPS;
+}
+
+int8_t create_streams(struct RS_State* s, const struct StreamConfig* config)
+{
+    struct StreamConfig defaults;
+    if (config == NULL) {
+        stream_config_defaults(&defaults);
+        config = &defaults;
+    }
+
+    if (s == NULL) {
+        fprintf(stderr, "Cannot init streaming: given pointer is null\n");
+        return 1;
+    }
+
+    // A profile resolved against the old pipeline no longer applies
+    if (s->selection != NULL) {
+        rs2_delete_pipeline_profile(s->selection);
+        s->selection = NULL;
+    }
+
+    if (s->config != NULL) {
+        rs2_delete_config(s->config);
+        s->config = NULL;
+    }
+
+    if (s->pipe != NULL) {
+        rs2_delete_pipeline(s->pipe);
+        s->pipe = NULL;
+    }
+
+    rs2_error* e = NULL;
+    s->pipe = rs2_create_pipeline(s->ctx, &e);
+    if (check_error(e) != 0) {
+        s->pipe = NULL;
+        return 1;
+    }
+
+    s->config = rs2_create_config(&e);
+    if (check_error(e) != 0) {
+        s->config = NULL;
+        return 1;
+    }
+
+    struct StreamRequest depth = config->depth;
+    struct StreamRequest color = config->color;
+
+    if (config->playback_file != NULL)
+    {
+        // A recording has the resolution and rate it was captured with
+        depth.width = depth.height = depth.fps = 0;
+        color.width = color.height = color.fps = 0;
+
+        // Plays the file once, so a benchmark run ends with the recording
+        rs2_config_enable_device_from_file_repeat_option(s->config, config->playback_file, 0, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed opening playback file %s\n", config->playback_file);
+            return 1;
+        }
+
+        fprintf(stderr, "Playing back %s\n", config->playback_file);
+    }
+    else if (config->serial != NULL)
+    {
+        rs2_config_enable_device(s->config, config->serial, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed selecting device %s\n", config->serial);
+            return 1;
+        }
+    }
+
+    rs2_config_enable_stream(s->config, RS2_STREAM_DEPTH, -1, depth.width, depth.height, depth.format, depth.fps, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed initting depth streaming\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Depth stream created\n");
+
+    rs2_config_enable_stream(s->config, RS2_STREAM_COLOR, -1, color.width, color.height, color.format, color.fps, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed initting color streaming\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Color stream created\n");
+
+    return 0;
+}
+
+static int8_t resolve_selection(struct RS_State* s)
+{
+    rs2_error* e = NULL;
+
+    if (s->selection) {
+        rs2_delete_pipeline_profile(s->selection);
+        s->selection = NULL;
+    }
+
+    s->selection = rs2_config_resolve(s->config, s->pipe, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed resolving config\n");
+        s->selection = NULL;
+        return 1;
+    }
+
+    rs2_stream_profile_list* streams = rs2_pipeline_profile_get_streams(s->selection, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting resolved streams\n");
+        return 1;
+    }
+
+    int count = rs2_get_stream_profiles_count(streams, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting resolved stream count\n");
+        rs2_delete_stream_profiles_list(streams);
+        return 1;
+    }
+
+    memset(&s->depth, 0, sizeof(struct StreamInfo));
+    memset(&s->color, 0, sizeof(struct StreamInfo));
+    s->has_extrinsics = 0;
+
+    const rs2_stream_profile* depth_prof = NULL;
+    const rs2_stream_profile* color_prof = NULL;
+
+    int stream;
+    for (stream = 0; stream < count; stream++)
+    {
+        rs2_stream str;
+        rs2_format format;
+        int index;
+        int id;
+        int fps;
+
+        const rs2_stream_profile* prof = rs2_get_stream_profile(streams, stream, &e);
+        if (check_error(e) != 0)
+            break;
+
+        rs2_get_stream_profile_data(prof, &str, &format, &index, &id, &fps, &e);
+        if (check_error(e) != 0)
+            break;
+
+        struct StreamInfo* info = NULL;
+        if (str == RS2_STREAM_DEPTH) {
+            info = &s->depth;
+            depth_prof = prof;
+        } else if (str == RS2_STREAM_COLOR) {
+            info = &s->color;
+            color_prof = prof;
+        } else {
+            continue;
+        }
+
+        info->format = format;
+        info->fps = fps;
+        rs2_get_video_stream_intrinsics(prof, &info->intrinsics, &e);
+        if (check_error(e) != 0)
+            break;
+    }
+
+    // Only alignment needs these, a recording without them still streams
+    if (stream == count && depth_prof != NULL && color_prof != NULL)
+    {
+        rs2_get_extrinsics(depth_prof, color_prof, &s->depth_to_color, &e);
+        if (check_error(e) != 0)
+            fprintf(stderr, "No depth to color extrinsics, alignment is unavailable\n");
+        else
+            s->has_extrinsics = 1;
+    }
+
+    rs2_delete_stream_profiles_list(streams);
+
+    if (stream < count) {
+        fprintf(stderr, "Failed reading resolved stream %d / %d\n", stream, count);
+        return 1;
+    }
+
+    if (s->depth.intrinsics.width == 0 || s->color.intrinsics.width == 0) {
+        fprintf(stderr, "Resolved profile lacks a depth or color stream\n");
+        return 1;
+    }
+
+    if (s->depth.format != RS2_FORMAT_Z16 || (s->color.format != RS2_FORMAT_RGB8 &&
+        s->color.format != RS2_FORMAT_RGBA8 && s->color.format != RS2_FORMAT_BGRA8)) {
+        fprintf(stderr, "Resolved formats %s / %s cannot be rendered\n",
+                rs2_format_to_string(s->depth.format), rs2_format_to_string(s->color.format));
+        return 1;
+    }
+
+    fprintf(stderr, "resolved depth %dx%d %s @ %d, color %dx%d %s @ %d\n",
+            s->depth.intrinsics.width, s->depth.intrinsics.height, rs2_format_to_string(s->depth.format), s->depth.fps,
+            s->color.intrinsics.width, s->color.intrinsics.height, rs2_format_to_string(s->color.format), s->color.fps);
+
+    return 0;
+}
+
+int8_t resolve_streams(struct RS_State* s, const struct StreamConfig* config)
+{
+    if (s == NULL) {
+        fprintf(stderr, "Cannot resolve streams: given pointer is null\n");
+        return 1;
+    }
+
+    if (s->ctx == NULL && create_context(s) != 0)
+        return 1;
+
+    if (create_streams(s, config) != 0)
+        return 1;
+
+    return resolve_selection(s);
+}
+
+int8_t start_stream(struct RS_State* s, int preset_index, const struct StreamDelivery* delivery)
+{
+    rs2_error* e = NULL;
+
+    if (s == NULL) {
+        fprintf(stderr, "Cannot star t stream: given pointer is null\n");
+        return 1;
+    }
+
+    // Starts what resolve_streams settled on when it was called first
+    if (s->selection == NULL && resolve_selection(s) != 0)
+        return 1;
+
+    if (s->device_list != NULL) {
+        rs2_delete_device_list(s->device_list);
+        s->device_list = 0;
+    }
+
+    s->dev_count = 0;
+
+    if (s->dev) {
+        rs2_delete_device(s->dev);
+        s->dev = NULL;
+    }
+
+    s->dev = rs2_pipeline_profile_get_device(s->selection, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting device for pipeline profile\n");
+        s->dev = NULL;
+        return 1;
+    }
+
+    if (s->sensor_list) {
+        rs2_delete_sensor_list(s->sensor_list);
+        s->sensor_list = NULL;
+    }
+
+    if (s->sensor_list_count > 0) {
+        int sensor;
+        for (sensor = 0; sensor < s->sensor_list_count; sensor++) {
+            rs2_delete_sensor(s->sensors[sensor]);
+            s->sensors[sensor] = NULL;
+        }
+        s->sensor_list_count = 0;
+    }
+
+    s->sensor_list = rs2_query_sensors(s->dev, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed querying for sensors\n");
+        s->sensor_list = NULL;
+        return 1;
+    }
+
+    s->sensor_list_count = rs2_get_sensors_count(s->sensor_list, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting sensor list count\n");
+        s->sensor_list_count = 0;
+        return 1;
+    }
+
+    int sensor;
+    for (sensor = 0; sensor < s->sensor_list_count; sensor++) {
+        s->sensors[sensor] = rs2_create_sensor(s->sensor_list, sensor, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed creating sensor %d / %d\n", sensor, s->sensor_list_count);
+            s->sensors[sensor] = NULL;
+            return 1;
+        }
+
+        s->sensors_created++;
+    }
+
+    s->playback = rs2_is_device_extendable_to(s->dev, RS2_EXTENSION_PLAYBACK, &e) == 1;
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed checking for playback device\n");
+        return 1;
+    }
+
+    s->synthetic = rs2_is_device_extendable_to(s->dev, RS2_EXTENSION_SOFTWARE_DEVICE, &e) == 1;
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed checking for software device\n");
+        return 1;
+    }
+
+    // A recording keeps whatever preset it was captured with, and a
+    // software device has no advanced mode to load one into
+    if (s->playback == 0 && s->synthetic == 0)
+    {
+        if (set_preset(s, presets[preset_index]) != 0)
+            return 1;
+
+        fprintf(stderr, "Preset changed");
+    }
+
+    if (delivery != NULL && delivery->mode != STREAM_DELIVERY_WAIT)
+    {
+        rs2_frame_callback_ptr callback = delivery->callback;
+        void* user = delivery->user;
+
+        if (delivery->mode == STREAM_DELIVERY_QUEUE)
+        {
+            if (s->frame_queue) {
+                rs2_delete_frame_queue(s->frame_queue);
+                s->frame_queue = NULL;
+            }
+
+            // librealsense drops the oldest frameset once the queue is full
+            s->frame_queue = rs2_create_frame_queue(delivery->frame_queue_size, &e);
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed creating frame queue\n");
+                s->frame_queue = NULL;
+                return 1;
+            }
+
+            callback = rs2_enqueue_frame;
+            user = s->frame_queue;
+        }
+
+        if (callback == NULL) {
+            fprintf(stderr, "Cannot start pipeline: no frame callback given\n");
+            return 1;
+        }
+
+        // Framesets are handed to the callback from librealsense's own thread
+        rs2_pipeline_profile* started = rs2_pipeline_start_with_config_and_callback(s->pipe, s->config,
+                                                                                   callback, user, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed starting pipeline with frame callback\n");
+            return 1;
+        }
+
+        rs2_delete_pipeline_profile(started);
+    }
+    else
+    {
+        rs2_pipeline_start_with_config(s->pipe, s->config, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed starting pipeline\n");
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "pipeline started\n");
+
+
+    s->stream_list = rs2_pipeline_profile_get_streams(s->selection, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting pipeline profile streams\n");
+        s->stream_list = NULL;
+        return 1;
+    }
+
+    s->stream_list_count = rs2_get_stream_profiles_count(s->stream_list, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed getting pipeline profile stream count\n");
+        s->stream_list_count = 0;
+        return 1;
+    }
+
+    fprintf(stderr, "stream list count: %d\n", s->stream_list_count);
+
+    return 0;
+}
+
+int8_t stop_stream(struct RS_State* s)
+{
+    rs2_error* e = NULL;
+
+    if (s == NULL || s->pipe == NULL) {
+        fprintf(stderr, "Cannot stop stream: no pipeline\n");
+        return 1;
+    }
+
+    rs2_pipeline_stop(s->pipe, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed stopping pipeline\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int8_t playback_finished(struct RS_State* s)
+{
+    rs2_error* e = NULL;
+
+    if (s == NULL || s->playback == 0 || s->dev == NULL)
+        return 0;
+
+    rs2_playback_status status = rs2_playback_device_get_current_status(s->dev, &e);
+    if (check_error(e) != 0)
+        return 0;
+
+    return status == RS2_PLAYBACK_STATUS_STOPPED;
+}
+
+int8_t set_advanced(struct RS_State* s, int val)
+{
+    if (s == NULL) {
+        fprintf(stderr, "Cannot set advanced: given pointer is null\n");
+        return 1;
+    }
+
+    rs2_error* e = NULL;
+
+    if (val == 0) {
+        fprintf(stderr, "disabling advanced mode\n");
+    } else {
+        fprintf(stderr, "enabling advanced mode\n");
+    }
+
+    rs2_toggle_advanced_mode(s->dev, val, &e);
+    if (check_error(e) != 0) {
+        // This thing spits out errors if the device is not ready for this mode yet
+        return 0;
+    }
+
+    rs2_is_enabled(s->dev, &s->advanced_enabled, &e);
+    if (check_error(e) != 0) {
+        // This thing spits out errors if the device is not ready for this mode yet
+        return 0;
+    }
+
+    return 0;
+}
+
+// Bumped by librealsense whenever a device comes or goes
+static SDL_atomic_t devices_changed;
+
+static void on_devices_changed(rs2_device_list* removed, rs2_device_list* added, void* user)
+{
+    // The lists are handed over to the callback
+    rs2_delete_device_list(removed);
+    rs2_delete_device_list(added);
+    SDL_AtomicAdd(&devices_changed, 1);
+}
+
+// Releases what ensure_device opened, the context stays for the streams
+static void release_device(struct RS_State* s)
+{
+    if (s->dev) {
+        rs2_delete_device(s->dev);
+        s->dev = NULL;
+    }
+
+    if (s->device_list) {
+        rs2_delete_device_list(s->device_list);
+        s->device_list = NULL;
+    }
+
+    s->dev_count = 0;
+}
+
+// 1 when the device reports advanced mode, 0 when it does not or is not back yet
+static int8_t poll_advanced(struct RS_State* s)
+{
+    rs2_error* e = NULL;
+
+    if (ensure_device(s, 0) != 0)
+        return 0;
+
+    int enabled = 0;
+    rs2_is_enabled(s->dev, &enabled, &e);
+    if (e != NULL) {
+        // Expected while the device is still resetting, polled again after the backoff
+        rs2_free_error(e);
+        return 0;
+    }
+
+    s->advanced_enabled = enabled;
+    return enabled != 0;
+}
+
+int8_t ensure_advanced(struct RS_State* s)
+{
+    rs2_error* e = NULL;
+    const Uint64 freq = SDL_GetPerformanceFrequency();
+    const Uint64 start = SDL_GetPerformanceCounter();
+
+    if (s->ctx == NULL && create_context(s) != 0)
+        return 1;
+
+    if (ensure_device(s, 0) != 0) {
+        fprintf(stderr, "Failed creating device when checking for advanced mode\n");
+        return 1;
+    }
+
+    rs2_is_enabled(s->dev, &s->advanced_enabled, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed checking for advanced mode\n");
+        return 1;
+    }
+
+    if (s->advanced_enabled == 0)
+    {
+        // Toggling resets the device, it drops off the bus and comes back in advanced mode
+        rs2_set_devices_changed_callback(s->ctx, on_devices_changed, NULL, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "No device change notifications, polling for advanced mode\n");
+            rs2_free_error(e);
+        }
+        e = NULL;
+
+        if (set_advanced(s, 1) != 0) {
+            fprintf(stderr, "failed setting advanced mode\n");
+            return 1;
+        }
+
+        Uint32 backoff = ADVANCED_MODE_BACKOFF_MIN_MS;
+        while (s->advanced_enabled == 0)
+        {
+            const Uint64 waited_ms = (SDL_GetPerformanceCounter() - start) * 1000 / freq;
+            if (waited_ms > ADVANCED_MODE_TIMEOUT_MS) {
+                fprintf(stderr, "Device did not come back in advanced mode within %d ms\n", ADVANCED_MODE_TIMEOUT_MS);
+                return 1;
+            }
+
+            // Sleep out the backoff, but look again as soon as a device shows up
+            int seen = SDL_AtomicGet(&devices_changed);
+            Uint32 slept = 0;
+            while (slept < backoff && SDL_AtomicGet(&devices_changed) == seen) {
+                SDL_Delay(ADVANCED_MODE_BACKOFF_MIN_MS);
+                slept += ADVANCED_MODE_BACKOFF_MIN_MS;
+            }
+
+            if (poll_advanced(s))
+                break;
+
+            backoff *= 2;
+            if (backoff > ADVANCED_MODE_BACKOFF_MAX_MS)
+                backoff = ADVANCED_MODE_BACKOFF_MAX_MS;
+        }
+    }
+
+    release_device(s);
+
+    fprintf(stderr, "advanced mode enabled after %.1f ms\n",
+            (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / freq);
+    return 0;
+}
+
+int8_t start_sensor(struct RS_State* rs_state, int dev_index, int preset_index,
+                    const struct StreamConfig* config, const struct StreamDelivery* delivery)
+{
+    rs2_error* e = NULL;
+
+    if (rs_state->ctx == NULL) {
+        if (create_context(rs_state) != 0)  {
+            fprintf(stderr, "Failed creating context when starting sensor\n");
+            return 1;
+        }
+    }
+
+    if (rs_state->selection == NULL)
+    {
+        if (resolve_streams(rs_state, config) != 0)
+        {
+            fprintf(stderr, "Failed initting streams\n");
+            return 1;
+        }
+
+        fprintf(stderr, "streams created\n");
+    }
+
+    if (start_stream(rs_state, preset_index, delivery) != 0)
+    {
+        fprintf(stderr, "Failed starting streams\n");
+        return 1;
+    }
+
+    fprintf(stderr, "streams started\n");
+
+    if (rs_state->playback)
+    {
+        // The device that is actually playing is the one of the active profile
+        rs2_pipeline_profile* active = rs2_pipeline_get_active_profile(rs_state->pipe, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed getting active pipeline profile\n");
+            return 1;
+        }
+
+        rs2_device* playing = rs2_pipeline_profile_get_device(active, &e);
+        rs2_delete_pipeline_profile(active);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed getting playback device\n");
+            return 1;
+        }
+
+        if (rs_state->dev) {
+            rs2_delete_device(rs_state->dev);
+        }
+        rs_state->dev = playing;
+
+        int8_t realtime = config != NULL ? config->playback_realtime : 1;
+        rs2_playback_device_set_real_time(rs_state->dev, realtime, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed setting playback speed\n");
+            return 1;
+        }
+
+        fprintf(stderr, "playback %s\n", realtime ? "in real time" : "as fast as possible");
+    }
+
+    int stream;
+    float fov[2];
+    float rgb_fov[2];
+    for (stream = 0; stream < rs_state->stream_list_count; stream++)
+    {
+        rs2_stream str;
+        rs2_format format;
+        int index;
+        int id;
+        int fps;
+
+        const rs2_stream_profile* prof = rs2_get_stream_profile(rs_state->stream_list, stream, &e);
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed getting stream profile: %d / %d\n", stream, rs_state->stream_list_count);
+            return 1;
+        }
+
+        rs2_get_stream_profile_data(prof, &str, &format, &index, &id, &fps, &e);
+
+        if (check_error(e) != 0) {
+            fprintf(stderr, "Failed getting stream profile data for stream: %d / %d\n", stream, rs_state->stream_list_count);
+            return 1;
+        }
+
+        rs2_intrinsics intrinsics;
+        if (str == RS2_STREAM_DEPTH)
+        {
+            rs2_get_video_stream_intrinsics(prof, &intrinsics, &e);
+            if (check_error(e) != 0) {
+                fprintf(stdout, "Failed getting depth stream intrinsics\n");
+                return 1;
+            }
+
+            rs2_fov(&intrinsics, fov);
+            fprintf(stderr, "Started depth stream, fov %f, %f\n", fov[0], fov[1]);
+        }
+        else if (str == RS2_STREAM_COLOR)
+        {
+            rs2_get_video_stream_intrinsics(prof, &intrinsics, &e);
+            if (check_error(e) != 0) {
+                fprintf(stderr, "Failed getting color stream intrinsics\n");
+                return 1;
+            }
+
+            rs2_fov(&intrinsics, rgb_fov);
+            fprintf(stderr, "Started color stream, fov %f, %f\n", rgb_fov[0], rgb_fov[1]);
+        }
+    }
+
+    return 0;
+}
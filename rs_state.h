@@ -0,0 +1,135 @@
+#ifndef RS_STATE_H
+#define RS_STATE_H
+
+#include <librealsense2/rs.h>
+#include <librealsense2/h/rs_pipeline.h>
+#include <librealsense2/h/rs_frame.h>
+
+#include <stdint.h>
+
+// Stream profile requested when none is configured
+#define DEFAULT_DEPTH_W 1280
+#define DEFAULT_DEPTH_H 720
+#define DEFAULT_COLOR_W 1920
+#define DEFAULT_COLOR_H 1080
+#define DEFAULT_FPS 30
+
+// RGBA8 and BGRA8 color frames are used as delivered, RGB8 frames are
+// expanded to RGBA on the CPU
+#define DEFAULT_COLOR_FORMAT RS2_FORMAT_RGB8
+
+// Polling for a device to come back in advanced mode starts at the minimum
+// and doubles up to the maximum, unless a device change cuts the wait short
+#define ADVANCED_MODE_BACKOFF_MIN_MS 5
+#define ADVANCED_MODE_BACKOFF_MAX_MS 250
+#define ADVANCED_MODE_TIMEOUT_MS 10000
+
+#define PRESET_COUNT 3
+extern const char* presets[PRESET_COUNT];
+
+// How framesets get from a started pipeline to the application
+enum StreamDeliveryMode
+{
+    STREAM_DELIVERY_WAIT,     // rs2_pipeline_wait_for_frames on the pipeline
+    STREAM_DELIVERY_QUEUE,    // pushed into rs_state->frame_queue
+    STREAM_DELIVERY_CALLBACK  // handed to callback on librealsense's thread
+};
+
+struct StreamDelivery
+{
+    enum StreamDeliveryMode mode;
+    int frame_queue_size;
+    // The callback owns the frameset and must release it
+    rs2_frame_callback_ptr callback;
+    void* user;
+};
+
+// A stream as requested from librealsense. Zero fields and RS2_FORMAT_ANY
+// leave the choice to librealsense.
+struct StreamRequest
+{
+    int width;
+    int height;
+    rs2_format format;
+    int fps;
+};
+
+// A stream as resolved by librealsense, what buffers and textures are sized from
+struct StreamInfo
+{
+    rs2_format format;
+    int fps;
+    rs2_intrinsics intrinsics;
+};
+
+// Where frames come from
+struct StreamConfig
+{
+    // Recorded .bag file to play back instead of a live device, or NULL
+    const char* playback_file;
+    // 1 plays back at recorded speed, 0 as fast as frames can be consumed
+    int8_t playback_realtime;
+    // Serial number of the device to stream from, or NULL for any
+    const char* serial;
+    struct StreamRequest depth;
+    struct StreamRequest color;
+};
+
+#define RS_STATE_SENSORS_MAX 20
+struct RS_State
+{
+    rs2_context* ctx;
+    rs2_device_list* device_list;
+    int32_t dev_count;
+    rs2_device* dev;
+    rs2_sensor_list* sensor_list;
+    int32_t sensor_list_count;
+    rs2_sensor* sensors[RS_STATE_SENSORS_MAX];
+    int32_t sensors_created;
+    int32_t advanced_enabled;
+    rs2_pipeline* pipe;
+    rs2_pipeline_profile* selection;
+    rs2_stream_profile_list* stream_list;
+    int32_t stream_list_count;
+    rs2_config* config;
+    rs2_frame_queue* frame_queue;
+    int8_t playback;
+    int8_t synthetic;
+    // Valid once resolve_streams has succeeded
+    struct StreamInfo depth;
+    struct StreamInfo color;
+    // Rigid transform from depth to color coordinates, 0 when the device has none
+    int8_t has_extrinsics;
+    rs2_extrinsics depth_to_color;
+};
+
+int8_t create_context(struct RS_State* rs_state);
+int8_t clear_state(struct RS_State* s);
+int8_t ensure_device(struct RS_State* s, int rs_dev_index);
+// Serial numbers of up to max connected devices, for StreamConfig.serial.
+// Returns how many were found, -1 on error.
+#define RS_SERIAL_LEN 32
+int query_device_serials(rs2_context* ctx, char serials[][RS_SERIAL_LEN], int max);
+int8_t set_preset(struct RS_State* s, const char* new_preset);
+// Fills in the default device and stream profile
+void stream_config_defaults(struct StreamConfig* config);
+int8_t create_streams(struct RS_State* s, const struct StreamConfig* config);
+// Creates the streams and resolves them against the device, filling in
+// s->depth and s->color without starting anything. start_sensor starts what
+// was resolved, so buffers can be sized before the first frame arrives.
+int8_t resolve_streams(struct RS_State* s, const struct StreamConfig* config);
+// A NULL delivery is the same as STREAM_DELIVERY_WAIT
+int8_t start_stream(struct RS_State* s, int preset_index, const struct StreamDelivery* delivery);
+int8_t stop_stream(struct RS_State* s);
+
+// 1 once a non-repeating playback has delivered its last frame
+int8_t playback_finished(struct RS_State* s);
+int8_t set_advanced(struct RS_State* s, int val);
+// Puts device 0 in advanced mode unless it already is, waiting for it to
+// come back after the reset. Leaves only the context open.
+int8_t ensure_advanced(struct RS_State* s);
+// A NULL config streams the default profile from the live device
+int8_t start_sensor(struct RS_State* rs_state, int dev_index, int preset_index,
+                    const struct StreamConfig* config, const struct StreamDelivery* delivery);
+
+#endif
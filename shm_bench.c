@@ -0,0 +1,317 @@
+#define SDL_MAIN_HANDLED
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "publisher.h"
+#include "shm_reader.h"
+
+// Publishes generated depth and color frames to shared memory while N
+// reader processes map them in place, and reports what each reader got.
+// A reader can be slowed down to show the publisher does not wait for it.
+
+#define SHM_BENCH_READERS_MAX 64
+#define SHM_BENCH_DEFAULT_READERS 4
+#define SHM_BENCH_DEFAULT_SECONDS 5
+// How long readers get to map the segment before the bench gives up
+#define SHM_BENCH_READY_TIMEOUT_MS 5000.0
+
+struct ReaderResult
+{
+    int ready;
+    uint64_t frames;
+    uint64_t skipped;
+    uint64_t torn;
+    // Intact frames whose payload did not carry their frame number
+    uint64_t corrupt;
+    uint64_t bytes;
+    double latency_total_ms;
+    double latency_max_ms;
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+// Touches a word of every cache line, as analytics reading the frame would
+static uint64_t read_payload(const struct ShmFrame* frame)
+{
+    const uint8_t* p = (const uint8_t*)frame->data;
+    uint64_t sum = 0;
+    size_t i;
+    for (i = 0; i + sizeof(uint64_t) <= frame->size; i += 64)
+        sum += *(const uint64_t*)(p + i);
+    return sum;
+}
+
+static int run_reader(const char* name, struct ReaderResult* result, int delay_ms)
+{
+    struct ShmReader r;
+    if (shm_reader_open(&r, name) != 0)
+        return 1;
+
+    __atomic_store_n(&result->ready, 1, __ATOMIC_RELEASE);
+
+    volatile uint64_t sink = 0;
+    struct ShmFrame frame;
+    while (shm_reader_closed(&r) == 0)
+    {
+        if (shm_reader_next(&r, &frame, 100) != 0)
+            continue;
+
+        const double latency = now_ms() - frame.timestamp;
+        uint64_t first;
+        memcpy(&first, frame.data, sizeof(first));
+        sink += read_payload(&frame);
+
+        if (delay_ms > 0)
+            usleep((useconds_t)delay_ms * 1000);
+
+        if (shm_reader_valid(&r, &frame) == 0)
+            continue;
+
+        if (first != frame.number)
+            result->corrupt++;
+        result->bytes += frame.size;
+        result->latency_total_ms += latency;
+        if (latency > result->latency_max_ms)
+            result->latency_max_ms = latency;
+    }
+
+    result->frames = r.frames;
+    result->skipped = r.skipped;
+    result->torn = r.torn;
+    shm_reader_close(&r);
+    return 0;
+}
+
+// Closing the segment ends the readers, which are then reaped
+static void stop_readers(struct Publisher* pub, const pid_t* pids, int readers)
+{
+    publisher_stop(pub);
+    int i;
+    for (i = 0; i < readers; i++)
+        waitpid(pids[i], NULL, 0);
+}
+
+// Waits for reader i to map the segment, 1 when it exited or timed out first
+static int8_t wait_ready(struct ReaderResult* result, pid_t pid, int i)
+{
+    const double deadline = now_ms() + SHM_BENCH_READY_TIMEOUT_MS;
+    while (__atomic_load_n(&result->ready, __ATOMIC_ACQUIRE) == 0)
+    {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            fprintf(stderr, "Reader %d exited before mapping the segment\n", i);
+            return 1;
+        }
+        if (now_ms() > deadline) {
+            fprintf(stderr, "Reader %d did not map the segment within %.0f ms\n", i, SHM_BENCH_READY_TIMEOUT_MS);
+            return 1;
+        }
+        usleep(1000);
+    }
+    return 0;
+}
+
+static int8_t parse_size(const char* s, int* width, int* height)
+{
+    if (sscanf(s, "%dx%d", width, height) != 2 || *width <= 0 || *height <= 0) {
+        fprintf(stderr, "Bad frame size %s, expected e.g. 1280x720\n", s);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int readers = SHM_BENCH_DEFAULT_READERS;
+    double seconds = SHM_BENCH_DEFAULT_SECONDS;
+    int fps = 0;
+    int width = 1280;
+    int height = 720;
+    int slow_ms = 0;
+
+    struct PublisherConfig config;
+    publisher_default_config(&config);
+    config.name = "/minimal_realsense2_bench";
+
+    int arg;
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--readers") == 0 && arg + 1 < argc) {
+            readers = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--seconds") == 0 && arg + 1 < argc) {
+            seconds = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "--fps") == 0 && arg + 1 < argc) {
+            fps = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--size") == 0 && arg + 1 < argc) {
+            if (parse_size(argv[++arg], &width, &height) != 0)
+                return 1;
+        } else if (strcmp(argv[arg], "--slots") == 0 && arg + 1 < argc) {
+            config.slots = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--slow-reader") == 0 && arg + 1 < argc) {
+            slow_ms = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--name") == 0 && arg + 1 < argc) {
+            config.name = argv[++arg];
+        } else {
+            fprintf(stderr, "usage: %s [--readers n] [--seconds s] [--fps n] [--size WxH] [--slots n] "
+                    "[--slow-reader ms] [--name /shm]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (readers < 1 || readers > SHM_BENCH_READERS_MAX) {
+        fprintf(stderr, "Between 1 and %d readers\n", SHM_BENCH_READERS_MAX);
+        return 1;
+    }
+
+    SDL_SetMainReady();
+
+    // Only what the publisher sizes its slots and header from
+    struct RS_State rs_state;
+    memset(&rs_state, 0, sizeof(rs_state));
+    rs_state.depth.format = RS2_FORMAT_Z16;
+    rs_state.depth.intrinsics.width = width;
+    rs_state.depth.intrinsics.height = height;
+    rs_state.color.format = RS2_FORMAT_RGB8;
+    rs_state.color.intrinsics.width = width;
+    rs_state.color.intrinsics.height = height;
+
+    struct Publisher pub;
+    if (publisher_start(&pub, &config, &rs_state) != 0)
+        return 1;
+
+    // Results live in memory the children share with the parent
+    const size_t results_size = sizeof(struct ReaderResult) * readers;
+    struct ReaderResult* results = (struct ReaderResult*)mmap(NULL, results_size, PROT_READ | PROT_WRITE,
+                                                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        fprintf(stderr, "Failed mapping reader results\n");
+        publisher_stop(&pub);
+        return 1;
+    }
+    memset(results, 0, results_size);
+
+    pid_t pids[SHM_BENCH_READERS_MAX];
+    int i;
+    for (i = 0; i < readers; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == 0)
+            _exit(run_reader(config.name, &results[i], i == 0 ? slow_ms : 0));
+        if (pids[i] < 0) {
+            fprintf(stderr, "Failed starting reader %d\n", i);
+            readers = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < readers; i++) {
+        if (wait_ready(&results[i], pids[i], i) != 0) {
+            // An exited reader is reaped again below, which just fails
+            stop_readers(&pub, pids, readers);
+            munmap(results, results_size);
+            return 1;
+        }
+    }
+
+    struct FrameHandle frames[RECORDING_STREAM_COUNT];
+    memset(frames, 0, sizeof(frames));
+    frames[RECORDING_STREAM_DEPTH].width = width;
+    frames[RECORDING_STREAM_DEPTH].height = height;
+    frames[RECORDING_STREAM_DEPTH].stride = width * 2;
+    frames[RECORDING_STREAM_DEPTH].format = RS2_FORMAT_Z16;
+    frames[RECORDING_STREAM_COLOR].width = width;
+    frames[RECORDING_STREAM_COLOR].height = height;
+    frames[RECORDING_STREAM_COLOR].stride = width * 3;
+    frames[RECORDING_STREAM_COLOR].format = RS2_FORMAT_RGB8;
+
+    int s;
+    for (s = 0; s < RECORDING_STREAM_COUNT; s++) {
+        const size_t size = (size_t)frames[s].stride * height;
+        void* data = malloc(size);
+        if (data == NULL) {
+            fprintf(stderr, "Failed allocating a %lu byte frame\n", (unsigned long)size);
+            stop_readers(&pub, pids, readers);
+            while (s-- > 0)
+                free((void*)frames[s].data);
+            munmap(results, results_size);
+            return 1;
+        }
+        memset(data, 0x40 + s, size);
+        frames[s].data = data;
+    }
+
+    fprintf(stderr, "publishing %dx%d depth and color to %d readers for %.1f s%s\n", width, height, readers,
+            seconds, slow_ms > 0 ? ", reader 0 slowed down" : "");
+
+    const double start = now_ms();
+    const double end = start + seconds * 1000.0;
+    unsigned long long number = 0;
+    double t = start;
+    while (t < end)
+    {
+        for (s = 0; s < RECORDING_STREAM_COUNT; s++) {
+            // Readers check the payload starts with its frame number
+            number++;
+            frames[s].number = number;
+            memcpy((void*)frames[s].data, &number, sizeof(number));
+            frames[s].timestamp = now_ms();
+            publisher_submit(&pub, &frames[s], (enum RecordingStream)s);
+        }
+
+        t = now_ms();
+        if (fps > 0) {
+            const double next = start + (double)(number / 2) * 1000.0 / fps;
+            if (next > t)
+                usleep((useconds_t)((next - t) * 1000.0));
+            t = now_ms();
+        }
+    }
+    const double elapsed_s = (t - start) / 1000.0;
+
+    stop_readers(&pub, pids, readers);
+
+    printf("published %llu frames in %.2f s: %.0f frames/s, %.2f GB/s\n", number, elapsed_s,
+           (double)number / elapsed_s, (double)pub.bytes / elapsed_s / 1e9);
+    fflush(stdout);
+    publisher_print_stats(&pub);
+
+    uint64_t corrupt = 0;
+    printf("reader   frames  skipped  torn  corrupt    GB/s  latency avg   max ms\n");
+    for (i = 0; i < readers; i++) {
+        const struct ReaderResult* res = &results[i];
+        corrupt += res->corrupt;
+        const uint64_t intact = res->frames - res->torn;
+        printf("%6d %8llu %8llu %5llu %8llu %7.2f %12.3f %8.3f%s\n", i, (unsigned long long)res->frames,
+               (unsigned long long)res->skipped, (unsigned long long)res->torn, (unsigned long long)res->corrupt,
+               (double)res->bytes / elapsed_s / 1e9, intact ? res->latency_total_ms / intact : 0.0,
+               res->latency_max_ms, i == 0 && slow_ms > 0 ? "  slowed" : "");
+    }
+
+    for (s = 0; s < RECORDING_STREAM_COUNT; s++)
+        free((void*)frames[s].data);
+    munmap(results, results_size);
+
+    // Torn frames are expected of slow readers, intact ones carrying the wrong payload are not
+    if (corrupt > 0) {
+        fprintf(stderr, "%llu intact frames carried another frame's payload\n", (unsigned long long)corrupt);
+        return 1;
+    }
+    return 0;
+}
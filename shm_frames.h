@@ -0,0 +1,77 @@
+#ifndef SHM_FRAMES_H
+#define SHM_FRAMES_H
+
+#include <stdint.h>
+
+#include "recording.h"
+
+// Layout of the POSIX shared memory segment the publisher writes frames to:
+//
+//   ShmFramesHeader
+//   ShmFrameSlot + payload, slot_count of them, slot_size apart from slots_offset
+//
+// Frames go round the slots in publish order, frame i into slot
+// i % slot_count. The publisher never waits for readers: each slot is a
+// seqlock whose sequence is odd while it is being written, and a reader
+// checks the sequence again once done with a payload it read in place.
+// published counts the frames so far and is the futex readers sleep on.
+
+#define SHM_FRAMES_MAGIC "RS2SHM\r\n"
+#define SHM_FRAMES_VERSION 1
+
+// Slots start on a page, payloads on a cache line after the slot header
+#define SHM_FRAMES_ALIGN 4096
+
+#define SHM_FRAMES_DEFAULT_NAME "/minimal_realsense2"
+// A power of two, so slot indices survive published wrapping
+#define SHM_FRAMES_DEFAULT_SLOTS 8
+
+struct ShmFramesHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_count;
+    uint64_t slot_size;
+    uint64_t slots_offset;
+    uint64_t total_size;
+    // Indexed by RecordingStream, as in a recording header
+    struct RecordingStreamInfo streams[RECORDING_STREAM_COUNT];
+    int32_t has_extrinsics;
+    float rotation[9];
+    float translation[3];
+    uint8_t reserved0[52];
+
+    // Written while streaming, on a cache line of their own. Only the
+    // publisher writes, readers may map the segment read-only.
+    uint32_t published;
+    // Set once the publisher stopped, a new one creates a new segment
+    uint32_t closed;
+    uint32_t publisher_pid;
+    uint32_t reserved1[13];
+};
+
+struct ShmFrameSlot
+{
+    uint32_t sequence;
+    uint8_t stream;
+    uint8_t reserved0[3];
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t payload_size;
+    int32_t format;
+    int32_t timestamp_domain;
+    uint64_t frame_number;
+    double timestamp;
+    // Meters per Z16 step, depth frames only
+    float depth_units;
+    // Low bits of the frame's publish count, tells readers which lap the slot is on
+    uint32_t index;
+    uint32_t reserved1[2];
+};
+
+// Fails to compile when a struct's size drifts from the layout
+typedef char shm_frames_header_size[sizeof(struct ShmFramesHeader) == 320 ? 1 : -1];
+typedef char shm_frame_slot_size[sizeof(struct ShmFrameSlot) == 64 ? 1 : -1];
+
+#endif
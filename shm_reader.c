@@ -0,0 +1,191 @@
+#include "shm_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+// Sleeps while published still reads seen, at most timeout_ms
+static void wait_published(const struct ShmReader* r, uint32_t seen, double timeout_ms)
+{
+    struct timespec ts;
+#ifdef __linux__
+    ts.tv_sec = (time_t)(timeout_ms / 1000.0);
+    ts.tv_nsec = (long)((timeout_ms - (double)ts.tv_sec * 1000.0) * 1e6);
+    syscall(SYS_futex, &r->header->published, FUTEX_WAIT, seen, &ts, NULL, 0);
+#else
+    ts.tv_sec = 0;
+    ts.tv_nsec = timeout_ms < 1.0 ? (long)(timeout_ms * 1e6) : 1000000;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+int8_t shm_reader_open(struct ShmReader* r, const char* name)
+{
+    if (r == NULL || name == NULL) {
+        fprintf(stderr, "Cannot open shared memory reader: given pointer is null\n");
+        return 1;
+    }
+
+    memset(r, 0, sizeof(struct ShmReader));
+    r->fd = shm_open(name, O_RDONLY, 0);
+    if (r->fd < 0) {
+        fprintf(stderr, "Failed opening shared memory %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(r->fd, &st) != 0 || (size_t)st.st_size < sizeof(struct ShmFramesHeader)) {
+        fprintf(stderr, "Shared memory %s is not ready yet\n", name);
+        shm_reader_close(r);
+        return 1;
+    }
+
+    r->size = (size_t)st.st_size;
+    void* base = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed mapping shared memory %s: %s\n", name, strerror(errno));
+        shm_reader_close(r);
+        return 1;
+    }
+    r->base = (const uint8_t*)base;
+    r->header = (const struct ShmFramesHeader*)base;
+
+    // The publisher writes the magic last
+    char magic[sizeof(r->header->magic)];
+    memcpy(magic, r->header->magic, sizeof(magic));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (memcmp(magic, SHM_FRAMES_MAGIC, sizeof(magic)) != 0 || r->header->version != SHM_FRAMES_VERSION ||
+        r->header->total_size != r->size || r->header->slot_count == 0 ||
+        (r->header->slot_count & (r->header->slot_count - 1)) != 0) {
+        fprintf(stderr, "Shared memory %s holds no frames of version %d\n", name, SHM_FRAMES_VERSION);
+        shm_reader_close(r);
+        return 1;
+    }
+
+    r->next = __atomic_load_n(&r->header->published, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+void shm_reader_close(struct ShmReader* r)
+{
+    if (r->base != NULL)
+        munmap((void*)r->base, r->size);
+    if (r->fd >= 0)
+        close(r->fd);
+    r->base = NULL;
+    r->header = NULL;
+    r->fd = -1;
+}
+
+int8_t shm_reader_closed(const struct ShmReader* r)
+{
+    return __atomic_load_n(&r->header->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+static const struct ShmFrameSlot* slot_of(const struct ShmReader* r, uint32_t index)
+{
+    return (const struct ShmFrameSlot*)(r->base + r->header->slots_offset +
+                                        (size_t)(index & (r->header->slot_count - 1)) * r->header->slot_size);
+}
+
+int8_t shm_reader_next(struct ShmReader* r, struct ShmFrame* frame, int timeout_ms)
+{
+    const double deadline = now_ms() + timeout_ms;
+
+    for (;;)
+    {
+        if (shm_reader_closed(r))
+            return 1;
+
+        const uint32_t published = __atomic_load_n(&r->header->published, __ATOMIC_ACQUIRE);
+        if (published == r->next) {
+            const double left = deadline - now_ms();
+            if (left <= 0.0)
+                return 1;
+            wait_published(r, published, left);
+            continue;
+        }
+
+        // A whole ring behind, the oldest slots are going next; the newest lasts longest
+        if (published - r->next >= r->header->slot_count) {
+            r->skipped += published - 1 - r->next;
+            r->next = published - 1;
+        }
+
+        const struct ShmFrameSlot* slot = slot_of(r, r->next);
+        const uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+        frame->stream = (enum RecordingStream)slot->stream;
+        frame->width = (int)slot->width;
+        frame->height = (int)slot->height;
+        frame->stride = (int)slot->stride;
+        frame->format = slot->format;
+        frame->timestamp_domain = slot->timestamp_domain;
+        frame->number = slot->frame_number;
+        frame->timestamp = slot->timestamp;
+        frame->depth_units = slot->depth_units;
+        frame->size = slot->payload_size;
+        frame->data = (const uint8_t*)slot + sizeof(struct ShmFrameSlot);
+        frame->slot = slot;
+        frame->sequence = sequence;
+        const uint32_t index = slot->index;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((sequence & 1) != 0 || __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence ||
+            index != r->next || frame->size > r->header->slot_size - sizeof(struct ShmFrameSlot)) {
+            // Lapped while reading the slot header, the next one is newer
+            r->skipped++;
+            r->next++;
+            continue;
+        }
+
+        r->next++;
+        r->frames++;
+        return 0;
+    }
+}
+
+int8_t shm_reader_valid(struct ShmReader* r, const struct ShmFrame* frame)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&frame->slot->sequence, __ATOMIC_RELAXED) == frame->sequence)
+        return 1;
+
+    r->torn++;
+    return 0;
+}
+
+int8_t shm_reader_copy(struct ShmReader* r, const struct ShmFrame* frame, void* dst, size_t dst_size)
+{
+    if (frame->size > dst_size) {
+        fprintf(stderr, "Shared memory frame of %lu bytes does not fit %lu\n", (unsigned long)frame->size,
+                (unsigned long)dst_size);
+        return 1;
+    }
+
+    memcpy(dst, frame->data, frame->size);
+    return shm_reader_valid(r, frame) ? 0 : 1;
+}
+
+void shm_reader_print_stats(const struct ShmReader* r)
+{
+    fprintf(stderr, "shm reader: %llu frames, %llu skipped, %llu torn\n", (unsigned long long)r->frames,
+            (unsigned long long)r->skipped, (unsigned long long)r->torn);
+}
@@ -0,0 +1,73 @@
+#ifndef SHM_READER_H
+#define SHM_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shm_frames.h"
+
+// Reads the frames a publisher (see publisher.h) puts in shared memory,
+// in place. Needs neither SDL nor librealsense, so other processes can
+// link just this and shm_frames.h. A reader only ever maps the segment
+// read-only; one that falls a whole ring behind skips to the newest frame.
+
+// A frame in the mapped segment. data stays put until the publisher comes
+// round to its slot again, shm_reader_valid tells whether that happened.
+struct ShmFrame
+{
+    enum RecordingStream stream;
+    int width;
+    int height;
+    int stride;
+    // rs2_format and rs2_timestamp_domain values
+    int format;
+    int timestamp_domain;
+    unsigned long long number;
+    double timestamp;
+    float depth_units;
+    const void* data;
+    size_t size;
+
+    const struct ShmFrameSlot* slot;
+    uint32_t sequence;
+};
+
+struct ShmReader
+{
+    int fd;
+    const uint8_t* base;
+    size_t size;
+    const struct ShmFramesHeader* header;
+
+    // Publish count of the next frame to read
+    uint32_t next;
+
+    uint64_t frames;
+    // Overwritten before this reader got to them
+    uint64_t skipped;
+    // Overwritten while this reader was still using them
+    uint64_t torn;
+};
+
+// Maps the segment a running publisher created under name and starts at
+// the next frame it publishes
+int8_t shm_reader_open(struct ShmReader* r, const char* name);
+void shm_reader_close(struct ShmReader* r);
+
+// Waits up to timeout_ms for the next frame. Returns 0 with frame set,
+// 1 on timeout or once the publisher stopped, see shm_reader_closed.
+int8_t shm_reader_next(struct ShmReader* r, struct ShmFrame* frame, int timeout_ms);
+
+// 1 once the publisher stopped, a restarted one has to be opened again
+int8_t shm_reader_closed(const struct ShmReader* r);
+
+// 1 when frame's slot was not rewritten since shm_reader_next returned it.
+// Whatever was computed from data in place only counts when this holds after.
+int8_t shm_reader_valid(struct ShmReader* r, const struct ShmFrame* frame);
+
+// Copies the payload out, 0 when the copy is intact
+int8_t shm_reader_copy(struct ShmReader* r, const struct ShmFrame* frame, void* dst, size_t dst_size);
+
+void shm_reader_print_stats(const struct ShmReader* r);
+
+#endif
@@ -0,0 +1,614 @@
+#include <librealsense2/rs.h>
+#include <librealsense2/h/rs_pipeline.h>
+#include <librealsense2/h/rs_frame.h>
+
+#define SDL_MAIN_HANDLED
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "align.h"
+#include "colorize.h"
+#include "frame_handle.h"
+#include "frame_pool.h"
+#include "frames.h"
+#include "latency.h"
+#include "pointcloud.h"
+#include "recording_reader.h"
+#include "rgb_expand.h"
+#include "rs_error.h"
+#include "rs_state.h"
+#include "stream_options.h"
+#include "synthetic.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Runs the per-frame processing path headless, one stage at a time, against
+// synthetic frames or a recording, and writes per-stage latency as JSON.
+// With --replay the frames come out of a mapped recording and the wait
+// stage is the read, decompression included.
+
+#define STAGE_BENCH_DEFAULT_FRAMES 600
+#define STAGE_BENCH_DEFAULT_WARMUP 30
+
+enum BenchStage
+{
+    BENCH_STAGE_WAIT,
+    BENCH_STAGE_EXTRACT,
+    BENCH_STAGE_MEMCPY,
+    BENCH_STAGE_COLORIZE,
+    BENCH_STAGE_RGB_EXPAND,
+    BENCH_STAGE_ALIGN,
+    BENCH_STAGE_POINTCLOUD,
+    BENCH_STAGE_UPDATE_TEXTURE,
+    BENCH_STAGE_TOTAL,
+    BENCH_STAGE_COUNT
+};
+
+static const char* stage_names[BENCH_STAGE_COUNT] = {
+    "wait",
+    "extract",
+    "memcpy",
+    "colorize",
+    "rgb_expand",
+    "align",
+    "pointcloud",
+    "update_texture",
+    "total"
+};
+
+static double ms_between(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static void write_json(FILE* out, const char* source, const struct StreamInfo* depth,
+                       const struct StreamInfo* color, int frames, double elapsed_ms,
+                       const struct Colorizer* colorizer, const struct RgbExpander* expander,
+                       const struct Aligner* aligner, const char* renderer, double sensor_started_ms,
+                       double first_frame_ms, int heap_allocs, struct LatencySamples* samples)
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"source\": \"%s\",\n", source);
+    fprintf(out, "  \"depth\": {\"width\": %d, \"height\": %d, \"format\": \"%s\", \"fps\": %d},\n",
+            depth->intrinsics.width, depth->intrinsics.height, rs2_format_to_string(depth->format), depth->fps);
+    fprintf(out, "  \"color\": {\"width\": %d, \"height\": %d, \"format\": \"%s\", \"fps\": %d},\n",
+            color->intrinsics.width, color->intrinsics.height, rs2_format_to_string(color->format), color->fps);
+    fprintf(out, "  \"kernels\": {\"colorize\": \"%s\", \"rgb_expand\": \"%s\", \"align\": \"%s\"},\n",
+            colorizer->kernel_name, expander->kernel_name, aligner->mode != ALIGN_NONE ? aligner->kernel_name : "none");
+    fprintf(out, "  \"align\": {\"mode\": \"%s\", \"threads\": %d},\n", align_mode_name(aligner->mode),
+            aligner->threads != NULL ? aligner->threads->threads : 1);
+    fprintf(out, "  \"renderer\": \"%s\",\n", renderer);
+    fprintf(out, "  \"startup\": {\"sensor_started_ms\": %.3f, \"first_frame_ms\": %.3f},\n",
+            sensor_started_ms, first_frame_ms);
+    fprintf(out, "  \"frames\": %d,\n", frames);
+    fprintf(out, "  \"heap_allocs\": %d,\n", heap_allocs);
+    fprintf(out, "  \"elapsed_ms\": %.3f,\n", elapsed_ms);
+    fprintf(out, "  \"fps\": %.2f,\n", elapsed_ms > 0.0 ? frames * 1000.0 / elapsed_ms : 0.0);
+    fprintf(out, "  \"stages\": {\n");
+
+    int stage;
+    for (stage = 0; stage < BENCH_STAGE_COUNT; stage++)
+    {
+        struct LatencySummary sum;
+        latency_summarize(&samples[stage], &sum);
+
+        // The rate the stage alone could sustain
+        double per_s = sum.mean_ms > 0.0 ? 1000.0 / sum.mean_ms : 0.0;
+
+        fprintf(out, "    \"%s\": {\"count\": %d, \"mean_ms\": %.4f, \"min_ms\": %.4f, \"p50_ms\": %.4f, "
+                "\"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, \"per_s\": %.1f}%s\n",
+                stage_names[stage], sum.count, sum.mean_ms, sum.min_ms, sum.p50_ms,
+                sum.p95_ms, sum.p99_ms, sum.max_ms, per_s,
+                stage + 1 < BENCH_STAGE_COUNT ? "," : "");
+    }
+
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char** argv)
+{
+    struct StreamConfig stream_config;
+    stream_config_defaults(&stream_config);
+    stream_config.playback_realtime = 0;
+
+    int synthetic_fps = 0;
+    int frames = STAGE_BENCH_DEFAULT_FRAMES;
+    int warmup = STAGE_BENCH_DEFAULT_WARMUP;
+    const char* json_path = NULL;
+    const char* trace_path = NULL;
+    int8_t use_window = 0;
+    enum AlignMode align_mode = ALIGN_NONE;
+    int align_threads = 0;
+    // Colorize and RGB expansion run inline unless asked for more
+    int convert_threads = 1;
+    enum ColorizeMode colormap = COLORIZE_LINEAR;
+    int8_t use_pointcloud = 0;
+    struct PointCloudConfig pointcloud_config;
+    pointcloud_default_config(&pointcloud_config);
+    const char* replay_file = NULL;
+    double replay_from = -1.0;
+
+    int arg;
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--playback") == 0 && arg + 1 < argc) {
+            stream_config.playback_file = argv[++arg];
+        } else if (strcmp(argv[arg], "--replay") == 0 && arg + 1 < argc) {
+            replay_file = argv[++arg];
+        } else if (strcmp(argv[arg], "--from") == 0 && arg + 1 < argc) {
+            replay_from = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "--realtime") == 0) {
+            stream_config.playback_realtime = 1;
+        } else if (strcmp(argv[arg], "--synthetic") == 0) {
+            if (arg + 1 < argc && argv[arg + 1][0] >= '0' && argv[arg + 1][0] <= '9')
+                synthetic_fps = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--frames") == 0 && arg + 1 < argc) {
+            frames = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--warmup") == 0 && arg + 1 < argc) {
+            warmup = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--json") == 0 && arg + 1 < argc) {
+            json_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            trace_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--window") == 0) {
+            use_window = 1;
+        } else if (strcmp(argv[arg], "--align") == 0 && arg + 1 < argc) {
+            if (align_parse_mode(argv[++arg], &align_mode) != 0)
+                return 1;
+        } else if (strcmp(argv[arg], "--align-threads") == 0 && arg + 1 < argc) {
+            align_threads = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--colormap") == 0 && arg + 1 < argc) {
+            if (colorize_parse_mode(argv[++arg], &colormap) != 0)
+                return 1;
+        } else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+            convert_threads = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--pointcloud") == 0 && arg + 1 < argc) {
+            use_pointcloud = 1;
+            pointcloud_config.compact = strcmp(argv[++arg], "compact") == 0;
+        } else if (strcmp(argv[arg], "--uv") == 0) {
+            pointcloud_config.uv = 1;
+        } else if (strcmp(argv[arg], "--config") == 0 && arg + 1 < argc) {
+            if (stream_options_load(&stream_config, argv[++arg]) != 0)
+                return 1;
+        } else if (strncmp(argv[arg], "--", 2) == 0 && arg + 1 < argc &&
+                   stream_option_set(&stream_config, argv[arg] + 2, argv[arg + 1]) == 0) {
+            arg++;
+        } else {
+            fprintf(stderr, "usage: %s [--playback file.bag [--realtime] | --replay file [--from ms] | --synthetic [fps]] "
+                    "[--frames n] [--warmup n] [--json out.json] [--trace out.json] [--window] [--align color|depth [--align-threads n]] [--threads n] [--colormap linear|percentile|equalize] [--pointcloud dense|compact [--uv]] %s\n",
+                    argv[0], STREAM_OPTIONS_USAGE);
+            return 1;
+        }
+    }
+
+    if (frames <= 0 || warmup < 0) {
+        fprintf(stderr, "Frame counts must be positive\n");
+        return 1;
+    }
+
+    SDL_SetMainReady();
+
+    // Startup runs from here to the first frame through every stage
+    const Uint64 startup_begin = SDL_GetPerformanceCounter();
+
+    trace_init();
+    trace_thread_name("main");
+
+    struct RS_State rs_state;
+    memset(&rs_state, 0, sizeof(rs_state));
+
+    struct SyntheticSource synthetic;
+    memset(&synthetic, 0, sizeof(synthetic));
+
+    struct RecordingReader reader;
+    memset(&reader, 0, sizeof(reader));
+
+    const char* source = stream_config.playback_file != NULL ? stream_config.playback_file : "synthetic";
+    if (replay_file != NULL)
+    {
+        if (recording_reader_open(&reader, replay_file) != 0)
+            return 1;
+        if (replay_from >= 0.0 && recording_reader_seek_time(&reader, replay_from) != 0)
+            return 1;
+
+        // Nothing to resolve, the recording says what was streamed
+        recording_reader_stream_state(&reader, &rs_state);
+        source = replay_file;
+    }
+    else if (stream_config.playback_file == NULL)
+    {
+        if (create_context(&rs_state) != 0)
+            return 1;
+
+        stream_config.color.fps = stream_config.depth.fps;
+
+        struct SyntheticConfig synthetic_config;
+        synthetic_config.depth_w = stream_config.depth.width;
+        synthetic_config.depth_h = stream_config.depth.height;
+        synthetic_config.color_w = stream_config.color.width;
+        synthetic_config.color_h = stream_config.color.height;
+        synthetic_config.color_format = stream_config.color.format;
+        synthetic_config.profile_fps = stream_config.depth.fps;
+        synthetic_config.fps = synthetic_fps;
+
+        if (synthetic_create(&synthetic, &synthetic_config, rs_state.ctx) != 0)
+            return 1;
+
+        stream_config.serial = SYNTHETIC_SERIAL;
+    }
+
+    if (replay_file == NULL && resolve_streams(&rs_state, &stream_config) != 0)
+        return 1;
+
+    const int depth_w = rs_state.depth.intrinsics.width;
+    const int depth_h = rs_state.depth.intrinsics.height;
+    const int color_w = rs_state.color.intrinsics.width;
+    const int color_h = rs_state.color.intrinsics.height;
+
+    // Headless runs upload into a software renderer, --window into the
+    // accelerated one main uses, from a window that is never shown
+    if (SDL_Init(use_window ? SDL_INIT_VIDEO : 0) != 0) {
+        fprintf(stderr, "Failed initting SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    SDL_Window* sdlwin = NULL;
+    SDL_Surface* target = NULL;
+    SDL_Renderer* sdlren = NULL;
+    if (use_window)
+    {
+        sdlwin = SDL_CreateWindow("rs2 stage bench", 0, 0, depth_w, depth_h, SDL_WINDOW_HIDDEN);
+        if (sdlwin != NULL)
+            sdlren = SDL_CreateRenderer(sdlwin, -1, SDL_RENDERER_ACCELERATED);
+    }
+    else
+    {
+        target = SDL_CreateRGBSurfaceWithFormat(0, depth_w, depth_h, 32, SDL_PIXELFORMAT_RGBA32);
+        if (target != NULL)
+            sdlren = SDL_CreateSoftwareRenderer(target);
+    }
+
+    if (sdlren == NULL) {
+        fprintf(stderr, "Failed creating SDL renderer: %s\n", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
+
+    SDL_RendererInfo renderer_info;
+    if (SDL_GetRendererInfo(sdlren, &renderer_info) != 0)
+        renderer_info.name = "unknown";
+
+    // BGRA8 color is uploaded as delivered, everything else is RGBA by then
+    Uint32 col_tex_format = rs_state.color.format == RS2_FORMAT_BGRA8 ? SDL_PIXELFORMAT_BGRA32 : SDL_PIXELFORMAT_RGBA32;
+    SDL_Texture* dep_tex = SDL_CreateTexture(sdlren, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, depth_w, depth_h);
+    SDL_Texture* col_tex = SDL_CreateTexture(sdlren, col_tex_format, SDL_TEXTUREACCESS_STATIC, color_w, color_h);
+    if (dep_tex == NULL || col_tex == NULL) {
+        fprintf(stderr, "Failed creating sdl textures: %s\n", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
+
+    struct Colorizer colorizer;
+    struct RgbExpander expander;
+    if (colorize_init(&colorizer, COLORIZE_DEFAULT_MAX_DEPTH) != 0 || colorize_set_mode(&colorizer, colormap) != 0)
+        return 1;
+    if (rgb_expand_init(&expander) != 0)
+        return 1;
+
+    struct ThreadPool row_threads;
+    if (thread_pool_init(&row_threads, convert_threads, 1) != 0)
+        return 1;
+
+    // Alignment shares the row threads unless given a pool of its own
+    struct ThreadPool align_pool;
+    memset(&align_pool, 0, sizeof(align_pool));
+    if (align_threads > 0 && thread_pool_init(&align_pool, align_threads, 1) != 0)
+        return 1;
+
+    struct Aligner aligner;
+    if (align_init(&aligner, align_mode, &rs_state, align_threads > 0 ? &align_pool : &row_threads) != 0)
+        return 1;
+
+    struct PointCloud pointcloud;
+    memset(&pointcloud, 0, sizeof(pointcloud));
+    if (use_pointcloud && pointcloud_init(&pointcloud, &pointcloud_config, &rs_state, &row_threads) != 0)
+        return 1;
+
+    // The buffers come out of a frame pool as in main, so the run shows whether any stage allocates
+    struct FramePool frame_pool;
+    frame_pool_init(&frame_pool, 1);
+
+    int aligned_w = 0;
+    int aligned_h = 0;
+    uint16_t* aligned_depth = NULL;
+    struct RGBA* aligned = NULL;
+    if (align_mode != ALIGN_NONE)
+    {
+        align_output_size(&aligner, depth_w, depth_h, &aligned_w, &aligned_h);
+        const size_t aligned_depth_bytes = (size_t)color_w * color_h * sizeof(uint16_t);
+        const size_t aligned_bytes = (size_t)aligned_w * aligned_h * sizeof(struct RGBA);
+        if (frame_pool_reserve(&frame_pool, aligned_depth_bytes, 1) != 0 ||
+            frame_pool_reserve(&frame_pool, aligned_bytes, 1) != 0)
+            return 1;
+
+        aligned_depth = (uint16_t*)frame_pool_acquire(&frame_pool, aligned_depth_bytes);
+        aligned = (struct RGBA*)frame_pool_acquire(&frame_pool, aligned_bytes);
+        if (aligned_depth == NULL || aligned == NULL) {
+            fprintf(stderr, "Failed allocating aligned buffers\n");
+            return 1;
+        }
+    }
+
+    const int dep_bytes_rgb = depth_w * depth_h * sizeof(struct RGBA);
+    const int col_bytes = color_w * color_h * sizeof(struct RGBA);
+    const int dep_bytes = depth_w * depth_h * sizeof(uint16_t);
+    if (frame_pool_reserve(&frame_pool, dep_bytes_rgb, 1) != 0 ||
+        frame_pool_reserve(&frame_pool, col_bytes, 2) != 0 ||
+        frame_pool_reserve(&frame_pool, dep_bytes, 1) != 0)
+        return 1;
+
+    struct RGBA* dep_rgb = (struct RGBA*)frame_pool_acquire(&frame_pool, dep_bytes_rgb);
+    struct RGBA* col = (struct RGBA*)frame_pool_acquire(&frame_pool, col_bytes);
+
+    // Where the memcpy stage copies frames to, as the path did before frames were held by reference
+    uint8_t* dep_copy = (uint8_t*)frame_pool_acquire(&frame_pool, dep_bytes);
+    uint8_t* col_copy = (uint8_t*)frame_pool_acquire(&frame_pool, col_bytes);
+
+    struct LatencySamples samples[BENCH_STAGE_COUNT];
+    int stage;
+    for (stage = 0; stage < BENCH_STAGE_COUNT; stage++) {
+        if (latency_init(&samples[stage], frames) != 0)
+            return 1;
+    }
+
+    if (dep_rgb == NULL || col == NULL || dep_copy == NULL || col_copy == NULL) {
+        fprintf(stderr, "Failed allocating frame buffers\n");
+        return 1;
+    }
+
+    memset(dep_rgb, 0, dep_bytes_rgb);
+    memset(col, 0, col_bytes);
+
+    if (replay_file == NULL && start_sensor(&rs_state, 0, 0, &stream_config, NULL) != 0)
+        return 1;
+
+    if (replay_file == NULL && stream_config.playback_file == NULL && synthetic_start(&synthetic) != 0)
+        return 1;
+
+    const double sensor_started_ms = ms_between(startup_begin, SDL_GetPerformanceCounter());
+    double first_frame_ms = 0.0;
+
+    struct FrameHandle dep;
+    struct FrameHandle col_frame;
+    memset(&dep, 0, sizeof(dep));
+    memset(&col_frame, 0, sizeof(col_frame));
+
+    int measured = 0;
+    int seen = 0;
+    Uint64 run_start = 0;
+    Uint64 run_end = 0;
+    uint64_t replay_start_bytes = 0;
+    int start_heap_allocs = 0;
+    int8_t failed = 0;
+
+    while (measured < frames)
+    {
+        rs2_error* e = NULL;
+        int8_t new_dep = 0;
+        int8_t new_col = 0;
+        const uint64_t bytes_before = reader.bytes_read;
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        Uint64 t1;
+        Uint64 t2;
+
+        if (replay_file != NULL)
+        {
+            // Frames point into the mapping, there is no frameset to extract them from
+            if (recording_reader_next(&reader, &dep, &col_frame, &new_dep, &new_col) != 0) {
+                if (recording_reader_finished(&reader))
+                    fprintf(stderr, "replay finished after %d measured frames\n", measured);
+                else
+                    failed = 1;
+                break;
+            }
+
+            t1 = SDL_GetPerformanceCounter();
+            t2 = t1;
+        }
+        else
+        {
+            rs2_frame* frameset = rs2_pipeline_wait_for_frames(rs_state.pipe, 5000, &e);
+            if (check_error(e) != 0) {
+                if (playback_finished(&rs_state)) {
+                    fprintf(stderr, "playback finished after %d measured frames\n", measured);
+                } else {
+                    fprintf(stderr, "Failed waiting for frames\n");
+                    failed = 1;
+                }
+                break;
+            }
+
+            t1 = SDL_GetPerformanceCounter();
+
+            if (extract_frames(frameset, &dep, &col_frame, &new_dep, &new_col) != 0) {
+                rs2_release_frame(frameset);
+                failed = 1;
+                break;
+            }
+            rs2_release_frame(frameset);
+
+            t2 = SDL_GetPerformanceCounter();
+        }
+
+        if (new_dep)
+            memcpy(dep_copy, dep.data, dep.stride * dep.height);
+        if (new_col)
+            memcpy(col_copy, col_frame.data, col_frame.stride * col_frame.height);
+
+        Uint64 t3 = SDL_GetPerformanceCounter();
+
+        convert_frames(&colorizer, &expander, &row_threads, new_dep ? &dep : NULL, dep_rgb, NULL, col);
+
+        Uint64 t4 = SDL_GetPerformanceCounter();
+
+        convert_frames(&colorizer, &expander, &row_threads, NULL, dep_rgb, new_col ? &col_frame : NULL, col);
+
+        Uint64 t5 = SDL_GetPerformanceCounter();
+
+        if (new_dep && align_frames(&aligner, &colorizer, &dep, &col_frame, aligned_depth, aligned) != 0) {
+            failed = 1;
+            break;
+        }
+
+        Uint64 t5a = SDL_GetPerformanceCounter();
+
+        if (new_dep && use_pointcloud && pointcloud_compute(&pointcloud, &dep) != 0) {
+            failed = 1;
+            break;
+        }
+
+        Uint64 t5b = SDL_GetPerformanceCounter();
+
+        if (new_dep && SDL_UpdateTexture(dep_tex, NULL, dep_rgb, depth_w * 4) != 0) {
+            fprintf(stderr, "Failed updating texture: %s\n", SDL_GetError());
+            failed = 1;
+            break;
+        }
+
+        // Direct RGBA formats are uploaded from the frame itself, as in main
+        const void* col_pixels = col;
+        int col_pitch = color_w * 4;
+        if (col_frame.format != RS2_FORMAT_RGB8) {
+            col_pixels = col_frame.data;
+            col_pitch = col_frame.stride;
+        }
+
+        if (new_col && SDL_UpdateTexture(col_tex, NULL, col_pixels, col_pitch) != 0) {
+            fprintf(stderr, "Failed updating texture: %s\n", SDL_GetError());
+            failed = 1;
+            break;
+        }
+
+        Uint64 t6 = SDL_GetPerformanceCounter();
+
+        if (seen == 0) {
+            first_frame_ms = ms_between(startup_begin, t6);
+            fprintf(stderr, "startup: sensor started after %.1f ms, first frame after %.1f ms\n",
+                    sensor_started_ms, first_frame_ms);
+        }
+
+        seen++;
+        if (seen <= warmup)
+            continue;
+
+        if (measured == 0) {
+            run_start = t0;
+            replay_start_bytes = bytes_before;
+            start_heap_allocs = frame_pool_heap_allocs(&frame_pool);
+        }
+        run_end = t6;
+        measured++;
+
+        latency_add(&samples[BENCH_STAGE_WAIT], ms_between(t0, t1));
+        latency_add(&samples[BENCH_STAGE_EXTRACT], ms_between(t1, t2));
+        if (new_dep || new_col)
+            latency_add(&samples[BENCH_STAGE_MEMCPY], ms_between(t2, t3));
+        if (new_dep)
+            latency_add(&samples[BENCH_STAGE_COLORIZE], ms_between(t3, t4));
+        if (new_col && col_frame.format == RS2_FORMAT_RGB8)
+            latency_add(&samples[BENCH_STAGE_RGB_EXPAND], ms_between(t4, t5));
+        if (new_dep && align_mode != ALIGN_NONE)
+            latency_add(&samples[BENCH_STAGE_ALIGN], ms_between(t5, t5a));
+        if (new_dep && use_pointcloud)
+            latency_add(&samples[BENCH_STAGE_POINTCLOUD], ms_between(t5a, t5b));
+        if (new_dep || new_col)
+            latency_add(&samples[BENCH_STAGE_UPDATE_TEXTURE], ms_between(t5b, t6));
+        latency_add(&samples[BENCH_STAGE_TOTAL], ms_between(t0, t6));
+    }
+
+    synthetic_stop(&synthetic);
+    if (replay_file == NULL)
+        stop_stream(&rs_state);
+
+    if (replay_file != NULL && measured > 0)
+    {
+        const double elapsed = ms_between(run_start, run_end);
+        const uint64_t bytes = reader.bytes_read - replay_start_bytes;
+        fprintf(stderr, "replayed %.1f MB, %.1f MB/s\n", bytes / 1e6, elapsed > 0.0 ? bytes / 1e3 / elapsed : 0.0);
+    }
+
+    frame_pool_print_stats(&frame_pool);
+    thread_pool_print_stats(&row_threads);
+    colorize_print_stats(&colorizer);
+    trace_print_stats();
+    if (trace_path != NULL)
+        trace_dump(trace_path);
+
+    frame_handle_release(&dep);
+    frame_handle_release(&col_frame);
+
+    // clear_state forgets what was streamed
+    struct StreamInfo depth_info = rs_state.depth;
+    struct StreamInfo color_info = rs_state.color;
+    clear_state(&rs_state);
+    synthetic_destroy(&synthetic);
+    recording_reader_close(&reader);
+
+    if (failed == 0)
+    {
+        FILE* out = stdout;
+        if (json_path != NULL) {
+            out = fopen(json_path, "w");
+            if (out == NULL) {
+                fprintf(stderr, "Failed opening %s\n", json_path);
+                failed = 1;
+            }
+        }
+
+        if (out != NULL) {
+            write_json(out, source, &depth_info, &color_info, measured, measured > 0 ? ms_between(run_start, run_end) : 0.0,
+                       &colorizer, &expander, &aligner, renderer_info.name, sensor_started_ms, first_frame_ms,
+                       measured > 0 ? frame_pool_heap_allocs(&frame_pool) - start_heap_allocs : 0, samples);
+            if (out != stdout) {
+                fclose(out);
+                fprintf(stderr, "wrote %s\n", json_path);
+            }
+        }
+    }
+
+    for (stage = 0; stage < BENCH_STAGE_COUNT; stage++)
+        latency_free(&samples[stage]);
+
+    frame_pool_release(&frame_pool, dep_rgb);
+    frame_pool_release(&frame_pool, col);
+    frame_pool_release(&frame_pool, dep_copy);
+    frame_pool_release(&frame_pool, col_copy);
+    frame_pool_release(&frame_pool, aligned_depth);
+    frame_pool_release(&frame_pool, aligned);
+    frame_pool_free(&frame_pool);
+    align_free(&aligner);
+    thread_pool_free(&align_pool);
+    thread_pool_free(&row_threads);
+    pointcloud_free(&pointcloud);
+    colorize_free(&colorizer);
+
+    SDL_DestroyTexture(dep_tex);
+    SDL_DestroyTexture(col_tex);
+    SDL_DestroyRenderer(sdlren);
+    if (sdlwin)
+        SDL_DestroyWindow(sdlwin);
+    if (target)
+        SDL_FreeSurface(target);
+    SDL_Quit();
+
+    return failed;
+}
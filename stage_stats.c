@@ -0,0 +1,40 @@
+#include "stage_stats.h"
+
+#include <stdio.h>
+
+static uint64_t ticks_to_us(Uint64 ticks)
+{
+    return ticks * 1000000 / SDL_GetPerformanceFrequency();
+}
+
+void stage_stats_record(struct StageStats* st, Uint64 start, Uint64 end)
+{
+    uint64_t us = ticks_to_us(end - start);
+
+    SDL_AtomicLock(&st->lock);
+    st->count++;
+    st->total_us += us;
+    if (us > st->max_us)
+        st->max_us = us;
+    SDL_AtomicUnlock(&st->lock);
+}
+
+void stage_stats_get(struct StageStats* st, uint64_t* count, uint64_t* total_us, uint64_t* max_us)
+{
+    SDL_AtomicLock(&st->lock);
+    *count = st->count;
+    *total_us = st->total_us;
+    *max_us = st->max_us;
+    SDL_AtomicUnlock(&st->lock);
+}
+
+void stage_stats_print(struct StageStats* st, const char* name)
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    stage_stats_get(st, &count, &total, &max);
+
+    fprintf(stderr, "  %-12s n %8llu avg %8.1f us max %8llu us\n", name,
+            (unsigned long long)count, count ? (double)total / count : 0.0, (unsigned long long)max);
+}
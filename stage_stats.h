@@ -0,0 +1,27 @@
+#ifndef STAGE_STATS_H
+#define STAGE_STATS_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+// Running count, mean and max of a stage's duration, safe to record from any thread
+struct StageStats
+{
+    SDL_SpinLock lock;
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+};
+
+// start and end are SDL performance counter values
+void stage_stats_record(struct StageStats* st, Uint64 start, Uint64 end);
+// Consistent copy of the totals, for readers on other threads
+void stage_stats_get(struct StageStats* st, uint64_t* count, uint64_t* total_us, uint64_t* max_us);
+void stage_stats_print(struct StageStats* st, const char* name);
+
+#endif
@@ -0,0 +1,122 @@
+#include "stream_options.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_OPTIONS_LINE_MAX 256
+
+static int8_t parse_resolution(const char* value, struct StreamRequest* request)
+{
+    int w = 0;
+    int h = 0;
+    int fps = 0;
+
+    int fields = sscanf(value, "%dx%d@%d", &w, &h, &fps);
+    if (fields < 2 || w <= 0 || h <= 0 || (fields == 3 && fps <= 0))
+        return 1;
+
+    request->width = w;
+    request->height = h;
+    if (fields == 3)
+        request->fps = fps;
+    return 0;
+}
+
+static int8_t parse_color_format(const char* value, rs2_format* format)
+{
+    if (strcmp(value, "rgb8") == 0)
+        *format = RS2_FORMAT_RGB8;
+    else if (strcmp(value, "rgba8") == 0)
+        *format = RS2_FORMAT_RGBA8;
+    else if (strcmp(value, "bgra8") == 0)
+        *format = RS2_FORMAT_BGRA8;
+    else
+        return 1;
+
+    return 0;
+}
+
+int8_t stream_option_set(struct StreamConfig* config, const char* key, const char* value)
+{
+    int8_t bad = 0;
+
+    if (strcmp(key, "depth") == 0) {
+        bad = parse_resolution(value, &config->depth);
+    } else if (strcmp(key, "color") == 0) {
+        bad = parse_resolution(value, &config->color);
+    } else if (strcmp(key, "fps") == 0) {
+        int fps = atoi(value);
+        bad = fps <= 0;
+        if (!bad)
+            config->depth.fps = config->color.fps = fps;
+    } else if (strcmp(key, "color-format") == 0) {
+        bad = parse_color_format(value, &config->color.format);
+    } else {
+        fprintf(stderr, "Unknown stream option: %s\n", key);
+        return 1;
+    }
+
+    if (bad) {
+        fprintf(stderr, "Invalid value for %s: %s\n", key, value);
+        return 1;
+    }
+
+    return 0;
+}
+
+static char* trim(char* str)
+{
+    while (isspace((unsigned char)*str))
+        str++;
+
+    char* end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+
+    return str;
+}
+
+int8_t stream_options_load(struct StreamConfig* config, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Failed opening config file %s\n", path);
+        return 1;
+    }
+
+    char line[STREAM_OPTIONS_LINE_MAX];
+    int line_number = 0;
+    int8_t failed = 0;
+
+    while (failed == 0 && fgets(line, sizeof(line), f) != NULL)
+    {
+        line_number++;
+
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char* key = trim(line);
+        if (*key == '\0')
+            continue;
+
+        char* eq = strchr(key, '=');
+        if (eq == NULL) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, line_number);
+            failed = 1;
+            continue;
+        }
+
+        *eq = '\0';
+        if (stream_option_set(config, trim(key), trim(eq + 1)) != 0) {
+            fprintf(stderr, "%s:%d: bad option\n", path, line_number);
+            failed = 1;
+        }
+    }
+
+    fclose(f);
+    return failed;
+}
@@ -0,0 +1,22 @@
+#ifndef STREAM_OPTIONS_H
+#define STREAM_OPTIONS_H
+
+#include "rs_state.h"
+
+#include <stdint.h>
+
+// Stream profile options, shared by the command line (as --key value) and
+// config files (as key = value):
+//   depth WxH[@fps]     depth resolution, optionally with its frame rate
+//   color WxH[@fps]     color resolution, optionally with its frame rate
+//   fps N               frame rate of both streams
+//   color-format F      rgb8, rgba8 or bgra8
+#define STREAM_OPTIONS_USAGE \
+    "[--config file] [--depth WxH[@fps]] [--color WxH[@fps]] [--fps n] [--color-format rgb8|rgba8|bgra8]"
+
+int8_t stream_option_set(struct StreamConfig* config, const char* key, const char* value);
+
+// Applies every option in a file, # starts a comment
+int8_t stream_options_load(struct StreamConfig* config, const char* path);
+
+#endif
@@ -0,0 +1,77 @@
+#include "stream_texture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int8_t stream_texture_create(struct StreamTexture* st, SDL_Renderer* renderer, Uint32 format, int width, int height)
+{
+    if (st == NULL || renderer == NULL) {
+        fprintf(stderr, "Cannot create stream texture: given pointer is null\n");
+        return 1;
+    }
+
+    memset(st, 0, sizeof(struct StreamTexture));
+    st->renderer = renderer;
+    st->format = format;
+
+    return stream_texture_resize(st, width, height);
+}
+
+void stream_texture_destroy(struct StreamTexture* st)
+{
+    if (st == NULL)
+        return;
+
+    stream_texture_unlock(st);
+    if (st->tex)
+        SDL_DestroyTexture(st->tex);
+    st->tex = NULL;
+}
+
+int8_t stream_texture_resize(struct StreamTexture* st, int width, int height)
+{
+    if (st->tex != NULL && st->width == width && st->height == height)
+        return 0;
+
+    stream_texture_destroy(st);
+
+    st->tex = SDL_CreateTexture(st->renderer, st->format, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (st->tex == NULL) {
+        fprintf(stderr, "Failed creating %dx%d streaming texture: %s\n", width, height, SDL_GetError());
+        return 1;
+    }
+
+    st->width = width;
+    st->height = height;
+    return 0;
+}
+
+int8_t stream_texture_lock(struct StreamTexture* st, void** pixels, int* pitch)
+{
+    if (SDL_LockTexture(st->tex, NULL, pixels, pitch) != 0) {
+        fprintf(stderr, "Failed locking texture: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    st->locked = 1;
+    return 0;
+}
+
+void stream_texture_unlock(struct StreamTexture* st)
+{
+    if (st->locked == 0)
+        return;
+
+    SDL_UnlockTexture(st->tex);
+    st->locked = 0;
+}
+
+int8_t stream_texture_upload(struct StreamTexture* st, const void* pixels, int pitch)
+{
+    if (SDL_UpdateTexture(st->tex, NULL, pixels, pitch) != 0) {
+        fprintf(stderr, "Failed updating texture: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef STREAM_TEXTURE_H
+#define STREAM_TEXTURE_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+// A streaming texture the converters write into while it is locked, so
+// a displayed frame is converted once into the memory SDL uploads from
+// instead of into a buffer that is then copied over.
+struct StreamTexture
+{
+    SDL_Renderer* renderer;
+    SDL_Texture* tex;
+    Uint32 format;
+    int width;
+    int height;
+    int8_t locked;
+};
+
+// format is an SDL_PIXELFORMAT_*, e.g. SDL_PIXELFORMAT_RGBA32 for struct RGBA
+int8_t stream_texture_create(struct StreamTexture* st, SDL_Renderer* renderer, Uint32 format, int width, int height);
+void stream_texture_destroy(struct StreamTexture* st);
+
+// Recreates the texture when the frames changed size, e.g. behind decimation
+int8_t stream_texture_resize(struct StreamTexture* st, int width, int height);
+
+// pixels and pitch stay valid until stream_texture_unlock(), which hands
+// the written frame to the renderer. The pitch may exceed width * 4.
+int8_t stream_texture_lock(struct StreamTexture* st, void** pixels, int* pitch);
+void stream_texture_unlock(struct StreamTexture* st);
+
+// For frames already converted elsewhere, e.g. by the pipeline workers
+int8_t stream_texture_upload(struct StreamTexture* st, const void* pixels, int pitch);
+
+#endif
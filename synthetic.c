@@ -0,0 +1,311 @@
+#include "synthetic.h"
+#include "rs_error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The patterns belong to the source, librealsense must not free them
+static void keep_pixels(void* pixels)
+{
+}
+
+static void fill_patterns(struct SyntheticSource* s)
+{
+    const struct SyntheticConfig* c = &s->config;
+    int p, x, y;
+
+    for (p = 0; p < SYNTHETIC_PATTERNS; p++)
+    {
+        uint16_t* dep = s->depth_patterns + (size_t)p * c->depth_w * c->depth_h;
+        for (y = 0; y < c->depth_h; y++)
+        {
+            for (x = 0; x < c->depth_w; x++)
+            {
+                // Diagonal ramp over 0.5 - 8.5 m that moves every frame,
+                // with a hole in the middle like a surface out of range
+                uint16_t d = (uint16_t)(500 + ((x + y + p * 64) % 1000) * 8);
+                if (abs(x - c->depth_w / 2) < c->depth_w / 16 && abs(y - c->depth_h / 2) < c->depth_h / 16)
+                    d = 0;
+                dep[y * c->depth_w + x] = d;
+            }
+        }
+
+        uint8_t* col = s->color_patterns + (size_t)p * c->color_w * c->color_h * s->color_bpp;
+        for (y = 0; y < c->color_h; y++)
+        {
+            for (x = 0; x < c->color_w; x++)
+            {
+                uint8_t* px = col + s->color_bpp * (y * c->color_w + x);
+                uint8_t r = (uint8_t)(x + p * 32);
+                uint8_t b = (uint8_t)((x ^ y) + p * 32);
+                px[0] = c->color_format == RS2_FORMAT_BGRA8 ? b : r;
+                px[1] = (uint8_t)(y + p * 32);
+                px[2] = c->color_format == RS2_FORMAT_BGRA8 ? r : b;
+                if (s->color_bpp == 4)
+                    px[3] = 255;
+            }
+        }
+    }
+}
+
+static rs2_stream_profile* add_stream(rs2_sensor* sensor, rs2_stream type, int uid, int w, int h,
+                                      int fps, int bpp, rs2_format format)
+{
+    rs2_error* e = NULL;
+    rs2_video_stream vs;
+    memset(&vs, 0, sizeof(vs));
+
+    vs.type = type;
+    vs.index = 0;
+    vs.uid = uid;
+    vs.width = w;
+    vs.height = h;
+    vs.fps = fps;
+    vs.bpp = bpp;
+    vs.fmt = format;
+
+    // A plain pinhole with a roughly 90 degree horizontal field of view
+    vs.intrinsics.width = w;
+    vs.intrinsics.height = h;
+    vs.intrinsics.ppx = w / 2.0f;
+    vs.intrinsics.ppy = h / 2.0f;
+    vs.intrinsics.fx = w / 2.0f;
+    vs.intrinsics.fy = w / 2.0f;
+    vs.intrinsics.model = RS2_DISTORTION_NONE;
+
+    rs2_stream_profile* profile = rs2_software_sensor_add_video_stream(sensor, vs, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed adding synthetic %dx%d stream\n", w, h);
+        return NULL;
+    }
+
+    return profile;
+}
+
+int8_t synthetic_create(struct SyntheticSource* s, const struct SyntheticConfig* config, rs2_context* ctx)
+{
+    rs2_error* e = NULL;
+
+    if (s == NULL || config == NULL || ctx == NULL) {
+        fprintf(stderr, "Cannot create synthetic source: given pointer is null\n");
+        return 1;
+    }
+
+    memset(s, 0, sizeof(struct SyntheticSource));
+    s->config = *config;
+
+    const struct SyntheticConfig* c = &s->config;
+    if (c->color_format == RS2_FORMAT_RGB8) {
+        s->color_bpp = 3;
+    } else if (c->color_format == RS2_FORMAT_RGBA8 || c->color_format == RS2_FORMAT_BGRA8) {
+        s->color_bpp = 4;
+    } else {
+        fprintf(stderr, "Synthetic source cannot generate %s color\n", rs2_format_to_string(c->color_format));
+        return 1;
+    }
+
+    s->depth_patterns = (uint16_t*)malloc((size_t)SYNTHETIC_PATTERNS * c->depth_w * c->depth_h * sizeof(uint16_t));
+    s->color_patterns = (uint8_t*)malloc((size_t)SYNTHETIC_PATTERNS * c->color_w * c->color_h * s->color_bpp);
+    if (s->depth_patterns == NULL || s->color_patterns == NULL) {
+        fprintf(stderr, "Failed allocating synthetic patterns\n");
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    fill_patterns(s);
+
+    s->dev = rs2_create_software_device(&e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed creating software device\n");
+        s->dev = NULL;
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    rs2_software_device_register_info(s->dev, RS2_CAMERA_INFO_NAME, "Synthetic", &e);
+    if (check_error(e) != 0) {
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    rs2_software_device_register_info(s->dev, RS2_CAMERA_INFO_SERIAL_NUMBER, SYNTHETIC_SERIAL, &e);
+    if (check_error(e) != 0) {
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    s->depth_sensor = rs2_software_device_add_sensor(s->dev, "Depth", &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed adding synthetic depth sensor\n");
+        s->depth_sensor = NULL;
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    rs2_software_sensor_add_read_only_option(s->depth_sensor, RS2_OPTION_DEPTH_UNITS, 0.001f, &e);
+    if (check_error(e) != 0) {
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    s->color_sensor = rs2_software_device_add_sensor(s->dev, "Color", &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed adding synthetic color sensor\n");
+        s->color_sensor = NULL;
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    s->depth_profile = add_stream(s->depth_sensor, RS2_STREAM_DEPTH, 0, c->depth_w, c->depth_h,
+                                  c->profile_fps, 2, RS2_FORMAT_Z16);
+    s->color_profile = add_stream(s->color_sensor, RS2_STREAM_COLOR, 1, c->color_w, c->color_h,
+                                  c->profile_fps, s->color_bpp, c->color_format);
+    if (s->depth_profile == NULL || s->color_profile == NULL) {
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    // Parallel cameras a typical 15 mm apart, enough for alignment to have work to do
+    rs2_extrinsics depth_to_color;
+    memset(&depth_to_color, 0, sizeof(depth_to_color));
+    depth_to_color.rotation[0] = 1.0f;
+    depth_to_color.rotation[4] = 1.0f;
+    depth_to_color.rotation[8] = 1.0f;
+    depth_to_color.translation[0] = 0.015f;
+
+    rs2_register_extrinsics(s->depth_profile, s->color_profile, depth_to_color, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed registering synthetic extrinsics\n");
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    rs2_context_add_software_device(ctx, s->dev, &e);
+    if (check_error(e) != 0) {
+        fprintf(stderr, "Failed adding software device to context\n");
+        synthetic_destroy(s);
+        return 1;
+    }
+
+    fprintf(stderr, "synthetic source: depth %dx%d, color %dx%d %s, %d fps\n",
+            c->depth_w, c->depth_h, c->color_w, c->color_h, rs2_format_to_string(c->color_format), c->fps);
+    return 0;
+}
+
+static int8_t send_frame(rs2_sensor* sensor, const rs2_stream_profile* profile, void* pixels,
+                         int stride, int bpp, double timestamp, int number)
+{
+    rs2_error* e = NULL;
+    rs2_software_video_frame frame;
+    memset(&frame, 0, sizeof(frame));
+
+    frame.pixels = pixels;
+    frame.deleter = keep_pixels;
+    frame.stride = stride;
+    frame.bpp = bpp;
+    frame.timestamp = timestamp;
+    frame.domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+    frame.frame_number = number;
+    frame.profile = profile;
+
+    rs2_software_sensor_on_video_frame(sensor, frame, &e);
+    return check_error(e);
+}
+
+static int generator_thread(void* data)
+{
+    struct SyntheticSource* s = (struct SyntheticSource*)data;
+    const struct SyntheticConfig* c = &s->config;
+    const Uint64 freq = SDL_GetPerformanceFrequency();
+    const Uint64 start = SDL_GetPerformanceCounter();
+    const Uint64 period = c->fps > 0 ? freq / c->fps : 0;
+    Uint64 next = start;
+    int number = 0;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    while (SDL_AtomicGet(&s->running))
+    {
+        if (period > 0)
+        {
+            Uint64 now = SDL_GetPerformanceCounter();
+            if (now < next)
+            {
+                // Sleep the coarse part, spin the last millisecond for an even rate
+                Uint64 ms = (next - now) * 1000 / freq;
+                if (ms > 1)
+                    SDL_Delay((Uint32)(ms - 1));
+                while (SDL_GetPerformanceCounter() < next)
+                    ;
+            }
+            next += period;
+        }
+
+        int p = number % SYNTHETIC_PATTERNS;
+        double timestamp = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / freq;
+
+        // Both streams share a timestamp so the pipeline pairs them up
+        if (send_frame(s->depth_sensor, s->depth_profile,
+                       s->depth_patterns + (size_t)p * c->depth_w * c->depth_h,
+                       c->depth_w * 2, 2, timestamp, number) != 0 ||
+            send_frame(s->color_sensor, s->color_profile,
+                       s->color_patterns + (size_t)p * c->color_w * c->color_h * s->color_bpp,
+                       c->color_w * s->color_bpp, s->color_bpp, timestamp, number) != 0) {
+            fprintf(stderr, "Failed sending synthetic frame %d\n", number);
+            break;
+        }
+
+        number++;
+        SDL_AtomicAdd(&s->frames_sent, 1);
+    }
+
+    return 0;
+}
+
+int8_t synthetic_start(struct SyntheticSource* s)
+{
+    if (s == NULL || s->dev == NULL) {
+        fprintf(stderr, "Cannot start synthetic source: not created\n");
+        return 1;
+    }
+
+    SDL_AtomicSet(&s->running, 1);
+    s->thread = SDL_CreateThread(generator_thread, "rs2 synthetic", s);
+    if (s->thread == NULL) {
+        fprintf(stderr, "Failed creating synthetic generator thread: %s\n", SDL_GetError());
+        SDL_AtomicSet(&s->running, 0);
+        return 1;
+    }
+
+    return 0;
+}
+
+void synthetic_stop(struct SyntheticSource* s)
+{
+    if (s == NULL)
+        return;
+
+    SDL_AtomicSet(&s->running, 0);
+    if (s->thread) {
+        SDL_WaitThread(s->thread, NULL);
+        s->thread = NULL;
+    }
+}
+
+void synthetic_destroy(struct SyntheticSource* s)
+{
+    if (s == NULL)
+        return;
+
+    synthetic_stop(s);
+
+    // The sensors and profiles are owned by the device
+    if (s->dev) {
+        rs2_delete_device(s->dev);
+    }
+
+    free(s->depth_patterns);
+    free(s->color_patterns);
+    memset(s, 0, sizeof(struct SyntheticSource));
+}
@@ -0,0 +1,67 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <librealsense2/rs.h>
+#include <librealsense2/h/rs_internal.h>
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+// Serial number the synthetic device registers, for rs2_config_enable_device
+#define SYNTHETIC_SERIAL "synthetic"
+
+// Distinct frames per stream the generator cycles through
+#define SYNTHETIC_PATTERNS 4
+
+struct SyntheticConfig
+{
+    int depth_w;
+    int depth_h;
+    int color_w;
+    int color_h;
+    // RS2_FORMAT_RGB8, RGBA8 or BGRA8
+    rs2_format color_format;
+    // Declared in the stream profiles so a pipeline config can match them
+    int profile_fps;
+    // Rate frames are actually generated at, 0 generates as fast as possible
+    int fps;
+};
+
+// A librealsense software device producing Z16 depth and 8-bit color with
+// deterministic patterns. Added to a context, it is picked up by a pipeline
+// like any camera, so update() and the pipeline stages consume it unchanged.
+// The patterns are generated once and handed out without copying, so the
+// generator costs next to nothing compared to the processing it feeds.
+struct SyntheticSource
+{
+    struct SyntheticConfig config;
+    rs2_device* dev;
+    rs2_sensor* depth_sensor;
+    rs2_sensor* color_sensor;
+    rs2_stream_profile* depth_profile;
+    rs2_stream_profile* color_profile;
+    uint16_t* depth_patterns;
+    uint8_t* color_patterns;
+    int color_bpp;
+    SDL_Thread* thread;
+    SDL_atomic_t running;
+    SDL_atomic_t frames_sent;
+};
+
+// Creates the device and adds it to ctx
+int8_t synthetic_create(struct SyntheticSource* s, const struct SyntheticConfig* config, rs2_context* ctx);
+
+// Starts generating. The pipeline should be started first, sensors that are
+// not streaming drop what they are given.
+int8_t synthetic_start(struct SyntheticSource* s);
+void synthetic_stop(struct SyntheticSource* s);
+
+// Frames referencing the patterns must all be released before this
+void synthetic_destroy(struct SyntheticSource* s);
+
+#endif
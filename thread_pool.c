@@ -0,0 +1,218 @@
+#include "thread_pool.h"
+#include "affinity.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static void run_bands(struct ThreadPool* pool, int thread)
+{
+    for (;;)
+    {
+        const int band = SDL_AtomicAdd(&pool->next_band, 1);
+        if (band >= pool->band_count)
+            break;
+
+        const int y_begin = (int)((int64_t)band * pool->rows / pool->band_count);
+        const int y_end = (int)((int64_t)(band + 1) * pool->rows / pool->band_count);
+        pool->fn(pool->ctx, thread, y_begin, y_end);
+    }
+}
+
+static int pool_worker(void* data)
+{
+    struct ThreadPoolSlot* slot = (struct ThreadPoolSlot*)data;
+    struct ThreadPool* pool = slot->pool;
+
+    // Keeps the worker's cache and memory on the node it was given
+    if (slot->core >= 0)
+        affinity_pin_current_thread(slot->core);
+
+    for (;;)
+    {
+        SDL_SemWait(pool->start);
+        if (SDL_AtomicGet(&pool->quit))
+            break;
+
+        run_bands(pool, slot->index);
+        SDL_SemPost(pool->done);
+    }
+
+    return 0;
+}
+
+int8_t thread_pool_init(struct ThreadPool* pool, int threads, int8_t pin)
+{
+    if (pool == NULL) {
+        fprintf(stderr, "Cannot init thread pool: given pointer is null\n");
+        return 1;
+    }
+
+    memset(pool, 0, sizeof(struct ThreadPool));
+
+    if (threads <= 0)
+        threads = SDL_GetCPUCount();
+    if (threads > THREAD_POOL_THREADS_MAX)
+        threads = THREAD_POOL_THREADS_MAX;
+    pool->threads = threads;
+
+    int cores[THREAD_POOL_THREADS_MAX];
+    int core_count = pin ? affinity_node_cores(cores, THREAD_POOL_THREADS_MAX) : 0;
+    pool->pinned = core_count > 0;
+
+    int t;
+    for (t = 0; t < THREAD_POOL_THREADS_MAX; t++) {
+        pool->slots[t].pool = pool;
+        pool->slots[t].index = t;
+        pool->slots[t].core = pool->pinned ? cores[t % core_count] : -1;
+    }
+
+    // Even a single thread pool takes callers in turn once its inline indices run out
+    pool->lock = SDL_CreateMutex();
+    if (pool->lock == NULL) {
+        fprintf(stderr, "Failed creating thread pool lock: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    if (pool->threads < 2)
+        return 0;
+
+    pool->start = SDL_CreateSemaphore(0);
+    pool->done = SDL_CreateSemaphore(0);
+    if (pool->start == NULL || pool->done == NULL) {
+        fprintf(stderr, "Failed creating thread pool sync: %s\n", SDL_GetError());
+        thread_pool_free(pool);
+        return 1;
+    }
+
+    // Slot 0 is whoever calls thread_pool_run, its affinity is not ours to change
+    for (t = 1; t < pool->threads; t++)
+    {
+        pool->workers[t] = SDL_CreateThread(pool_worker, "rs2 rows", &pool->slots[t]);
+        if (pool->workers[t] == NULL) {
+            fprintf(stderr, "Failed creating thread pool worker: %s\n", SDL_GetError());
+            thread_pool_free(pool);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "converting rows on %d threads%s\n", pool->threads, pool->pinned ? ", pinned" : "");
+    return 0;
+}
+
+void thread_pool_free(struct ThreadPool* pool)
+{
+    if (pool == NULL)
+        return;
+
+    SDL_AtomicSet(&pool->quit, 1);
+
+    int t;
+    for (t = 1; t < THREAD_POOL_THREADS_MAX; t++) {
+        if (pool->workers[t])
+            SDL_SemPost(pool->start);
+    }
+
+    for (t = 1; t < THREAD_POOL_THREADS_MAX; t++)
+    {
+        if (pool->workers[t]) {
+            SDL_WaitThread(pool->workers[t], NULL);
+            pool->workers[t] = NULL;
+        }
+    }
+
+    if (pool->lock) {
+        SDL_DestroyMutex(pool->lock);
+        pool->lock = NULL;
+    }
+    if (pool->start) {
+        SDL_DestroySemaphore(pool->start);
+        pool->start = NULL;
+    }
+    if (pool->done) {
+        SDL_DestroySemaphore(pool->done);
+        pool->done = NULL;
+    }
+}
+
+// Claims a free inline index, -1 when every one is taken
+static int claim_inline(struct ThreadPool* pool)
+{
+    for (;;)
+    {
+        const int busy = SDL_AtomicGet(&pool->inline_busy);
+        int slot = 0;
+        while (slot < THREAD_POOL_INLINE_SLOTS && (busy & (1 << slot)) != 0)
+            slot++;
+        if (slot == THREAD_POOL_INLINE_SLOTS)
+            return -1;
+        if (SDL_AtomicCAS(&pool->inline_busy, busy, busy | (1 << slot)))
+            return slot;
+    }
+}
+
+static void release_inline(struct ThreadPool* pool, int slot)
+{
+    for (;;)
+    {
+        const int busy = SDL_AtomicGet(&pool->inline_busy);
+        if (SDL_AtomicCAS(&pool->inline_busy, busy, busy & ~(1 << slot)))
+            return;
+    }
+}
+
+void thread_pool_run(struct ThreadPool* pool, int rows, int row_pixels, thread_pool_rows_fn fn, void* ctx)
+{
+    if (rows <= 0)
+        return;
+
+    if (pool == NULL) {
+        fn(ctx, 0, 0, rows);
+        return;
+    }
+
+    if (pool->threads < 2 || (int64_t)rows * row_pixels < THREAD_POOL_INLINE_PIXELS ||
+        SDL_TryLockMutex(pool->lock) != 0)
+    {
+        // The pool's owner may be running on index 0, an inline run gets one of its own
+        const int slot = claim_inline(pool);
+        if (slot >= 0) {
+            SDL_AtomicAdd(&pool->runs_inline, 1);
+            fn(ctx, pool->threads + slot, 0, rows);
+            release_inline(pool, slot);
+            return;
+        }
+
+        SDL_LockMutex(pool->lock);
+    }
+
+    pool->rows = rows;
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->band_count = pool->threads * THREAD_POOL_BANDS_PER_THREAD;
+    if (pool->band_count > rows)
+        pool->band_count = rows;
+    SDL_AtomicSet(&pool->next_band, 0);
+
+    int t;
+    for (t = 1; t < pool->threads; t++)
+        SDL_SemPost(pool->start);
+
+    run_bands(pool, 0);
+
+    for (t = 1; t < pool->threads; t++)
+        SDL_SemWait(pool->done);
+
+    SDL_AtomicAdd(&pool->runs_split, 1);
+    SDL_UnlockMutex(pool->lock);
+}
+
+int thread_pool_scratch_count(const struct ThreadPool* pool)
+{
+    return pool != NULL ? pool->threads + THREAD_POOL_INLINE_SLOTS : 1;
+}
+
+void thread_pool_print_stats(struct ThreadPool* pool)
+{
+    fprintf(stderr, "row threads: %d%s, %d runs split into bands, %d inline\n", pool->threads,
+            pool->pinned ? " pinned" : "", SDL_AtomicGet(&pool->runs_split), SDL_AtomicGet(&pool->runs_inline));
+}
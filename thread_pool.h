@@ -0,0 +1,88 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+#define THREAD_POOL_THREADS_MAX 16
+
+// Below this many pixels waking the workers costs more than it saves
+#define THREAD_POOL_INLINE_PIXELS (320 * 240)
+
+// Bands per thread, so a descheduled thread only holds up a small part of the frame
+#define THREAD_POOL_BANDS_PER_THREAD 4
+
+// Callers that find the pool busy run inline on indices of their own, this many at once
+#define THREAD_POOL_INLINE_SLOTS 4
+
+// Scratch indices any pool hands out, see thread_pool_scratch_count
+#define THREAD_POOL_SCRATCH_MAX (THREAD_POOL_THREADS_MAX + THREAD_POOL_INLINE_SLOTS)
+
+// Processes rows [y_begin, y_end) of whatever ctx describes. thread indexes
+// per-thread scratch such as partial sums, below thread_pool_scratch_count:
+// the caller's 0 or a worker's index for split runs, one past the workers
+// for inline ones. No two bands run on one index at once, except with a
+// NULL pool, whose callers all get 0.
+typedef void (*thread_pool_rows_fn)(void* ctx, int thread, int y_begin, int y_end);
+
+struct ThreadPool;
+
+struct ThreadPoolSlot
+{
+    struct ThreadPool* pool;
+    int index;
+    // -1 leaves the thread wherever the OS puts it
+    int core;
+};
+
+// Persistent workers that split a frame's rows into bands and claim them
+// until none are left, the calling thread included. One call runs at a
+// time; a caller that finds the pool busy, e.g. a second pipeline worker,
+// runs its rows inline instead of waiting.
+struct ThreadPool
+{
+    SDL_mutex* lock;
+    SDL_sem* start;
+    SDL_sem* done;
+    SDL_atomic_t quit;
+    int threads;
+    int8_t pinned;
+    SDL_Thread* workers[THREAD_POOL_THREADS_MAX];
+    struct ThreadPoolSlot slots[THREAD_POOL_THREADS_MAX];
+
+    // The call in progress
+    SDL_atomic_t next_band;
+    int band_count;
+    int rows;
+    thread_pool_rows_fn fn;
+    void* ctx;
+
+    // Bit i set while an inline run holds index threads + i
+    SDL_atomic_t inline_busy;
+
+    SDL_atomic_t runs_split;
+    SDL_atomic_t runs_inline;
+};
+
+// threads 0 picks one per core. With pin the workers are pinned to cores,
+// filling the caller's NUMA node before the next one.
+int8_t thread_pool_init(struct ThreadPool* pool, int threads, int8_t pin);
+void thread_pool_free(struct ThreadPool* pool);
+
+// Calls fn over rows [0, rows) of row_pixels pixels each and returns once
+// all of them are done. A NULL or single thread pool, a frame smaller than
+// THREAD_POOL_INLINE_PIXELS or a busy pool run fn inline in one go. With
+// every inline index taken as well, the call waits for the pool.
+void thread_pool_run(struct ThreadPool* pool, int rows, int row_pixels, thread_pool_rows_fn fn, void* ctx);
+
+// How many scratch indices fn may be given, 1 for a NULL pool
+int thread_pool_scratch_count(const struct ThreadPool* pool);
+
+void thread_pool_print_stats(struct ThreadPool* pool);
+
+#endif
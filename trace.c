@@ -0,0 +1,260 @@
+#include "trace.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+static const char* trace_names[TRACE_NAME_COUNT] = {
+    "arrival",
+    "drop",
+    "extract",
+    "colorize",
+    "expand",
+    "align",
+    "upload",
+    "present"
+};
+
+static const char* stream_names[TRACE_STREAM_COUNT] = {
+    "depth",
+    "color"
+};
+
+static Uint64 time_base;
+static struct TraceRing* rings[TRACE_THREADS_MAX];
+static SDL_atomic_t ring_count;
+
+// Frame number + 1 of the last arrival per stream, 0 before the first
+static SDL_atomic_t last_frame[TRACE_STREAM_COUNT];
+static SDL_atomic_t dropped[TRACE_STREAM_COUNT];
+
+static volatile sig_atomic_t dump_requested;
+
+static TRACE_THREAD_LOCAL struct TraceRing* thread_ring;
+static TRACE_THREAD_LOCAL int8_t thread_untraced;
+
+static struct TraceRing* create_ring(const char* name)
+{
+    const int index = SDL_AtomicAdd(&ring_count, 1);
+    if (index >= TRACE_THREADS_MAX) {
+        thread_untraced = 1;
+        return NULL;
+    }
+
+    // Once per thread, the hot path never allocates
+    struct TraceRing* r = (struct TraceRing*)calloc(1, sizeof(struct TraceRing));
+    if (r == NULL) {
+        thread_untraced = 1;
+        return NULL;
+    }
+
+    r->tid = index + 1;
+    if (name != NULL)
+        snprintf(r->name, sizeof(r->name), "%s", name);
+    else
+        snprintf(r->name, sizeof(r->name), "thread %lu", (unsigned long)SDL_ThreadID());
+
+    SDL_AtomicSetPtr((void**)&rings[index], r);
+    thread_ring = r;
+    return r;
+}
+
+static void record(const struct TraceEvent* e)
+{
+    struct TraceRing* r = thread_ring;
+    if (r == NULL) {
+        if (thread_untraced)
+            return;
+        r = create_ring(NULL);
+        if (r == NULL)
+            return;
+    }
+
+    const uint32_t head = (uint32_t)SDL_AtomicGet(&r->head);
+    r->events[head & (TRACE_RING_EVENTS - 1)] = *e;
+    SDL_AtomicSet(&r->head, (int)(head + 1));
+}
+
+void trace_init(void)
+{
+    time_base = SDL_GetPerformanceCounter();
+}
+
+void trace_thread_name(const char* name)
+{
+    if (thread_ring != NULL)
+        snprintf(thread_ring->name, sizeof(thread_ring->name), "%s", name);
+    else if (thread_untraced == 0)
+        create_ring(name);
+}
+
+void trace_span(enum TraceName name, enum TraceStream stream, Uint64 begin, unsigned long long frame)
+{
+    struct TraceEvent e;
+    e.begin = begin;
+    e.end = SDL_GetPerformanceCounter();
+    e.frame = frame;
+    e.device_ms = 0.0;
+    e.name = (uint16_t)name;
+    e.stream = (uint16_t)stream;
+    e.count = 0;
+    record(&e);
+}
+
+void trace_instant(enum TraceName name, enum TraceStream stream, unsigned long long frame, double device_ms,
+                   uint32_t count)
+{
+    struct TraceEvent e;
+    e.begin = SDL_GetPerformanceCounter();
+    e.end = e.begin;
+    e.frame = frame;
+    e.device_ms = device_ms;
+    e.name = (uint16_t)name;
+    e.stream = (uint16_t)stream;
+    e.count = count;
+    record(&e);
+}
+
+void trace_frame_arrival(enum TraceStream stream, unsigned long long frame, double device_ms)
+{
+    trace_instant(TRACE_ARRIVAL, stream, frame, device_ms, 0);
+
+    // Only the low bits are kept, differences survive the wrap
+    const uint32_t previous = (uint32_t)SDL_AtomicSet(&last_frame[stream], (int)(uint32_t)(frame + 1));
+    if (previous == 0)
+        return;
+
+    // The same frame seen again is 0, a restart wraps to a huge gap
+    const uint32_t gap = (uint32_t)(frame + 1) - previous;
+    if (gap > 1 && gap < TRACE_DROP_GAP_MAX) {
+        SDL_AtomicAdd(&dropped[stream], (int)(gap - 1));
+        trace_instant(TRACE_DROP, stream, frame, device_ms, gap - 1);
+    }
+}
+
+int trace_dropped(enum TraceStream stream)
+{
+    return SDL_AtomicGet(&dropped[stream]);
+}
+
+void trace_request_dump(void)
+{
+    dump_requested = 1;
+}
+
+int8_t trace_dump_pending(void)
+{
+    if (dump_requested == 0)
+        return 0;
+
+    dump_requested = 0;
+    return 1;
+}
+
+static double to_us(Uint64 t, double us_per_tick)
+{
+    return (double)(int64_t)(t - time_base) * us_per_tick;
+}
+
+static void write_event(FILE* out, const struct TraceRing* r, const struct TraceEvent* e, double us_per_tick,
+                        int8_t* first)
+{
+    fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,",
+            *first ? "" : ",", trace_names[e->name], stream_names[e->stream], r->tid, to_us(e->begin, us_per_tick));
+    *first = 0;
+
+    if (e->end == e->begin)
+        fprintf(out, "\"ph\":\"i\",\"s\":\"t\",");
+    else
+        fprintf(out, "\"ph\":\"X\",\"dur\":%.3f,", (double)(e->end - e->begin) * us_per_tick);
+
+    fprintf(out, "\"args\":{\"frame\":%llu", e->frame);
+    if (e->name == TRACE_ARRIVAL)
+        fprintf(out, ",\"device_ms\":%.3f", e->device_ms);
+    if (e->name == TRACE_DROP)
+        fprintf(out, ",\"dropped\":%u", e->count);
+    fprintf(out, "}}");
+}
+
+int8_t trace_dump(const char* path)
+{
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Failed opening trace file %s\n", path);
+        return 1;
+    }
+
+    struct TraceEvent* copy = (struct TraceEvent*)malloc(TRACE_RING_EVENTS * sizeof(struct TraceEvent));
+    if (copy == NULL) {
+        fprintf(stderr, "Failed allocating trace dump buffer\n");
+        fclose(out);
+        return 1;
+    }
+
+    const double us_per_tick = 1e6 / (double)SDL_GetPerformanceFrequency();
+    int8_t first = 1;
+    int events = 0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    int count = SDL_AtomicGet(&ring_count);
+    if (count > TRACE_THREADS_MAX)
+        count = TRACE_THREADS_MAX;
+
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        struct TraceRing* r = (struct TraceRing*)SDL_AtomicGetPtr((void**)&rings[i]);
+        if (r == NULL)
+            continue;
+
+        fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", r->tid, r->name);
+        first = 0;
+
+        const uint32_t head = (uint32_t)SDL_AtomicGet(&r->head);
+        const uint32_t held = head < TRACE_RING_EVENTS ? head : TRACE_RING_EVENTS;
+        uint32_t n;
+        for (n = 0; n < held; n++)
+            copy[n] = r->events[(head - held + n) & (TRACE_RING_EVENTS - 1)];
+
+        // The writer kept going while copying. The events it published since
+        // and the one it may be writing now took the slots of the oldest ones.
+        SDL_MemoryBarrierAcquire();
+        const uint32_t reused = (uint32_t)SDL_AtomicGet(&r->head) - head + 1;
+        const uint32_t free_slots = TRACE_RING_EVENTS - held;
+        uint32_t torn = reused > free_slots ? reused - free_slots : 0;
+        if (torn > held)
+            torn = held;
+        for (n = torn; n < held; n++) {
+            write_event(out, r, &copy[n], us_per_tick, &first);
+            events++;
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    free(copy);
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed writing trace file %s\n", path);
+        return 1;
+    }
+
+    fprintf(stderr, "trace: wrote %d events to %s\n", events, path);
+    return 0;
+}
+
+void trace_print_stats(void)
+{
+    int count = SDL_AtomicGet(&ring_count);
+    fprintf(stderr, "trace: %d threads traced%s, dropped frames: %d depth, %d color\n",
+            count > TRACE_THREADS_MAX ? TRACE_THREADS_MAX : count, count > TRACE_THREADS_MAX ? " (ring limit hit)" : "",
+            trace_dropped(TRACE_STREAM_DEPTH), trace_dropped(TRACE_STREAM_COLOR));
+}
@@ -0,0 +1,88 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdint.h>
+
+// Events each thread keeps, the oldest are overwritten. A power of two.
+#define TRACE_RING_EVENTS 8192
+#define TRACE_THREADS_MAX 64
+
+// Frame number jumps beyond this are a restart, e.g. a looping playback, not drops
+#define TRACE_DROP_GAP_MAX 100000
+
+enum TraceName
+{
+    TRACE_ARRIVAL,   // a frame came out of a frameset, instant
+    TRACE_DROP,      // frames missing before this one, instant
+    TRACE_EXTRACT,   // frameset split into handles
+    TRACE_COLORIZE,
+    TRACE_EXPAND,
+    TRACE_ALIGN,
+    TRACE_UPLOAD,    // texture upload
+    TRACE_PRESENT,
+    TRACE_NAME_COUNT
+};
+
+enum TraceStream
+{
+    TRACE_STREAM_DEPTH,
+    TRACE_STREAM_COLOR,
+    TRACE_STREAM_COUNT
+};
+
+struct TraceEvent
+{
+    // SDL performance counter values, equal for instant events
+    Uint64 begin;
+    Uint64 end;
+    unsigned long long frame;
+    // rs2_get_frame_timestamp of arrivals
+    double device_ms;
+    uint16_t name;
+    uint16_t stream;
+    // Frames missing for drops
+    uint32_t count;
+};
+
+// Written only by the thread it belongs to, which publishes each event by
+// bumping head. A dump copies the ring without stopping the writer and
+// keeps what head shows was not overwritten meanwhile.
+struct TraceRing
+{
+    SDL_atomic_t head;
+    int tid;
+    char name[32];
+    struct TraceEvent events[TRACE_RING_EVENTS];
+};
+
+// Sets the time base of the dumps, call before any thread records
+void trace_init(void);
+
+// Names the calling thread in the dumps, before it records anything
+void trace_thread_name(const char* name);
+
+// A span from begin until now, or an instant event now
+void trace_span(enum TraceName name, enum TraceStream stream, Uint64 begin, unsigned long long frame);
+void trace_instant(enum TraceName name, enum TraceStream stream, unsigned long long frame, double device_ms,
+                   uint32_t count);
+
+// Records an arrival and counts the frames a gap in frame numbers says were dropped
+void trace_frame_arrival(enum TraceStream stream, unsigned long long frame, double device_ms);
+int trace_dropped(enum TraceStream stream);
+
+// Only sets a flag, safe to call from a signal handler; trace_dump_pending picks it up
+void trace_request_dump(void);
+int8_t trace_dump_pending(void);
+
+// Writes every ring as Chrome trace JSON, for chrome://tracing or Perfetto
+int8_t trace_dump(const char* path);
+
+void trace_print_stats(void);
+
+#endif